@@ -19,8 +19,6 @@
 
 #include "DShowPlugin.h"
 
-DWORD STDCALL PackPlanarThread(ConvertData *data);
-
 #define NEAR_SILENT  3000
 #define NEAR_SILENTf 3000.0
 
@@ -63,13 +61,6 @@ bool DeviceSource::Init(XElement *data)
 
     capture->SetFiltergraph(graph);
 
-    int numThreads = MAX(OSGetTotalCores()-2, 1);
-    hConvertThreads = (HANDLE*)Allocate(sizeof(HANDLE)*numThreads);
-    convertData = (ConvertData*)Allocate(sizeof(ConvertData)*numThreads);
-
-    zero(hConvertThreads, sizeof(HANDLE)*numThreads);
-    zero(convertData, sizeof(ConvertData)*numThreads);
-
     this->data = data;
     UpdateSettings();
 
@@ -91,12 +82,6 @@ DeviceSource::~DeviceSource()
     SafeReleaseLogRef(capture);
     SafeReleaseLogRef(graph);
 
-    if(hConvertThreads)
-        Free(hConvertThreads);
-
-    if(convertData)
-        Free(convertData);
-
     if(hSampleMutex)
         OSCloseMutex(hSampleMutex);
 }
@@ -780,33 +765,10 @@ bool DeviceSource::LoadFilters()
         deinterlacer.pixelShader.reset(CreatePixelShaderFromFile(ChooseDeinterlacingShader()));
     }
 
-    int numThreads = MAX(OSGetTotalCores()-2, 1);
-    for(int i=0; i<numThreads; i++)
-    {
-        convertData[i].width  = lineSize;
-        convertData[i].height = renderCY;
-        convertData[i].sample = NULL;
-        convertData[i].hSignalConvert  = CreateEvent(NULL, FALSE, FALSE, NULL);
-        convertData[i].hSignalComplete = CreateEvent(NULL, FALSE, FALSE, NULL);
-        convertData[i].linePitch = linePitch;
-        convertData[i].lineShift = lineShift;
-
-        if(i == 0)
-            convertData[i].startY = 0;
-        else
-            convertData[i].startY = convertData[i-1].endY;
-
-        if(i == (numThreads-1))
-            convertData[i].endY = renderCY;
-        else
-            convertData[i].endY = ((renderCY/numThreads)*(i+1)) & 0xFFFFFFFE;
-    }
-
-    if(colorType == DeviceOutputType_YV12 || colorType == DeviceOutputType_I420)
-    {
-        for(int i=0; i<numThreads; i++)
-            hConvertThreads[i] = OSCreateThread((XTHREAD)PackPlanarThread, convertData+i);
-    }
+    convertData.width  = lineSize;
+    convertData.height = renderCY;
+    convertData.linePitch = linePitch;
+    convertData.lineShift = lineShift;
 
     bSucceeded = true;
 
@@ -947,31 +909,11 @@ void DeviceSource::UnloadFilters()
         previousTexture = NULL;
     }
 
-    int numThreads = MAX(OSGetTotalCores()-2, 1);
-    for(int i=0; i<numThreads; i++)
+    convertTasks.Wait();
+    if(convertSample)
     {
-        if(hConvertThreads[i])
-        {
-            convertData[i].bKillThread = true;
-            SetEvent(convertData[i].hSignalConvert);
-
-            OSTerminateThread(hConvertThreads[i], 10000);
-            hConvertThreads[i] = NULL;
-        }
-
-        convertData[i].bKillThread = false;
-
-        if(convertData[i].hSignalConvert)
-        {
-            CloseHandle(convertData[i].hSignalConvert);
-            convertData[i].hSignalConvert = NULL;
-        }
-
-        if(convertData[i].hSignalComplete)
-        {
-            CloseHandle(convertData[i].hSignalComplete);
-            convertData[i].hSignalComplete = NULL;
-        }
+        convertSample->Release();
+        convertSample = NULL;
     }
 
     if(bFiltersLoaded)
@@ -1265,19 +1207,12 @@ void DeviceSource::ReceiveMediaSample(IMediaSample *sample, bool bAudio)
     }
 }
 
-static DWORD STDCALL PackPlanarThread(ConvertData *data)
-{
-    do {
-        WaitForSingleObject(data->hSignalConvert, INFINITE);
-        if(data->bKillThread) break;
-
-        PackPlanar(data->output, data->input, data->width, data->height, data->pitch, data->startY, data->endY, data->linePitch, data->lineShift);
-        data->sample->Release();
-
-        SetEvent(data->hSignalComplete);
-    }while(!data->bKillThread);
+//rows per conversion task, has to stay even for the chroma planes
+#define PACKPLANAR_TILE_ROWS 16
 
-    return 0;
+static void STDCALL PackPlanarTile(ConvertData *data, UINT startY, UINT endY)
+{
+    PackPlanar(data->output, data->input, data->width, data->height, data->pitch, startY, endY, data->linePitch, data->lineShift);
 }
 
 void DeviceSource::Preprocess()
@@ -1319,8 +1254,6 @@ void DeviceSource::Preprocess()
 
     //----------------------------------------
 
-    int numThreads = MAX(OSGetTotalCores()-2, 1);
-
     if(lastSample)
     {
         /*REFERENCE_TIME refTimeStart, refTimeFinish;
@@ -1353,11 +1286,7 @@ void DeviceSource::Preprocess()
             {
                 if(!bFirstFrame)
                 {
-                    List<HANDLE> events;
-                    for(int i=0; i<numThreads; i++)
-                        events << convertData[i].hSignalComplete;
-
-                    WaitForMultipleObjects(numThreads, events.Array(), TRUE, INFINITE);
+                    convertTasks.Wait();
                     texture->SetImage(lpImageBuffer, GS_IMAGEFORMAT_RGBX, texturePitch);
 
                     bReadyToDraw = true;
@@ -1365,19 +1294,19 @@ void DeviceSource::Preprocess()
                 else
                     bFirstFrame = false;
 
-                for(int i=0; i<numThreads; i++)
-                    lastSample->AddRef();
+                if(convertSample)
+                    convertSample->Release();
 
-                for(int i=0; i<numThreads; i++)
-                {
-                    convertData[i].input     = lastSample->lpData;
-                    convertData[i].sample    = lastSample;
-                    convertData[i].pitch     = texturePitch;
-                    convertData[i].output    = lpImageBuffer;
-                    convertData[i].linePitch = linePitch;
-                    convertData[i].lineShift = lineShift;
-                    SetEvent(convertData[i].hSignalConvert);
-                }
+                lastSample->AddRef();
+                convertSample = lastSample;
+
+                convertData.input     = lastSample->lpData;
+                convertData.pitch     = texturePitch;
+                convertData.output    = lpImageBuffer;
+                convertData.linePitch = linePitch;
+                convertData.lineShift = lineShift;
+
+                convertTasks.Run((TASKPROC)PackPlanarTile, &convertData, 0, renderCY, PACKPLANAR_TILE_ROWS);
             }
             else
             {
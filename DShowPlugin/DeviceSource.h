@@ -61,12 +61,8 @@ struct SampleData {
 struct ConvertData
 {
     LPBYTE input, output;
-    SampleData *sample;
-    HANDLE hSignalConvert, hSignalComplete;
-    bool   bKillThread;
     UINT   width, height;
     UINT   pitch;
-    UINT   startY, endY;
     UINT   linePitch, lineShift;
 };
 
@@ -180,8 +176,9 @@ class DeviceSource : public ImageSource
     //---------------------------------
 
     LPBYTE          lpImageBuffer;
-    ConvertData     *convertData;
-    HANDLE          *hConvertThreads;
+    ConvertData     convertData;
+    TaskGroup       convertTasks;
+    SampleData      *convertSample;
 
     //---------------------------------
 
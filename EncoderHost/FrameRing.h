@@ -0,0 +1,159 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+#pragma once
+
+#include "HostIPC.h"
+
+
+//single producer, single consumer ring of fixed size slots in shared memory.  two semaphores
+//count the filled and the free slots, so each side only touches its own index and no lock is
+//ever shared between the processes.  slots are handed over whole and read in place, the only
+//copy is whatever the producer does to fill one.
+//
+//  [ring_header][slot_header|data][slot_header|data]...
+//
+//the semaphores are named <name>_filled and <name>_free.  if the other process dies while
+//holding a slot the ring is simply abandoned along with it.
+namespace encoder_host
+{
+    const uint32_t ring_magic = 0x474E4952; //"RING"
+
+    struct ring_header
+    {
+        uint32_t magic;
+        uint32_t slot_count, slot_size, slot_stride;
+    };
+
+    struct slot_header
+    {
+        uint64_t queued_ns;     //monotonic_ns() when the producer handed the slot over
+        uint32_t length, flags;
+    };
+
+    //keeps the slot data cache line (and SIMD) aligned
+    const size_t ring_align = 64;
+
+    inline size_t ring_align_up(size_t size) { return (size + ring_align-1) & ~(ring_align-1); }
+
+    class frame_ring
+    {
+        shared_memory memory;
+        ipc_semaphore filled, free_slots;
+
+        ring_header *header;
+        uint8_t *slots;
+
+        uint32_t write_index, read_index;
+
+        uint8_t *slot(uint32_t index) { return slots + size_t(index)*header->slot_stride; }
+        slot_header *info(uint32_t index) { return reinterpret_cast<slot_header*>(slot(index)); }
+
+        bool attach(const std::string &name, uint32_t slot_count, uint32_t slot_size, bool create)
+        {
+            header = nullptr;
+            slots = nullptr;
+            write_index = read_index = 0;
+
+            size_t size = memory_size(slot_count, slot_size);
+            if(create)
+            {
+                if(!memory.create(name, size))
+                    return false;
+                if(!filled.create(name+"_filled", 0, slot_count) || !free_slots.create(name+"_free", slot_count, slot_count))
+                    return false;
+
+                header = memory.as<ring_header>();
+                header->slot_count  = slot_count;
+                header->slot_size   = slot_size;
+                header->slot_stride = uint32_t(ring_align_up(sizeof(slot_header)) + ring_align_up(slot_size));
+                header->magic       = ring_magic;
+            }
+            else
+            {
+                if(!memory.open(name, size))
+                    return false;
+                if(!filled.open(name+"_filled") || !free_slots.open(name+"_free"))
+                    return false;
+
+                header = memory.as<ring_header>();
+                if(header->magic != ring_magic || header->slot_count != slot_count || header->slot_size != slot_size)
+                {
+                    header = nullptr;
+                    return false;
+                }
+            }
+
+            slots = reinterpret_cast<uint8_t*>(memory.memory) + ring_align_up(sizeof(ring_header));
+            return true;
+        }
+
+    public:
+        frame_ring() : header(nullptr), slots(nullptr), write_index(0), read_index(0) {}
+
+        static size_t memory_size(uint32_t slot_count, uint32_t slot_size)
+        {
+            return ring_align_up(sizeof(ring_header)) + size_t(slot_count)*(ring_align_up(sizeof(slot_header)) + ring_align_up(slot_size));
+        }
+
+        bool create(const std::string &name, uint32_t slot_count, uint32_t slot_size) { return attach(name, slot_count, slot_size, true); }
+        bool open(const std::string &name, uint32_t slot_count, uint32_t slot_size)   { return attach(name, slot_count, slot_size, false); }
+
+        bool operator!() const { return !header; }
+
+        uint32_t slot_count() const { return header->slot_count; }
+        uint32_t slot_size() const  { return header->slot_size; }
+
+        //producer side.  returns the data of the next free slot, or null on timeout
+        uint8_t *begin_write(uint32_t timeout_ms)
+        {
+            if(!free_slots.wait(timeout_ms))
+                return nullptr;
+
+            return slot(write_index) + ring_align_up(sizeof(slot_header));
+        }
+
+        void end_write(uint32_t length, uint32_t flags=0)
+        {
+            slot_header *si = info(write_index);
+            si->length    = length;
+            si->flags     = flags;
+            si->queued_ns = monotonic_ns();
+
+            write_index = (write_index+1) % header->slot_count;
+            filled.post();
+        }
+
+        //consumer side.  returns the data of the oldest filled slot, or null on timeout.
+        //the slot stays valid until end_read
+        uint8_t *begin_read(uint32_t timeout_ms, slot_header *&si)
+        {
+            if(!filled.wait(timeout_ms))
+                return nullptr;
+
+            si = info(read_index);
+            return slot(read_index) + ring_align_up(sizeof(slot_header));
+        }
+
+        void end_read()
+        {
+            read_index = (read_index+1) % header->slot_count;
+            free_slots.post();
+        }
+    };
+}
@@ -0,0 +1,575 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+#pragma once
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+//the pieces an out-of-process encoder is built from: named shared memory, named counting
+//semaphores, starting and watching the other process, and a clock both processes agree on.
+//same idea as QSVHelper/WindowsStuff.h, but with a POSIX backend (shm_open, sem_open,
+//posix_spawn) next to the win32 one.  object names are plain ascii, the POSIX side adds the
+//leading '/' itself.  the side that creates an object owns it and removes the name again.
+namespace encoder_host
+{
+    const uint32_t wait_forever = 0xFFFFFFFF;
+
+    inline uint64_t monotonic_ns()
+    {
+#ifdef _WIN32
+        static LARGE_INTEGER freq = {0};
+        if(!freq.QuadPart)
+            QueryPerformanceFrequency(&freq);
+
+        LARGE_INTEGER t;
+        QueryPerformanceCounter(&t);
+
+        uint64_t ticks = uint64_t(t.QuadPart), rate = uint64_t(freq.QuadPart);
+        return (ticks/rate)*1000000000ULL + (ticks%rate)*1000000000ULL/rate;
+#else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec)*1000000000ULL + uint64_t(ts.tv_nsec);
+#endif
+    }
+
+    inline uint32_t current_process_id()
+    {
+#ifdef _WIN32
+        return GetCurrentProcessId();
+#else
+        return uint32_t(getpid());
+#endif
+    }
+
+    inline std::string object_name(const std::string &name)
+    {
+#ifdef _WIN32
+        return name;
+#else
+        return "/" + name;
+#endif
+    }
+
+#ifdef _WIN32
+    inline std::wstring widen(const std::string &str)
+    {
+        int len = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, nullptr, 0);
+        if(len <= 1)
+            return std::wstring();
+
+        std::vector<wchar_t> buf(len);
+        MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, &buf[0], len);
+        return std::wstring(&buf[0]);
+    }
+
+    inline std::string narrow(const std::wstring &str)
+    {
+        int len = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), -1, nullptr, 0, nullptr, nullptr);
+        if(len <= 1)
+            return std::string();
+
+        std::vector<char> buf(len);
+        WideCharToMultiByte(CP_UTF8, 0, str.c_str(), -1, &buf[0], len, nullptr, nullptr);
+        return std::string(&buf[0]);
+    }
+#endif
+
+    inline std::string current_executable_path()
+    {
+#ifdef _WIN32
+        wchar_t path[MAX_PATH];
+        DWORD len = GetModuleFileNameW(nullptr, path, MAX_PATH);
+        if(!len || len == MAX_PATH)
+            return std::string();
+        return narrow(path);
+#else
+        char path[PATH_MAX];
+        ssize_t len = readlink("/proc/self/exe", path, sizeof(path)-1);
+        if(len <= 0)
+            return std::string();
+        path[len] = 0;
+        return path;
+#endif
+    }
+
+    //-----------------------------------------------------------------------
+
+    struct shared_memory
+    {
+        void *memory;
+        size_t size;
+        bool owner;
+
+        shared_memory() : memory(nullptr), size(0), owner(false)
+#ifdef _WIN32
+            , file(nullptr)
+#endif
+        {}
+        ~shared_memory() { close(); }
+
+        bool operator!() const { return !memory; }
+
+        template <class T>
+        T *as() { return reinterpret_cast<T*>(memory); }
+
+        bool create(const std::string &name_, size_t size_)
+        {
+            close();
+#ifdef _WIN32
+            uint64_t size64 = size_;
+            file = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, DWORD(size64>>32), DWORD(size64 & 0xffffffff), object_name(name_).c_str());
+            if(file && GetLastError() == ERROR_ALREADY_EXISTS)
+            {
+                close();
+                return false;
+            }
+
+            owner = true;
+            return map(size_);
+#else
+            name = object_name(name_);
+
+            //a name left behind by a crashed process with a reused pid, nothing can still be using it
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if(fd < 0 && errno == EEXIST)
+            {
+                shm_unlink(name.c_str());
+                fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            }
+            if(fd < 0)
+                return false;
+
+            owner = true;
+
+            if(ftruncate(fd, off_t(size_)) != 0)
+            {
+                ::close(fd);
+                close();
+                return false;
+            }
+
+            return map(size_, fd);
+#endif
+        }
+
+        bool open(const std::string &name_, size_t size_)
+        {
+            close();
+#ifdef _WIN32
+            file = OpenFileMappingA(FILE_MAP_ALL_ACCESS, false, object_name(name_).c_str());
+            return map(size_);
+#else
+            int fd = shm_open(object_name(name_).c_str(), O_RDWR, 0600);
+            if(fd < 0)
+                return false;
+
+            struct stat st;
+            if(fstat(fd, &st) != 0 || size_t(st.st_size) < size_)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            return map(size_, fd);
+#endif
+        }
+
+        void close()
+        {
+#ifdef _WIN32
+            if(memory)
+                UnmapViewOfFile(memory);
+            if(file)
+                CloseHandle(file);
+            file = nullptr;
+#else
+            if(memory)
+                munmap(memory, size);
+            if(owner && !name.empty())
+                shm_unlink(name.c_str());
+            name.clear();
+#endif
+            memory = nullptr;
+            size = 0;
+            owner = false;
+        }
+
+    private:
+#ifdef _WIN32
+        HANDLE file;
+
+        bool map(size_t size_)
+        {
+            if(!file)
+                return false;
+
+            memory = MapViewOfFile(file, FILE_MAP_ALL_ACCESS, 0, 0, size_);
+            if(!memory)
+            {
+                close();
+                return false;
+            }
+
+            size = size_;
+            return true;
+        }
+#else
+        std::string name;
+
+        bool map(size_t size_, int fd)
+        {
+            void *mapping = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+
+            if(mapping == MAP_FAILED)
+            {
+                close();
+                return false;
+            }
+
+            memory = mapping;
+            size = size_;
+            return true;
+        }
+#endif
+
+        shared_memory(const shared_memory&);
+        shared_memory &operator=(const shared_memory&);
+    };
+
+    //-----------------------------------------------------------------------
+
+    struct ipc_semaphore
+    {
+        ipc_semaphore() : sem(nullptr), owner(false) {}
+        ~ipc_semaphore() { close(); }
+
+        bool operator!() const { return !sem; }
+
+        bool create(const std::string &name_, uint32_t initial, uint32_t maximum)
+        {
+            close();
+#ifdef _WIN32
+            sem = CreateSemaphoreA(nullptr, LONG(initial), LONG(maximum), object_name(name_).c_str());
+            if(sem && GetLastError() == ERROR_ALREADY_EXISTS)
+            {
+                close();
+                return false;
+            }
+#else
+            (void)maximum; //POSIX semaphores don't have one
+            name = object_name(name_);
+
+            sem_t *s = sem_open(name.c_str(), O_CREAT | O_EXCL, 0600, initial);
+            if(s == SEM_FAILED && errno == EEXIST)
+            {
+                sem_unlink(name.c_str());
+                s = sem_open(name.c_str(), O_CREAT | O_EXCL, 0600, initial);
+            }
+            sem = (s == SEM_FAILED) ? nullptr : s;
+#endif
+            owner = (sem != nullptr);
+            return owner;
+        }
+
+        bool open(const std::string &name_)
+        {
+            close();
+#ifdef _WIN32
+            sem = OpenSemaphoreA(SEMAPHORE_MODIFY_STATE | SYNCHRONIZE, false, object_name(name_).c_str());
+#else
+            sem_t *s = sem_open(object_name(name_).c_str(), 0);
+            sem = (s == SEM_FAILED) ? nullptr : s;
+#endif
+            return sem != nullptr;
+        }
+
+        void close()
+        {
+            if(sem)
+            {
+#ifdef _WIN32
+                CloseHandle(sem);
+#else
+                sem_close(sem);
+                if(owner)
+                    sem_unlink(name.c_str());
+#endif
+            }
+
+            sem = nullptr;
+            owner = false;
+        }
+
+        void post()
+        {
+#ifdef _WIN32
+            ReleaseSemaphore(sem, 1, nullptr);
+#else
+            sem_post(sem);
+#endif
+        }
+
+        //false on timeout
+        bool wait(uint32_t timeout_ms)
+        {
+#ifdef _WIN32
+            return WaitForSingleObject(sem, (timeout_ms == wait_forever) ? INFINITE : DWORD(timeout_ms)) == WAIT_OBJECT_0;
+#else
+            int ret;
+            if(timeout_ms == wait_forever)
+            {
+                while((ret = sem_wait(sem)) != 0 && errno == EINTR);
+            }
+            else if(timeout_ms == 0)
+            {
+                while((ret = sem_trywait(sem)) != 0 && errno == EINTR);
+            }
+            else
+            {
+                timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec  += timeout_ms/1000;
+                ts.tv_nsec += long(timeout_ms%1000)*1000000;
+                if(ts.tv_nsec >= 1000000000)
+                {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000;
+                }
+
+                while((ret = sem_timedwait(sem, &ts)) != 0 && errno == EINTR);
+            }
+
+            return ret == 0;
+#endif
+        }
+
+    private:
+#ifdef _WIN32
+        HANDLE sem;
+#else
+        sem_t *sem;
+        std::string name;
+#endif
+        bool owner;
+
+        ipc_semaphore(const ipc_semaphore&);
+        ipc_semaphore &operator=(const ipc_semaphore&);
+    };
+
+    //-----------------------------------------------------------------------
+
+    //the host process as seen by whoever started it
+    struct host_process
+    {
+        uint32_t id;
+        int exit_code;
+
+        host_process() : id(0), exit_code(0), started(false)
+#ifdef _WIN32
+            , process(nullptr)
+#endif
+        {}
+        ~host_process()
+        {
+#ifdef _WIN32
+            if(process)
+                CloseHandle(process);
+#else
+            if(started)
+                running();
+#endif
+        }
+
+        bool spawn(const std::string &path, const std::vector<std::string> &args)
+        {
+#ifdef _WIN32
+            std::wstring cmd = quote(widen(path));
+            for(size_t i=0; i<args.size(); i++)
+                cmd += L" " + quote(widen(args[i]));
+
+            std::vector<wchar_t> cmdline(cmd.begin(), cmd.end());
+            cmdline.push_back(0);
+
+            STARTUPINFOW si;
+            PROCESS_INFORMATION pi;
+            memset(&si, 0, sizeof(si));
+            memset(&pi, 0, sizeof(pi));
+            si.cb = sizeof(si);
+
+            if(!CreateProcessW(widen(path).c_str(), &cmdline[0], nullptr, nullptr, false, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi))
+                return false;
+
+            CloseHandle(pi.hThread);
+            process = pi.hProcess;
+            id = pi.dwProcessId;
+#else
+            std::vector<char*> argv;
+            argv.push_back(const_cast<char*>(path.c_str()));
+            for(size_t i=0; i<args.size(); i++)
+                argv.push_back(const_cast<char*>(args[i].c_str()));
+            argv.push_back(nullptr);
+
+            pid_t pid;
+            if(posix_spawn(&pid, path.c_str(), nullptr, nullptr, &argv[0], environ) != 0)
+                return false;
+
+            id = uint32_t(pid);
+#endif
+            started = true;
+            return true;
+        }
+
+        //false once the process has exited, exit_code is valid from then on
+        bool running()
+        {
+            if(!started)
+                return false;
+#ifdef _WIN32
+            if(WaitForSingleObject(process, 0) == WAIT_TIMEOUT)
+                return true;
+
+            DWORD code = 0;
+            GetExitCodeProcess(process, &code);
+            exit_code = int(code);
+#else
+            int status;
+            pid_t ret = waitpid(pid_t(id), &status, WNOHANG);
+            if(ret == 0)
+                return true;
+
+            if(ret == pid_t(id))
+                exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+#endif
+            started = false;
+            return false;
+        }
+
+        bool wait(uint32_t timeout_ms)
+        {
+            uint64_t end = monotonic_ns() + uint64_t(timeout_ms)*1000000;
+            while(running())
+            {
+                if(timeout_ms != wait_forever && monotonic_ns() >= end)
+                    return false;
+#ifdef _WIN32
+                WaitForSingleObject(process, 10);
+#else
+                usleep(10000);
+#endif
+            }
+            return true;
+        }
+
+        void kill()
+        {
+            if(!started)
+                return;
+#ifdef _WIN32
+            TerminateProcess(process, 1);
+#else
+            ::kill(pid_t(id), SIGKILL);
+#endif
+            wait(wait_forever);
+        }
+
+    private:
+        bool started;
+#ifdef _WIN32
+        HANDLE process;
+
+        static std::wstring quote(const std::wstring &arg)
+        {
+            //only used for paths and object names, which can't contain quotes
+            return L"\"" + arg + L"\"";
+        }
+#endif
+
+        host_process(const host_process&);
+        host_process &operator=(const host_process&);
+    };
+
+    //the process that started us, so a host doesn't outlive it
+    struct parent_process
+    {
+        parent_process() : id(0)
+#ifdef _WIN32
+            , process(nullptr)
+#endif
+        {}
+        ~parent_process()
+        {
+#ifdef _WIN32
+            if(process)
+                CloseHandle(process);
+#endif
+        }
+
+        bool open(uint32_t id_)
+        {
+            id = id_;
+#ifdef _WIN32
+            process = OpenProcess(SYNCHRONIZE, false, id);
+            return process != nullptr;
+#else
+            return alive();
+#endif
+        }
+
+        bool alive()
+        {
+#ifdef _WIN32
+            return process && WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+#else
+            return ::kill(pid_t(id), 0) == 0 || errno == EPERM;
+#endif
+        }
+
+    private:
+        uint32_t id;
+#ifdef _WIN32
+        HANDLE process;
+#endif
+
+        parent_process(const parent_process&);
+        parent_process &operator=(const parent_process&);
+    };
+}
@@ -19,6 +19,9 @@
 #include "NoiseGate.h"
 #include "resource.h"
 
+#include <emmintrin.h>
+#include <float.h>
+
 //============================================================================
 // Helpers
 
@@ -44,7 +47,14 @@ NoiseGateFilter::NoiseGateFilter(NoiseGate *parent)
     , level(0.0f)
     , heldTime(0.0f)
     , isOpen(false)
+    , lookAheadFrames(0)
+    , lookAheadMs(0)
 {
+    // The output is delayed by the look-ahead so that the gate sees an onset before it
+    // is output and has time to open. Starts out as silence.
+    lookAheadFrames = (UINT)(parent->lookAheadTime * float(OBSGetSampleRateHz()) + 0.5f);
+    lookAheadMs = (QWORD)(parent->lookAheadTime * 1000.0f + 0.5f);
+    delayLine.SetSize(lookAheadFrames * 2);
 }
 
 NoiseGateFilter::~NoiseGateFilter()
@@ -64,7 +74,16 @@ AudioSegment *NoiseGateFilter::Process(AudioSegment *segment)
         level = 0.0f;
         heldTime = 0.0f;
         isOpen = false;
+
+        // Keep delaying so the timing doesn't jump while the gate is toggled
+        if(lookAheadFrames)
+            DelayAudio(segment->audioData.Array(), segment->audioData.Num() / 2);
     }
+
+    // The delayed audio was captured earlier than the segment claims
+    if(lookAheadMs && segment->timestamp > lookAheadMs)
+        segment->timestamp -= lookAheadMs;
+
     return segment;
 }
 
@@ -74,6 +93,49 @@ void NoiseGateFilter::ApplyNoiseGate(float *buffer, int totalFloats)
     if(totalFloats % 2)
         return; // Odd number of samples
 
+    int numFrames = totalFloats / 2;
+    if(gains.Num() < (UINT)numFrames)
+        gains.SetSize(numFrames);
+
+    // The gate is driven by the undelayed input
+    for(int i = 0; i < numFrames; i += BLOCK_FRAMES)
+        ComputeBlockGains(buffer + i * 2, min(BLOCK_FRAMES, numFrames - i), gains.Array() + i);
+
+    // ...and applied to the delayed output
+    if(lookAheadFrames)
+        DelayAudio(buffer, numFrames);
+
+    // Test if disabled from the config window here so that the above state calculations
+    // are still processed when playing around with the configuration
+    if(parent->isDisabledFromConfig)
+        return;
+
+    // Multiple input by gate multiplier (0.0f if fully closed, 1.0f if fully open)
+    const float *gain = gains.Array();
+    int i = 0;
+    for(; i + 4 <= numFrames; i += 4)
+    {
+        __m128 frameGains = _mm_loadu_ps(gain + i);
+        __m128 lr01 = _mm_loadu_ps(buffer + i * 2);
+        __m128 lr23 = _mm_loadu_ps(buffer + i * 2 + 4);
+
+        _mm_storeu_ps(buffer + i * 2,     _mm_mul_ps(lr01, _mm_unpacklo_ps(frameGains, frameGains)));
+        _mm_storeu_ps(buffer + i * 2 + 4, _mm_mul_ps(lr23, _mm_unpackhi_ps(frameGains, frameGains)));
+    }
+    for(; i < numFrames; i++)
+    {
+        buffer[i * 2] *= gain[i];
+        buffer[i * 2 + 1] *= gain[i];
+    }
+}
+
+/**
+ * Updates the gate state for a block of at most BLOCK_FRAMES stereo frames and writes the
+ * gate multiplier of each frame. The thresholds are only tested once per block, which puts
+ * the output within a block's worth of attack/release of the per-sample gate.
+ */
+void NoiseGateFilter::ComputeBlockGains(const float *buffer, int numFrames, float *blockGains)
+{
     const float SAMPLE_RATE_F = float(OBSGetSampleRateHz());
     const float dtPerSample = 1.0f / SAMPLE_RATE_F;
 
@@ -87,44 +149,103 @@ void NoiseGateFilter::ApplyNoiseGate(float *buffer, int totalFloats)
     const float minDecayPeriod = (1.0f / 75.0f) * SAMPLE_RATE_F;
     const float decayRate = thresholdDiff / minDecayPeriod;
 
-    // We can't use SSE as the processing of each sample depends on the processed
-    // result of the previous sample.
-    for(int i = 0; i < totalFloats; i += 2)
+    // Get the input level of each frame. The decaying peak detector
+    // (level = max(level, curLvl) - decayRate per frame) ends the block at
+    // max(level - n * decay, max(curLvl[k] + k * decay) - (n + 1) * decay) for k = 1..n,
+    // so it only needs the maximum of the levels offset by their position.
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 offsetStep = _mm_set1_ps(4.0f * decayRate);
+    __m128 offset = _mm_mul_ps(_mm_setr_ps(1.0f, 2.0f, 3.0f, 4.0f), _mm_set1_ps(decayRate));
+    __m128 peak = _mm_setzero_ps();
+    __m128 decayedPeak = _mm_set1_ps(-FLT_MAX);
+
+    int i = 0;
+    for(; i + 4 <= numFrames; i += 4)
     {
-        // Get current input level
-        float curLvl = abs(buffer[i] + buffer[i+1]) * 0.5f;
+        __m128 lr01 = _mm_loadu_ps(buffer + i * 2);
+        __m128 lr23 = _mm_loadu_ps(buffer + i * 2 + 4);
+        __m128 left = _mm_shuffle_ps(lr01, lr23, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 right = _mm_shuffle_ps(lr01, lr23, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 curLvl = _mm_mul_ps(_mm_and_ps(_mm_add_ps(left, right), absMask), half);
+
+        peak = _mm_max_ps(peak, curLvl);
+        decayedPeak = _mm_max_ps(decayedPeak, _mm_add_ps(curLvl, offset));
+        offset = _mm_add_ps(offset, offsetStep);
+    }
 
-        // Test thresholds
-        if(curLvl > parent->openThreshold && !isOpen)
-            isOpen = true;
-        if(level < parent->closeThreshold && isOpen)
-        {
-            heldTime = 0.0f;
-            isOpen = false;
-        }
+    peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(1, 1, 1, 1)));
+    decayedPeak = _mm_max_ps(decayedPeak, _mm_movehl_ps(decayedPeak, decayedPeak));
+    decayedPeak = _mm_max_ss(decayedPeak, _mm_shuffle_ps(decayedPeak, decayedPeak, _MM_SHUFFLE(1, 1, 1, 1)));
 
-        // Decay level slowly so human voice (75-300Hz) doesn't cross the close threshold
-        // (Essentially a peak detector with very fast decay)
-        level = max(level, curLvl) - decayRate;
+    float blockPeak = _mm_cvtss_f32(peak);
+    float blockDecayedPeak = _mm_cvtss_f32(decayedPeak);
+    for(; i < numFrames; i++)
+    {
+        float curLvl = abs(buffer[i * 2] + buffer[i * 2 + 1]) * 0.5f;
+        blockPeak = max(blockPeak, curLvl);
+        blockDecayedPeak = max(blockDecayedPeak, curLvl + float(i + 1) * decayRate);
+    }
 
-        // Apply gate state to attenuation
-        if(isOpen)
-            attenuation = min(1.0f, attenuation + attackRate);
-        else
-        {
-            heldTime += dtPerSample;
-            if(heldTime > parent->holdTime)
-                attenuation = max(0.0f, attenuation - releaseRate);
-        }
+    // Test thresholds
+    if(level < parent->closeThreshold && isOpen)
+    {
+        heldTime = 0.0f;
+        isOpen = false;
+    }
+    if(blockPeak > parent->openThreshold && !isOpen)
+        isOpen = true;
 
-        // Test if disabled from the config window here so that the above state calculations
-        // are still processed when playing around with the configuration
-        if(!parent->isDisabledFromConfig) {
-            // Multiple input by gate multiplier (0.0f if fully closed, 1.0f if fully open)
-            buffer[i] *= attenuation;
-            buffer[i+1] *= attenuation;
-        }
+    level = max(level - float(numFrames) * decayRate, blockDecayedPeak - float(numFrames + 1) * decayRate);
+
+    // Apply gate state to attenuation. Frame k of the block gets
+    // attenuation + slope * max(0, k - rampStart), clamped to 0..1
+    float slope;
+    float rampStart = 0.0f;
+    if(isOpen)
+        slope = attackRate;
+    else
+    {
+        // The release only starts once the remainder of the hold time has passed
+        slope = -releaseRate;
+        rampStart = min(float(numFrames), max(0.0f, (float)floor((parent->holdTime - heldTime) * SAMPLE_RATE_F)));
+        heldTime += float(numFrames) * dtPerSample;
+    }
+
+    const __m128 startAttenuation = _mm_set1_ps(attenuation);
+    const __m128 slopes = _mm_set1_ps(slope);
+    const __m128 rampStarts = _mm_set1_ps(rampStart);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 frameIndex = _mm_setr_ps(1.0f, 2.0f, 3.0f, 4.0f);
+
+    for(i = 0; i + 4 <= numFrames; i += 4)
+    {
+        __m128 rampFrames = _mm_max_ps(zero, _mm_sub_ps(frameIndex, rampStarts));
+        __m128 gain = _mm_add_ps(startAttenuation, _mm_mul_ps(slopes, rampFrames));
+        _mm_storeu_ps(blockGains + i, _mm_min_ps(one, _mm_max_ps(zero, gain)));
+        frameIndex = _mm_add_ps(frameIndex, _mm_set1_ps(4.0f));
     }
+    for(; i < numFrames; i++)
+        blockGains[i] = min(1.0f, max(0.0f, attenuation + slope * max(0.0f, float(i + 1) - rampStart)));
+
+    attenuation = blockGains[numFrames - 1];
+}
+
+/**
+ * Outputs the oldest lookAheadFrames frames of input in place of the newest.
+ */
+void NoiseGateFilter::DelayAudio(float *buffer, int numFrames)
+{
+    UINT lineFloats = (lookAheadFrames + numFrames) * 2;
+    if(delayLine.Num() < lineFloats)
+        delayLine.SetSize(lineFloats);
+
+    float *line = delayLine.Array();
+    mcpy(line + lookAheadFrames * 2, buffer, numFrames * 2 * sizeof(float));
+    mcpy(buffer, line, numFrames * 2 * sizeof(float));
+    memmove(line, line + numFrames * 2, lookAheadFrames * 2 * sizeof(float));
 }
 
 //============================================================================
@@ -188,6 +309,12 @@ void NoiseGateSettings::ApplySettings()
     GetWindowText(ctrlHwnd, str, str.Length() + 1);
     parent->releaseTime = (float)str.ToInt() * 0.001f;
 
+    // Look-ahead time, only picked up by the filter when the stream next starts
+    ctrlHwnd = GetDlgItem(hwnd, IDC_LOOKAHEADTIME_EDIT);
+    str.SetLength(GetWindowTextLength(ctrlHwnd));
+    GetWindowText(ctrlHwnd, str, str.Length() + 1);
+    parent->lookAheadTime = (float)min(str.ToInt(), MAX_LOOKAHEAD_MS) * 0.001f;
+
     // Close threshold
     val = (int)SendMessage(GetDlgItem(hwnd, IDC_CLOSETHRES_SLIDER), TBM_GETPOS, 0, 0);
     parent->closeThreshold = dbToRms((float)(-val));
@@ -258,6 +385,7 @@ void NoiseGateSettings::RefreshConfig()
     SetWindowText(GetDlgItem(hwnd, IDC_ATTACKTIME_EDIT), IntString((int)(parent->attackTime * 1000.0f)));
     SetWindowText(GetDlgItem(hwnd, IDC_HOLDTIME_EDIT), IntString((int)(parent->holdTime * 1000.0f)));
     SetWindowText(GetDlgItem(hwnd, IDC_RELEASETIME_EDIT), IntString((int)(parent->releaseTime * 1000.0f)));
+    SetWindowText(GetDlgItem(hwnd, IDC_LOOKAHEADTIME_EDIT), IntString((int)(parent->lookAheadTime * 1000.0f + 0.5f)));
 
     // Close threshold trackbar (Control uses positive values)
     val = rmsToDb(parent->closeThreshold);
@@ -411,6 +539,7 @@ INT_PTR NoiseGateSettings::MsgClicked(int controlId, int code, HWND controlHwnd)
     case IDC_ATTACKTIME_EDIT:
     case IDC_HOLDTIME_EDIT:
     case IDC_RELEASETIME_EDIT:
+    case IDC_LOOKAHEADTIME_EDIT:
         if(code == EN_CHANGE) // Modified the text box
             SetChangedSettings(true);
         break;
@@ -505,6 +634,7 @@ NoiseGate::NoiseGate()
     //, attackTime()
     //, holdTime()
     //, releaseTime()
+    //, lookAheadTime()
 {
     LoadDefaults();
     config.Open(OBSGetPluginDataPath() + CONFIG_FILENAME, true);
@@ -536,6 +666,7 @@ void NoiseGate::LoadDefaults()
     attackTime = 0.025f;
     holdTime = 0.2f;
     releaseTime = 0.15f;
+    lookAheadTime = 0.0f;
 }
 
 void NoiseGate::LoadSettings()
@@ -546,6 +677,7 @@ void NoiseGate::LoadSettings()
     attackTime = config.GetFloat(TEXT("General"), TEXT("AttackTime"), attackTime);
     holdTime = config.GetFloat(TEXT("General"), TEXT("HoldTime"), holdTime);
     releaseTime = config.GetFloat(TEXT("General"), TEXT("ReleaseTime"), releaseTime);
+    lookAheadTime = config.GetFloat(TEXT("General"), TEXT("LookAheadTime"), lookAheadTime);
 }
 
 void NoiseGate::SaveSettings()
@@ -556,6 +688,7 @@ void NoiseGate::SaveSettings()
     config.SetFloat(TEXT("General"), TEXT("AttackTime"), attackTime);
     config.SetFloat(TEXT("General"), TEXT("HoldTime"), holdTime);
     config.SetFloat(TEXT("General"), TEXT("ReleaseTime"), releaseTime);
+    config.SetFloat(TEXT("General"), TEXT("LookAheadTime"), lookAheadTime);
 }
 
 void NoiseGate::StreamStarted()
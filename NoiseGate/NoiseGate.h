@@ -29,6 +29,12 @@ class NoiseGate;
 
 class NoiseGateFilter : public AudioFilter
 {
+    //-----------------------------------------------------------------------
+    // Constants
+
+private:
+    static const int    BLOCK_FRAMES = 32; // Gate state is evaluated once per this many frames
+
     //-----------------------------------------------------------------------
     // Private members
 
@@ -41,6 +47,13 @@ private:
     float   heldTime; // The amount of time we've held the gate open after it we hit the close threshold
     bool    isOpen;
 
+    // Look-ahead, fixed for the lifetime of the filter
+    UINT    lookAheadFrames;
+    QWORD   lookAheadMs;
+    List<float> delayLine; // Input not yet output, followed by room for the current segment
+
+    List<float> gains; // Gate multiplier of each frame of the current segment
+
     //-----------------------------------------------------------------------
     // Constructor/destructor
     
@@ -56,6 +69,8 @@ public:
 
 private:
     void ApplyNoiseGate(float *buffer, int totalFloats);
+    void ComputeBlockGains(const float *buffer, int numFrames, float *blockGains);
+    void DelayAudio(float *buffer, int numFrames);
 };
 
 //============================================================================
@@ -69,6 +84,7 @@ class NoiseGateSettings : public SettingsPane
 private:
     static const int    REPAINT_TIMER_ID = 1;
     static const int    CURVOL_RESOLUTION = 96 * 4 - 1; // 0.25 dB resolution for a (-96..0) dB range
+    static const int    MAX_LOOKAHEAD_MS = 50;
 
     //-----------------------------------------------------------------------
     // Private members
@@ -143,6 +159,7 @@ private:
     float   attackTime;
     float   holdTime;
     float   releaseTime;
+    float   lookAheadTime;
 
     //-----------------------------------------------------------------------
     // Constructor/destructor
@@ -11,5 +11,6 @@
 #define IDC_RELEASETIME_EDIT                    1024
 #define IDC_HOLDTIME_EDIT                       1025
 #define IDC_ATTACKTIME_EDIT                     1026
+#define IDC_LOOKAHEADTIME_EDIT                  1027
 #define IDC_OPENTHRES_DB                        1028
 #define IDC_CLOSETHRES_DB                       1029
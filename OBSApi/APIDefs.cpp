@@ -144,3 +144,11 @@ void OBSRemoveSettingsPane(SettingsPane *pane)  {API->RemoveSettingsPane(pane);}
 UINT OBSGetAPIVersion()                         {return 0x0101;}
 
 UINT OBSGetSampleRateHz()                       {return API->GetSampleRateHz();}
+
+void OBSGetFrameStageStats(FrameStage stage, FrameStageStats &stats)    {API->GetFrameStageStats(stage, stats);}
+void OBSDumpFrameStageStats()                   {API->DumpFrameStageStats();}
+void OBSResetFrameStageStats()                  {API->ResetFrameStageStats();}
+
+UINT OBSGetSceneBufferingTime()                 {return API->GetSceneBufferingTime();}
+
+void OBSNotifyAudioReady()                      {API->NotifyAudioReady();}
@@ -37,6 +37,34 @@ enum StreamInfoPriority
     StreamInfoPriority_Critical,
 };
 
+//stages of a video frame's trip through the pipeline that latency is tracked for
+enum FrameStage
+{
+    FrameStage_Capture,     //scene render, from the frame tick to the GPU copy being queued
+    FrameStage_Readback,    //mapping the copied frame, mostly waiting on the GPU
+    FrameStage_Convert,     //4:2:0 conversion (and CPU downscale), dispatch to last row done
+    FrameStage_Encode,      //call to the video encoder
+    FrameStage_Queued,      //held in the scene buffering delay before being sent out
+    FrameStage_Sent,        //main stream's send queue until librtmp has taken the frame.  with a send
+                            //buffer that's the copy into it, the socket write comes later
+    FrameStage_TickJitter,  //how late the encode thread woke up for each frame tick
+    FrameStage_TickToOutput,//frame tick to the encoded frame being handed to the outputs.  not glass to
+                            //glass, whatever the source and the viewer add comes on top
+    FrameStage_HostHandoff, //frame slot queued for the x264 encoder host until the host picked it up
+
+    FrameStage_Count
+};
+
+//latencies are in microseconds.  percentiles come from log-linear buckets and are
+//rounded up to the top of their bucket, so they can be up to ~6% high
+struct FrameStageStats
+{
+    QWORD count;
+    DWORD minTime, maxTime;
+    double avgTime;
+    DWORD p50, p99, p999;
+};
+
 //-------------------------------------------------------------------
 // API interface, plugins should not ever use, use C funcs below
 
@@ -176,6 +204,14 @@ public:
     virtual UINT GetSampleRateHz() const=0;
 
     virtual void SetAbortApplySettings(bool abort) = 0;
+
+    virtual void GetFrameStageStats(FrameStage stage, FrameStageStats &stats) const=0;
+    virtual void DumpFrameStageStats() const=0;
+    virtual void ResetFrameStageStats()=0;
+
+    virtual UINT GetSceneBufferingTime() const=0;
+
+    virtual void NotifyAudioReady()=0;
 };
 
 BASE_EXPORT extern APIInterface *API;
@@ -292,3 +328,13 @@ BASE_EXPORT void OBSRemoveSettingsPane(SettingsPane *pane);
 BASE_EXPORT UINT OBSGetAPIVersion();
 
 BASE_EXPORT UINT OBSGetSampleRateHz();
+
+/* Frame latency stats, collected since the stream started or the last reset */
+BASE_EXPORT void OBSGetFrameStageStats(FrameStage stage, FrameStageStats &stats);
+BASE_EXPORT void OBSDumpFrameStageStats();  //writes every stage to the log
+BASE_EXPORT void OBSResetFrameStageStats();
+
+BASE_EXPORT UINT OBSGetSceneBufferingTime();  //in milliseconds
+
+/* call when an audio source has new data buffered, wakes the audio thread instead of waiting for its next tick */
+BASE_EXPORT void OBSNotifyAudioReady();
@@ -28,5 +28,8 @@ public:
     inline AudioFilter() {}
     virtual ~AudioFilter() {}
 
+    //the segment is allocated with new and handed over to the filter.  either modify it in place
+    //and return it, or delete it and return a new segment allocated with new, or NULL to drop it.
+    //whatever is returned belongs to the audio source again
     virtual AudioSegment* Process(AudioSegment *segment)=0;
 };
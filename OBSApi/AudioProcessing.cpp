@@ -0,0 +1,925 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "OBSApi.h"
+#include <Audioclient.h>
+#include <intrin.h>
+#include <immintrin.h>
+
+#define KSAUDIO_SPEAKER_4POINT1     (KSAUDIO_SPEAKER_QUAD|SPEAKER_LOW_FREQUENCY)
+#define KSAUDIO_SPEAKER_3POINT1     (KSAUDIO_SPEAKER_STEREO|SPEAKER_FRONT_CENTER|SPEAKER_LOW_FREQUENCY)
+#define KSAUDIO_SPEAKER_2POINT1     (KSAUDIO_SPEAKER_STEREO|SPEAKER_LOW_FREQUENCY)
+
+
+//audio kernels for the mixer and audio sources.  none of them need aligned buffers, the
+//vector loops just run over as many samples as they can and the scalar code does the rest.
+//
+//everything except the RMS sum gives exactly the same result as the scalar code: the
+//vector versions do the same float operations in the same order, and the 24/32bit
+//conversions divide in double precision just like the scalar ones.
+
+const float dbMinus3    = 0.7071067811865476f;
+const float dbMinus6    = 0.5f;
+const float dbMinus9    = 0.3535533905932738f;
+
+//not entirely sure if these are the correct coefficients for downmixing,
+//I'm fairly new to the whole multi speaker thing
+const float surroundMix = dbMinus3;
+const float centerMix   = dbMinus6;
+const float lowFreqMix  = dbMinus3;
+
+const float surroundMix4 = dbMinus6;
+
+const float attn5dot1 = 1.0f / (1.0f + centerMix + surroundMix);
+const float attn4dotX = 1.0f / (1.0f + surroundMix4);
+
+//--------------------------------------------------------------------------
+// mix
+
+static void MixAudio_Scalar(float *bufferDest, float *bufferSrc, UINT totalFloats, bool bForceMono)
+{
+    if(bForceMono)
+    {
+        for(UINT i=0; i<totalFloats; i += 2)
+        {
+            bufferSrc[i] += bufferSrc[i+1];
+            bufferSrc[i] *= 0.5f;
+            bufferSrc[i+1] = bufferSrc[i];
+        }
+    }
+
+    for(UINT i=0; i<totalFloats; i++)
+    {
+        float val = bufferDest[i]+bufferSrc[i];
+
+        if(val < -1.0f)     val = -1.0f;
+        else if(val > 1.0f) val = 1.0f;
+
+        bufferDest[i] = val;
+    }
+}
+
+static void MixAudio_SSE2(float *bufferDest, float *bufferSrc, UINT totalFloats, bool bForceMono)
+{
+    UINT alignedFloats = totalFloats & 0xFFFFFFFC;
+
+    if(bForceMono)
+    {
+        __m128 halfVal = _mm_set_ps1(0.5f);
+        for(UINT i=0; i<alignedFloats; i += 4)
+        {
+            __m128 val = _mm_loadu_ps(bufferSrc+i);
+            __m128 shufVal = _mm_shuffle_ps(val, val, _MM_SHUFFLE(2, 3, 0, 1));
+
+            _mm_storeu_ps(bufferSrc+i, _mm_mul_ps(_mm_add_ps(val, shufVal), halfVal));
+        }
+    }
+
+    __m128 maxVal = _mm_set_ps1(1.0f);
+    __m128 minVal = _mm_set_ps1(-1.0f);
+
+    for(UINT i=0; i<alignedFloats; i += 4)
+    {
+        __m128 mix = _mm_add_ps(_mm_loadu_ps(bufferDest+i), _mm_loadu_ps(bufferSrc+i));
+        mix = _mm_min_ps(mix, maxVal);
+        mix = _mm_max_ps(mix, minVal);
+
+        _mm_storeu_ps(bufferDest+i, mix);
+    }
+
+    if(alignedFloats != totalFloats)
+        MixAudio_Scalar(bufferDest+alignedFloats, bufferSrc+alignedFloats, totalFloats-alignedFloats, bForceMono);
+}
+
+static void MixAudio_AVX(float *bufferDest, float *bufferSrc, UINT totalFloats, bool bForceMono)
+{
+    UINT alignedFloats = totalFloats & 0xFFFFFFF8;
+
+    if(bForceMono)
+    {
+        __m256 halfVal = _mm256_set1_ps(0.5f);
+        for(UINT i=0; i<alignedFloats; i += 8)
+        {
+            __m256 val = _mm256_loadu_ps(bufferSrc+i);
+            __m256 shufVal = _mm256_permute_ps(val, _MM_SHUFFLE(2, 3, 0, 1));
+
+            _mm256_storeu_ps(bufferSrc+i, _mm256_mul_ps(_mm256_add_ps(val, shufVal), halfVal));
+        }
+    }
+
+    __m256 maxVal = _mm256_set1_ps(1.0f);
+    __m256 minVal = _mm256_set1_ps(-1.0f);
+
+    for(UINT i=0; i<alignedFloats; i += 8)
+    {
+        __m256 mix = _mm256_add_ps(_mm256_loadu_ps(bufferDest+i), _mm256_loadu_ps(bufferSrc+i));
+        mix = _mm256_min_ps(mix, maxVal);
+        mix = _mm256_max_ps(mix, minVal);
+
+        _mm256_storeu_ps(bufferDest+i, mix);
+    }
+
+    _mm256_zeroupper();
+
+    if(alignedFloats != totalFloats)
+        MixAudio_SSE2(bufferDest+alignedFloats, bufferSrc+alignedFloats, totalFloats-alignedFloats, bForceMono);
+}
+
+//--------------------------------------------------------------------------
+// gain
+
+static void MultiplyAudioBuffer_Scalar(float *buffer, UINT totalFloats, float mulVal)
+{
+    for(UINT i=0; i<totalFloats; i++)
+        buffer[i] *= mulVal;
+}
+
+static void MultiplyAudioBuffer_SSE2(float *buffer, UINT totalFloats, float mulVal)
+{
+    UINT alignedFloats = totalFloats & 0xFFFFFFFC;
+    __m128 sseMulVal = _mm_set_ps1(mulVal);
+
+    for(UINT i=0; i<alignedFloats; i += 4)
+        _mm_storeu_ps(buffer+i, _mm_mul_ps(_mm_loadu_ps(buffer+i), sseMulVal));
+
+    MultiplyAudioBuffer_Scalar(buffer+alignedFloats, totalFloats-alignedFloats, mulVal);
+}
+
+static void MultiplyAudioBuffer_AVX(float *buffer, UINT totalFloats, float mulVal)
+{
+    UINT alignedFloats = totalFloats & 0xFFFFFFF8;
+    __m256 avxMulVal = _mm256_set1_ps(mulVal);
+
+    for(UINT i=0; i<alignedFloats; i += 8)
+        _mm256_storeu_ps(buffer+i, _mm256_mul_ps(_mm256_loadu_ps(buffer+i), avxMulVal));
+
+    _mm256_zeroupper();
+
+    MultiplyAudioBuffer_Scalar(buffer+alignedFloats, totalFloats-alignedFloats, mulVal);
+}
+
+//--------------------------------------------------------------------------
+// RMS/peak.  sums and returns the squares, the caller takes the square roots
+
+static void SumSquares_Scalar(const float *buffer, UINT totalFloats, float mulVal, float &sum, float &peak)
+{
+    for(UINT i=0; i<totalFloats; i++)
+    {
+        float val = buffer[i] * mulVal;
+        float pow2Val = val * val;
+        sum += pow2Val;
+        if(pow2Val > peak)
+            peak = pow2Val;
+    }
+}
+
+static inline float HorizontalSum(__m128 val)
+{
+    val = _mm_add_ps(val, _mm_movehl_ps(val, val));
+    val = _mm_add_ss(val, _mm_shuffle_ps(val, val, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(val);
+}
+
+static inline float HorizontalMax(__m128 val)
+{
+    val = _mm_max_ps(val, _mm_movehl_ps(val, val));
+    val = _mm_max_ss(val, _mm_shuffle_ps(val, val, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(val);
+}
+
+static void SumSquares_SSE2(const float *buffer, UINT totalFloats, float mulVal, float &sum, float &peak)
+{
+    UINT alignedFloats = totalFloats & 0xFFFFFFFC;
+    __m128 sseMulVal = _mm_set_ps1(mulVal);
+    __m128 sseSum = _mm_setzero_ps();
+    __m128 sseMax = _mm_setzero_ps();
+
+    for(UINT i=0; i<alignedFloats; i += 4)
+    {
+        __m128 val = _mm_mul_ps(_mm_loadu_ps(buffer+i), sseMulVal);
+        __m128 squares = _mm_mul_ps(val, val);
+
+        sseSum = _mm_add_ps(sseSum, squares);
+        sseMax = _mm_max_ps(sseMax, squares);
+    }
+
+    sum  += HorizontalSum(sseSum);
+    peak  = max(peak, HorizontalMax(sseMax));
+
+    SumSquares_Scalar(buffer+alignedFloats, totalFloats-alignedFloats, mulVal, sum, peak);
+}
+
+static void SumSquares_AVX(const float *buffer, UINT totalFloats, float mulVal, float &sum, float &peak)
+{
+    UINT alignedFloats = totalFloats & 0xFFFFFFF8;
+    __m256 avxMulVal = _mm256_set1_ps(mulVal);
+    __m256 avxSum = _mm256_setzero_ps();
+    __m256 avxMax = _mm256_setzero_ps();
+
+    for(UINT i=0; i<alignedFloats; i += 8)
+    {
+        __m256 val = _mm256_mul_ps(_mm256_loadu_ps(buffer+i), avxMulVal);
+        __m256 squares = _mm256_mul_ps(val, val);
+
+        avxSum = _mm256_add_ps(avxSum, squares);
+        avxMax = _mm256_max_ps(avxMax, squares);
+    }
+
+    __m128 sseSum = _mm_add_ps(_mm256_castps256_ps128(avxSum), _mm256_extractf128_ps(avxSum, 1));
+    __m128 sseMax = _mm_max_ps(_mm256_castps256_ps128(avxMax), _mm256_extractf128_ps(avxMax, 1));
+    _mm256_zeroupper();
+
+    sum  += HorizontalSum(sseSum);
+    peak  = max(peak, HorizontalMax(sseMax));
+
+    SumSquares_Scalar(buffer+alignedFloats, totalFloats-alignedFloats, mulVal, sum, peak);
+}
+
+//--------------------------------------------------------------------------
+// integer to float
+
+//puts a 24bit sample in the top 3 bytes of an int, shifting it back down sign extends it
+static inline int ReadTriple(const BYTE *input)
+{
+    return int(UINT(input[0]) << 8 | UINT(input[1]) << 16 | UINT(input[2]) << 24);
+}
+
+static void ConvertAudioToFloat_Scalar(float *output, const void *input, UINT totalSamples, UINT bitsPerSample)
+{
+    if(bitsPerSample == 8)
+    {
+        const char *inputSByte = (const char*)input;
+        for(UINT i=0; i<totalSamples; i++)
+            output[i] = float(inputSByte[i])/127.0f;
+    }
+    else if(bitsPerSample == 16)
+    {
+        const short *inputShort = (const short*)input;
+        for(UINT i=0; i<totalSamples; i++)
+            output[i] = float(inputShort[i])/32767.0f;
+    }
+    else if(bitsPerSample == 24)
+    {
+        const BYTE *inputTriple = (const BYTE*)input;
+        for(UINT i=0; i<totalSamples; i++)
+        {
+            output[i] = float(double(ReadTriple(inputTriple) >> 8)/8388607.0);
+            inputTriple += 3;
+        }
+    }
+    else if(bitsPerSample == 32)
+    {
+        const LONG *inputLong = (const LONG*)input;
+        for(UINT i=0; i<totalSamples; i++)
+            output[i] = float(double(inputLong[i])/2147483647.0);
+    }
+}
+
+//converts 4 ints by dividing in double precision, same as float(double(val)/divisor)
+static inline __m128 ConvertIntsDouble(__m128i vals, __m128d divisor)
+{
+    __m128d lo = _mm_div_pd(_mm_cvtepi32_pd(vals), divisor);
+    __m128d hi = _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(vals, _MM_SHUFFLE(1, 0, 3, 2))), divisor);
+    return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+}
+
+static void ConvertAudioToFloat_SSE2(float *output, const void *input, UINT totalSamples, UINT bitsPerSample)
+{
+    UINT i = 0;
+
+    if(bitsPerSample == 8)
+    {
+        const char *inputSByte = (const char*)input;
+        __m128 divisor = _mm_set_ps1(127.0f);
+
+        for(; i+16 <= totalSamples; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(inputSByte+i));
+            __m128i words1 = _mm_unpacklo_epi8(bytes, bytes);
+            __m128i words2 = _mm_unpackhi_epi8(bytes, bytes);
+
+            _mm_storeu_ps(output+i,    _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(words1, words1), 24)), divisor));
+            _mm_storeu_ps(output+i+4,  _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(words1, words1), 24)), divisor));
+            _mm_storeu_ps(output+i+8,  _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(words2, words2), 24)), divisor));
+            _mm_storeu_ps(output+i+12, _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(words2, words2), 24)), divisor));
+        }
+
+        input = inputSByte+i;
+    }
+    else if(bitsPerSample == 16)
+    {
+        const short *inputShort = (const short*)input;
+        __m128 divisor = _mm_set_ps1(32767.0f);
+
+        for(; i+8 <= totalSamples; i += 8)
+        {
+            __m128i words = _mm_loadu_si128((const __m128i*)(inputShort+i));
+
+            _mm_storeu_ps(output+i,   _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16)), divisor));
+            _mm_storeu_ps(output+i+4, _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16)), divisor));
+        }
+
+        input = inputShort+i;
+    }
+    else if(bitsPerSample == 24)
+    {
+        //SSE2 has no byte shuffle, so only the conversion itself is vectorized
+        const BYTE *inputTriple = (const BYTE*)input;
+        __m128d divisor = _mm_set1_pd(8388607.0);
+
+        for(; i+4 <= totalSamples; i += 4)
+        {
+            const BYTE *in = inputTriple+(i*3);
+            __m128i vals = _mm_setr_epi32(ReadTriple(in), ReadTriple(in+3), ReadTriple(in+6), ReadTriple(in+9));
+
+            _mm_storeu_ps(output+i, ConvertIntsDouble(_mm_srai_epi32(vals, 8), divisor));
+        }
+
+        input = inputTriple+(i*3);
+    }
+    else if(bitsPerSample == 32)
+    {
+        const LONG *inputLong = (const LONG*)input;
+        __m128d divisor = _mm_set1_pd(2147483647.0);
+
+        for(; i+4 <= totalSamples; i += 4)
+            _mm_storeu_ps(output+i, ConvertIntsDouble(_mm_loadu_si128((const __m128i*)(inputLong+i)), divisor));
+
+        input = inputLong+i;
+    }
+
+    ConvertAudioToFloat_Scalar(output+i, input, totalSamples-i, bitsPerSample);
+}
+
+static void ConvertAudioToFloat_AVX2(float *output, const void *input, UINT totalSamples, UINT bitsPerSample)
+{
+    UINT i = 0;
+
+    if(bitsPerSample == 8)
+    {
+        const char *inputSByte = (const char*)input;
+        __m256 divisor = _mm256_set1_ps(127.0f);
+
+        for(; i+16 <= totalSamples; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(inputSByte+i));
+
+            _mm256_storeu_ps(output+i,   _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes)), divisor));
+            _mm256_storeu_ps(output+i+8, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(bytes, 8))), divisor));
+        }
+
+        input = inputSByte+i;
+    }
+    else if(bitsPerSample == 16)
+    {
+        const short *inputShort = (const short*)input;
+        __m256 divisor = _mm256_set1_ps(32767.0f);
+
+        for(; i+16 <= totalSamples; i += 16)
+        {
+            __m256i words = _mm256_loadu_si256((const __m256i*)(inputShort+i));
+
+            _mm256_storeu_ps(output+i,   _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(words))), divisor));
+            _mm256_storeu_ps(output+i+8, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(words, 1))), divisor));
+        }
+
+        input = inputShort+i;
+    }
+    else if(bitsPerSample == 24)
+    {
+        //moves each sample to the top 3 bytes of a dword, an arithmetic shift then sign extends it
+        const BYTE *inputTriple = (const BYTE*)input;
+        __m256d divisor = _mm256_set1_pd(8388607.0);
+        __m128i shuffle = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+
+        //each load reads 16 bytes for 12 bytes of samples, so stop early enough not to read past the end
+        for(; i+6 <= totalSamples; i += 4)
+        {
+            __m128i vals = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(inputTriple+(i*3))), shuffle);
+            __m256d converted = _mm256_div_pd(_mm256_cvtepi32_pd(_mm_srai_epi32(vals, 8)), divisor);
+
+            _mm_storeu_ps(output+i, _mm256_cvtpd_ps(converted));
+        }
+
+        input = inputTriple+(i*3);
+    }
+    else if(bitsPerSample == 32)
+    {
+        const LONG *inputLong = (const LONG*)input;
+        __m256d divisor = _mm256_set1_pd(2147483647.0);
+
+        for(; i+4 <= totalSamples; i += 4)
+        {
+            __m256d converted = _mm256_div_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(inputLong+i))), divisor);
+            _mm_storeu_ps(output+i, _mm256_cvtpd_ps(converted));
+        }
+
+        input = inputLong+i;
+    }
+
+    _mm256_zeroupper();
+
+    ConvertAudioToFloat_Scalar(output+i, input, totalSamples-i, bitsPerSample);
+}
+
+//--------------------------------------------------------------------------
+// channel upmix/downmix to stereo
+//
+//the vector loops do two frames at a time, with lanes laid out as L0 R0 L1 R1
+
+static inline __m128 LoadChannelPair(const float *input, UINT stride, UINT channel)
+{
+    __m128 val = _mm_castpd_ps(_mm_load_sd((const double*)(input+channel)));
+    return _mm_loadh_pi(val, (const __m64*)(input+stride+channel));
+}
+
+static inline __m128 LoadChannelDup(const float *input, UINT stride, UINT channel)
+{
+    return _mm_setr_ps(input[channel], input[channel], input[stride+channel], input[stride+channel]);
+}
+
+//for the layouts that just take front left/right
+static void CopyFrontChannels(float *output, const float *input, UINT numFrames, UINT stride)
+{
+    UINT i = 0;
+
+    for(; i+2 <= numFrames; i += 2)
+    {
+        _mm_storeu_ps(output, LoadChannelPair(input, stride, 0));
+
+        input  += stride*2;
+        output += 4;
+    }
+
+    if(i < numFrames)
+    {
+        output[0] = input[0];
+        output[1] = input[1];
+    }
+}
+
+//front + rear pair, used by quad and 4.1
+static void DownmixFrontRear(float *output, const float *input, UINT numFrames, UINT stride, UINT rearChannel)
+{
+    UINT i = 0;
+    __m128 mixVal  = _mm_set_ps1(surroundMix4);
+    __m128 attnVal = _mm_set_ps1(attn4dotX);
+
+    for(; i+2 <= numFrames; i += 2)
+    {
+        __m128 front = LoadChannelPair(input, stride, 0);
+        __m128 rear  = _mm_mul_ps(LoadChannelPair(input, stride, rearChannel), mixVal);
+
+        _mm_storeu_ps(output, _mm_mul_ps(_mm_add_ps(front, rear), attnVal));
+
+        input  += stride*2;
+        output += 4;
+    }
+
+    if(i < numFrames)
+    {
+        float left      = input[0];
+        float right     = input[1];
+        float rearLeft  = input[rearChannel]*surroundMix4;
+        float rearRight = input[rearChannel+1]*surroundMix4;
+
+        output[0] = (left  + rearLeft)  * attn4dotX;
+        output[1] = (right + rearRight) * attn4dotX;
+    }
+}
+
+//5.1 layout, also used by 7.1 (front left/right of center dropped)
+static void Downmix5dot1(float *output, const float *input, UINT numFrames, UINT stride)
+{
+    UINT i = 0;
+    __m128 centerVal   = _mm_set_ps1(centerMix);
+    __m128 surroundVal = _mm_set_ps1(surroundMix);
+    __m128 attnVal     = _mm_set_ps1(attn5dot1);
+
+    for(; i+2 <= numFrames; i += 2)
+    {
+        __m128 front  = LoadChannelPair(input, stride, 0);
+        __m128 center = _mm_mul_ps(LoadChannelDup(input, stride, 2), centerVal);
+        __m128 rear   = _mm_mul_ps(LoadChannelPair(input, stride, 4), surroundVal);
+
+        _mm_storeu_ps(output, _mm_mul_ps(_mm_add_ps(_mm_add_ps(front, center), rear), attnVal));
+
+        input  += stride*2;
+        output += 4;
+    }
+
+    if(i < numFrames)
+    {
+        //see the ITU-R BS.775-1 notes in DownmixAudioToStereo
+        float left      = input[0];
+        float right     = input[1];
+        float center    = input[2]*centerMix;
+        float rearLeft  = input[4]*surroundMix;
+        float rearRight = input[5]*surroundMix;
+
+        output[0] = (left  + center  + rearLeft)  * attn5dot1;
+        output[1] = (right + center  + rearRight) * attn5dot1;
+    }
+}
+
+//7.1 surround, the rear and side channels are averaged down to 5.1 first
+static void Downmix7dot1Surround(float *output, const float *input, UINT numFrames)
+{
+    UINT i = 0;
+    __m128 halfVal     = _mm_set_ps1(0.5f);
+    __m128 centerVal   = _mm_set_ps1(centerMix);
+    __m128 surroundVal = _mm_set_ps1(surroundMix);
+    __m128 attnVal     = _mm_set_ps1(attn5dot1);
+
+    for(; i+2 <= numFrames; i += 2)
+    {
+        __m128 front  = LoadChannelPair(input, 8, 0);
+        __m128 center = _mm_mul_ps(LoadChannelDup(input, 8, 2), centerVal);
+        __m128 rear   = _mm_mul_ps(_mm_add_ps(LoadChannelPair(input, 8, 4), LoadChannelPair(input, 8, 6)), halfVal);
+
+        _mm_storeu_ps(output, _mm_mul_ps(_mm_add_ps(_mm_add_ps(front, center), _mm_mul_ps(rear, surroundVal)), attnVal));
+
+        input  += 16;
+        output += 4;
+    }
+
+    if(i < numFrames)
+    {
+        float left      = input[0];
+        float right     = input[1];
+        float center    = input[2]*centerMix;
+        float rearLeft  = (input[4] + input[6]) * 0.5f;
+        float rearRight = (input[5] + input[7]) * 0.5f;
+
+        output[0] = (left  + center + rearLeft  * surroundMix) * attn5dot1;
+        output[1] = (right + center + rearRight * surroundMix) * attn5dot1;
+    }
+}
+
+static void UpmixMono(float *output, const float *input, UINT numFrames)
+{
+    UINT i = 0;
+
+    for(; i+4 <= numFrames; i += 4)
+    {
+        __m128 inVal = _mm_loadu_ps(input+i);
+
+        _mm_storeu_ps(output+(i*2),   _mm_unpacklo_ps(inVal, inVal));
+        _mm_storeu_ps(output+(i*2)+4, _mm_unpackhi_ps(inVal, inVal));
+    }
+
+    for(; i<numFrames; i++)
+        output[i*2] = output[i*2+1] = input[i];
+}
+
+void DownmixAudioToStereo(float *output, const float *input, UINT numFrames, UINT channels, DWORD channelMask)
+{
+    if(channels == 1)
+    {
+        UpmixMono(output, input, numFrames);
+        return;
+    }
+    else if(channels == 2) //straight up copy
+    {
+        mcpy(output, input, numFrames*2*sizeof(float));
+        return;
+    }
+
+    //todo: support for other speaker configurations than ones I can merely "think" of.  ugh.
+    switch(channelMask)
+    {
+        // When in doubt, use only left and right .... and rear left and rear right :)
+        // Same idea as with 5.1 downmix
+        case KSAUDIO_SPEAKER_QUAD:      DownmixFrontRear(output, input, numFrames, 4, 2); break;
+
+        // Skip LFE , we don't really need it.
+        case KSAUDIO_SPEAKER_4POINT1:   DownmixFrontRear(output, input, numFrames, 5, 3); break;
+
+        // Drop LFE and center, just use left and right
+        case KSAUDIO_SPEAKER_2POINT1:   CopyFrontChannels(output, input, numFrames, 3); break;
+        case KSAUDIO_SPEAKER_3POINT1:   CopyFrontChannels(output, input, numFrames, 4); break;
+
+        // When in doubt, use only left and right :) Seriously.
+        // THIS NEEDS TO BE PROPERLY IMPLEMENTED!
+        case KSAUDIO_SPEAKER_SURROUND:  CopyFrontChannels(output, input, numFrames, 4); break;
+
+        // Both speakers configs share the same format, the difference is in rear speakers position
+        // See: http://msdn.microsoft.com/en-us/library/windows/hardware/ff537083(v=vs.85).aspx
+        // Probably for KSAUDIO_SPEAKER_5POINT1_SURROUND we will need a different coefficient for rear left/right
+        //
+        // According to ITU-R  BS.775-1 recommendation, the downmix from a 3/2 source to stereo
+        // is the following:
+        // L = FL + k0*C + k1*RL
+        // R = FR + k0*C + k1*RR
+        // k0 = centerMix, k1 = surroundMix, LFE is dropped
+        //
+        // The output (L,R) can be out of (-1,1) domain so we attenuate it [ attn5dot1 = 1/(1 + centerMix + surroundMix) ]
+        // http://acousticsfreq.com/blog/wp-content/uploads/2012/01/ITU-R-BS775-1.pdf
+        // http://ir.lib.nctu.edu.tw/bitstream/987654321/22934/1/030104001.pdf
+        case KSAUDIO_SPEAKER_5POINT1:
+        case KSAUDIO_SPEAKER_5POINT1_SURROUND:
+            Downmix5dot1(output, input, numFrames, 6);
+            break;
+
+        // According to http://msdn.microsoft.com/en-us/library/windows/hardware/ff537083(v=vs.85).aspx
+        // KSAUDIO_SPEAKER_7POINT1 is obsolete and no longer supported in Windows Vista and later versions of Windows
+        // Not sure what to do about it, meh , drop front left of center/front right of center -> 5.1 -> stereo;
+        case KSAUDIO_SPEAKER_7POINT1:   Downmix5dot1(output, input, numFrames, 8); break;
+
+        // Downmix to 5.1 (easy stuff) then downmix to stereo as done in KSAUDIO_SPEAKER_5POINT1
+        case KSAUDIO_SPEAKER_7POINT1_SURROUND: Downmix7dot1Surround(output, input, numFrames); break;
+    }
+}
+
+//--------------------------------------------------------------------------
+// polyphase resampler
+//
+//fixed-ratio resampler for rates with a small rational ratio (44.1k->48k is 160/147).  the
+//kaiser windowed sinc is cut into one filter per output phase up front, so every output
+//frame is a single dot product over the input history instead of libsamplerate's per-sample
+//coefficient interpolation.  cutoff and tap count roughly match SRC_SINC_FASTEST.
+
+//up to this many phases, more than that and the tables get silly
+#define RESAMPLER_MAX_PHASES    640
+
+//taps per phase when upsampling, downsampling scales this by the ratio
+#define RESAMPLER_BASE_TAPS     48
+
+//passband as a fraction of the lower nyquist rate
+#define RESAMPLER_CUTOFF        0.85
+
+#define RESAMPLER_KAISER_BETA   8.0
+
+#define RESAMPLER_PI            3.14159265358979323846
+
+struct PolyphaseResampler
+{
+    UINT upFactor, downFactor;      //output rate = input rate * upFactor/downFactor
+    UINT numTaps;                   //per phase, always a multiple of 4
+    float *coefs;                   //per phase, each tap stored twice to line up with L R pairs
+
+    float *history;                 //stereo input frames still needed by the filter
+    UINT historyFrames, historyCapacity;
+    UINT pos, phase;
+};
+
+typedef void (*RESAMPLEFRAMEPROC)(const float *input, const float *coefs, UINT numTaps, float *output);
+
+static void ResampleFrame_SSE2(const float *input, const float *coefs, UINT numTaps, float *output)
+{
+    __m128 sum1 = _mm_setzero_ps();
+    __m128 sum2 = _mm_setzero_ps();
+
+    for(UINT i=0; i<numTaps*2; i += 8)
+    {
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(input+i),   _mm_loadu_ps(coefs+i)));
+        sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_loadu_ps(input+i+4), _mm_loadu_ps(coefs+i+4)));
+    }
+
+    sum1 = _mm_add_ps(sum1, sum2);
+    sum1 = _mm_add_ps(sum1, _mm_movehl_ps(sum1, sum1));
+    _mm_storel_pi((__m64*)output, sum1);
+}
+
+static void ResampleFrame_AVX(const float *input, const float *coefs, UINT numTaps, float *output)
+{
+    __m256 sum = _mm256_setzero_ps();
+
+    for(UINT i=0; i<numTaps*2; i += 8)
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(input+i), _mm256_loadu_ps(coefs+i)));
+
+    __m128 sum1 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    _mm256_zeroupper();
+
+    sum1 = _mm_add_ps(sum1, _mm_movehl_ps(sum1, sum1));
+    _mm_storel_pi((__m64*)output, sum1);
+}
+
+static RESAMPLEFRAMEPROC resampleFrame = ResampleFrame_SSE2;
+
+static double BesselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for(int k=1; k<50; k++)
+    {
+        double val = x/(2.0*k);
+        term *= val*val;
+        sum += term;
+        if(term < sum*1e-12)
+            break;
+    }
+
+    return sum;
+}
+
+static UINT GreatestCommonDivisor(UINT a, UINT b)
+{
+    while(b)
+    {
+        UINT temp = a%b;
+        a = b;
+        b = temp;
+    }
+
+    return a;
+}
+
+PolyphaseResampler* CreatePolyphaseResampler(UINT inputRate, UINT outputRate)
+{
+    if(!inputRate || !outputRate)
+        return NULL;
+
+    UINT divisor    = GreatestCommonDivisor(inputRate, outputRate);
+    UINT upFactor   = outputRate/divisor;
+    UINT downFactor = inputRate/divisor;
+
+    if(upFactor > RESAMPLER_MAX_PHASES || downFactor > RESAMPLER_MAX_PHASES*4)
+        return NULL;
+
+    //the prototype filter runs at inputRate*upFactor, cut off below the lower of the two nyquists
+    UINT maxFactor = MAX(upFactor, downFactor);
+    UINT numTaps   = (RESAMPLER_BASE_TAPS*maxFactor + upFactor-1)/upFactor;
+    numTaps = (numTaps+3) & 0xFFFFFFFC;
+
+    UINT filterLen = numTaps*upFactor;
+    double cutoff  = RESAMPLER_CUTOFF*0.5/double(maxFactor);
+    double center  = double(filterLen-1)*0.5;
+    double i0Beta  = BesselI0(RESAMPLER_KAISER_BETA);
+
+    PolyphaseResampler *resampler = (PolyphaseResampler*)Allocate(sizeof(PolyphaseResampler));
+    zero(resampler, sizeof(PolyphaseResampler));
+
+    resampler->upFactor   = upFactor;
+    resampler->downFactor = downFactor;
+    resampler->numTaps    = numTaps;
+    resampler->coefs      = (float*)Allocate(upFactor*numTaps*2*sizeof(float));
+
+    List<double> phaseTaps;
+    phaseTaps.SetSize(numTaps);
+
+    for(UINT phase=0; phase<upFactor; phase++)
+    {
+        double sum = 0.0;
+
+        //tap r multiplies input frame (q-numTaps+1+r), which sits at prototype offset phase+(numTaps-1-r)*upFactor
+        for(UINT r=0; r<numTaps; r++)
+        {
+            double x = double(phase + (numTaps-1-r)*upFactor) - center;
+            double val = 2.0*cutoff;
+            if(fabs(x) > 1e-9)
+                val = sin(2.0*RESAMPLER_PI*cutoff*x)/(RESAMPLER_PI*x);
+
+            double window = x/(double(filterLen)*0.5);
+            window = (fabs(window) < 1.0) ? BesselI0(RESAMPLER_KAISER_BETA*sqrt(1.0-window*window))/i0Beta : 0.0;
+
+            phaseTaps[r] = val*window;
+            sum += phaseTaps[r];
+        }
+
+        //each phase gets unity gain, otherwise DC picks up a ripple at the phase rate
+        float *coefs = resampler->coefs + phase*numTaps*2;
+        for(UINT r=0; r<numTaps; r++)
+            coefs[r*2] = coefs[r*2+1] = float(phaseTaps[r]/sum);
+    }
+
+    //start with a window of silence so output starts right away
+    resampler->historyCapacity = numTaps*2;
+    resampler->history = (float*)Allocate(resampler->historyCapacity*2*sizeof(float));
+    zero(resampler->history, resampler->historyCapacity*2*sizeof(float));
+    resampler->historyFrames = numTaps-1;
+
+    Log(TEXT("Using polyphase resampler: %u -> %u, %u/%u, %u taps"), inputRate, outputRate, upFactor, downFactor, numTaps);
+    return resampler;
+}
+
+void DestroyPolyphaseResampler(PolyphaseResampler *resampler)
+{
+    if(!resampler)
+        return;
+
+    Free(resampler->coefs);
+    Free(resampler->history);
+    Free(resampler);
+}
+
+UINT PolyphaseResample(PolyphaseResampler *resampler, const float *input, UINT inputFrames, float *output, UINT maxOutputFrames)
+{
+    //only grows when a block bigger than any before it comes in
+    UINT neededFrames = resampler->historyFrames+inputFrames;
+    if(neededFrames > resampler->historyCapacity)
+    {
+        resampler->historyCapacity = neededFrames;
+        resampler->history = (float*)ReAllocate(resampler->history, neededFrames*2*sizeof(float));
+    }
+
+    mcpy(resampler->history+(resampler->historyFrames*2), input, inputFrames*2*sizeof(float));
+    resampler->historyFrames = neededFrames;
+
+    UINT numTaps = resampler->numTaps;
+    UINT pos = resampler->pos, phase = resampler->phase;
+    UINT outputFrames = 0;
+
+    while(pos+numTaps <= resampler->historyFrames && outputFrames < maxOutputFrames)
+    {
+        resampleFrame(resampler->history+(pos*2), resampler->coefs+(phase*numTaps*2), numTaps, output+(outputFrames*2));
+        outputFrames++;
+
+        phase += resampler->downFactor;
+        pos   += phase/resampler->upFactor;
+        phase %= resampler->upFactor;
+    }
+
+    //drop the frames no output needs any more
+    UINT usedFrames = MIN(pos, resampler->historyFrames);
+    resampler->historyFrames -= usedFrames;
+    if(resampler->historyFrames)
+        memmove(resampler->history, resampler->history+(usedFrames*2), resampler->historyFrames*2*sizeof(float));
+
+    resampler->pos   = pos-usedFrames;
+    resampler->phase = phase;
+
+    return outputFrames;
+}
+
+//--------------------------------------------------------------------------
+// runtime dispatch
+
+typedef void (*MIXAUDIOPROC)(float *bufferDest, float *bufferSrc, UINT totalFloats, bool bForceMono);
+typedef void (*MULTIPLYAUDIOPROC)(float *buffer, UINT totalFloats, float mulVal);
+typedef void (*SUMSQUARESPROC)(const float *buffer, UINT totalFloats, float mulVal, float &sum, float &peak);
+typedef void (*CONVERTAUDIOPROC)(float *output, const void *input, UINT totalSamples, UINT bitsPerSample);
+
+static MIXAUDIOPROC      mixAudio            = MixAudio_SSE2;
+static MULTIPLYAUDIOPROC multiplyAudioBuffer = MultiplyAudioBuffer_SSE2;
+static SUMSQUARESPROC    sumSquares          = SumSquares_SSE2;
+static CONVERTAUDIOPROC  convertAudioToFloat = ConvertAudioToFloat_SSE2;
+
+//cpuInfo is cpuid leaf 1.  lpForce can be "SSE2" or "AVX" to force a lower variant for testing
+void InitAudioKernels(const int *cpuInfo, CTSTR lpForce)
+{
+    bool bAVX = false, bAVX2 = false;
+
+    //AVX, and the OS has to save the ymm registers
+    if((cpuInfo[2] & (1<<27)) && (cpuInfo[2] & (1<<28)) && (_xgetbv(0) & 6) == 6)
+    {
+        bAVX = !lpForce || scmpi(lpForce, TEXT("SSE2")) != 0;
+
+        int extInfo[4];
+        __cpuid(extInfo, 0);
+        if(bAVX && extInfo[0] >= 7)
+        {
+            __cpuidex(extInfo, 7, 0);
+            bAVX2 = (extInfo[1] & (1<<5)) != 0 && (!lpForce || scmpi(lpForce, TEXT("AVX")) != 0);
+        }
+    }
+
+    mixAudio            = bAVX  ? MixAudio_AVX               : MixAudio_SSE2;
+    multiplyAudioBuffer = bAVX  ? MultiplyAudioBuffer_AVX    : MultiplyAudioBuffer_SSE2;
+    sumSquares          = bAVX  ? SumSquares_AVX             : SumSquares_SSE2;
+    convertAudioToFloat = bAVX2 ? ConvertAudioToFloat_AVX2   : ConvertAudioToFloat_SSE2;
+    resampleFrame       = bAVX  ? ResampleFrame_AVX          : ResampleFrame_SSE2;
+
+    Log(TEXT("Using %s audio kernels"), bAVX2 ? TEXT("AVX2") : (bAVX ? TEXT("AVX") : TEXT("SSE2")));
+}
+
+void MixAudio(float *bufferDest, float *bufferSrc, UINT totalFloats, bool bForceMono)
+{
+    mixAudio(bufferDest, bufferSrc, totalFloats, bForceMono);
+}
+
+void MultiplyAudioBuffer(float *buffer, UINT totalFloats, float mulVal)
+{
+    multiplyAudioBuffer(buffer, totalFloats, mulVal);
+}
+
+void CalculateVolumeLevels(const float *buffer, UINT totalFloats, float mulVal, float &RMS, float &peak)
+{
+    float sum = 0.0f, peakSquared = 0.0f;
+
+    if(totalFloats)
+        sumSquares(buffer, totalFloats, mulVal, sum, peakSquared);
+
+    RMS  = totalFloats ? sqrt(sum / totalFloats) : 0.0f;
+    peak = sqrt(peakSquared);
+}
+
+void ConvertAudioToFloat(float *output, const void *input, UINT totalSamples, UINT bitsPerSample)
+{
+    convertAudioToFloat(output, input, totalSamples, bitsPerSample);
+}
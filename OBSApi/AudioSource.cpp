@@ -26,35 +26,151 @@
 #define KSAUDIO_SPEAKER_2POINT1     (KSAUDIO_SPEAKER_STEREO|SPEAKER_LOW_FREQUENCY)
 
 
-void MultiplyAudioBuffer(float *buffer, int totalFloats, float mulVal)
+//extra time queued on top of the scene buffering time before the queue has to grow
+#define AUDIO_QUEUE_HEADROOM_MS 500
+
+//fixed-capacity queue of 10ms audio segments.  slots keep their sample storage between uses, so
+//once the queue is set up, queueing and dequeueing audio doesn't touch the heap
+class AudioSegmentQueue
 {
-    float sum = 0.0f;
-    int totalFloatsStore = totalFloats;
+    struct Slot
+    {
+        AudioSegment segment;
+        UINT capacity;      //floats allocated behind the segment's data
+    };
+
+    List<Slot> slots;
+    UINT start, count;
+    UINT slotFloats;
+
+    inline Slot& GetSlot(UINT index)
+    {
+        assert(index < count);
+        UINT pos = start+index;
+        if(pos >= slots.Num())
+            pos -= slots.Num();
+        return slots[pos];
+    }
 
-    if((UPARAM(buffer) & 0xF) == 0)
+    //the list's num is moved around by hand so the allocation can stay bigger than the data
+    static void SetSlotData(Slot &slot, const float *data, UINT numFloats)
     {
-        UINT alignedFloats = totalFloats & 0xFFFFFFFC;
-        __m128 sseMulVal = _mm_set_ps1(mulVal);
+        float *array;
+        UINT num;
+        slot.segment.audioData.TransferTo(array, num);
 
-        for(UINT i=0; i<alignedFloats; i += 4)
+        if(!array || numFloats > slot.capacity)
         {
-            __m128 sseScaledVals = _mm_mul_ps(_mm_load_ps(buffer+i), sseMulVal);
-            _mm_store_ps(buffer+i, sseScaledVals);
+            slot.capacity = MAX(numFloats, 1);
+            array = (float*)ReAllocate(array, slot.capacity*sizeof(float));
         }
 
-        buffer      += alignedFloats;
-        totalFloats -= alignedFloats;
+        if(data && numFloats)
+            mcpy(array, data, numFloats*sizeof(float));
+
+        slot.segment.audioData.TransferFrom(array, numFloats);
     }
 
-    for(int i=0; i<totalFloats; i++)
-        buffer[i] *= mulVal;
-}
+public:
+    inline AudioSegmentQueue() : start(0), count(0), slotFloats(0) {}
+    inline ~AudioSegmentQueue() {Free();}
+
+    inline UINT Num() const {return count;}
+
+    inline AudioSegment& operator[](UINT index) {return GetSlot(index).segment;}
+
+    inline AudioSegment& First() {return GetSlot(0).segment;}
+    inline AudioSegment& Last()  {return GetSlot(count-1).segment;}
+
+    void Reserve(UINT capacity, UINT floatsPerSlot)
+    {
+        if(floatsPerSlot > slotFloats)
+            slotFloats = floatsPerSlot;
+
+        if(capacity > slots.Num())
+        {
+            //lists are moved as-is, so the segments are laid out again in order starting at 0
+            List<Slot> newSlots;
+            newSlots.SetSize(capacity);
+
+            for(UINT i=0; i<slots.Num(); i++)
+            {
+                UINT pos = start+i;
+                if(pos >= slots.Num())
+                    pos -= slots.Num();
+                mcpy(newSlots+i, slots+pos, sizeof(Slot));
+            }
+
+            slots.Clear();
+            slots.TransferFrom(newSlots);
+            start = 0;
+        }
+
+        for(UINT i=0; i<slots.Num(); i++)
+        {
+            Slot &slot = slots[i];
+            if(slot.capacity < slotFloats)
+            {
+                float *array;
+                UINT num;
+                slot.segment.audioData.TransferTo(array, num);
+
+                array = (float*)ReAllocate(array, slotFloats*sizeof(float));
+                slot.capacity = slotFloats;
+
+                slot.segment.audioData.TransferFrom(array, num);
+            }
+        }
+    }
+
+    AudioSegment& Push(const float *data, UINT numFloats, QWORD timestamp)
+    {
+        if(count == slots.Num())
+        {
+            if(slots.Num())
+                Log(TEXT("AudioSegmentQueue: queue full at %u segments, growing"), slots.Num());
+            Reserve(MAX(slots.Num()*2, 16), slotFloats);
+        }
+
+        ++count;
+        Slot &slot = GetSlot(count-1);
+        SetSlotData(slot, data, numFloats);
+        slot.segment.timestamp = timestamp;
+        return slot.segment;
+    }
+
+    inline void PopFront()
+    {
+        assert(count);
+        if(++start == slots.Num())
+            start = 0;
+        --count;
+    }
+
+    inline void Clear()
+    {
+        start = count = 0;
+    }
+
+    void Free()
+    {
+        Clear();
+        for(UINT i=0; i<slots.Num(); i++)
+            slots[i].segment.ClearData();
+        slots.Clear();
+    }
+};
 
 /* astoundingly disgusting hack to get more variables into the class without breaking API */
 struct NotAResampler
 {
     SRC_STATE *resampler;
     QWORD     jumpRange;
+
+    PolyphaseResampler *polyphase;  //used instead of libsamplerate when the rates have a simple ratio
+
+    AudioSegmentQueue segments;
+    AudioSegment *filterSegment;    //heap segment handed to the filters, kept while they give it back
 };
 
 #define MoreVariables static_cast<NotAResampler*>(resampler)
@@ -66,29 +182,31 @@ AudioSource::AudioSource()
     MoreVariables->jumpRange = 70;
 }
 
-AudioSource::~AudioSource()
+void AudioSource::FreeResampler()
 {
     if(bResample)
-        src_delete(MoreVariables->resampler);
+    {
+        if(MoreVariables->polyphase)
+            DestroyPolyphaseResampler(MoreVariables->polyphase);
+        else
+            src_delete(MoreVariables->resampler);
+
+        MoreVariables->polyphase = NULL;
+        MoreVariables->resampler = NULL;
+        bResample = false;
+    }
+}
+
+AudioSource::~AudioSource()
+{
+    FreeResampler();
 
-    for(UINT i=0; i<audioSegments.Num(); i++)
-        delete audioSegments[i];
+    delete MoreVariables->filterSegment;
 
     delete (NotAResampler*)resampler;
 }
 
 
-union TripleToLong
-{
-    LONG val;
-    struct 
-    {
-        WORD wVal;
-        BYTE tripleVal;
-        BYTE lastByte;
-    };
-};
-
 void AudioSource::InitAudioData(bool bFloat, UINT channels, UINT samplesPerSec, UINT bitsPerSample, UINT blockSize, DWORD channelMask)
 {
     this->bFloat = bFloat;
@@ -102,7 +220,24 @@ void AudioSource::InitAudioData(bool bFloat, UINT channels, UINT samplesPerSec,
 
     UINT sampleRateHz = OBSGetSampleRateHz();
 
+    //devices call this again when they're reacquired, possibly at a different rate
+    FreeResampler();
+
+    //enough 10ms segments for the scene buffering plus some slack, each with room for the
+    //extra frame the resampler can produce
+    UINT numSegments = (OBSGetSceneBufferingTime()+AUDIO_QUEUE_HEADROOM_MS)/10;
+    MoreVariables->segments.Reserve(numSegments, (sampleRateHz/100+2)*2);
+
     if(inputSamplesPerSec != sampleRateHz)
+    {
+        resampleRatio = double(sampleRateHz) / double(inputSamplesPerSec);
+        bResample = true;
+
+        //the usual rates (44.1k/48k and multiples) have a simple ratio and get the polyphase resampler
+        MoreVariables->polyphase = CreatePolyphaseResampler(inputSamplesPerSec, sampleRateHz);
+    }
+
+    if(bResample && !MoreVariables->polyphase)
     {
         int errVal;
 
@@ -111,9 +246,6 @@ void AudioSource::InitAudioData(bool bFloat, UINT channels, UINT samplesPerSec,
         if(!MoreVariables->resampler)
             CrashError(TEXT("AudioSource::InitAudioData: Could not initiate resampler"));
 
-        resampleRatio = double(sampleRateHz) / double(inputSamplesPerSec);
-        bResample = true;
-
         //----------------------------------------------------
         // hack to get rid of that weird first quirky resampled packet size
 
@@ -179,25 +311,29 @@ void AudioSource::InitAudioData(bool bFloat, UINT channels, UINT samplesPerSec,
 }
 
 
-const float dbMinus3    = 0.7071067811865476f;
-const float dbMinus6    = 0.5f;
-const float dbMinus9    = 0.3535533905932738f;
+void AudioSource::AddAudioSegment(float *data, UINT numFloats, QWORD timestamp, float curVolume)
+{
+    NotAResampler *vars = MoreVariables;
 
-//not entirely sure if these are the correct coefficients for downmixing,
-//I'm fairly new to the whole multi speaker thing
-const float surroundMix = dbMinus3;
-const float centerMix   = dbMinus6;
-const float lowFreqMix  = dbMinus3;
+    if (!audioFilters.Num())
+    {
+        AudioSegment &segment = vars->segments.Push(data, numFloats, timestamp);
+        MultiplyAudioBuffer(segment.audioData.Array(), segment.audioData.Num(), curVolume*sourceVolume);
+        return;
+    }
 
-const float surroundMix4 = dbMinus6;
+    //filters get a heap segment the same as always: they're free to delete it and return a new
+    //one or NULL.  whatever comes back out belongs to the source and is used for the next segment
+    AudioSegment *newSegment = vars->filterSegment;
+    vars->filterSegment = NULL;
 
-const float attn5dot1 = 1.0f / (1.0f + centerMix + surroundMix);
-const float attn4dotX = 1.0f / (1.0f + surroundMix4);
+    if (!newSegment)
+        newSegment = new AudioSegment;
 
-void AudioSource::AddAudioSegment(AudioSegment *newSegment, float curVolume)
-{
-    if (newSegment)
-        MultiplyAudioBuffer(newSegment->audioData.Array(), newSegment->audioData.Num(), curVolume*sourceVolume);
+    newSegment->audioData.CopyArray(data, numFloats);
+    newSegment->timestamp = timestamp;
+
+    MultiplyAudioBuffer(newSegment->audioData.Array(), newSegment->audioData.Num(), curVolume*sourceVolume);
 
     for (UINT i=0; i<audioFilters.Num(); i++)
     {
@@ -206,23 +342,27 @@ void AudioSource::AddAudioSegment(AudioSegment *newSegment, float curVolume)
     }
 
     if (newSegment)
-        audioSegments << newSegment;
+    {
+        vars->segments.Push(newSegment->audioData.Array(), newSegment->audioData.Num(), newSegment->timestamp);
+        vars->filterSegment = newSegment;
+    }
 }
 
 //  Used to sort sort audio in case from back->front in case of burst (this shouldn't be
 //necessary but a necessary thing for the current audio system)
 void AudioSource::SortAudio(QWORD timestamp)
 {
+    AudioSegmentQueue &segments = MoreVariables->segments;
     QWORD jumpAmount = 0;
 
-    if (audioSegments.Num() <= 1)
+    if (segments.Num() <= 1)
         return;
 
-    lastUsedTimestamp = lastSentTimestamp = audioSegments.Last()->timestamp = timestamp;
+    lastUsedTimestamp = lastSentTimestamp = segments.Last().timestamp = timestamp;
 
-    for (UINT i = audioSegments.Num()-1; i > 0; i--)
+    for (UINT i = segments.Num()-1; i > 0; i--)
     {
-        AudioSegment *segment = audioSegments[i-1];
+        AudioSegment *segment = &segments[i-1];
         UINT frames = segment->audioData.Num()/2;
         double totalTime = double(frames)/double(OBSGetSampleRateHz())*1000.0;
         QWORD newTime = timestamp - QWORD(totalTime);
@@ -273,56 +413,7 @@ UINT AudioSource::QueryAudio2(float curVolume, bool bCanBurstHack)
             if(convertBuffer.Num() < totalSamples)
                 convertBuffer.SetSize(totalSamples);
 
-            if(inputBitsPerSample == 8)
-            {
-                float *tempConvert = convertBuffer.Array();
-                char *tempSByte = (char*)buffer;
-
-                while(totalSamples--)
-                {
-                    *(tempConvert++) = float(*(tempSByte++))/127.0f;
-                }
-            }
-            else if(inputBitsPerSample == 16)
-            {
-                float *tempConvert = convertBuffer.Array();
-                short *tempShort = (short*)buffer;
-
-                while(totalSamples--)
-                {
-                    *(tempConvert++) = float(*(tempShort++))/32767.0f;
-                }
-            }
-            else if(inputBitsPerSample == 24)
-            {
-                float *tempConvert = convertBuffer.Array();
-                BYTE *tempTriple = (BYTE*)buffer;
-                TripleToLong valOut;
-
-                while(totalSamples--)
-                {
-                    TripleToLong &valIn  = (TripleToLong&)tempTriple;
-
-                    valOut.wVal = valIn.wVal;
-                    valOut.tripleVal = valIn.tripleVal;
-                    if(valOut.tripleVal > 0x7F)
-                        valOut.lastByte = 0xFF;
-
-                    *(tempConvert++) = float(double(valOut.val)/8388607.0);
-                    tempTriple += 3;
-                }
-            }
-            else if(inputBitsPerSample == 32)
-            {
-                float *tempConvert = convertBuffer.Array();
-                long *tempShort = (long*)buffer;
-
-                while(totalSamples--)
-                {
-                    *(tempConvert++) = float(double(*(tempShort++))/2147483647.0);
-                }
-            }
-
+            ConvertAudioToFloat(convertBuffer.Array(), buffer, totalSamples, inputBitsPerSample);
             captureBuffer = convertBuffer.Array();
         }
         else
@@ -334,269 +425,7 @@ UINT AudioSource::QueryAudio2(float curVolume, bool bCanBurstHack)
         if(tempBuffer.Num() < numAudioFrames*2)
             tempBuffer.SetSize(numAudioFrames*2);
 
-        float *dataOutputBuffer = tempBuffer.Array();
-        float *tempOut = dataOutputBuffer;
-
-        if(inputChannels == 1)
-        {
-            UINT  numFloats   = numAudioFrames;
-            float *inputTemp  = (float*)captureBuffer;
-            float *outputTemp = dataOutputBuffer;
-
-            if((UPARAM(inputTemp) & 0xF) == 0 && (UPARAM(outputTemp) & 0xF) == 0)
-            {
-                UINT alignedFloats = numFloats & 0xFFFFFFFC;
-                for(UINT i=0; i<alignedFloats; i += 4)
-                {
-                    __m128 inVal   = _mm_load_ps(inputTemp+i);
-
-                    __m128 outVal1 = _mm_unpacklo_ps(inVal, inVal);
-                    __m128 outVal2 = _mm_unpackhi_ps(inVal, inVal);
-
-                    _mm_store_ps(outputTemp+(i*2),   outVal1);
-                    _mm_store_ps(outputTemp+(i*2)+4, outVal2);
-                }
-
-                numFloats  -= alignedFloats;
-                inputTemp  += alignedFloats;
-                outputTemp += alignedFloats*2;
-            }
-
-            while(numFloats--)
-            {
-                float inputVal = *inputTemp;
-                *(outputTemp++) = inputVal;
-                *(outputTemp++) = inputVal;
-
-                inputTemp++;
-            }
-        }
-        else if(inputChannels == 2) //straight up copy
-        {
-            memcpy(dataOutputBuffer, captureBuffer, numAudioFrames*2*sizeof(float));
-        }
-        else
-        {
-            //todo: downmix optimization, also support for other speaker configurations than ones I can merely "think" of.  ugh.
-            float *inputTemp  = (float*)captureBuffer;
-            float *outputTemp = dataOutputBuffer;
-
-            if(inputChannelMask == KSAUDIO_SPEAKER_QUAD)
-            {
-                UINT numFloats = numAudioFrames*4;
-                float *endTemp = inputTemp+numFloats;
-
-                while(inputTemp < endTemp)
-                {
-                    float left      = inputTemp[0];
-                    float right     = inputTemp[1];
-                    float rearLeft  = inputTemp[2]*surroundMix4;
-                    float rearRight = inputTemp[3]*surroundMix4;
-
-                    // When in doubt, use only left and right .... and rear left and rear right :) 
-                    // Same idea as with 5.1 downmix
-
-                    *(outputTemp++) = (left  + rearLeft)  * attn4dotX;
-                    *(outputTemp++) = (right + rearRight) * attn4dotX;
-
-                    inputTemp  += 4;
-                }
-            }
-            else if(inputChannelMask == KSAUDIO_SPEAKER_2POINT1)
-            {
-                UINT numFloats = numAudioFrames*3;
-                float *endTemp = inputTemp+numFloats;
-
-                while(inputTemp < endTemp)
-                {
-                    float left      = inputTemp[0];
-                    float right     = inputTemp[1];
-                   
-                    // Drop LFE since we don't need it
-                    //float lfe       = inputTemp[2]*lowFreqMix;
-
-                    *(outputTemp++) = left;
-                    *(outputTemp++) = right;
-
-                    inputTemp  += 3;
-                }
-            }
-            else if(inputChannelMask == KSAUDIO_SPEAKER_3POINT1)
-            {
-                UINT numFloats = numAudioFrames*4;
-                float *endTemp = inputTemp+numFloats;
-
-                while(inputTemp < endTemp)
-                {
-                    float left          = inputTemp[0];
-                    float right         = inputTemp[1];
-                    float frontCenter   = inputTemp[2];
-                    float lowFreq       = inputTemp[3];
-
-                    *(outputTemp++) = left;
-                    *(outputTemp++) = right;
-
-                    inputTemp  += 4;
-                }
-            }
-            else if(inputChannelMask == KSAUDIO_SPEAKER_4POINT1)
-            {
-                UINT numFloats = numAudioFrames*5;
-                float *endTemp = inputTemp+numFloats;
-
-                while(inputTemp < endTemp)
-                {
-                    float left      = inputTemp[0];
-                    float right     = inputTemp[1];
-
-                    // Skip LFE , we don't really need it.
-                    //float lfe       = inputTemp[2];
-
-                    float rearLeft  = inputTemp[3]*surroundMix4;
-                    float rearRight = inputTemp[4]*surroundMix4;
-
-                    // Same idea as with 5.1 downmix
-
-                    *(outputTemp++) = (left  + rearLeft)  * attn4dotX;
-                    *(outputTemp++) = (right + rearRight) * attn4dotX;
-
-                    inputTemp  += 5;
-                }
-            }
-            else if(inputChannelMask == KSAUDIO_SPEAKER_SURROUND)
-            {
-                UINT numFloats = numAudioFrames*4;
-                float *endTemp = inputTemp+numFloats;
-
-                while(inputTemp < endTemp)
-                {
-                    float left      = inputTemp[0];
-                    float right     = inputTemp[1];
-                    float frontCenter    = inputTemp[2];
-                    float rearCenter     = inputTemp[3];
-                    
-                    // When in doubt, use only left and right :) Seriously.
-                    // THIS NEEDS TO BE PROPERLY IMPLEMENTED!
-
-                    *(outputTemp++) = left;
-                    *(outputTemp++) = right;
-
-                    inputTemp  += 4;
-                }
-            }
-            // Both speakers configs share the same format, the difference is in rear speakers position 
-            // See: http://msdn.microsoft.com/en-us/library/windows/hardware/ff537083(v=vs.85).aspx
-            // Probably for KSAUDIO_SPEAKER_5POINT1_SURROUND we will need a different coefficient for rear left/right
-            else if(inputChannelMask == KSAUDIO_SPEAKER_5POINT1 || inputChannelMask == KSAUDIO_SPEAKER_5POINT1_SURROUND)
-            {
-                UINT numFloats = numAudioFrames*6;
-                float *endTemp = inputTemp+numFloats;
-
-                while(inputTemp < endTemp)
-                {
-                    float left      = inputTemp[0];
-                    float right     = inputTemp[1];
-                    float center    = inputTemp[2]*centerMix;
-                    
-                    //We don't need LFE channel so skip it (see below)
-                    //float lowFreq   = inputTemp[3]*lowFreqMix;
-                    
-                    float rearLeft  = inputTemp[4]*surroundMix;
-                    float rearRight = inputTemp[5]*surroundMix;
-                    
-                    // According to ITU-R  BS.775-1 recommendation, the downmix from a 3/2 source to stereo
-                    // is the following:
-                    // L = FL + k0*C + k1*RL
-                    // R = FR + k0*C + k1*RR
-                    // FL = front left
-                    // FR = front right
-                    // C  = center
-                    // RL = rear left
-                    // RR = rear right
-                    // k0 = centerMix   = dbMinus3 = 0.7071067811865476 [for k0 we can use dbMinus6 = 0.5 too, probably it's better]
-                    // k1 = surroundMix = dbMinus3 = 0.7071067811865476
-
-                    // The output (L,R) can be out of (-1,1) domain so we attenuate it [ attn5dot1 = 1/(1 + centerMix + surroundMix) ]
-                    // Note: this method of downmixing is far from "perfect" (pretty sure it's not the correct way) but the resulting downmix is "okayish", at least no more bleeding ears.
-                    // (maybe have a look at http://forum.doom9.org/archive/index.php/t-148228.html too [ 5.1 -> stereo ] the approach seems almost the same [but different coefficients])
-
-                    
-                    // http://acousticsfreq.com/blog/wp-content/uploads/2012/01/ITU-R-BS775-1.pdf
-                    // http://ir.lib.nctu.edu.tw/bitstream/987654321/22934/1/030104001.pdf
-
-                    *(outputTemp++) = (left  + center  + rearLeft) * attn5dot1;
-                    *(outputTemp++) = (right + center  + rearRight) * attn5dot1;
-
-                    inputTemp  += 6;
-                }
-            }
-
-            // According to http://msdn.microsoft.com/en-us/library/windows/hardware/ff537083(v=vs.85).aspx
-            // KSAUDIO_SPEAKER_7POINT1 is obsolete and no longer supported in Windows Vista and later versions of Windows
-            // Not sure what to do about it, meh , drop front left of center/front right of center -> 5.1 -> stereo; 
-
-            else if(inputChannelMask == KSAUDIO_SPEAKER_7POINT1)
-            {
-                UINT numFloats = numAudioFrames*8;
-                float *endTemp = inputTemp+numFloats;
-
-                while(inputTemp < endTemp)
-                {
-                    float left          = inputTemp[0];
-                    float right         = inputTemp[1];
-                    
-                    float center        = inputTemp[2] * centerMix;
-                    
-                    // Drop LFE since we don't need it
-                    //float lowFreq       = inputTemp[3]*lowFreqMix;
-                    
-                    float rearLeft      = inputTemp[4] * surroundMix;
-                    float rearRight     = inputTemp[5] * surroundMix;
-
-                    // Drop SPEAKER_FRONT_LEFT_OF_CENTER , SPEAKER_FRONT_RIGHT_OF_CENTER
-                    //float centerLeft    = inputTemp[6];
-                    //float centerRight   = inputTemp[7];
-                    
-                    // Downmix from 5.1 to stereo
-                    *(outputTemp++) = (left  + center  + rearLeft)  * attn5dot1;
-                    *(outputTemp++) = (right + center  + rearRight) * attn5dot1;
-
-                    inputTemp  += 8;
-                }
-            }
-
-            // Downmix to 5.1 (easy stuff) then downmix to stereo as done in KSAUDIO_SPEAKER_5POINT1
-            else if(inputChannelMask == KSAUDIO_SPEAKER_7POINT1_SURROUND)
-            {
-                UINT numFloats = numAudioFrames*8;
-                float *endTemp = inputTemp+numFloats;
-
-                while(inputTemp < endTemp)
-                {
-                    float left      = inputTemp[0];
-                    float right     = inputTemp[1];
-                    float center    = inputTemp[2] * centerMix;
-
-                    // Skip LFE we don't need it
-                    //float lowFreq   = inputTemp[3]*lowFreqMix;
-
-                    float rearLeft  = inputTemp[4];
-                    float rearRight = inputTemp[5];
-                    float sideLeft  = inputTemp[6];
-                    float sideRight = inputTemp[7];
-
-                    // combine the rear/side channels first , baaam! 5.1
-                    rearLeft  = (rearLeft  + sideLeft)  * 0.5f;
-                    rearRight = (rearRight + sideRight) * 0.5f;
-
-                    // downmix to stereo as in 5.1 case
-                    *(outputTemp++) = (left  + center + rearLeft  * surroundMix) * attn5dot1;
-                    *(outputTemp++) = (right + center + rearRight * surroundMix) * attn5dot1;
-
-                    inputTemp  += 8;
-                }
-            }
-        }
+        DownmixAudioToStereo(tempBuffer.Array(), captureBuffer, numAudioFrames, inputChannels, inputChannelMask);
 
         ReleaseBuffer();
 
@@ -611,31 +440,36 @@ UINT AudioSource::QueryAudio2(float curVolume, bool bCanBurstHack)
             if(tempResampleBuffer.Num() < newFrameSize)
                 tempResampleBuffer.SetSize(newFrameSize);
 
-            SRC_DATA data;
-            data.src_ratio = resampleRatio;
+            if(MoreVariables->polyphase)
+                numAudioFrames = PolyphaseResample(MoreVariables->polyphase, tempBuffer.Array(), numAudioFrames, tempResampleBuffer.Array(), frameAdjust);
+            else
+            {
+                SRC_DATA data;
+                data.src_ratio = resampleRatio;
 
-            data.data_in = tempBuffer.Array();
-            data.input_frames = numAudioFrames;
+                data.data_in = tempBuffer.Array();
+                data.input_frames = numAudioFrames;
 
-            data.data_out = tempResampleBuffer.Array();
-            data.output_frames = frameAdjust;
+                data.data_out = tempResampleBuffer.Array();
+                data.output_frames = frameAdjust;
 
-            data.end_of_input = 0;
+                data.end_of_input = 0;
 
-            int err = src_process(MoreVariables->resampler, &data);
-            if(err)
-            {
-                RUNONCE AppWarning(TEXT("AudioSource::QueryAudio: Was unable to resample audio for device '%s'"), GetDeviceName());
-                return NoAudioAvailable;
-            }
+                int err = src_process(MoreVariables->resampler, &data);
+                if(err)
+                {
+                    RUNONCE AppWarning(TEXT("AudioSource::QueryAudio: Was unable to resample audio for device '%s'"), GetDeviceName());
+                    return NoAudioAvailable;
+                }
 
-            if(data.input_frames_used != numAudioFrames)
-            {
-                RUNONCE AppWarning(TEXT("AudioSource::QueryAudio: Failed to downsample buffer completely, which shouldn't actually happen because it should be using 10ms of samples"));
-                return NoAudioAvailable;
-            }
+                if(data.input_frames_used != numAudioFrames)
+                {
+                    RUNONCE AppWarning(TEXT("AudioSource::QueryAudio: Failed to downsample buffer completely, which shouldn't actually happen because it should be using 10ms of samples"));
+                    return NoAudioAvailable;
+                }
 
-            numAudioFrames = data.output_frames_gen;
+                numAudioFrames = data.output_frames_gen;
+            }
         }
 
         //------------------------------------------------------
@@ -673,8 +507,7 @@ UINT AudioSource::QueryAudio2(float curVolume, bool bCanBurstHack)
         bool overshotAudio = (lastUsedTimestamp < lastSentTimestamp+10);
         if (bCanBurstHack || !overshotAudio)
         {
-            AudioSegment *newSegment = new AudioSegment(newBuffer, numAudioFrames*2, lastUsedTimestamp);
-            AddAudioSegment(newSegment, curVolume*sourceVolume);
+            AddAudioSegment(newBuffer, numAudioFrames*2, lastUsedTimestamp, curVolume*sourceVolume);
             lastSentTimestamp = lastUsedTimestamp;
         }
 
@@ -688,9 +521,11 @@ UINT AudioSource::QueryAudio2(float curVolume, bool bCanBurstHack)
 
 bool AudioSource::GetEarliestTimestamp(QWORD &timestamp)
 {
-    if(audioSegments.Num())
+    AudioSegmentQueue &segments = MoreVariables->segments;
+
+    if(segments.Num())
     {
-        timestamp = audioSegments[0]->timestamp;
+        timestamp = segments.First().timestamp;
         return true;
     }
 
@@ -699,9 +534,11 @@ bool AudioSource::GetEarliestTimestamp(QWORD &timestamp)
 
 bool AudioSource::GetLatestTimestamp(QWORD &timestamp)
 {
-    if(audioSegments.Num())
+    AudioSegmentQueue &segments = MoreVariables->segments;
+
+    if(segments.Num())
     {
-        timestamp = audioSegments.Last()->timestamp;
+        timestamp = segments.Last().timestamp;
         return true;
     }
 
@@ -710,18 +547,23 @@ bool AudioSource::GetLatestTimestamp(QWORD &timestamp)
 
 bool AudioSource::GetBuffer(float **buffer, QWORD targetTimestamp)
 {
+    AudioSegmentQueue &segments = MoreVariables->segments;
+
     bool bSuccess = false;
     bool bDeleted = false;
-    outputBuffer.Clear();
+
+    //only allocates on the first call
+    UINT outputFloats = OBSGetSampleRateHz()/100*2;
+    outputBuffer.SetSize(outputFloats);
 
     bool bReportedOnce = false;
 
-    while(audioSegments.Num())
+    while(segments.Num())
     {
-        if(audioSegments[0]->timestamp < targetTimestamp)
+        if(segments.First().timestamp < targetTimestamp)
         {
-            QWORD diff = targetTimestamp-audioSegments[0]->timestamp;
-            //OSDebugOut(TEXT("Off by %llu\n"), targetTimestamp-audioSegments[0]->timestamp);
+            QWORD diff = targetTimestamp-segments.First().timestamp;
+            //OSDebugOut(TEXT("Off by %llu\n"), targetTimestamp-segments.First().timestamp);
             if (!bReportedOnce) {
                 Log(TEXT("Audio timestamp for device '%s' was behind target timestamp by %llu"),
                         GetDeviceName(), diff);
@@ -729,21 +571,7 @@ bool AudioSource::GetBuffer(float **buffer, QWORD targetTimestamp)
                 bReportedOnce = true;
             }
 
-            /*if (!bReportedOnce && diff > 150) {
-                for (UINT i = 0; i < audioSegments.Num(); i++)
-                    Log(L"    %llu", audioSegments[i]->timestamp);
-
-                bReportedOnce = true;
-            }*/
-
-            /*OSDebugOut(L"targetTimestamp: %llu\n", targetTimestamp);
-            for (UINT i = 0; i < audioSegments.Num(); i++)
-            {
-                OSDebugOut(L"%llu\n", audioSegments[i]->timestamp);
-            }*/
-
-            delete audioSegments[0];
-            audioSegments.Remove(0);
+            segments.PopFront();
 
             bDeleted = true;
         }
@@ -751,26 +579,27 @@ bool AudioSource::GetBuffer(float **buffer, QWORD targetTimestamp)
             break;
     }
 
-    if(audioSegments.Num())
+    if(segments.Num())
     {
-        bool bUseSegment = false;
+        AudioSegment &segment = segments.First();
 
-        AudioSegment *segment = audioSegments[0];
-
-        QWORD difference = (segment->timestamp-targetTimestamp);
+        QWORD difference = (segment.timestamp-targetTimestamp);
         if(bDeleted || difference <= 11)
         {
             //Log(TEXT("segment.timestamp: %llu, targetTimestamp: %llu"), segment.timestamp, targetTimestamp);
-            outputBuffer.TransferFrom(segment->audioData);
+            UINT numFloats = MIN(segment.audioData.Num(), outputFloats);
+            mcpy(outputBuffer.Array(), segment.audioData.Array(), numFloats*sizeof(float));
+            if(numFloats < outputFloats)
+                zero(outputBuffer+numFloats, (outputFloats-numFloats)*sizeof(float));
 
-            delete segment;
-            audioSegments.Remove(0);
+            segments.PopFront();
 
             bSuccess = true;
         }
     }
 
-    outputBuffer.SetSize(OBSGetSampleRateHz()/100*2);
+    if(!bSuccess)
+        zero(outputBuffer.Array(), outputFloats*sizeof(float));
 
     *buffer = outputBuffer.Array();
 
@@ -779,11 +608,13 @@ bool AudioSource::GetBuffer(float **buffer, QWORD targetTimestamp)
 
 bool AudioSource::GetNewestFrame(float **buffer)
 {
+    AudioSegmentQueue &segments = MoreVariables->segments;
+
     if(buffer)
     {
-        if(audioSegments.Num())
+        if(segments.Num())
         {
-            List<float> &data = audioSegments.Last()->audioData;
+            List<float> &data = segments.Last().audioData;
             *buffer = data.Array();
             return true;
         }
@@ -794,8 +625,10 @@ bool AudioSource::GetNewestFrame(float **buffer)
 
 QWORD AudioSource::GetBufferedTime()
 {
-    if(audioSegments.Num())
-        return audioSegments.Last()->timestamp - audioSegments[0]->timestamp;
+    AudioSegmentQueue &segments = MoreVariables->segments;
+
+    if(segments.Num())
+        return segments.Last().timestamp - segments.First().timestamp;
 
     return 0;
 }
@@ -31,6 +31,7 @@ struct AudioSegment
     List<float> audioData;
     QWORD timestamp;
 
+    inline AudioSegment() : timestamp(0) {}
     inline AudioSegment(float *data, UINT numFloats, QWORD timestamp) : timestamp(timestamp)
     {
         audioData.CopyArray(data, numFloats);
@@ -55,6 +56,7 @@ class BASE_EXPORT AudioSource
 
     //-----------------------------------------
 
+    //unused, queued segments live in NotAResampler so the class layout stays the same for plugins
     List<AudioSegment*> audioSegments;
 
     QWORD lastUsedTimestamp;
@@ -87,7 +89,8 @@ class BASE_EXPORT AudioSource
 
     //-----------------------------------------
 
-    void AddAudioSegment(AudioSegment *segment, float curVolume);
+    void AddAudioSegment(float *data, UINT numFloats, QWORD timestamp, float curVolume);
+    void FreeResampler();
 
 protected:
 
@@ -78,7 +78,19 @@ inline QWORD GetQWDif(QWORD val1, QWORD val2)
 BASE_EXPORT QWORD GetQPCTimeNS();
 BASE_EXPORT QWORD GetQPCTime100NS();
 BASE_EXPORT QWORD GetQPCTimeMS();
+//audio kernels, see AudioProcessing.cpp.  none of them need aligned buffers
+BASE_EXPORT void InitAudioKernels(const int *cpuInfo, CTSTR lpForce=NULL);
 BASE_EXPORT void MixAudio(float *bufferDest, float *bufferSrc, UINT totalFloats, bool bForceMono);
+BASE_EXPORT void MultiplyAudioBuffer(float *buffer, UINT totalFloats, float mulVal);
+BASE_EXPORT void CalculateVolumeLevels(const float *buffer, UINT totalFloats, float mulVal, float &RMS, float &peak);
+BASE_EXPORT void ConvertAudioToFloat(float *output, const void *input, UINT totalSamples, UINT bitsPerSample);
+BASE_EXPORT void DownmixAudioToStereo(float *output, const float *input, UINT numFrames, UINT channels, DWORD channelMask);
+
+//stereo fixed-ratio resampler, create returns NULL if the ratio between the rates is too complex
+struct PolyphaseResampler;
+BASE_EXPORT PolyphaseResampler* CreatePolyphaseResampler(UINT inputRate, UINT outputRate);
+BASE_EXPORT void DestroyPolyphaseResampler(PolyphaseResampler *resampler);
+BASE_EXPORT UINT PolyphaseResample(PolyphaseResampler *resampler, const float *input, UINT inputFrames, float *output, UINT maxOutputFrames);
 
 //-------------------------------------------
 
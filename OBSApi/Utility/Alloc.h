@@ -62,6 +62,10 @@ BASE_EXPORT extern   Alloc       *MainAllocator;
 BASE_EXPORT extern unsigned int  dwAllocCurLine;
 BASE_EXPORT extern TCHAR *       lpAllocCurFile;
 
+//allocations and reallocations made by the current thread, read by the profiler.
+//internal to OBSApi, thread-local variables can't be imported from a dll
+extern __declspec(thread) unsigned int dwThreadAllocCount;
+
 
 inline void Free(void *lpData)   {MainAllocator->_Free(lpData);}
 
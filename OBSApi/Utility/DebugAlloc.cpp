@@ -243,11 +243,13 @@ void DebugAlloc::_Free(LPVOID lpData)
 
 void* __restrict DefaultAlloc::_Allocate(size_t dwSize)
 {
+    ++dwThreadAllocCount;
     return _aligned_malloc(dwSize, 16);
 }
 
 void* DefaultAlloc::_ReAllocate(LPVOID lpData, size_t dwSize)
 {
+    ++dwThreadAllocCount;
     return (!lpData) ? _aligned_malloc(dwSize, 16) : _aligned_realloc(lpData, dwSize, 16);
 }
 
@@ -23,6 +23,8 @@
 
 
 
+__declspec(thread) unsigned int dwThreadAllocCount = 0;
+
 struct MemInfo;
 struct Pool;
 
@@ -139,6 +141,8 @@ void   FastAlloc::ErrorTermination()
 
 void * __restrict FastAlloc::_Allocate(size_t dwSize)
 {
+    ++dwThreadAllocCount;
+
     OSEnterMutex(hAllocationMutex);
 
     //assert(dwSize);
@@ -271,6 +275,8 @@ void * FastAlloc::_ReAllocate(LPVOID lpMemory, size_t dwSize)
         return NULL;
     }
 
+    ++dwThreadAllocCount;
+
     Pool *pool = &PoolList[PtrTo32(lpMemory)>>24][(PtrTo32(lpMemory)>>16)&0xFF];
 
     if(pool->meminfo)
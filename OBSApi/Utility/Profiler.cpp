@@ -65,6 +65,9 @@ struct BASE_EXPORT ProfileNodeInfo
           cpuTimeElapsed,
           lastCpuTimeElapsed;
 
+    QWORD totalAllocs;
+    DWORD lastAllocs;
+
     DWORD lastCall;
 
     ProfileNodeInfo *parent;
@@ -118,10 +121,12 @@ struct BASE_EXPORT ProfileNodeInfo
 
         if(avgPercentage >= minPercentage && fTimeTaken >= minTime)
         {
+            double avgAllocs = double(totalAllocs)/double(numCalls);
+
             if(Children.Num())
-                Log(TEXT("%s%s - [%.3g%%] [avg time: %g ms] [children: %.3g%%] [unaccounted: %.3g%%]"), lpIndent, lpName, avgPercentage, fTimeTaken, childPercentage, unaccountedPercentage);
+                Log(TEXT("%s%s - [%.3g%%] [avg time: %g ms] [children: %.3g%%] [unaccounted: %.3g%%] [avg allocs: %.3g]"), lpIndent, lpName, avgPercentage, fTimeTaken, childPercentage, unaccountedPercentage, avgAllocs);
             else
-                Log(TEXT("%s%s - [%.3g%%] [avg time: %g ms]"), lpIndent, lpName, avgPercentage, fTimeTaken);
+                Log(TEXT("%s%s - [%.3g%%] [avg time: %g ms] [avg allocs: %.3g]"), lpIndent, lpName, avgPercentage, fTimeTaken, avgAllocs);
         }
 
         for(unsigned int i=0; i<Children.Num(); i++)
@@ -171,7 +176,7 @@ struct BASE_EXPORT ProfileNodeInfo
 
         CTSTR lpIndent = indent == 0 ? TEXT("") : indentStr.Array();
 
-        Log(TEXT("%s%s - [time: %g ms (cpu time: %g ms)]"), lpIndent, lpName, MicroToMS((DWORD)lastTimeElapsed), MicroToMS((DWORD)lastCpuTimeElapsed));
+        Log(TEXT("%s%s - [time: %g ms (cpu time: %g ms)] [allocs: %u]"), lpIndent, lpName, MicroToMS((DWORD)lastTimeElapsed), MicroToMS((DWORD)lastCpuTimeElapsed), lastAllocs);
 
         for(unsigned int i=0; i<Children.Num(); i++)
             Children[i].dumpLastData(callNum, indent+1);
@@ -221,6 +226,8 @@ struct BASE_EXPORT ProfileNodeInfo
         lastTimeElapsed = info->lastTimeElapsed;
         cpuTimeElapsed += info->cpuTimeElapsed;
         lastCpuTimeElapsed = info->lastCpuTimeElapsed;
+        totalAllocs += info->totalAllocs;
+        lastAllocs = info->lastAllocs;
         numParallelCalls = info->numParallelCalls;
         for(UINT i = 0; i < info->Children.Num(); i++)
         {
@@ -339,6 +346,7 @@ ProfilerNode::ProfilerNode(CTSTR lpName, bool bSingularize) : lpName(nullptr), p
     this->lpName = lpName;
 
     startTime = OSGetTimeMicroseconds();
+    allocStartCount = dwThreadAllocCount;
 
     MonitorThread(OSGetCurrentThread());
 
@@ -362,6 +370,11 @@ ProfilerNode::~ProfilerNode()
             info->lastCpuTimeElapsed = cpuTime;
         }
         info->numParallelCalls = parallelCalls;
+
+        //counted before merging, so the profiler's own bookkeeping isn't included
+        DWORD allocs = dwThreadAllocCount-allocStartCount;
+        info->totalAllocs += allocs;
+        info->lastAllocs = allocs;
     }
 
     if(!bSingularNode)
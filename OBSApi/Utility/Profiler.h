@@ -29,6 +29,7 @@ class BASE_EXPORT ProfilerNode
     QWORD startTime,
           cpuStartTime;
     DWORD parallelCalls;
+    DWORD allocStartCount;
     HANDLE thread;
     ProfilerNode *parent;
     bool bSingularNode;
@@ -0,0 +1,315 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "XT.h"
+
+
+#define TASK_QUEUE_SIZE 1024 //per worker, must be a power of 2
+
+struct Task
+{
+    TaskGroup *group;
+    TASKPROC proc;
+    LPVOID param;
+    UINT start, end;
+};
+
+//the owning worker takes from the back, thieves take from the front
+struct TaskQueue
+{
+    HANDLE hMutex;
+    Task tasks[TASK_QUEUE_SIZE];
+    UINT head, tail;
+
+    bool Push(const Task &task)
+    {
+        OSEnterMutex(hMutex);
+        bool bSuccess = (tail-head) < TASK_QUEUE_SIZE;
+        if(bSuccess)
+            tasks[(tail++) & (TASK_QUEUE_SIZE-1)] = task;
+        OSLeaveMutex(hMutex);
+        return bSuccess;
+    }
+
+    bool Pop(Task &task)
+    {
+        OSEnterMutex(hMutex);
+        bool bSuccess = tail != head;
+        if(bSuccess)
+            task = tasks[(--tail) & (TASK_QUEUE_SIZE-1)];
+        OSLeaveMutex(hMutex);
+        return bSuccess;
+    }
+
+    bool Steal(Task &task)
+    {
+        OSEnterMutex(hMutex);
+        bool bSuccess = tail != head;
+        if(bSuccess)
+            task = tasks[(head++) & (TASK_QUEUE_SIZE-1)];
+        OSLeaveMutex(hMutex);
+        return bSuccess;
+    }
+
+    //takes any one of the group's tiles, the front tile is moved into the gap
+    bool StealFromGroup(TaskGroup *group, Task &task)
+    {
+        OSEnterMutex(hMutex);
+        bool bSuccess = false;
+        for(UINT pos=head; pos!=tail; pos++)
+        {
+            Task &queued = tasks[pos & (TASK_QUEUE_SIZE-1)];
+            if(queued.group == group)
+            {
+                task = queued;
+                queued = tasks[(head++) & (TASK_QUEUE_SIZE-1)];
+                bSuccess = true;
+                break;
+            }
+        }
+        OSLeaveMutex(hMutex);
+        return bSuccess;
+    }
+};
+
+class TaskPool
+{
+    struct WorkerData
+    {
+        TaskPool *pool;
+        UINT id;
+    };
+
+    UINT numWorkers;
+    HANDLE *hThreads;
+    WorkerData *workerData;
+    TaskQueue *queues;
+
+    HANDLE hWorkSemaphore;
+    volatile LONG nextQueue;
+    bool bExit;
+
+    static DWORD STDCALL WorkerThread(WorkerData *data)
+    {
+        TaskPool *pool = data->pool;
+
+        for(;;)
+        {
+            WaitForSingleObject(pool->hWorkSemaphore, INFINITE);
+            if(pool->bExit)
+                break;
+
+            //the semaphore count only says roughly how much work there is, so keep going until
+            //there's nothing left anywhere rather than taking one tile per wake
+            while(pool->RunTask(data->id));
+        }
+
+        return 0;
+    }
+
+    //TaskGroup::Wait can return as soon as numPending hits 0, and the group is often on the
+    //waiter's stack, so dropping the reference has to be the very last thing done with it
+    static inline void Execute(Task &task)
+    {
+        TaskGroup *group = task.group;
+
+        task.proc(task.param, task.start, task.end);
+
+        if(!InterlockedDecrement(&group->numPending))
+            SetEvent(group->hComplete);
+
+        InterlockedDecrement(&group->numRefs);
+    }
+
+public:
+    TaskPool(UINT numWorkers) : numWorkers(numWorkers), nextQueue(0), bExit(false)
+    {
+        hWorkSemaphore = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+
+        queues = (TaskQueue*)Allocate(sizeof(TaskQueue)*numWorkers);
+        zero(queues, sizeof(TaskQueue)*numWorkers);
+
+        workerData = (WorkerData*)Allocate(sizeof(WorkerData)*numWorkers);
+        hThreads = (HANDLE*)Allocate(sizeof(HANDLE)*numWorkers);
+
+        for(UINT i=0; i<numWorkers; i++)
+        {
+            queues[i].hMutex = OSCreateMutex();
+
+            workerData[i].pool = this;
+            workerData[i].id = i;
+            hThreads[i] = OSCreateThread((XTHREAD)WorkerThread, workerData+i);
+        }
+    }
+
+    ~TaskPool()
+    {
+        bExit = true;
+        ReleaseSemaphore(hWorkSemaphore, numWorkers, NULL);
+
+        for(UINT i=0; i<numWorkers; i++)
+        {
+            OSWaitForThread(hThreads[i], NULL);
+            OSCloseThread(hThreads[i]);
+            OSCloseMutex(queues[i].hMutex);
+        }
+
+        CloseHandle(hWorkSemaphore);
+
+        Free(hThreads);
+        Free(workerData);
+        Free(queues);
+    }
+
+    inline UINT NumWorkers() const {return numWorkers;}
+
+    void Submit(TaskGroup &group, TASKPROC proc, LPVOID param, UINT start, UINT end, UINT tileSize)
+    {
+        if(end <= start)
+            return;
+        if(!tileSize)
+            tileSize = 1;
+
+        UINT numTiles = (end-start+tileSize-1)/tileSize;
+        UINT numQueued = 0;
+
+        InterlockedExchangeAdd(&group.numRefs, numTiles);
+        InterlockedExchangeAdd(&group.numPending, numTiles);
+
+        Task task;
+        task.group = &group;
+        task.proc = proc;
+        task.param = param;
+
+        for(UINT pos=start; pos<end; pos+=tileSize)
+        {
+            task.start = pos;
+            task.end = MIN(pos+tileSize, end);
+
+            UINT queue = UINT(InterlockedIncrement(&nextQueue)) % numWorkers;
+            if(queues[queue].Push(task))
+                numQueued++;
+            else
+                Execute(task);
+        }
+
+        if(numQueued)
+            ReleaseSemaphore(hWorkSemaphore, numQueued, NULL);
+    }
+
+    //runs one tile, from the given worker's own queue if possible, otherwise stolen from another
+    bool RunTask(UINT id)
+    {
+        Task task;
+
+        if(id < numWorkers && queues[id].Pop(task))
+        {
+            Execute(task);
+            return true;
+        }
+
+        for(UINT i=0; i<numWorkers; i++)
+        {
+            UINT victim = (id+i+1) % numWorkers;
+            if(queues[victim].Steal(task))
+            {
+                Execute(task);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //runs one of the group's tiles from any queue.  a waiter only helps with its own work, so
+    //it can't get stuck in a long tile from some other group while its own are done
+    bool RunGroupTask(TaskGroup *group)
+    {
+        Task task;
+
+        for(UINT i=0; i<numWorkers; i++)
+        {
+            if(queues[i].StealFromGroup(group, task))
+            {
+                Execute(task);
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+
+static TaskPool *taskPool = NULL;
+
+static TaskPool* GetTaskPool()
+{
+    if(!taskPool)
+    {
+        TaskPool *newPool = new TaskPool(MAX(OSGetTotalCores()-2, 1));
+        if(InterlockedCompareExchangePointer((PVOID*)&taskPool, newPool, NULL) != NULL)
+            delete newPool;
+    }
+
+    return taskPool;
+}
+
+void STDCALL DestroyTaskPool()
+{
+    delete taskPool;
+    taskPool = NULL;
+}
+
+UINT STDCALL OSGetNumTaskThreads()
+{
+    return GetTaskPool()->NumWorkers();
+}
+
+//--------------------------------------------------------------------------
+
+TaskGroup::TaskGroup() : numPending(0), numRefs(0)
+{
+    hComplete = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+TaskGroup::~TaskGroup()
+{
+    Wait();
+    CloseHandle(hComplete);
+}
+
+void TaskGroup::Run(TASKPROC proc, LPVOID param, UINT start, UINT end, UINT tileSize)
+{
+    GetTaskPool()->Submit(*this, proc, param, start, end, tileSize);
+}
+
+void TaskGroup::Wait()
+{
+    //the event is auto-reset and can be left signalled by an earlier batch, so always recheck the count
+    while(numPending)
+    {
+        if(!GetTaskPool()->RunGroupTask(this))
+            WaitForSingleObject(hComplete, INFINITE);
+    }
+
+    //the worker that finished the last tile can still be setting the event
+    while(numRefs)
+        SwitchToThread();
+}
@@ -0,0 +1,51 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#pragma once
+
+
+//shared worker threads for splitting per-frame work (color conversion and the like) into
+//small row tiles.  tiles are spread over per-worker queues and idle workers steal from the
+//others, so a slow or busy core only holds up the tiles it's actually working on.
+
+typedef void (STDCALL *TASKPROC)(LPVOID param, UINT start, UINT end);
+
+class BASE_EXPORT TaskGroup
+{
+    friend class TaskPool;
+
+    volatile LONG numPending;   //tiles not finished yet
+    volatile LONG numRefs;      //tiles a worker may still touch the group for
+    HANDLE hComplete;
+
+public:
+    TaskGroup();
+    ~TaskGroup();
+
+    //splits [start, end) into tiles of tileSize and queues them.  param has to stay valid until Wait
+    void Run(TASKPROC proc, LPVOID param, UINT start, UINT end, UINT tileSize);
+
+    //helps with this group's queued tiles until everything run in it has finished.  once it
+    //returns no worker touches the group anymore, so it can be destroyed right after
+    void Wait();
+
+    inline bool IsComplete() const {return numPending == 0;}
+};
+
+BASE_EXPORT UINT STDCALL OSGetNumTaskThreads();
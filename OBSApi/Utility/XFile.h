@@ -252,7 +252,6 @@ public:
 
     inline QWORD GetTotalWritten() {return totalWritten;}
 
-private:
     void Flush()
     {
         if(bufferPos)
@@ -262,6 +261,7 @@ private:
         }
     }
 
+private:
     XFile file;
 
     DWORD bufferPos;
@@ -43,6 +43,8 @@ void STDCALL CloseLogFile();
 void STDCALL OSInit();
 void STDCALL OSExit();
 
+void STDCALL DestroyTaskPool();
+
 BOOL STDCALL InitXT(CTSTR logFile, CTSTR allocatorName)
 {
     if(!bBaseLoaded)
@@ -87,6 +89,7 @@ void STDCALL TerminateXT()
 {
     if(bBaseLoaded)
     {
+        DestroyTaskPool();
         FreeProfileData();
 
         delete locale;
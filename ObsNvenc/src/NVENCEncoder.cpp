@@ -408,7 +408,7 @@ void NVENCEncoder::RequestBuffers(LPVOID buffers)
     NvLog(TEXT("No unlocked frame found"));
 }
 
-bool NVENCEncoder::Encode(LPVOID picIn, List<DataPacket> &packets, List<PacketType> &packetTypes, DWORD timestamp)
+bool NVENCEncoder::Encode(LPVOID picIn, VideoSegment &packets, DWORD timestamp)
 {
     NVENCSTATUS nvStatus;
     int i = -1;
@@ -418,8 +418,7 @@ bool NVENCEncoder::Encode(LPVOID picIn, List<DataPacket> &packets, List<PacketTy
 
     OSMutexLocker locker(frameMutex);
 
-    packets.Clear();
-    packetTypes.Clear();
+    packets.Reset();
     
     if (picIn)
     {
@@ -513,7 +512,7 @@ bool NVENCEncoder::Encode(LPVOID picIn, List<DataPacket> &packets, List<PacketTy
         NVENCEncoderOutputSurface *qSurf = outputSurfaceQueueReady.front();
         outputSurfaceQueueReady.pop();
 
-        ProcessOutput(qSurf, packets, packetTypes);
+        ProcessOutput(qSurf, packets);
 
         qSurf->busy = false;
 
@@ -524,7 +523,7 @@ bool NVENCEncoder::Encode(LPVOID picIn, List<DataPacket> &packets, List<PacketTy
     return true;
 }
 
-void NVENCEncoder::ProcessOutput(NVENCEncoderOutputSurface *surf, List<DataPacket> &packets, List<PacketType> &packetTypes)
+void NVENCEncoder::ProcessOutput(NVENCEncoderOutputSurface *surf, VideoSegment &packets)
 {
     List<uint32_t> sliceOffsets;
     sliceOffsets.SetSize(encodeConfig.encodeCodecConfig.h264Config.sliceModeData);
@@ -532,8 +531,6 @@ void NVENCEncoder::ProcessOutput(NVENCEncoderOutputSurface *surf, List<DataPacke
     NV_ENC_LOCK_BITSTREAM lockParams = { 0 };
     lockParams.version = NV_ENC_LOCK_BITSTREAM_VER;
 
-    encodeData.Clear();
-
     lockParams.doNotWait = 0;
     lockParams.outputBitstream = surf->outputSurface;
     lockParams.sliceOffsets = sliceOffsets.Array();
@@ -547,6 +544,8 @@ void NVENCEncoder::ProcessOutput(NVENCEncoderOutputSurface *surf, List<DataPacke
 
     memcpy(pstart, lockParams.bitstreamBufferPtr, lockParams.bitstreamSizeInBytes);
 
+    PacketBuffer *packet = PacketBuffer::Create();
+
     uint8_t *start = pstart;
     uint8_t *end = start + lockParams.bitstreamSizeInBytes;
     const static uint8_t start_seq[] = { 0, 0, 1 };
@@ -644,7 +643,7 @@ void NVENCEncoder::ProcessOutput(NVENCEncoderOutputSurface *surf, List<DataPacke
                 }
                 else
                 {
-                    BufferOutputSerializer packetOut(encodeData);
+                    PacketSerializer packetOut(packet);
 
                     packetOut.OutputDword(htonl(sei_size + 2));
                     packetOut.Serialize(sei_start - 1, sei_size + 1);
@@ -664,7 +663,7 @@ void NVENCEncoder::ProcessOutput(NVENCEncoderOutputSurface *surf, List<DataPacke
 
             int newPayloadSize = (nal.i_payload - skipBytes);
 
-            BufferOutputSerializer packetOut(encodeData);
+            PacketSerializer packetOut(packet);
 
             packetOut.OutputDword(htonl(newPayloadSize));
             packetOut.Serialize(nal.p_payload + skipBytes, newPayloadSize);
@@ -677,15 +676,17 @@ void NVENCEncoder::ProcessOutput(NVENCEncoderOutputSurface *surf, List<DataPacke
 
             if (!bFoundFrame)
             {
-                encodeData.Insert(0, (nal.i_type == NAL_SLICE_IDR) ? 0x17 : 0x27);
-                encodeData.Insert(1, 1);
-                encodeData.InsertArray(2, timeOffsetAddr, 3);
+                BYTE frameHeader[5];
+                frameHeader[0] = (nal.i_type == NAL_SLICE_IDR) ? 0x17 : 0x27;
+                frameHeader[1] = 1;
+                memcpy(frameHeader + 2, timeOffsetAddr, 3);
+                packet->Insert(0, frameHeader, 5);
 
                 bFoundFrame = true;
             }
 
             int newPayloadSize = (nal.i_payload - skipBytes);
-            BufferOutputSerializer packetOut(encodeData);
+            PacketSerializer packetOut(packet);
 
             packetOut.OutputDword(htonl(newPayloadSize));
             packetOut.Serialize(nal.p_payload + skipBytes, newPayloadSize);
@@ -702,12 +703,7 @@ void NVENCEncoder::ProcessOutput(NVENCEncoderOutputSurface *surf, List<DataPacke
             continue;
     }
 
-    DataPacket packet;
-    packet.lpPacket = encodeData.Array();
-    packet.size = encodeData.Num();
-
-    packetTypes << bestType;
-    packets << packet;
+    packets.AddPacket(packet, bestType);
 
     nvStatus = pNvEnc->nvEncUnlockBitstream(encoder, surf->outputSurface);
     if (nvStatus != NV_ENC_SUCCESS)
@@ -592,6 +592,25 @@ public:
     virtual void RemoveSettingsPane(SettingsPane *pane) {App->RemoveSettingsPane(pane);}
 
     virtual UINT GetSampleRateHz() const {return App->GetSampleRateHz();}
+
+    virtual void GetFrameStageStats(FrameStage stage, FrameStageStats &stats) const
+    {
+        if(stage < FrameStage_Count)
+            App->frameTiming[stage].GetStats(stats);
+        else
+            zero(&stats, sizeof(stats));
+    }
+
+    virtual void DumpFrameStageStats() const    {App->DumpFrameTiming();}
+    virtual void ResetFrameStageStats()         {App->ResetFrameTiming();}
+
+    virtual UINT GetSceneBufferingTime() const
+    {
+        //sources can be created before the buffering time is read at stream start
+        return (UINT)GlobalConfig->GetInt(TEXT("General"), TEXT("SceneBufferingTime"), 700);
+    }
+
+    virtual void NotifyAudioReady() {App->NotifyAudioReady();}
 };
 
 APIInterface* CreateOBSApiInterface()
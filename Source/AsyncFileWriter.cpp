@@ -0,0 +1,303 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "Main.h"
+
+
+//unbuffered writes need sector aligned sizes and offsets, this covers both 512 byte and 4k sectors
+#define WRITE_ALIGNMENT 4096
+
+
+AsyncFileWriter::AsyncFileWriter()
+{
+    hFile = INVALID_HANDLE_VALUE;
+    hWriteThread = NULL;
+    hFreeBuffers = hQueuedBuffers = NULL;
+
+    bufferSize = 0;
+    curBuffer = writeBuffer = 0;
+    bufferPos = 0;
+
+    bUnbuffered = false;
+    preallocateSize = allocatedSize = 0;
+
+    totalQueued = 0;
+    fileOffset = 0;
+
+    bWriteFailed = false;
+    writeError = 0;
+    failedOffset = 0;
+    bReportedFailure = false;
+
+    numQueued = 0;
+    zero(&stats, sizeof(stats));
+}
+
+bool AsyncFileWriter::Open(CTSTR lpFile)
+{
+    UINT numBuffers = (UINT)AppConfig->GetInt(TEXT("Publish"), TEXT("RecordingWriteBuffers"), 4);
+    numBuffers = MIN(MAX(numBuffers, 2), 64);
+
+    bufferSize = (DWORD)AppConfig->GetInt(TEXT("Publish"), TEXT("RecordingWriteBufferSize"), 4096); //KB
+    bufferSize = MIN(MAX(bufferSize, 64), 65536)*1024;
+    bufferSize = (bufferSize+WRITE_ALIGNMENT-1) & ~(WRITE_ALIGNMENT-1);
+
+    bUnbuffered = AppConfig->GetInt(TEXT("Publish"), TEXT("UnbufferedRecording")) != 0;
+    preallocateSize = UINT64(AppConfig->GetInt(TEXT("Publish"), TEXT("RecordingPreallocate")))*1024*1024; //MB
+
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+    if(bUnbuffered)
+        flags |= FILE_FLAG_NO_BUFFERING;
+
+    hFile = CreateFile(lpFile, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, flags, NULL);
+    if(hFile == INVALID_HANDLE_VALUE)
+    {
+        Log(TEXT("AsyncFileWriter::Open: could not open '%s', error %u"), lpFile, GetLastError());
+        return false;
+    }
+
+    strFile = lpFile;
+
+    //page aligned, which is what unbuffered writes need
+    for(UINT i=0; i<numBuffers; i++)
+        buffers << (LPBYTE)VirtualAlloc(NULL, bufferSize, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    bufferLengths.SetSize(numBuffers);
+
+    //the first buffer starts out being filled
+    hFreeBuffers   = CreateSemaphore(NULL, numBuffers-1, numBuffers, NULL);
+    hQueuedBuffers = CreateSemaphore(NULL, 0, numBuffers, NULL);
+
+    hWriteThread = OSCreateThread((XTHREAD)AsyncFileWriter::WriteThread, this);
+    return true;
+}
+
+void AsyncFileWriter::Close()
+{
+    if(hFile == INVALID_HANDLE_VALUE)
+        return;
+
+    if(hWriteThread)
+    {
+        if(bufferPos)
+            QueueBuffer(bufferPos);
+
+        //an empty buffer tells the thread to stop
+        bufferLengths[curBuffer] = 0;
+        ReleaseSemaphore(hQueuedBuffers, 1, NULL);
+
+        OSWaitForThread(hWriteThread, NULL);
+        OSCloseThread(hWriteThread);
+        hWriteThread = NULL;
+    }
+
+    if(bWriteFailed && !bReportedFailure)
+        ReportWriteFailure();
+
+    //cut off the padding of the last unbuffered write and whatever was preallocated, or
+    //whatever never got written
+    if(bUnbuffered || allocatedSize || bWriteFailed)
+    {
+        LARGE_INTEGER size;
+        size.QuadPart = bWriteFailed ? failedOffset : totalQueued;
+        SetFilePointerEx(hFile, size, NULL, FILE_BEGIN);
+        SetEndOfFile(hFile);
+    }
+
+    CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
+
+    CloseHandle(hFreeBuffers);
+    CloseHandle(hQueuedBuffers);
+    hFreeBuffers = hQueuedBuffers = NULL;
+
+    for(UINT i=0; i<buffers.Num(); i++)
+        VirtualFree(buffers[i], 0, MEM_RELEASE);
+
+    Log(TEXT("Recording writer: %llu bytes written, waited for the disk %u times (%u ms total), at most %u of %u buffers queued, longest write %u ms"),
+        stats.bytesWritten, stats.numTimesWaited, stats.totalWaitTime, stats.maxQueuedBuffers, buffers.Num(), stats.maxWriteTime);
+
+    buffers.Clear();
+    bufferLengths.Clear();
+}
+
+void AsyncFileWriter::Serialize(LPCVOID lpData, DWORD length)
+{
+    assert(lpData);
+
+    LPBYTE lpTemp = (LPBYTE)lpData;
+
+    while(length)
+    {
+        DWORD copySize = MIN(length, bufferSize-bufferPos);
+        mcpy(buffers[curBuffer]+bufferPos, lpTemp, copySize);
+
+        bufferPos += copySize;
+        lpTemp += copySize;
+        length -= copySize;
+
+        if(bufferPos == bufferSize)
+            QueueBuffer(bufferSize);
+    }
+}
+
+//the data before the current position may already be on its way to disk, so there's nothing
+//to seek back into.  anything that needs to patch the file has to reopen it after Close
+UINT64 AsyncFileWriter::Seek(INT64 offset, DWORD seekType)
+{
+    UINT64 pos = GetPos();
+    UINT64 newPos = (seekType == SERIALIZE_SEEK_CURRENT) ? pos+offset : UINT64(offset);
+
+    assert(seekType != SERIALIZE_SEEK_END && newPos == pos);
+    if(seekType == SERIALIZE_SEEK_END || newPos != pos)
+        Log(TEXT("AsyncFileWriter::Seek: can't seek in '%s' while it's being written"), strFile.Array());
+
+    return pos;
+}
+
+void AsyncFileWriter::Flush()
+{
+    //unbuffered writes have to stay aligned, so the unaligned end carries over to the next buffer
+    DWORD flushSize = bUnbuffered ? (bufferPos & ~(WRITE_ALIGNMENT-1)) : bufferPos;
+    if(!flushSize)
+        return;
+
+    LPBYTE lpFlushed = buffers[curBuffer];
+    DWORD remainder = bufferPos-flushSize;
+
+    QueueBuffer(flushSize);
+
+    if(remainder)
+    {
+        mcpy(buffers[curBuffer], lpFlushed+flushSize, remainder);
+        bufferPos = remainder;
+    }
+}
+
+void AsyncFileWriter::QueueBuffer(DWORD length)
+{
+    if(bWriteFailed && !bReportedFailure)
+        ReportWriteFailure();
+
+    bufferLengths[curBuffer] = length;
+    totalQueued += length;
+
+    DWORD queued = (DWORD)InterlockedIncrement(&numQueued);
+    if(queued > stats.maxQueuedBuffers)
+        stats.maxQueuedBuffers = queued;
+
+    ReleaseSemaphore(hQueuedBuffers, 1, NULL);
+
+    //buffers are written in the order they're filled, so the next one is the oldest queued
+    curBuffer = (curBuffer+1) % buffers.Num();
+    bufferPos = 0;
+
+    if(WaitForSingleObject(hFreeBuffers, 0) == WAIT_TIMEOUT)
+    {
+        DWORD startTime = OSGetTime();
+        WaitForSingleObject(hFreeBuffers, INFINITE);
+
+        stats.numTimesWaited++;
+        stats.totalWaitTime += OSGetTime()-startTime;
+    }
+}
+
+//called from the thread that feeds the writer, the same way the publisher reports a lost
+//connection
+void AsyncFileWriter::ReportWriteFailure()
+{
+    bReportedFailure = true;
+
+    String strReport = FormattedString(TEXT("Could not write to the recording file '%s' (error %u).  The file stops after the first %llu bytes, check that the disk isn't full or disconnected."),
+        strFile.Array(), writeError, failedOffset);
+    AppWarning(TEXT("%s"), strReport.Array());
+
+    App->SetStreamReport(strReport);
+    if(hwndMain)
+        PostMessage(hwndMain, OBS_FILEWRITEFAILED, 0, 0);
+}
+
+DWORD STDCALL AsyncFileWriter::WriteThread(LPVOID lpWriter)
+{
+    ((AsyncFileWriter*)lpWriter)->WriteLoop();
+    return 0;
+}
+
+void AsyncFileWriter::WriteLoop()
+{
+    while(true)
+    {
+        WaitForSingleObject(hQueuedBuffers, INFINITE);
+
+        LPBYTE lpBuffer = buffers[writeBuffer];
+        DWORD length = bufferLengths[writeBuffer];
+        if(!length)
+            break;
+
+        //only the last write can be unaligned, pad it and trim the file afterwards
+        DWORD writeSize = length;
+        if(bUnbuffered && (writeSize & (WRITE_ALIGNMENT-1)))
+        {
+            writeSize = (writeSize+WRITE_ALIGNMENT-1) & ~(WRITE_ALIGNMENT-1);
+            zero(lpBuffer+length, writeSize-length);
+        }
+
+        //grow the file in large steps so the file system can keep it in one piece
+        if(preallocateSize && fileOffset+writeSize > allocatedSize)
+        {
+            while(allocatedSize < fileOffset+writeSize)
+                allocatedSize += preallocateSize;
+
+            LARGE_INTEGER pos;
+            pos.QuadPart = allocatedSize;
+            SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN);
+            SetEndOfFile(hFile);
+
+            pos.QuadPart = fileOffset;
+            SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN);
+        }
+
+        if(!bWriteFailed)
+        {
+            DWORD startTime = OSGetTime();
+
+            DWORD written;
+            if(!WriteFile(hFile, lpBuffer, writeSize, &written, NULL) || written != writeSize)
+            {
+                writeError = GetLastError();
+                Log(TEXT("AsyncFileWriter::WriteLoop: write failed, error %u"), writeError);
+
+                failedOffset = fileOffset;
+                bWriteFailed = true;
+            }
+            else
+                stats.bytesWritten += length;
+
+            DWORD writeTime = OSGetTime()-startTime;
+            if(writeTime > stats.maxWriteTime)
+                stats.maxWriteTime = writeTime;
+        }
+
+        fileOffset += length;
+
+        writeBuffer = (writeBuffer+1) % buffers.Num();
+
+        InterlockedDecrement(&numQueued);
+        ReleaseSemaphore(hFreeBuffers, 1, NULL);
+    }
+}
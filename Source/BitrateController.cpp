@@ -0,0 +1,148 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "Main.h"
+
+
+//stats are sampled over this window, per-frame deltas are too noisy to act on
+#define AIMD_SAMPLE_INTERVAL    500
+
+//minimum time between two decreases, gives the encoder's rate control time to catch up
+#define AIMD_DECREASE_INTERVAL  1500
+
+//number of consecutive clear samples needed before each increase
+#define AIMD_CLEAR_SAMPLES      10
+
+//--------------------------------------------------------------------------
+//additive increase/multiplicative decrease controller.
+//
+//congestion is detected from the publisher's buffer occupancy, the estimated queueing
+//delay (pending bytes over the measured drain rate) and its gradient, and from the sender
+//having had to wait or drop frames.  on congestion the bitrate is cut multiplicatively, and
+//toward the drain rate if the link is clearly slower than that.  once the queue has been
+//clear for a while the bitrate creeps back up in small steps toward the configured maximum.
+
+class AIMDBitrateController : public BitrateController
+{
+    DWORD maxBitRate, minBitRate;
+    DWORD curBitRate;
+
+    QWORD lastSampleTime, lastDecreaseTime;
+    QWORD lastBytesSent;
+    DWORD lastTimesWaited, lastDroppedFrames;
+
+    double drainRate;
+    double lastQueueDelay;
+    UINT numClearSamples;
+
+public:
+    AIMDBitrateController(DWORD maxBitRate)
+    {
+        this->maxBitRate = maxBitRate;
+        minBitRate = max(maxBitRate/10, 100);
+        curBitRate = maxBitRate;
+
+        lastSampleTime = lastDecreaseTime = 0;
+        lastBytesSent = 0;
+        lastTimesWaited = lastDroppedFrames = 0;
+
+        drainRate = 0.0;
+        lastQueueDelay = 0.0;
+        numClearSamples = 0;
+    }
+
+    DWORD Update(const NetworkSendStats &stats, QWORD timeMS)
+    {
+        if(!lastSampleTime)
+        {
+            lastSampleTime = timeMS;
+            lastBytesSent = stats.bytesSent;
+            lastTimesWaited = stats.numTimesWaited;
+            lastDroppedFrames = stats.numDroppedFrames;
+            return curBitRate;
+        }
+
+        QWORD elapsed = timeMS-lastSampleTime;
+        if(elapsed < AIMD_SAMPLE_INTERVAL)
+            return curBitRate;
+
+        //bytes per ms * 8 = kbps
+        double sampleRate = double(stats.bytesSent-lastBytesSent)*8.0/double(elapsed);
+        drainRate = (drainRate > 0.0) ? (drainRate*0.7 + sampleRate*0.3) : sampleRate;
+
+        DWORD pendingBytes = stats.queuedBytes+stats.bufferedBytes;
+        double queueDelay = double(pendingBytes)*8.0/max(drainRate, 1.0);
+        double delayGradient = queueDelay-lastQueueDelay;
+        double occupancy = stats.bufferSize ? double(stats.bufferedBytes)*100.0/double(stats.bufferSize) : 0.0;
+
+        bool bWaited  = stats.numTimesWaited != lastTimesWaited;
+        bool bDropped = stats.numDroppedFrames != lastDroppedFrames;
+
+        bool bCongested = bWaited || bDropped || occupancy > 25.0 || (queueDelay > 1000.0 && delayGradient > 0.0);
+
+        //a frame or two in flight makes the gradient jitter around zero, so a short queue counts as clear either way
+        bool bClear     = occupancy < 5.0 && queueDelay < 250.0 && (delayGradient <= 0.0 || queueDelay < 100.0);
+
+        //already under what the link drains and the backlog is shrinking, cutting again would only overshoot
+        bool bDraining  = !bDropped && delayGradient < 0.0 && double(curBitRate) < drainRate*0.95;
+
+        if(bCongested)
+        {
+            numClearSamples = 0;
+
+            if(!bDraining && curBitRate > minBitRate && timeMS-lastDecreaseTime >= AIMD_DECREASE_INTERVAL)
+            {
+                double target = double(curBitRate)*0.85;
+
+                //while backed up the drain rate is roughly what the link can take
+                if(drainRate*0.9 < target)
+                    target = max(drainRate*0.9, double(curBitRate)*0.5);
+
+                curBitRate = max(DWORD(target), minBitRate);
+                lastDecreaseTime = timeMS;
+            }
+        }
+        else if(bClear && curBitRate < maxBitRate)
+        {
+            if(++numClearSamples >= AIMD_CLEAR_SAMPLES)
+            {
+                curBitRate = min(curBitRate + max(maxBitRate/20, 1), maxBitRate);
+                numClearSamples = 0;
+            }
+        }
+        else
+            numClearSamples = 0;
+
+        lastSampleTime = timeMS;
+        lastBytesSent = stats.bytesSent;
+        lastTimesWaited = stats.numTimesWaited;
+        lastDroppedFrames = stats.numDroppedFrames;
+        lastQueueDelay = queueDelay;
+
+        return curBitRate;
+    }
+
+    DWORD GetBitRate() const {return curBitRate;}
+};
+
+
+BitrateController* CreateAIMDBitrateController(DWORD maxBitRate)
+{
+    return new AIMDBitrateController(maxBitRate);
+}
@@ -27,6 +27,9 @@
 //sound interface for vista+, will disable the main audio mixer if there is nothing playing.  What this means is that all output
 //to our audio stream completely stops, and the timestamps on our audio packets become unreliable.  So, to enable the mixer by
 //force, we play a muted 1 second sound loop to ensure that the audio stream continues seamlessly.  A simple but effective hack.
+//
+//  It also doubles as the desktop audio's ready signal: loopback capture streams don't signal their event before windows 10, so
+//this stream is event driven on the same device and each mixer period it wakes the audio thread, which then reads the loopback.
 
 struct BlankAudioPlayback
 {
@@ -35,7 +38,9 @@ struct BlankAudioPlayback
     IAudioClient        *mmClient;
     IAudioRenderClient  *mmRender;
 
-    BlankAudioPlayback(CTSTR lpDevice)
+    bool bEventDriven;
+
+    BlankAudioPlayback(CTSTR lpDevice, HANDLE hReadyEvent)
     {
         const CLSID CLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
         const IID IID_IMMDeviceEnumerator    = __uuidof(IMMDeviceEnumerator);
@@ -65,9 +70,34 @@ struct BlankAudioPlayback
 
         UINT inputBlockSize = pwfx->nBlockAlign;
 
-        err = mmClient->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, ConvertMSTo100NanoSec(1000), 0, pwfx, NULL);
-        if(FAILED(err))
-            CrashError(TEXT("Could not initialize audio client"));
+        bEventDriven = false;
+        if(hReadyEvent)
+        {
+            err = mmClient->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_EVENTCALLBACK, ConvertMSTo100NanoSec(1000), 0, pwfx, NULL);
+            if(SUCCEEDED(err))
+            {
+                err = mmClient->SetEventHandle(hReadyEvent);
+                if(SUCCEEDED(err))
+                    bEventDriven = true;
+            }
+
+            if(!bEventDriven)
+            {
+                Log(TEXT("BlankAudioPlayback: Event driven playback unavailable (%08lX), desktop audio will be polled"), err);
+
+                SafeRelease(mmClient);
+                err = mmDevice->Activate(IID_IAudioClient, CLSCTX_ALL, NULL, (void**)&mmClient);
+                if(FAILED(err))
+                    CrashError(TEXT("Could not create IAudioClient"));
+            }
+        }
+
+        if(!bEventDriven)
+        {
+            err = mmClient->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, ConvertMSTo100NanoSec(1000), 0, pwfx, NULL);
+            if(FAILED(err))
+                CrashError(TEXT("Could not initialize audio client"));
+        }
 
         err = mmClient->GetService(IID_IAudioRenderClient, (void**)&mmRender);
         if(FAILED(err))
@@ -107,10 +137,15 @@ struct BlankAudioPlayback
 
 static BlankAudioPlayback *curBlankPlaybackThingy = NULL;
 
-void StartBlankSoundPlayback(CTSTR lpDevice)
+void StartBlankSoundPlayback(CTSTR lpDevice, HANDLE hReadyEvent)
 {
     if(!curBlankPlaybackThingy)
-        curBlankPlaybackThingy = new BlankAudioPlayback(lpDevice);
+        curBlankPlaybackThingy = new BlankAudioPlayback(lpDevice, hReadyEvent);
+}
+
+bool BlankSoundPlaybackSignalsReady()
+{
+    return curBlankPlaybackThingy && curBlankPlaybackThingy->bEventDriven;
 }
 
 void StopBlankSoundPlayback()
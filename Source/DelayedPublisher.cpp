@@ -21,7 +21,7 @@
 #include "RTMPStuff.h"
 #include "RTMPPublisher.h"
 
-NetworkStream* CreateRTMPPublisher();
+NetworkStream* CreateRTMPPublisher(bool bSharedPackets);
 
 
 class DelayedPublisher : public RTMPPublisher
@@ -85,8 +85,8 @@ class DelayedPublisher : public RTMPPublisher
                     NetworkPacket &packet = delayedPackets[i];
                     if(packet.timestamp <= sendTime)
                     {
-                        RTMPPublisher::SendPacket(packet.data.Array(), packet.data.Num(), packet.timestamp, packet.type);
-                        packet.data.Clear();
+                        RTMPPublisher::SendPacket(packet.data, packet.timestamp, packet.type);
+                        packet.data->Release();
                         delayedPackets.Remove(i--);
                     }
                 }
@@ -151,15 +151,17 @@ public:
         }
 
         for(UINT i=0; i<delayedPackets.Num(); i++)
-            delayedPackets[i].data.Clear();
+            delayedPackets[i].data->Release();
     }
 
-    void SendPacket(BYTE *data, UINT size, DWORD timestamp, PacketType type)
+    void SendPacket(PacketBuffer *packet, DWORD timestamp, PacketType type)
     {
         ProcessDelayedPackets(timestamp);
 
+        packet->AddRef();
+
         NetworkPacket *newPacket = delayedPackets.CreateNew();
-        newPacket->data.CopyArray(data, size);
+        newPacket->data = packet;
         newPacket->timestamp = timestamp;
         newPacket->type = type;
 
@@ -171,7 +173,9 @@ public:
 };
 
 
-NetworkStream* CreateDelayedPublisher(DWORD delayTime)
+NetworkStream* CreateDelayedPublisher(DWORD delayTime, bool bSharedPackets)
 {
-    return new DelayedPublisher(delayTime*1000);
+    DelayedPublisher *publisher = new DelayedPublisher(delayTime*1000);
+    publisher->SetSharedPackets(bSharedPackets);
+    return publisher;
 }
@@ -283,12 +283,6 @@ bool CheckQSVHardwareSupport(bool log=true)
     return false;
 }
 
-struct VideoPacket
-{
-    List<BYTE> Packet;
-    inline void FreeData() {Packet.Clear();}
-};
-
 class QSVEncoder : public VideoEncoder
 {
     mfxVersion ver;
@@ -339,20 +333,13 @@ class QSVEncoder : public VideoEncoder
 
     bool bUseCBR, bUseCFR;
 
-    List<VideoPacket> CurrentPackets;
     List<BYTE> HeaderPacket, SEIData;
+    List<x264_nal_t> nalOut; //kept between frames, only the first nalNum are in use
 
     INT64 delayOffset;
 
     int frameShift;
 
-    inline void ClearPackets()
-    {
-        for(UINT i=0; i<CurrentPackets.Num(); i++)
-            CurrentPackets[i].FreeData();
-        CurrentPackets.Clear();
-    }
-
 public:
 
     QSVEncoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitrate, int bufferSize, bool bUseCFR_)
@@ -578,14 +565,13 @@ public:
     ~QSVEncoder()
     {
         stop.signal();
-        ClearPackets();
     }
 
 #ifndef SEI_USER_DATA_UNREGISTERED
 #define SEI_USER_DATA_UNREGISTERED 0x5
 #endif
 
-    void ProcessEncodedFrame(List<DataPacket> &packets, List<PacketType> &packetTypes, DWORD outputTimestamp, mfxU32 wait=0)
+    void ProcessEncodedFrame(VideoSegment &packets, DWORD outputTimestamp, mfxU32 wait=0)
     {
         if(!filled_bitstream_waiter.wait_for(2, wait))
             return;
@@ -600,7 +586,7 @@ public:
 
         mfxBitstream& bs = task.bs;
 
-        List<x264_nal_t> nalOut;
+        size_t nalNum = 0;
         mfxU8 *start, *end;
         {
             bitstream_info &info = bs_info[index];
@@ -644,13 +630,13 @@ public:
             start[3] = ((nal.i_ref_idc<<5)&0x60) | nal.i_type;
             nal.p_payload = start;
             nal.i_payload = int(next-start);
-            nalOut << nal;
+            if(nalNum == nalOut.Num())
+                nalOut.SetSize(UINT(nalNum)+1);
+            nalOut[UINT(nalNum++)] = nal;
             start = next;
         }
-        size_t nalNum = nalOut.Num();
 
-        packets.Clear();
-        ClearPackets();
+        packets.Reset();
 
         INT64 dts = msFromTimestamp(bs.DecodeTimeStamp);
 
@@ -681,7 +667,7 @@ public:
 
         BYTE *timeOffsetAddr = ((BYTE*)&timeOffset)+1;
 
-        VideoPacket *newPacket = NULL;
+        PacketBuffer *newPacket = NULL;
 
         PacketType bestType = PacketType_VideoDisposable;
         bool bFoundFrame = false;
@@ -741,9 +727,9 @@ public:
                         packetOut.OutputByte(0x80);
                     } else {
                         if (!newPacket)
-                            newPacket = CurrentPackets.CreateNew();
+                            newPacket = PacketBuffer::Create();
 
-                        BufferOutputSerializer packetOut(newPacket->Packet);
+                        PacketSerializer packetOut(newPacket);
 
                         packetOut.OutputDword(htonl(sei_size + 2));
                         packetOut.Serialize(sei_start - 1, sei_size + 1);
@@ -764,9 +750,9 @@ public:
                 int newPayloadSize = (nal.i_payload-skipBytes);
 
                 if (!newPacket)
-                    newPacket = CurrentPackets.CreateNew();
+                    newPacket = PacketBuffer::Create();
 
-                BufferOutputSerializer packetOut(newPacket->Packet);
+                PacketSerializer packetOut(newPacket);
 
                 packetOut.OutputDword(htonl(newPayloadSize));
                 packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
@@ -778,19 +764,21 @@ public:
                 int skipBytes = (int)(skip-nal.p_payload);
 
                 if (!newPacket)
-                    newPacket = CurrentPackets.CreateNew();
+                    newPacket = PacketBuffer::Create();
 
                 if (!bFoundFrame)
                 {
-                    newPacket->Packet.Insert(0, (nal.i_type == NAL_SLICE_IDR) ? 0x17 : 0x27);
-                    newPacket->Packet.Insert(1, 1);
-                    newPacket->Packet.InsertArray(2, timeOffsetAddr, 3);
+                    BYTE frameHeader[5];
+                    frameHeader[0] = (nal.i_type == NAL_SLICE_IDR) ? 0x17 : 0x27;
+                    frameHeader[1] = 1;
+                    mcpy(frameHeader+2, timeOffsetAddr, 3);
+                    newPacket->Insert(0, frameHeader, 5);
 
                     bFoundFrame = true;
                 }
 
                 int newPayloadSize = (nal.i_payload-skipBytes);
-                BufferOutputSerializer packetOut(newPacket->Packet);
+                PacketSerializer packetOut(newPacket);
 
                 packetOut.OutputDword(htonl(newPayloadSize));
                 packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
@@ -828,14 +816,8 @@ public:
                 continue;
         }
 
-        packetTypes << bestType;
-
-        packets.SetSize(CurrentPackets.Num());
-        for(UINT i=0; i<packets.Num(); i++)
-        {
-            packets[i].lpPacket = CurrentPackets[i].Packet.Array();
-            packets[i].size     = CurrentPackets[i].Packet.Num();
-        }
+        if(newPacket)
+            packets.AddPacket(newPacket, bestType);
 
         idle_tasks << index;
         assert(queued_tasks[0] == index);
@@ -905,7 +887,7 @@ public:
         CrashError(TEXT("QSV encoder is too slow"));
     }
 
-    bool Encode(LPVOID picInPtr, List<DataPacket> &packets, List<PacketType> &packetTypes, DWORD outputTimestamp)
+    bool Encode(LPVOID picInPtr, VideoSegment &packets, DWORD outputTimestamp)
     {
         if(!process_waiter.wait_timeout())
         {
@@ -934,7 +916,7 @@ public:
         profileIn("ProcessEncodedFrame");
         do
         {
-            ProcessEncodedFrame(packets, packetTypes, outputTimestamp, idle_tasks.Num() ? 0 : INFINITE);
+            ProcessEncodedFrame(packets, outputTimestamp, idle_tasks.Num() ? 0 : INFINITE);
         }
         while(!idle_tasks.Num());
         profileOut;
@@ -28,6 +28,8 @@ extern "C"
 #include "../x264/x264.h"
 }
 
+#include "../X264Helper/X264HostParams.h"
+
 
 
 void get_x264_log(void *param, int i_level, const char *psz, va_list argptr)
@@ -46,14 +48,6 @@ void get_x264_log(void *param, int i_level, const char *psz, va_list argptr)
 }
 
 
-struct VideoPacket
-{
-    List<BYTE> Packet;
-    inline void FreeData() {Packet.Clear();}
-};
-
-const float baseCRF = 22.0f;
-
 bool valid_x264_string(const String &str, const char **x264StringList)
 {
     do
@@ -65,6 +59,308 @@ bool valid_x264_string(const String &str, const char **x264StringList)
     return false;
 }
 
+//reads the custom x264 settings, taking out preset/tune/profile.  what's left goes to x264_param_parse
+static void GetX264CustomParams(StringList &paramList, String &curPreset, String &curTune, String &curProfile)
+{
+    BOOL bUseCustomParams = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("UseCustomSettings"));
+    if(bUseCustomParams)
+    {
+        String strCustomParams = AppConfig->GetString(TEXT("Video Encoding"), TEXT("CustomSettings"));
+        strCustomParams.KillSpaces();
+
+        if(strCustomParams.IsValid())
+        {
+            Log(TEXT("Using custom x264 settings: \"%s\""), strCustomParams.Array());
+
+            strCustomParams.GetTokenList(paramList, ' ', FALSE);
+            for(UINT i=0; i<paramList.Num(); i++)
+            {
+                String &strParam = paramList[i];
+                if(!schr(strParam, '='))
+                    continue;
+
+                String strParamName = strParam.GetToken(0, '=');
+                String strParamVal  = strParam.GetTokenOffset(1, '=');
+
+                if(strParamName.CompareI(TEXT("preset")))
+                {
+                    if(valid_x264_string(strParamVal, (const char**)x264_preset_names))
+                        curPreset = strParamVal;
+                    else
+                        Log(TEXT("invalid preset: %s"), strParamVal.Array());
+
+                    paramList.Remove(i--);
+                }
+                else if(strParamName.CompareI(TEXT("tune")))
+                {
+                    if(valid_x264_string(strParamVal, (const char**)x264_tune_names))
+                        curTune = strParamVal;
+                    else
+                        Log(TEXT("invalid tune: %s"), strParamVal.Array());
+
+                    paramList.Remove(i--);
+                }
+                else if(strParamName.CompareI(TEXT("profile")))
+                {
+                    if(valid_x264_string(strParamVal, (const char **)x264_profile_names))
+                        curProfile = strParamVal;
+                    else
+                        Log(TEXT("invalid profile: %s"), strParamVal.Array());
+
+                    paramList.Remove(i--);
+                }
+            }
+        }
+    }
+}
+
+static void CopyStringUTF8(CTSTR lpStr, char *lpDest, size_t maxLen)
+{
+    LPSTR lpUTF8 = String(lpStr).CreateUTF8String();
+    if(lpUTF8)
+    {
+        strncpy(lpDest, lpUTF8, maxLen-1);
+        Free(lpUTF8);
+    }
+    lpDest[maxLen-1] = 0;
+}
+
+static void LogX264Params(const char *format, ...)
+{
+    char message[1024];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message)-1, format, args);
+    va_end(args);
+    message[sizeof(message)-1] = 0;
+
+    Log(TEXT("%s"), String(message).Array());
+}
+
+//the resolved settings, in the form x264_host_setup_params takes them.  the in-process encoder
+//builds its x264 settings from this too, so both encoders set x264 up exactly the same way
+static void FillX264HostInit(x264_host_init &init, int fps, int width, int height, int quality, CTSTR preset, CTSTR tune, CTSTR profile,
+                             ColorDescription &colorDesc, int maxBitrate, int bufferSize, bool bUseCBR, bool bPadCBR, bool bUseCFR, bool bIntraRefresh,
+                             StringList &paramList)
+{
+    init.fps            = fps;
+    init.width          = width;
+    init.height         = height;
+    init.quality        = quality;
+    init.keyint         = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("KeyframeInterval"), 0);
+    init.max_bitrate    = maxBitrate;
+    init.buffer_size    = bufferSize;
+    init.use_cbr        = bUseCBR;
+    init.pad_cbr        = bPadCBR;
+    init.use_cfr        = bUseCFR;
+    init.intra_refresh  = bIntraRefresh;
+    init.full_range     = colorDesc.fullRange;
+    init.primaries      = colorDesc.primaries;
+    init.transfer       = colorDesc.transfer;
+    init.matrix         = colorDesc.matrix;
+
+    CopyStringUTF8(preset, init.preset, sizeof(init.preset));
+    CopyStringUTF8(tune, init.tune, sizeof(init.tune));
+    CopyStringUTF8(profile, init.profile, sizeof(init.profile));
+
+    init.custom[0] = 0;
+    for(UINT i=0; i<paramList.Num(); i++)
+    {
+        String &strParam = paramList[i];
+        if(!schr(strParam, '='))
+            continue;
+
+        String strParamName = strParam.GetToken(0, '=');
+        String strParamVal  = strParam.GetTokenOffset(1, '=');
+
+        if( strParamName.CompareI(TEXT("fps")) ||
+            strParamName.CompareI(TEXT("force-cfr")))
+        {
+            Log(TEXT("The custom x264 command '%s' is unsupported, use the application settings instead"), strParam.Array());
+            continue;
+        }
+
+        LPSTR lpParam = strParamName.CreateUTF8String();
+        LPSTR lpVal   = strParamVal.CreateUTF8String();
+
+        if(!x264_host_add_custom(init.custom, sizeof(init.custom), lpParam, lpVal ? lpVal : ""))
+            Log(TEXT("The custom x264 command '%s' doesn't fit with the others and was left out"), strParam.Array());
+
+        Free(lpParam);
+        Free(lpVal);
+    }
+}
+
+//turns the nals x264 returned for one frame into an flv video packet.  the host encoder rebuilds
+//the nal list from the helper's bitstream records and goes through here too
+static void PacketizeX264Frame(x264_nal_t *nalOut, int nalNum, INT64 pts, INT64 dts, bool bRecoveryPoint, int &frameShift, List<BYTE> &SEIData, VideoSegment &packets)
+{
+    int timeOffset;
+
+    //if frame duplication is being used, the shift will be insignificant, so just don't bother adjusting audio
+    timeOffset = int(pts-dts);
+    timeOffset += frameShift;
+
+    if(nalNum && timeOffset < 0)
+    {
+        frameShift -= timeOffset;
+        timeOffset = 0;
+    }
+
+    timeOffset = htonl(timeOffset);
+
+    BYTE *timeOffsetAddr = ((BYTE*)&timeOffset)+1;
+
+    PacketBuffer *newPacket = NULL;
+
+    PacketType bestType = PacketType_VideoDisposable;
+    bool bFoundFrame = false;
+
+    for(int i=0; i<nalNum; i++)
+    {
+        x264_nal_t &nal = nalOut[i];
+
+        if(nal.i_type == NAL_SEI)
+        {
+            BYTE *skip = nal.p_payload;
+            while(*(skip++) != 0x1);
+            int skipBytes = (int)(skip-nal.p_payload);
+
+            int newPayloadSize = (nal.i_payload-skipBytes);
+
+            if (nal.p_payload[skipBytes+1] == 0x5) {
+                SEIData.Clear();
+                BufferOutputSerializer packetOut(SEIData);
+
+                packetOut.OutputDword(htonl(newPayloadSize));
+                packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
+            } else {
+                if (!newPacket)
+                    newPacket = PacketBuffer::Create();
+
+                PacketSerializer packetOut(newPacket);
+
+                packetOut.OutputDword(htonl(newPayloadSize));
+                packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
+            }
+        }
+        else if(nal.i_type == NAL_FILLER)
+        {
+            BYTE *skip = nal.p_payload;
+            while(*(skip++) != 0x1);
+            int skipBytes = (int)(skip-nal.p_payload);
+
+            int newPayloadSize = (nal.i_payload-skipBytes);
+
+            if (!newPacket)
+                newPacket = PacketBuffer::Create();
+
+            PacketSerializer packetOut(newPacket);
+
+            packetOut.OutputDword(htonl(newPayloadSize));
+            packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
+        }
+        else if(nal.i_type == NAL_SLICE_IDR || nal.i_type == NAL_SLICE)
+        {
+            BYTE *skip = nal.p_payload;
+            while(*(skip++) != 0x1);
+            int skipBytes = (int)(skip-nal.p_payload);
+
+            if (!newPacket)
+                newPacket = PacketBuffer::Create();
+
+            if (!bFoundFrame)
+            {
+                BYTE frameHeader[5];
+                frameHeader[0] = (nal.i_type == NAL_SLICE_IDR) ? 0x17 : 0x27;
+                frameHeader[1] = 1;
+                mcpy(frameHeader+2, timeOffsetAddr, 3);
+                newPacket->Insert(0, frameHeader, 5);
+
+                bFoundFrame = true;
+            }
+
+            int newPayloadSize = (nal.i_payload-skipBytes);
+            PacketSerializer packetOut(newPacket);
+
+            packetOut.OutputDword(htonl(newPayloadSize));
+            packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
+
+            switch(nal.i_ref_idc)
+            {
+                case NAL_PRIORITY_DISPOSABLE:   bestType = MAX(bestType, PacketType_VideoDisposable);  break;
+                case NAL_PRIORITY_LOW:          bestType = MAX(bestType, PacketType_VideoLow);         break;
+                case NAL_PRIORITY_HIGH:         bestType = MAX(bestType, PacketType_VideoHigh);        break;
+                case NAL_PRIORITY_HIGHEST:      bestType = MAX(bestType, PacketType_VideoHighest);     break;
+            }
+        }
+        /*else if(nal.i_type == NAL_SPS)
+        {
+            VideoPacket *newPacket = CurrentPackets.CreateNew();
+            BufferOutputSerializer headerOut(newPacket->Packet);
+
+            headerOut.OutputByte(0x17);
+            headerOut.OutputByte(0);
+            headerOut.Serialize(timeOffsetAddr, 3);
+            headerOut.OutputByte(1);
+            headerOut.Serialize(nal.p_payload+5, 3);
+            headerOut.OutputByte(0xff);
+            headerOut.OutputByte(0xe1);
+            headerOut.OutputWord(htons(nal.i_payload-4));
+            headerOut.Serialize(nal.p_payload+4, nal.i_payload-4);
+
+            x264_nal_t &pps = nalOut[i+1]; //the PPS always comes after the SPS
+
+            headerOut.OutputByte(1);
+            headerOut.OutputWord(htons(pps.i_payload-4));
+            headerOut.Serialize(pps.p_payload+4, pps.i_payload-4);
+        }*/
+        else
+            continue;
+    }
+
+    //the start of an intra refresh wave is where a decoder can pick the stream up again, so the
+    //RTMP drop logic can wait for it like it waits for an IDR.  it stays an inter frame (0x27)
+    //for everything else, files and the replay buffer can only start on a real IDR
+    if(bRecoveryPoint)
+        bestType = PacketType_VideoHighest;
+
+    if(newPacket)
+        packets.AddPacket(newPacket, bestType);
+}
+
+static void BuildX264Headers(x264_nal_t *nalOut, int nalNum, List<BYTE> &HeaderPacket)
+{
+    for(int i=0; i<nalNum; i++)
+    {
+        x264_nal_t &nal = nalOut[i];
+
+        if(nal.i_type == NAL_SPS)
+        {
+            BufferOutputSerializer headerOut(HeaderPacket);
+
+            headerOut.OutputByte(0x17);
+            headerOut.OutputByte(0);
+            headerOut.OutputByte(0);
+            headerOut.OutputByte(0);
+            headerOut.OutputByte(0);
+            headerOut.OutputByte(1);
+            headerOut.Serialize(nal.p_payload+5, 3);
+            headerOut.OutputByte(0xff);
+            headerOut.OutputByte(0xe1);
+            headerOut.OutputWord(htons(nal.i_payload-4));
+            headerOut.Serialize(nal.p_payload+4, nal.i_payload-4);
+
+            x264_nal_t &pps = nalOut[i+1]; //the PPS always comes after the SPS
+
+            headerOut.OutputByte(1);
+            headerOut.OutputWord(htons(pps.i_payload-4));
+            headerOut.Serialize(pps.p_payload+4, pps.i_payload-4);
+        }
+    }
+}
+
 class X264Encoder : public VideoEncoder
 {
     x264_param_t paramData;
@@ -87,21 +383,14 @@ class X264Encoder : public VideoEncoder
     bool bFirstFrameProcessed;
 
     bool bUseCBR, bUseCFR, bPadCBR;
+    bool bLowLatency, bIntraRefresh;
 
-    List<VideoPacket> CurrentPackets;
     List<BYTE> HeaderPacket, SEIData;
 
     INT64 delayOffset;
 
     int frameShift;
 
-    inline void ClearPackets()
-    {
-        for(UINT i=0; i<CurrentPackets.Num(); i++)
-            CurrentPackets[i].FreeData();
-        CurrentPackets.Clear();
-    }
-
     inline void SetBitRateParams(DWORD maxBitrate, DWORD bufferSize)
     {
         //-1 means ignore so we don't have to know both settings
@@ -117,170 +406,46 @@ class X264Encoder : public VideoEncoder
     }
 
 public:
-    X264Encoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitrate, int bufferSize, bool bUseCFR)
+    X264Encoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitrate, int bufferSize, bool bUseCFR, bool bUseCBR, bool bLowLatency, bool bIntraRefresh)
     {
         curPreset = preset;
 
+        //low latency: the zerolatency tune (sliced threads, no lookahead, no b-frames, no frame
+        //threading delay), and if the caller allows it intra refresh instead of periodic IDR
+        //frames so there are no big keyframes to sit in the send buffer.  custom settings can
+        //still override it
+        this->bLowLatency = bLowLatency;
+        this->bIntraRefresh = bLowLatency && bIntraRefresh;
+        if(bLowLatency)
+            curTune = TEXT("zerolatency");
+
         fps_ms = 1000/fps;
 
         StringList paramList;
 
         curProfile = AppConfig->GetString(TEXT("Video Encoding"), TEXT("X264Profile"), TEXT("high"));
 
-        BOOL bUseCustomParams = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("UseCustomSettings"));
-        if(bUseCustomParams)
-        {
-            String strCustomParams = AppConfig->GetString(TEXT("Video Encoding"), TEXT("CustomSettings"));
-            strCustomParams.KillSpaces();
-
-            if(strCustomParams.IsValid())
-            {
-                Log(TEXT("Using custom x264 settings: \"%s\""), strCustomParams.Array());
-
-                strCustomParams.GetTokenList(paramList, ' ', FALSE);
-                for(UINT i=0; i<paramList.Num(); i++)
-                {
-                    String &strParam = paramList[i];
-                    if(!schr(strParam, '='))
-                        continue;
-
-                    String strParamName = strParam.GetToken(0, '=');
-                    String strParamVal  = strParam.GetTokenOffset(1, '=');
-
-                    if(strParamName.CompareI(TEXT("preset")))
-                    {
-                        if(valid_x264_string(strParamVal, (const char**)x264_preset_names))
-                            curPreset = strParamVal;
-                        else
-                            Log(TEXT("invalid preset: %s"), strParamVal.Array());
-
-                        paramList.Remove(i--);
-                    }
-                    else if(strParamName.CompareI(TEXT("tune")))
-                    {
-                        if(valid_x264_string(strParamVal, (const char**)x264_tune_names))
-                            curTune = strParamVal;
-                        else
-                            Log(TEXT("invalid tune: %s"), strParamVal.Array());
-
-                        paramList.Remove(i--);
-                    }
-                    else if(strParamName.CompareI(TEXT("profile")))
-                    {
-                        if(valid_x264_string(strParamVal, (const char **)x264_profile_names))
-                            curProfile = strParamVal;
-                        else
-                            Log(TEXT("invalid profile: %s"), strParamVal.Array());
-
-                        paramList.Remove(i--);
-                    }
-                }
-            }
-        }
-
-        zero(&paramData, sizeof(paramData));
-
-        LPSTR lpPreset = curPreset.CreateUTF8String();
-        LPSTR lpTune = curTune.CreateUTF8String();
-
-        if (x264_param_default_preset(&paramData, lpPreset, lpTune))
-            Log(TEXT("Failed to set x264 defaults: %s/%s"), curPreset.Array(), curTune.Array());
-
-        Free(lpTune);
-        Free(lpPreset);
+        GetX264CustomParams(paramList, curPreset, curTune, curProfile);
 
         this->width  = width;
         this->height = height;
 
-        paramData.b_deterministic       = false;
-
-        bUseCBR = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("UseCBR"), 1) != 0;
+        this->bUseCBR = bUseCBR;
         bPadCBR = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("PadCBR"), 1) != 0;
         this->bUseCFR = bUseCFR;
 
-        SetBitRateParams(maxBitrate, bufferSize);
-
-        if(bUseCBR)
-        {
-            if(bPadCBR) paramData.rc.b_filler = 1;
-            //if(bPadCBR) paramData.i_nal_hrd = X264_NAL_HRD_CBR;
-            paramData.rc.i_rc_method    = X264_RC_ABR;
-            paramData.rc.f_rf_constant  = 0.0f;
-        }
-        else
-        {
-            paramData.rc.i_rc_method    = X264_RC_CRF;
-            paramData.rc.f_rf_constant  = baseCRF+float(10-quality);
-        }
-
-        UINT keyframeInterval = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("KeyframeInterval"), 0);
-
-        paramData.b_vfr_input           = !bUseCFR;
-        paramData.i_width               = width;
-        paramData.i_height              = height;
-        paramData.vui.b_fullrange       = colorDesc.fullRange;
-        paramData.vui.i_colorprim       = colorDesc.primaries;
-        paramData.vui.i_transfer        = colorDesc.transfer;
-        paramData.vui.i_colmatrix       = colorDesc.matrix;
-
-        if (keyframeInterval)
-            paramData.i_keyint_max      = fps*keyframeInterval;
+        x264_host_init init;
+        zero(&init, sizeof(init));
+        FillX264HostInit(init, fps, width, height, quality, curPreset, curTune, curProfile, colorDesc,
+                         maxBitrate, bufferSize, bUseCBR, bPadCBR, bUseCFR, this->bIntraRefresh, paramList);
 
-        paramData.i_fps_num             = fps;
-        paramData.i_fps_den             = 1;
-
-        paramData.i_timebase_num        = 1;
-        paramData.i_timebase_den        = 1000;
-
-        paramData.pf_log                = get_x264_log;
-        paramData.i_log_level           = X264_LOG_WARNING;
-
-        for(UINT i=0; i<paramList.Num(); i++)
-        {
-            String &strParam = paramList[i];
-            if(!schr(strParam, '='))
-                continue;
-
-            String strParamName = strParam.GetToken(0, '=');
-            String strParamVal  = strParam.GetTokenOffset(1, '=');
-
-            if( strParamName.CompareI(TEXT("fps")) || 
-                strParamName.CompareI(TEXT("force-cfr")))
-            {
-                Log(TEXT("The custom x264 command '%s' is unsupported, use the application settings instead"), strParam.Array());
-                continue;
-            }
-            else
-            {
-                LPSTR lpParam = strParamName.CreateUTF8String();
-                LPSTR lpVal   = strParamVal.CreateUTF8String();
-
-                if(x264_param_parse(&paramData, lpParam, lpVal) != 0)
-                    Log(TEXT("The custom x264 command '%s' failed"), strParam.Array());
-
-                Free(lpParam);
-                Free(lpVal);
-            }
-        }
-
-        if(bUse444) paramData.i_csp = X264_CSP_I444;
-        else paramData.i_csp = X264_CSP_I420;
+        x264_host_setup_params(paramData, init, bUse444 ? X264_CSP_I444 : X264_CSP_I420, get_x264_log, LogX264Params);
 
         colorDesc.fullRange = paramData.vui.b_fullrange;
         colorDesc.primaries = paramData.vui.i_colorprim;
         colorDesc.transfer  = paramData.vui.i_transfer;
         colorDesc.matrix    = paramData.vui.i_colmatrix;
 
-        if (curProfile)
-        {
-            LPSTR lpProfile = curProfile.CreateUTF8String();
-
-            if (x264_param_apply_profile (&paramData, lpProfile))
-                Log(TEXT("Failed to set x264 profile: %s"), curProfile.Array());
-
-            Free(lpProfile);
-        }
-
         x264 = x264_encoder_open(&paramData);
         if(!x264)
             CrashError(TEXT("Could not initialize x264"));
@@ -295,22 +460,26 @@ public:
 
     ~X264Encoder()
     {
-        ClearPackets();
         x264_encoder_close(x264);
     }
 
-    bool Encode(LPVOID picInPtr, List<DataPacket> &packets, List<PacketType> &packetTypes, DWORD outputTimestamp)
+    bool Encode(LPVOID picInPtr, VideoSegment &packets, DWORD outputTimestamp)
     {
         x264_picture_t *picIn = (x264_picture_t*)picInPtr;
 
         x264_nal_t *nalOut;
         int nalNum;
 
-        packets.Clear();
-        ClearPackets();
+        packets.Reset();
 
+        //with intra refresh a new refresh wave does the job of a keyframe
         if(bRequestKeyframe && picIn)
-            picIn->i_type = X264_TYPE_IDR;
+        {
+            if(bIntraRefresh)
+                x264_encoder_intra_refresh(x264);
+            else
+                picIn->i_type = X264_TYPE_IDR;
+        }
 
         if(x264_encoder_encode(x264, &nalOut, &nalNum, picIn, &picOut) < 0)
         {
@@ -330,181 +499,540 @@ public:
             bFirstFrameProcessed = true;
         }
 
-        INT64 ts = INT64(outputTimestamp);
-        int timeOffset;
+        PacketizeX264Frame(nalOut, nalNum, picOut.i_pts, picOut.i_dts, bIntraRefresh && picOut.b_keyframe, frameShift, SEIData, packets);
 
-        //if frame duplication is being used, the shift will be insignificant, so just don't bother adjusting audio
-        timeOffset = int(picOut.i_pts-picOut.i_dts);
-        timeOffset += frameShift;
+        return true;
+    }
 
-        if(nalNum && timeOffset < 0)
+    void GetHeaders(DataPacket &packet)
+    {
+        if(!HeaderPacket.Num())
         {
-            frameShift -= timeOffset;
-            timeOffset = 0;
+            x264_nal_t *nalOut;
+            int nalNum;
+
+            x264_encoder_headers(x264, &nalOut, &nalNum);
+            BuildX264Headers(nalOut, nalNum, HeaderPacket);
         }
 
-        //OSDebugOut(TEXT("inpts: %005lld, dts: %005lld, pts: %005lld, timestamp: %005d, offset: %005d, newoffset: %005lld\n"), picIn->i_pts, picOut.i_dts, picOut.i_pts, outputTimestamp, timeOffset, picOut.i_pts-picOut.i_dts);
+        packet.lpPacket = HeaderPacket.Array();
+        packet.size     = HeaderPacket.Num();
+    }
 
-        timeOffset = htonl(timeOffset);
+    virtual void GetSEI(DataPacket &packet)
+    {
+        packet.lpPacket = SEIData.Array();
+        packet.size     = SEIData.Num();
+    }
 
-        BYTE *timeOffsetAddr = ((BYTE*)&timeOffset)+1;
+    int GetBitRate() const
+    {
+        if (paramData.rc.i_vbv_max_bitrate)
+            return paramData.rc.i_vbv_max_bitrate;
+        else
+            return paramData.rc.i_bitrate;
+    }
 
-        VideoPacket *newPacket = NULL;
+    String GetInfoString() const
+    {
+        String strInfo;
 
-        PacketType bestType = PacketType_VideoDisposable;
-        bool bFoundFrame = false;
+        strInfo << TEXT("Video Encoding: x264")  <<
+                   TEXT("\r\n    fps: ")         << IntString(paramData.i_fps_num) <<
+                   TEXT("\r\n    width: ")       << IntString(width) << TEXT(", height: ") << IntString(height) <<
+                   TEXT("\r\n    preset: ")      << curPreset <<
+                   TEXT("\r\n    profile: ")     << curProfile <<
+                   TEXT("\r\n    keyint: ")      << paramData.i_keyint_max <<
+                   TEXT("\r\n    CBR: ")         << CTSTR((bUseCBR) ? TEXT("yes") : TEXT("no")) <<
+                   TEXT("\r\n    CFR: ")         << CTSTR((bUseCFR) ? TEXT("yes") : TEXT("no")) <<
+                   TEXT("\r\n    low latency: ") << CTSTR((bLowLatency) ? (bIntraRefresh ? TEXT("yes, intra refresh") : TEXT("yes")) : TEXT("no")) <<
+                   TEXT("\r\n    max bitrate: ") << IntString(paramData.rc.i_vbv_max_bitrate) <<
+                   TEXT("\r\n    buffer size: ") << IntString(paramData.rc.i_vbv_buffer_size);
 
-        for(int i=0; i<nalNum; i++)
+        if(!bUseCBR)
         {
-            x264_nal_t &nal = nalOut[i];
+            strInfo << TEXT("\r\n    quality: ")     << IntString(10-int(paramData.rc.f_rf_constant-X264_HOST_BASE_CRF));
+        }
 
-            if(nal.i_type == NAL_SEI)
-            {
-                BYTE *skip = nal.p_payload;
-                while(*(skip++) != 0x1);
-                int skipBytes = (int)(skip-nal.p_payload);
+        return strInfo;
+    }
 
-                int newPayloadSize = (nal.i_payload-skipBytes);
+    virtual bool DynamicBitrateSupported() const
+    {
+        return (paramData.i_nal_hrd != X264_NAL_HRD_CBR);
+    }
 
-                if (nal.p_payload[skipBytes+1] == 0x5) {
-                    SEIData.Clear();
-                    BufferOutputSerializer packetOut(SEIData);
+    virtual bool SetBitRate(DWORD maxBitrate, DWORD bufferSize)
+    {
+        SetBitRateParams(maxBitrate, bufferSize);
 
-                    packetOut.OutputDword(htonl(newPayloadSize));
-                    packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
-                } else {
-                    if (!newPacket)
-                        newPacket = CurrentPackets.CreateNew();
+        int retVal = x264_encoder_reconfig(x264, &paramData);
+        if(retVal < 0)
+            Log(TEXT("Could not set new encoder bitrate, error value %u"), retVal);
 
-                    BufferOutputSerializer packetOut(newPacket->Packet);
+        return retVal == 0;
+    }
 
-                    packetOut.OutputDword(htonl(newPayloadSize));
-                    packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
-                }
-            }
-            else if(nal.i_type == NAL_FILLER)
-            {
-                BYTE *skip = nal.p_payload;
-                while(*(skip++) != 0x1);
-                int skipBytes = (int)(skip-nal.p_payload);
+    virtual void RequestKeyframe()
+    {
+        bRequestKeyframe = true;
+    }
 
-                int newPayloadSize = (nal.i_payload-skipBytes);
+    virtual int GetBufferedFrames()
+    {
+        return x264_encoder_delayed_frames(x264);
+    }
 
-                if (!newPacket)
-                    newPacket = CurrentPackets.CreateNew();
+    virtual bool HasBufferedFrames()
+    {
+        return x264_encoder_delayed_frames(x264) > 0;
+    }
+};
 
-                BufferOutputSerializer packetOut(newPacket->Packet);
 
-                packetOut.OutputDword(htonl(newPayloadSize));
-                packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
+VideoEncoder* CreateX264Encoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitRate, int bufferSize, bool bUseCFR, bool bUseCBR, bool bLowLatency, bool bIntraRefresh)
+{
+    return new X264Encoder(fps, width, height, quality, preset, bUse444, colorDesc, maxBitRate, bufferSize, bUseCFR, bUseCBR, bLowLatency, bIntraRefresh);
+}
+
+
+//-----------------------------------------------------------------------
+// x264 in X264Helper.exe
+
+//the longest the host gets to take a frame or hand one back before it's considered hung
+const DWORD x264HostTimeoutMS = 5000;
+
+//frames queued to the host before Encode waits for the oldest one to come back
+const UINT x264HostMaxFramesInFlight = 2;
+
+//runs x264 in X264Helper.exe and trades pictures and bitstream with it through shared memory
+//rings, so an encoder crash only ends the stream (reconnecting starts a new host) and x264's
+//lookahead and frame buffers don't live in our address space.  the output is packetized here
+//exactly like the in-process encoder's.
+class X264HostEncoder : public VideoEncoder
+{
+    encoder_host::shared_memory controlMemory;
+    encoder_host::ipc_semaphore hostReady;
+    encoder_host::frame_ring frames, bitstream;
+    encoder_host::host_process host;
+
+    x264_host_control *control;
+
+    UINT width, height;
+    int fps;
+
+    String curPreset, curTune, curProfile;
+
+    bool bUseCBR, bUseCFR, bPadCBR;
+    bool bLowLatency, bIntraRefresh;
+
+    int curMaxBitrate, curBufferSize;
+    int newMaxBitrate, newBufferSize;
+    bool bReconfigure;
+
+    bool bRequestKeyframe;
+
+    UINT framesInFlight;
+    int delayedFrames;
+    bool bHostFailed;
+
+    List<BYTE> HeaderPacket, SEIData;
+    List<x264_nal_t> nals;
+
+    int frameShift;
+
+    //rebuilds x264's nal list around payloads the helper wrote, read in place.  the helper is
+    //another process and may be broken, so the table and every payload have to fit in what it
+    //handed over, and every nal has to start with the start code PacketizeX264Frame and
+    //BuildX264Headers look for
+    static bool ReadHostNals(const x264_host_nal *hostNals, UINT nalCount, size_t tableSpace, LPBYTE payload, size_t payloadSpace, List<x264_nal_t> &nals)
+    {
+        if(UINT64(nalCount)*sizeof(x264_host_nal) > tableSpace)
+            return false;
+
+        nals.SetSize(nalCount);
+
+        size_t offset = 0;
+        for(UINT i=0; i<nalCount; i++)
+        {
+            int size = hostNals[i].size;
+            if(size < 5 || size_t(size) > payloadSpace-offset)
+                return false;
+
+            LPBYTE nalData = payload+offset;
+            if(!memchr(nalData, 1, 4))
+                return false;
+
+            nals[i].i_type      = hostNals[i].type;
+            nals[i].i_ref_idc   = hostNals[i].ref_idc;
+            nals[i].i_payload   = size;
+            nals[i].p_payload   = nalData;
+            offset += size;
+        }
+
+        return true;
+    }
+
+    void HostFailed(CTSTR lpReason)
+    {
+        if(bHostFailed)
+            return;
+
+        bHostFailed = true;
+
+        if(host.running())
+        {
+            Log(TEXT("X264Host: %s, stopping X264Helper.exe"), lpReason);
+            host.kill();
+        }
+        else
+            Log(TEXT("X264Host: %s, X264Helper.exe exited with code %d"), lpReason, host.exit_code);
+
+        App->PostStopMessage();
+    }
+
+    //waits on one of the rings in short steps so a dead host is noticed right away
+    LPBYTE WaitForSlot(encoder_host::frame_ring &ring, bool bWrite, encoder_host::slot_header *&si)
+    {
+        DWORD startTime = OSGetTime();
+
+        while(true)
+        {
+            LPBYTE data = bWrite ? ring.begin_write(50) : ring.begin_read(50, si);
+            if(data)
+                return data;
+
+            if(!host.running())
+            {
+                HostFailed(TEXT("the encoder host went away"));
+                return NULL;
             }
-            else if(nal.i_type == NAL_SLICE_IDR || nal.i_type == NAL_SLICE)
+
+            if(OSGetTime()-startTime > x264HostTimeoutMS)
             {
-                BYTE *skip = nal.p_payload;
-                while(*(skip++) != 0x1);
-                int skipBytes = (int)(skip-nal.p_payload);
+                HostFailed(TEXT("the encoder host stopped responding"));
+                return NULL;
+            }
+        }
+    }
 
-                if (!newPacket)
-                    newPacket = CurrentPackets.CreateNew();
+    bool SendPicture(x264_picture_t *picIn)
+    {
+        encoder_host::slot_header *si;
+        LPBYTE data = WaitForSlot(frames, true, si);
+        if(!data)
+            return false;
 
-                if (!bFoundFrame)
-                {
-                    newPacket->Packet.Insert(0, (nal.i_type == NAL_SLICE_IDR) ? 0x17 : 0x27);
-                    newPacket->Packet.Insert(1, 1);
-                    newPacket->Packet.InsertArray(2, timeOffsetAddr, 3);
+        x264_host_frame &frame = *(x264_host_frame*)data;
+        UINT flags = 0;
+        UINT length = UINT(x264_host_frame_data_offset());
 
-                    bFoundFrame = true;
-                }
+        frame.pts = 0;
+
+        if(bReconfigure)
+        {
+            frame.max_bitrate = newMaxBitrate;
+            frame.buffer_size = newBufferSize;
+            flags |= X264_HOST_FRAME_RECONFIG;
+            bReconfigure = false;
+        }
 
-                int newPayloadSize = (nal.i_payload-skipBytes);
-                BufferOutputSerializer packetOut(newPacket->Packet);
+        if(picIn)
+        {
+            frame.pts = picIn->i_pts;
 
-                packetOut.OutputDword(htonl(newPayloadSize));
-                packetOut.Serialize(nal.p_payload+skipBytes, newPayloadSize);
+            if(bRequestKeyframe)
+            {
+                flags |= X264_HOST_FRAME_KEYFRAME;
+                bRequestKeyframe = false;
+            }
 
-                switch(nal.i_ref_idc)
+            //NV12, packed to a pitch of width in the slot
+            LPBYTE lpDest = data+x264_host_frame_data_offset();
+            for(int plane=0; plane<2; plane++)
+            {
+                UINT planeHeight = plane ? height/2 : height;
+                UINT srcPitch = UINT(picIn->img.i_stride[plane]);
+                LPBYTE lpSrc = picIn->img.plane[plane];
+
+                if(srcPitch == width)
+                    mcpy(lpDest, lpSrc, width*planeHeight);
+                else
                 {
-                    case NAL_PRIORITY_DISPOSABLE:   bestType = MAX(bestType, PacketType_VideoDisposable);  break;
-                    case NAL_PRIORITY_LOW:          bestType = MAX(bestType, PacketType_VideoLow);         break;
-                    case NAL_PRIORITY_HIGH:         bestType = MAX(bestType, PacketType_VideoHigh);        break;
-                    case NAL_PRIORITY_HIGHEST:      bestType = MAX(bestType, PacketType_VideoHighest);     break;
+                    for(UINT y=0; y<planeHeight; y++)
+                        mcpy(lpDest+y*width, lpSrc+y*srcPitch, width);
                 }
+
+                lpDest += width*planeHeight;
             }
-            /*else if(nal.i_type == NAL_SPS)
-            {
-                VideoPacket *newPacket = CurrentPackets.CreateNew();
-                BufferOutputSerializer headerOut(newPacket->Packet);
-
-                headerOut.OutputByte(0x17);
-                headerOut.OutputByte(0);
-                headerOut.Serialize(timeOffsetAddr, 3);
-                headerOut.OutputByte(1);
-                headerOut.Serialize(nal.p_payload+5, 3);
-                headerOut.OutputByte(0xff);
-                headerOut.OutputByte(0xe1);
-                headerOut.OutputWord(htons(nal.i_payload-4));
-                headerOut.Serialize(nal.p_payload+4, nal.i_payload-4);
-
-                x264_nal_t &pps = nalOut[i+1]; //the PPS always comes after the SPS
-
-                headerOut.OutputByte(1);
-                headerOut.OutputWord(htons(pps.i_payload-4));
-                headerOut.Serialize(pps.p_payload+4, pps.i_payload-4);
-            }*/
-            else
-                continue;
+
+            length += width*height*3/2;
         }
+        else
+            flags |= X264_HOST_FRAME_FLUSH;
 
-        packetTypes << bestType;
+        frames.end_write(length, flags);
+        framesInFlight++;
+        return true;
+    }
+
+    bool ReceiveBitstream(bool bWait, VideoSegment &packets)
+    {
+        encoder_host::slot_header *si;
+        LPBYTE data;
+
+        if(bWait)
+            data = WaitForSlot(bitstream, false, si);
+        else
+        {
+            data = bitstream.begin_read(0, si);
+            if(!data && !host.running())
+                HostFailed(TEXT("the encoder host went away"));
+        }
+
+        if(!data)
+            return !bHostFailed;
 
-        packets.SetSize(CurrentPackets.Num());
-        for(UINT i=0; i<packets.Num(); i++)
+        size_t length = MIN(si->length, bitstream.slot_size());
+        if(length < sizeof(x264_host_bitstream))
         {
-            packets[i].lpPacket = CurrentPackets[i].Packet.Array();
-            packets[i].size     = CurrentPackets[i].Packet.Num();
+            bitstream.end_read();
+            HostFailed(TEXT("the encoder host sent a bitstream record that's too short"));
+            return false;
+        }
+
+        x264_host_bitstream record;
+        mcpy(&record, data, sizeof(record));
+
+        framesInFlight--;
+        delayedFrames = record.delayed_frames;
+
+        App->RecordFrameStage(FrameStage_HostHandoff, record.frame_dequeued_ns-record.frame_queued_ns);
+
+        if(record.reconfig_result < 0)
+            Log(TEXT("Could not set new encoder bitrate, error value %d"), record.reconfig_result);
+
+        if(record.status == X264_HOST_STATUS_TRUNCATED)
+        {
+            Log(TEXT("X264Host: a frame was too large for the bitstream slot and got dropped"));
+            bRequestKeyframe = true;
+        }
+
+        x264_host_nal *hostNals = (x264_host_nal*)(data+sizeof(x264_host_bitstream));
+        size_t tableSpace = length-sizeof(x264_host_bitstream);
+
+        if(!ReadHostNals(hostNals, record.nal_count, tableSpace, (LPBYTE)(hostNals+record.nal_count), tableSpace-size_t(record.nal_count)*sizeof(x264_host_nal), nals))
+        {
+            bitstream.end_read();
+            HostFailed(TEXT("the encoder host sent a bitstream record with nals that don't fit it"));
+            return false;
+        }
+
+        PacketizeX264Frame(nals.Array(), int(nals.Num()), record.pts, record.dts, bIntraRefresh && record.keyframe, frameShift, SEIData, packets);
+
+        bitstream.end_read();
+
+        if(record.status == X264_HOST_STATUS_FAILED)
+        {
+            AppWarning(TEXT("x264 encode failed"));
+            return false;
         }
 
         return true;
     }
 
-    void GetHeaders(DataPacket &packet)
+public:
+    X264HostEncoder()
     {
-        if(!HeaderPacket.Num())
+        control = NULL;
+        width = height = 0;
+        fps = 0;
+        bUseCBR = bUseCFR = bPadCBR = false;
+        bLowLatency = bIntraRefresh = false;
+        curMaxBitrate = curBufferSize = 0;
+        newMaxBitrate = newBufferSize = 0;
+        bReconfigure = false;
+        bRequestKeyframe = false;
+        framesInFlight = 0;
+        delayedFrames = 0;
+        bHostFailed = false;
+        frameShift = 0;
+    }
+
+    bool Init(int fps, int width, int height, int quality, CTSTR preset, ColorDescription &colorDesc, int maxBitrate, int bufferSize, bool bUseCFR, bool bUseCBR, bool bLowLatency, bool bIntraRefresh)
+    {
+        this->fps    = fps;
+        this->width  = width;
+        this->height = height;
+        this->bUseCFR = bUseCFR;
+        this->bUseCBR = bUseCBR;
+        this->bLowLatency = bLowLatency;
+
+        curPreset = preset;
+        this->bIntraRefresh = bLowLatency && bIntraRefresh;
+        if(bLowLatency)
+            curTune = TEXT("zerolatency");
+
+        bPadCBR = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("PadCBR"), 1) != 0;
+        curProfile = AppConfig->GetString(TEXT("Video Encoding"), TEXT("X264Profile"), TEXT("high"));
+
+        StringList paramList;
+        GetX264CustomParams(paramList, curPreset, curTune, curProfile);
+
+        //-------------------------------------------------------------
+
+        static LONG numHosts = 0;
+        String strPrefix = FormattedString(TEXT("OBSX264Host%u_%d_"), GetCurrentProcessId(), InterlockedIncrement(&numHosts));
+
+        LPSTR lpPrefix = strPrefix.CreateUTF8String();
+        std::string prefix = lpPrefix;
+        Free(lpPrefix);
+
+        if(!controlMemory.create(prefix+X264_HOST_CONTROL, sizeof(x264_host_control)) ||
+           !hostReady.create(prefix+X264_HOST_READY, 0, 1) ||
+           !frames.create(prefix+X264_HOST_FRAMES, X264_HOST_FRAME_SLOTS, x264_host_frame_slot_size(width, height)) ||
+           !bitstream.create(prefix+X264_HOST_BITSTREAM, X264_HOST_BITSTREAM_SLOTS, x264_host_bitstream_slot_size(width, height)))
         {
-            x264_nal_t *nalOut;
-            int nalNum;
+            Log(TEXT("X264Host: could not create the shared memory for the encoder host"));
+            return false;
+        }
 
-            x264_encoder_headers(x264, &nalOut, &nalNum);
+        control = controlMemory.as<x264_host_control>();
+        x264_host_init &init = control->init;
+
+        init.version        = X264_HOST_VERSION;
+        init.obs_process_id = GetCurrentProcessId();
+        FillX264HostInit(init, fps, width, height, quality, curPreset, curTune, curProfile, colorDesc,
+                         maxBitrate, bufferSize, bUseCBR, bPadCBR, bUseCFR, this->bIntraRefresh, paramList);
 
-            for(int i=0; i<nalNum; i++)
+        String strLogPath = FormattedString(TEXT("%s/pluginData/X264Helper.log"), OBSGetAppDataPath());
+        CopyStringUTF8(strLogPath, init.log_path, sizeof(init.log_path));
+
+        init.frame_slot_size     = frames.slot_size();
+        init.bitstream_slot_size = bitstream.slot_size();
+
+        //-------------------------------------------------------------
+
+        TCHAR lpCurDir[MAX_PATH];
+        GetCurrentDirectory(MAX_PATH, lpCurDir);
+        String strHelperPath = FormattedString(TEXT("%s/X264Helper.exe"), lpCurDir);
+
+        LPSTR lpHelperPath = strHelperPath.CreateUTF8String();
+        std::string helperPath = lpHelperPath;
+        Free(lpHelperPath);
+
+        std::vector<std::string> args;
+        args.push_back(prefix);
+
+        if(!host.spawn(helperPath, args))
+        {
+            Log(TEXT("X264Host: could not start '%s'"), strHelperPath.Array());
+            return false;
+        }
+
+        DWORD startTime = OSGetTime();
+        while(!hostReady.wait(50))
+        {
+            if(!host.running())
             {
-                x264_nal_t &nal = nalOut[i];
+                Log(TEXT("X264Host: X264Helper.exe exited with code %d while starting"), host.exit_code);
+                return false;
+            }
 
-                if(nal.i_type == NAL_SPS)
-                {
-                    BufferOutputSerializer headerOut(HeaderPacket);
-
-                    headerOut.OutputByte(0x17);
-                    headerOut.OutputByte(0);
-                    headerOut.OutputByte(0);
-                    headerOut.OutputByte(0);
-                    headerOut.OutputByte(0);
-                    headerOut.OutputByte(1);
-                    headerOut.Serialize(nal.p_payload+5, 3);
-                    headerOut.OutputByte(0xff);
-                    headerOut.OutputByte(0xe1);
-                    headerOut.OutputWord(htons(nal.i_payload-4));
-                    headerOut.Serialize(nal.p_payload+4, nal.i_payload-4);
-
-                    x264_nal_t &pps = nalOut[i+1]; //the PPS always comes after the SPS
-
-                    headerOut.OutputByte(1);
-                    headerOut.OutputWord(htons(pps.i_payload-4));
-                    headerOut.Serialize(pps.p_payload+4, pps.i_payload-4);
-                }
+            if(OSGetTime()-startTime > x264HostTimeoutMS)
+            {
+                Log(TEXT("X264Host: X264Helper.exe didn't start in time"));
+                host.kill();
+                return false;
             }
         }
 
+        x264_host_init_response &response = control->response;
+        if(response.status != 0)
+        {
+            Log(TEXT("X264Host: X264Helper.exe could not initialize x264, see pluginData/X264Helper.log"));
+            if(!host.wait(x264HostTimeoutMS))
+                host.kill();
+            return false;
+        }
+
+        curMaxBitrate = response.vbv_max_bitrate;
+        curBufferSize = response.vbv_buffer_size;
+
+        colorDesc.fullRange = response.full_range;
+        colorDesc.primaries = response.primaries;
+        colorDesc.transfer  = response.transfer;
+        colorDesc.matrix    = response.matrix;
+
+        //-------------------------------------------------------------
+
+        //checked like any bitstream record.  nothing has been sent yet, so a bad one just means
+        //falling back to x264 in this process
+        if(!ReadHostNals(response.header_nals, response.header_nal_count, sizeof(response.header_nals), response.header_data, sizeof(response.header_data), nals))
+        {
+            Log(TEXT("X264Host: X264Helper.exe sent bad headers (%u nals), stopping it"), response.header_nal_count);
+            host.kill();
+            return false;
+        }
+
+        BuildX264Headers(nals.Array(), int(nals.Num()), HeaderPacket);
+
+        Log(TEXT("------------------------------------------"));
+        Log(TEXT("%s"), GetInfoString().Array());
+        Log(TEXT("------------------------------------------"));
+
+        return true;
+    }
+
+    ~X264HostEncoder()
+    {
+        if(!host.running())
+            return;
+
+        //the host may be waiting for a bitstream slot, so keep the ring drained until it's gone
+        encoder_host::slot_header *si;
+        if(frames.begin_write(x264HostTimeoutMS))
+            frames.end_write(0, X264_HOST_FRAME_STOP);
+
+        DWORD startTime = OSGetTime();
+        while(host.running() && OSGetTime()-startTime < x264HostTimeoutMS)
+        {
+            while(bitstream.begin_read(0, si))
+                bitstream.end_read();
+
+            OSSleep(10);
+        }
+
+        if(host.running())
+        {
+            Log(TEXT("X264Host: X264Helper.exe didn't exit, stopping it"));
+            host.kill();
+        }
+    }
+
+    bool Encode(LPVOID picInPtr, VideoSegment &packets, DWORD outputTimestamp)
+    {
+        x264_picture_t *picIn = (x264_picture_t*)picInPtr;
+
+        packets.Reset();
+
+        if(bHostFailed)
+            return false;
+
+        //when flushing, collect what's still on its way back before asking the host to drain x264
+        if(picIn || !framesInFlight)
+        {
+            if(!SendPicture(picIn))
+                return false;
+        }
+
+        //keep the host a couple of frames ahead, low latency waits for every frame
+        bool bWait = !picIn || bLowLatency || framesInFlight > x264HostMaxFramesInFlight;
+        return ReceiveBitstream(bWait, packets);
+    }
+
+    void GetHeaders(DataPacket &packet)
+    {
         packet.lpPacket = HeaderPacket.Array();
         packet.size     = HeaderPacket.Num();
     }
@@ -517,30 +1045,33 @@ public:
 
     int GetBitRate() const
     {
-        if (paramData.rc.i_vbv_max_bitrate)
-            return paramData.rc.i_vbv_max_bitrate;
+        if(curMaxBitrate)
+            return curMaxBitrate;
         else
-            return paramData.rc.i_bitrate;
+            return control->response.bitrate;
     }
 
     String GetInfoString() const
     {
+        const x264_host_init_response &response = control->response;
+
         String strInfo;
 
-        strInfo << TEXT("Video Encoding: x264")  <<
-                   TEXT("\r\n    fps: ")         << IntString(paramData.i_fps_num) <<
+        strInfo << TEXT("Video Encoding: x264 (X264Helper.exe)")  <<
+                   TEXT("\r\n    fps: ")         << IntString(fps) <<
                    TEXT("\r\n    width: ")       << IntString(width) << TEXT(", height: ") << IntString(height) <<
                    TEXT("\r\n    preset: ")      << curPreset <<
                    TEXT("\r\n    profile: ")     << curProfile <<
-                   TEXT("\r\n    keyint: ")      << paramData.i_keyint_max <<
+                   TEXT("\r\n    keyint: ")      << response.keyint_max <<
                    TEXT("\r\n    CBR: ")         << CTSTR((bUseCBR) ? TEXT("yes") : TEXT("no")) <<
                    TEXT("\r\n    CFR: ")         << CTSTR((bUseCFR) ? TEXT("yes") : TEXT("no")) <<
-                   TEXT("\r\n    max bitrate: ") << IntString(paramData.rc.i_vbv_max_bitrate) <<
-                   TEXT("\r\n    buffer size: ") << IntString(paramData.rc.i_vbv_buffer_size);
+                   TEXT("\r\n    low latency: ") << CTSTR((bLowLatency) ? (bIntraRefresh ? TEXT("yes, intra refresh") : TEXT("yes")) : TEXT("no")) <<
+                   TEXT("\r\n    max bitrate: ") << IntString(response.vbv_max_bitrate) <<
+                   TEXT("\r\n    buffer size: ") << IntString(response.vbv_buffer_size);
 
         if(!bUseCBR)
         {
-            strInfo << TEXT("\r\n    quality: ")     << IntString(10-int(paramData.rc.f_rf_constant-baseCRF));
+            strInfo << TEXT("\r\n    quality: ")     << IntString(10-int(response.rf_constant-X264_HOST_BASE_CRF));
         }
 
         return strInfo;
@@ -548,18 +1079,21 @@ public:
 
     virtual bool DynamicBitrateSupported() const
     {
-        return (paramData.i_nal_hrd != X264_NAL_HRD_CBR);
+        return (control->response.nal_hrd != X264_NAL_HRD_CBR);
     }
 
+    //applied by the host before the next frame, a failure shows up in the log
     virtual bool SetBitRate(DWORD maxBitrate, DWORD bufferSize)
     {
-        SetBitRateParams(maxBitrate, bufferSize);
-
-        int retVal = x264_encoder_reconfig(x264, &paramData);
-        if(retVal < 0)
-            Log(TEXT("Could not set new encoder bitrate, error value %u"), retVal);
-
-        return retVal == 0;
+        if(maxBitrate != -1)
+            curMaxBitrate = int(maxBitrate);
+        if(bufferSize != -1)
+            curBufferSize = int(bufferSize);
+
+        newMaxBitrate = int(maxBitrate);
+        newBufferSize = int(bufferSize);
+        bReconfigure = true;
+        return true;
     }
 
     virtual void RequestKeyframe()
@@ -569,18 +1103,26 @@ public:
 
     virtual int GetBufferedFrames()
     {
-        return x264_encoder_delayed_frames(x264);
+        return int(framesInFlight)+delayedFrames;
     }
 
     virtual bool HasBufferedFrames()
     {
-        return x264_encoder_delayed_frames(x264) > 0;
+        return !bHostFailed && (framesInFlight || delayedFrames > 0);
     }
 };
 
 
-VideoEncoder* CreateX264Encoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitRate, int bufferSize, bool bUseCFR)
+VideoEncoder* CreateX264HostEncoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitRate, int bufferSize, bool bUseCFR, bool bUseCBR, bool bLowLatency, bool bIntraRefresh)
 {
-    return new X264Encoder(fps, width, height, quality, preset, bUse444, colorDesc, maxBitRate, bufferSize, bUseCFR);
-}
+    //the frame slots only carry NV12
+    if(bUse444)
+        return NULL;
+
+    X264HostEncoder *encoder = new X264HostEncoder;
+    if(encoder->Init(fps, width, height, quality, preset, colorDesc, maxBitRate, bufferSize, bUseCFR, bUseCBR, bLowLatency, bIntraRefresh))
+        return encoder;
 
+    delete encoder;
+    return NULL;
+}
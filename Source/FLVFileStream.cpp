@@ -24,9 +24,11 @@
 
 class FLVFileStream : public VideoFileStream
 {
-    XFileOutputSerializer fileOut;
+    AsyncFileWriter fileOut;
     String strFile;
 
+    VideoStreamInfo videoInfo;
+
     UINT64 metaDataPos;
     DWORD lastTimeStamp, initialTimeStamp;
 
@@ -36,7 +38,7 @@ class FLVFileStream : public VideoFileStream
     {
         if (!bSentSEI && type == 9 && lpData[0] == 0x17 && lpData[1] == 0x1) { //send SEI with first keyframe packet
             DataPacket sei;
-            App->GetVideoEncoder()->GetSEI(sei);
+            videoInfo.encoder->GetSEI(sei);
 
             UINT networkDataSize  = fastHtonl(size+sei.size);
             UINT networkTimestamp = fastHtonl(timestamp-initialTimeStamp);
@@ -69,12 +71,13 @@ class FLVFileStream : public VideoFileStream
     }
 
 public:
-    bool Init(CTSTR lpFile)
+    bool Init(CTSTR lpFile, const VideoStreamInfo &videoInfo)
     {
         strFile = lpFile;
+        this->videoInfo = videoInfo;
         initialTimeStamp = -1;
 
-        if(!fileOut.Open(lpFile, XFILE_CREATEALWAYS, 1024*1024))
+        if(!fileOut.Open(lpFile))
             return false;
 
         fileOut.OutputByte('F');
@@ -92,7 +95,7 @@ public:
         char *pend = metaDataBuffer+sizeof(metaDataBuffer);
 
         enc = AMF_EncodeString(enc, pend, &av_onMetaData);
-        char *endMetaData  = App->EncMetaData(enc, pend, true);
+        char *endMetaData  = App->EncMetaData(enc, pend, true, &videoInfo);
         UINT  metaDataSize = endMetaData-metaDataBuffer;
 
         AppendFLVPacket((LPBYTE)metaDataBuffer, metaDataSize, 18, 0);
@@ -104,8 +107,9 @@ public:
         UINT64 fileSize = fileOut.GetPos();
         fileOut.Close();
 
+        //a file that's cut short keeps the zero duration and size it started with
         XFile file;
-        if(file.Open(strFile, XFILE_WRITE, XFILE_OPENEXISTING))
+        if(!fileOut.WriteFailed() && file.Open(strFile, XFILE_WRITE, XFILE_OPENEXISTING))
         {
             double doubleFileSize = double(fileSize);
             double doubleDuration = double(lastTimeStamp/1000);
@@ -124,15 +128,18 @@ public:
         }
     }
 
-    virtual void AddPacket(BYTE *data, UINT size, DWORD timestamp, PacketType type)
+    virtual void AddPacket(PacketBuffer *packet, DWORD timestamp, PacketType type)
     {
+        LPBYTE data = packet->Data();
+        UINT size = packet->Size();
+
         if(!bSentFirstPacket)
         {
             bSentFirstPacket = true;
 
             DataPacket audioHeaders, videoHeaders;//, videoSEI;
             App->GetAudioHeaders(audioHeaders);
-            App->GetVideoHeaders(videoHeaders);
+            videoInfo.encoder->GetHeaders(videoHeaders);
 
             AppendFLVPacket(audioHeaders.lpPacket, audioHeaders.size, 8, 0);
             AppendFLVPacket(videoHeaders.lpPacket, videoHeaders.size, 9, 0);
@@ -149,12 +156,20 @@ public:
 };
 
 
-VideoFileStream* CreateFLVFileStream(CTSTR lpFile)
+VideoFileStream* CreateFLVFileStream(CTSTR lpFile, const VideoStreamInfo &videoInfo)
 {
     FLVFileStream *fileStream = new FLVFileStream;
-    if(fileStream->Init(lpFile))
+    if(fileStream->Init(lpFile, videoInfo))
         return fileStream;
 
     delete fileStream;
     return NULL;
 }
+
+VideoFileStream* CreateFLVFileStream(CTSTR lpFile)
+{
+    VideoStreamInfo videoInfo;
+    App->GetVideoStreamInfo(videoInfo);
+
+    return CreateFLVFileStream(lpFile, videoInfo);
+}
@@ -0,0 +1,241 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "Main.h"
+#include "FrameDropIndex.h"
+
+
+FrameDropIndex::FrameDropIndex(UINT size)
+{
+    this->size = size;
+    mask = size-1;
+
+    info = (SlotInfo*)Allocate(sizeof(SlotInfo)*size);
+    zero(info, sizeof(SlotInfo)*size);
+
+    //trees are laid out heap style, node 1 is the root and the leaves start at size
+    for(UINT i=0; i<=PacketType_VideoHighest; i++)
+    {
+        trees[i] = (UINT*)Allocate(sizeof(UINT)*size*2);
+        msetd(trees[i], INVALID, sizeof(UINT)*size*2);
+    }
+}
+
+FrameDropIndex::~FrameDropIndex()
+{
+    for(UINT i=0; i<=PacketType_VideoHighest; i++)
+        Free(trees[i]);
+    Free(info);
+}
+
+void FrameDropIndex::UpdateSlot(PacketType type, UINT slot)
+{
+    if(type > PacketType_VideoHighest)
+        return;
+
+    UINT *tree = trees[type];
+    UINT node = size+slot;
+
+    tree[node] = (info[slot].bQueued && info[slot].type == type) ? slot : INVALID;
+
+    for(node >>= 1; node; node >>= 1)
+        tree[node] = Furthest(tree[node*2], tree[node*2+1]);
+}
+
+UINT FrameDropIndex::QueryFurthest(const UINT *tree, UINT node, UINT nodeLo, UINT nodeHi, UINT lo, UINT hi) const
+{
+    if(hi <= nodeLo || nodeHi <= lo || tree[node] == INVALID)
+        return INVALID;
+    if(lo <= nodeLo && nodeHi <= hi)
+        return tree[node];
+
+    UINT mid = (nodeLo+nodeHi)/2;
+    return Furthest(QueryFurthest(tree, node*2, nodeLo, mid, lo, hi), QueryFurthest(tree, node*2+1, mid, nodeHi, lo, hi));
+}
+
+UINT FrameDropIndex::QueryLast(const UINT *tree, UINT node, UINT nodeLo, UINT nodeHi, UINT lo, UINT hi) const
+{
+    if(hi <= nodeLo || nodeHi <= lo || tree[node] == INVALID)
+        return INVALID;
+    if(nodeHi-nodeLo == 1)
+        return nodeLo;
+
+    UINT mid = (nodeLo+nodeHi)/2;
+    UINT slot = QueryLast(tree, node*2+1, mid, nodeHi, lo, hi);
+    if(slot != INVALID)
+        return slot;
+
+    return QueryLast(tree, node*2, nodeLo, mid, lo, hi);
+}
+
+void FrameDropIndex::Add(UINT pos, PacketType type, UINT distance)
+{
+    UINT slot = pos & mask;
+    SlotInfo &slotInfo = info[slot];
+
+    //whatever used to be in this slot has long since been sent
+    PacketType oldType = slotInfo.type;
+    bool bWasQueued = slotInfo.bQueued;
+
+    slotInfo.pos = pos;
+    slotInfo.type = type;
+    slotInfo.distance = distance;
+    slotInfo.bQueued = true;
+
+    if(bWasQueued && oldType != type)
+        UpdateSlot(oldType, slot);
+    UpdateSlot(type, slot);
+}
+
+void FrameDropIndex::Remove(UINT pos)
+{
+    UINT slot = pos & mask;
+    SlotInfo &slotInfo = info[slot];
+
+    if(slotInfo.pos != pos || !slotInfo.bQueued)
+        return;
+
+    slotInfo.bQueued = false;
+    UpdateSlot(slotInfo.type, slot);
+}
+
+void FrameDropIndex::SetDistance(UINT pos, UINT distance)
+{
+    UINT slot = pos & mask;
+    info[slot].distance = distance;
+
+    if(info[slot].bQueued)
+        UpdateSlot(info[slot].type, slot);
+}
+
+bool FrameDropIndex::FindFurthest(PacketType maxType, UINT first, UINT end, UINT &pos) const
+{
+    UINT num = end-first;
+    if(!num)
+        return false;
+
+    //the range can wrap around the end of the ring, in which case the part at the end comes first
+    UINT lo = first & mask;
+    UINT hi = lo+num;
+    UINT wrapHi = (hi > size) ? hi-size : 0;
+    if(hi > size)
+        hi = size;
+
+    UINT bestSlot = INVALID;
+
+    for(UINT type=0; type<=UINT(maxType) && type<=PacketType_VideoHighest; type++)
+    {
+        UINT slot = QueryFurthest(trees[type], 1, 0, size, lo, hi);
+        if(wrapHi)
+        {
+            UINT wrapSlot = QueryFurthest(trees[type], 1, 0, size, 0, wrapHi);
+            if(wrapSlot != INVALID && (slot == INVALID || info[wrapSlot].distance > info[slot].distance))
+                slot = wrapSlot;
+        }
+
+        if(slot == INVALID)
+            continue;
+
+        if(bestSlot == INVALID || info[slot].distance > info[bestSlot].distance ||
+           (info[slot].distance == info[bestSlot].distance && info[slot].pos-first < info[bestSlot].pos-first))
+        {
+            bestSlot = slot;
+        }
+    }
+
+    if(bestSlot == INVALID || !info[bestSlot].distance)
+        return false;
+
+    pos = info[bestSlot].pos;
+    return true;
+}
+
+bool FrameDropIndex::FindLast(PacketType type, UINT first, UINT end, UINT &pos) const
+{
+    UINT num = end-first;
+    if(!num || type > PacketType_VideoHighest)
+        return false;
+
+    UINT lo = first & mask;
+    UINT hi = lo+num;
+    UINT slot = INVALID;
+
+    if(hi > size)
+        slot = QueryLast(trees[type], 1, 0, size, 0, hi-size);
+    if(slot == INVALID)
+        slot = QueryLast(trees[type], 1, 0, size, lo, MIN(hi, size));
+
+    if(slot == INVALID)
+        return false;
+
+    pos = info[slot].pos;
+    return true;
+}
+
+
+void FrameDropIndex::MarkDropped(UINT pos, UINT first, UINT end)
+{
+    SetDistance(pos, 0);
+
+    for(UINT i=pos+1; i!=end; i++)
+    {
+        UINT distance = (i-pos);
+        if(GetDistance(i) <= distance)
+            break;
+
+        SetDistance(i, distance);
+    }
+
+    for(UINT i=pos; i!=first;)
+    {
+        i--;
+
+        UINT distance = (pos-i);
+        if(GetDistance(i) <= distance)
+            break;
+
+        SetDistance(i, distance);
+    }
+}
+
+bool FrameDropIndex::SelectDrop(bool bBFramesOnly, UINT first, UINT end, UINT &pos) const
+{
+    int curWaitType = PacketType_VideoDisposable;
+
+    while(!bBFramesOnly && curWaitType < PacketType_VideoHighest ||
+           bBFramesOnly && curWaitType < PacketType_VideoHigh)
+    {
+        if(curWaitType == PacketType_VideoHigh)
+        {
+            //prefer the last p-frame before the last i-frame, otherwise just the last p-frame
+            UINT lastIFrame;
+
+            if(FindLast(PacketType_VideoHighest, first, end, lastIFrame) && FindLast(PacketType_VideoHigh, first, lastIFrame, pos))
+                return true;
+            if(FindLast(PacketType_VideoHigh, first, end, pos))
+                return true;
+        }
+        else if(FindFurthest((PacketType)curWaitType, first, end, pos))
+            return true;
+
+        curWaitType++;
+    }
+
+    return false;
+}
@@ -0,0 +1,79 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#pragma once
+
+
+//index of the queued video packets for the frame drop logic, keyed by the same free-running
+//positions as NetworkPacketQueue.  each video PacketType has its own segment tree over the
+//queue slots, so finding the packet furthest from any dropped frame, or the last packet of a
+//type, is O(log n) instead of a walk over the whole queue.  it knows nothing about the
+//network, only positions, types and distances, and is only ever touched by the encode thread
+class FrameDropIndex
+{
+    struct SlotInfo
+    {
+        UINT pos;
+        UINT distance;
+        PacketType type;
+        bool bQueued;
+    };
+
+    SlotInfo *info;
+    UINT *trees[PacketType_VideoHighest+1];
+    UINT size, mask;
+
+    inline UINT Furthest(UINT a, UINT b) const
+    {
+        if(a == INVALID) return b;
+        if(b == INVALID) return a;
+        return (info[b].distance > info[a].distance) ? b : a;
+    }
+
+    void UpdateSlot(PacketType type, UINT slot);
+    UINT QueryFurthest(const UINT *tree, UINT node, UINT nodeLo, UINT nodeHi, UINT lo, UINT hi) const;
+    UINT QueryLast(const UINT *tree, UINT node, UINT nodeLo, UINT nodeHi, UINT lo, UINT hi) const;
+
+public:
+    //size is the number of queue slots, must be a power of two
+    FrameDropIndex(UINT size);
+    ~FrameDropIndex();
+
+    //audio is tracked for distances but never offered up for dropping
+    void Add(UINT pos, PacketType type, UINT distance);
+    void Remove(UINT pos);
+
+    void SetDistance(UINT pos, UINT distance);
+    inline UINT GetDistance(UINT pos) const {return info[pos & mask].distance;}
+
+    //searches [first, end) for the video packet of maxType or lower that's furthest from a
+    //dropped frame, taking the earliest on a tie.  fails if the best distance is 0
+    bool FindFurthest(PacketType maxType, UINT first, UINT end, UINT &pos) const;
+
+    //searches [first, end) for the latest packet of the given video type
+    bool FindLast(PacketType type, UINT first, UINT end, UINT &pos) const;
+
+    //the packet at pos was dropped: its distance goes to 0 and the distances of the queued
+    //packets around it in [first, end) are pulled in towards it
+    void MarkDropped(UINT pos, UINT first, UINT end);
+
+    //picks the frame to drop when the queue is too long: the b-frame furthest from any dropped
+    //frame, then the last p-frame before the last i-frame.  bBFramesOnly stops at b-frames
+    bool SelectDrop(bool bBFramesOnly, UINT first, UINT end, UINT &pos) const;
+};
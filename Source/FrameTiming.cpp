@@ -0,0 +1,154 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "Main.h"
+#include <intrin.h>
+
+
+static CTSTR frameStageNames[FrameStage_Count] =
+{
+    TEXT("capture"),
+    TEXT("readback"),
+    TEXT("convert"),
+    TEXT("encode"),
+    TEXT("queued"),
+    TEXT("sent"),
+    TEXT("tick jitter"),
+    TEXT("tick to output"),
+    TEXT("host handoff"),
+};
+
+//--------------------------------------------------------------------------
+
+UINT LatencyHistogram::BucketIndex(DWORD value)
+{
+    if(value < LATENCY_LINEAR_BUCKETS)
+        return value;
+
+    DWORD highBit;
+    _BitScanReverse(&highBit, value);
+
+    //the top 5 bits pick the bucket, the leading 1 is implied by highBit
+    UINT subBucket = (value >> (highBit-4)) & (LATENCY_SUB_BUCKETS-1);
+    return LATENCY_LINEAR_BUCKETS + (highBit-5)*LATENCY_SUB_BUCKETS + subBucket;
+}
+
+DWORD LatencyHistogram::BucketTop(UINT index)
+{
+    if(index < LATENCY_LINEAR_BUCKETS)
+        return index;
+
+    UINT highBit   = (index-LATENCY_LINEAR_BUCKETS)/LATENCY_SUB_BUCKETS + 5;
+    UINT subBucket = (index-LATENCY_LINEAR_BUCKETS)%LATENCY_SUB_BUCKETS;
+
+    QWORD bottom = QWORD(LATENCY_SUB_BUCKETS+subBucket) << (highBit-4);
+    return DWORD(bottom + (QWORD(1) << (highBit-4)) - 1);
+}
+
+//not safe against a concurrent Record, a value recorded right then may be half counted
+void LatencyHistogram::Reset()
+{
+    for(UINT i=0; i<LATENCY_NUM_BUCKETS; i++)
+        counts[i] = 0;
+
+    numValues = 0;
+    totalTime = 0;
+    minTime = 0x7FFFFFFF;
+    maxTime = 0;
+}
+
+void LatencyHistogram::Record(QWORD timeNS)
+{
+    QWORD timeUS = timeNS/1000;
+    LONG value = (timeUS > 0x7FFFFFFF) ? 0x7FFFFFFF : LONG(timeUS);
+
+    InterlockedIncrement(&counts[BucketIndex(DWORD(value))]);
+    InterlockedIncrement64(&numValues);
+    InterlockedExchangeAdd64(&totalTime, value);
+
+    LONG cur;
+    while(value < (cur = minTime) && InterlockedCompareExchange(&minTime, value, cur) != cur);
+    while(value > (cur = maxTime) && InterlockedCompareExchange(&maxTime, value, cur) != cur);
+}
+
+void LatencyHistogram::GetStats(FrameStageStats &stats) const
+{
+    zero(&stats, sizeof(stats));
+
+    //percentiles are taken from a copy so they agree with each other even while recording
+    LONG snapshot[LATENCY_NUM_BUCKETS];
+    QWORD total = 0;
+
+    for(UINT i=0; i<LATENCY_NUM_BUCKETS; i++)
+    {
+        snapshot[i] = counts[i];
+        total += snapshot[i];
+    }
+
+    if(!total)
+        return;
+
+    stats.count   = total;
+    stats.minTime = DWORD(minTime);
+    stats.maxTime = DWORD(maxTime);
+    stats.avgTime = double(totalTime)/double(numValues);
+
+    //in thousandths of a percent
+    const QWORD percentiles[3] = {50000, 99000, 99900};
+    DWORD *outputs[3] = {&stats.p50, &stats.p99, &stats.p999};
+
+    QWORD runningTotal = 0;
+    UINT curPercentile = 0;
+
+    for(UINT i=0; i<LATENCY_NUM_BUCKETS && curPercentile < 3; i++)
+    {
+        runningTotal += snapshot[i];
+
+        while(curPercentile < 3 && runningTotal*100000 >= total*percentiles[curPercentile])
+        {
+            *outputs[curPercentile] = MIN(BucketTop(i), stats.maxTime);
+            curPercentile++;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void OBS::DumpFrameTiming() const
+{
+    Log(TEXT("Frame stage latency (microseconds):"));
+
+    for(UINT i=0; i<FrameStage_Count; i++)
+    {
+        FrameStageStats stats;
+        frameTiming[i].GetStats(stats);
+
+        if(!stats.count)
+            continue;
+
+        Log(TEXT("  %-12s count: %llu, avg: %.1f, min: %u, p50: %u, p99: %u, p99.9: %u, max: %u"),
+            frameStageNames[i], stats.count, stats.avgTime, stats.minTime, stats.p50, stats.p99, stats.p999, stats.maxTime);
+    }
+}
+
+void OBS::ResetFrameTiming()
+{
+    for(UINT i=0; i<FrameStage_Count; i++)
+        frameTiming[i].Reset();
+}
@@ -17,11 +17,83 @@
 ********************************************************************************/
 
 #include "Main.h"
+#include <intrin.h>
+#include <immintrin.h>
 
 
-void Convert444toI420(LPBYTE input, int width, int pitch, int height, int startY, int endY, LPBYTE *output)
+//the 4:4:4 input is 32bit per pixel: byte 0 is U, byte 1 is Y, byte 2 is V.
+//every variant must give exactly the same output as the scalar one, chroma is the
+//truncated average of each 2x2 block.
+
+//--------------------------------------------------------------------------
+// scalar reference, also handles the columns left over by the vector versions
+
+static void Convert444toNV12_Scalar(LPBYTE input, int inPitch, int outPitch, int startX, int endX, int startY, int endY, LPBYTE *output)
+{
+    LPBYTE lumPlane = output[0];
+    LPBYTE uvPlane  = output[1];
+
+    for(int y=startY; y<endY; y+=2)
+    {
+        LPBYTE line1 = input+(y*inPitch);
+        LPBYTE line2 = line1+inPitch;
+        LPBYTE lum1  = lumPlane+(y*outPitch);
+        LPBYTE lum2  = lum1+outPitch;
+        LPBYTE uv    = uvPlane+((y>>1)*outPitch);
+
+        for(int x=startX; x<endX; x+=2)
+        {
+            LPBYTE p1 = line1+(x*4);
+            LPBYTE p2 = line2+(x*4);
+
+            lum1[x]   = p1[1];
+            lum1[x+1] = p1[5];
+            lum2[x]   = p2[1];
+            lum2[x+1] = p2[5];
+
+            uv[x]   = BYTE((p1[0]+p1[4]+p2[0]+p2[4])>>2);
+            uv[x+1] = BYTE((p1[2]+p1[6]+p2[2]+p2[6])>>2);
+        }
+    }
+}
+
+static void Convert444toI420_Scalar(LPBYTE input, int width, int pitch, int startX, int endX, int startY, int endY, LPBYTE *output)
+{
+    LPBYTE lumPlane = output[0];
+    LPBYTE uPlane   = output[1];
+    LPBYTE vPlane   = output[2];
+    int  chrPitch   = width>>1;
+
+    for(int y=startY; y<endY; y+=2)
+    {
+        LPBYTE line1 = input+(y*pitch);
+        LPBYTE line2 = line1+pitch;
+        LPBYTE lum1  = lumPlane+(y*width);
+        LPBYTE lum2  = lum1+width;
+        LPBYTE u     = uPlane+((y>>1)*chrPitch);
+        LPBYTE v     = vPlane+((y>>1)*chrPitch);
+
+        for(int x=startX; x<endX; x+=2)
+        {
+            LPBYTE p1 = line1+(x*4);
+            LPBYTE p2 = line2+(x*4);
+
+            lum1[x]   = p1[1];
+            lum1[x+1] = p1[5];
+            lum2[x]   = p2[1];
+            lum2[x+1] = p2[5];
+
+            u[x>>1] = BYTE((p1[0]+p1[4]+p2[0]+p2[4])>>2);
+            v[x>>1] = BYTE((p1[2]+p1[6]+p2[2]+p2[6])>>2);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+// SSE2, 4 pixels at a time (width is always a multiple of 4)
+
+static void Convert444toI420_SSE2(LPBYTE input, int width, int pitch, int height, int startY, int endY, LPBYTE *output)
 {
-    profileSegment("Convert444toI420");
     LPBYTE lumPlane     = output[0];
     LPBYTE uPlane       = output[1];
     LPBYTE vPlane       = output[2];
@@ -51,8 +123,8 @@ void Convert444toI420(LPBYTE input, int width, int pitch, int height, int startY
                 __m128i packVal = _mm_packs_epi32(_mm_srli_si128(_mm_and_si128(line1, lumMask), 1), _mm_srli_si128(_mm_and_si128(line2, lumMask), 1));
                 packVal = _mm_packus_epi16(packVal, packVal);
 
-                *(LPUINT)(lumPlane+lumPos0) = packVal.m128i_u32[0];
-                *(LPUINT)(lumPlane+lumPos1) = packVal.m128i_u32[1];
+                *(LPUINT)(lumPlane+lumPos0) = _mm_cvtsi128_si32(packVal);
+                *(LPUINT)(lumPlane+lumPos1) = _mm_cvtsi128_si32(_mm_srli_si128(packVal, 4));
             }
 
             //do average, pack UV vals
@@ -63,7 +135,7 @@ void Convert444toI420(LPBYTE input, int width, int pitch, int height, int startY
                 avgVal = _mm_shufflelo_epi16(avgVal, _MM_SHUFFLE(3, 1, 2, 0));
                 avgVal = _mm_packus_epi16(avgVal, avgVal);
 
-                DWORD packedVals = avgVal.m128i_u32[0];
+                DWORD packedVals = _mm_cvtsi128_si32(avgVal);
 
                 *(LPWORD)(uPlane+chrPos) = WORD(packedVals);
                 *(LPWORD)(vPlane+chrPos) = WORD(packedVals>>16);
@@ -72,11 +144,10 @@ void Convert444toI420(LPBYTE input, int width, int pitch, int height, int startY
     }
 }
 
-void Convert444toNV12(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
+static void Convert444toNV12_SSE2(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
 {
-    profileSegment("Convert444toNV12");
     LPBYTE lumPlane     = output[0];
-    LPBYTE uvPlane		= output[1];
+    LPBYTE uvPlane      = output[1];
 
     __m128i lumMask = _mm_set1_epi32(0x0000FF00);
     __m128i uvMask = _mm_set1_epi16(0x00FF);
@@ -102,8 +173,8 @@ void Convert444toNV12(LPBYTE input, int width, int inPitch, int outPitch, int he
                 __m128i packVal = _mm_packs_epi32(_mm_srli_si128(_mm_and_si128(line1, lumMask), 1), _mm_srli_si128(_mm_and_si128(line2, lumMask), 1));
                 packVal = _mm_packus_epi16(packVal, packVal);
 
-                *(LPUINT)(lumPlane+lumPos0) = packVal.m128i_u32[0];
-                *(LPUINT)(lumPlane+lumPos1) = packVal.m128i_u32[1];
+                *(LPUINT)(lumPlane+lumPos0) = _mm_cvtsi128_si32(packVal);
+                *(LPUINT)(lumPlane+lumPos1) = _mm_cvtsi128_si32(_mm_srli_si128(packVal, 4));
             }
 
             //do average, pack UV vals
@@ -112,8 +183,634 @@ void Convert444toNV12(LPBYTE input, int width, int inPitch, int outPitch, int he
                 __m128i avgVal = _mm_srai_epi16(_mm_add_epi64(addVal, _mm_shuffle_epi32(addVal, _MM_SHUFFLE(2, 3, 0, 1))), 2);
                 avgVal = _mm_shuffle_epi32(avgVal, _MM_SHUFFLE(3, 1, 2, 0));
 
-                *(LPUINT)(uvPlane+uvPos) = _mm_packus_epi16(avgVal, avgVal).m128i_u32[0];
+                *(LPUINT)(uvPlane+uvPos) = _mm_cvtsi128_si32(_mm_packus_epi16(avgVal, avgVal));
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+// SSSE3, 8 pixels at a time.  pshufb pulls Y out directly, and lines chroma up as
+// U0 U1 V0 V1 so pmaddubsw with all ones sums horizontal pairs in one go.
+
+#define SHUF_Y_LO   _mm_setr_epi8(1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)
+#define SHUF_Y_HI   _mm_setr_epi8(-1, -1, -1, -1, 1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1)
+#define SHUF_UV_LO  _mm_setr_epi8(0, 4, 2, 6, 8, 12, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1)
+#define SHUF_UV_HI  _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 2, 6, 8, 12, 10, 14)
+#define SHUF_SPLIT  _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15)
+
+//returns 8 interleaved UV bytes in the low half for 8 pixels of two lines
+static inline __m128i AverageUV_SSSE3(__m128i a1, __m128i b1, __m128i a2, __m128i b2, __m128i shufLo, __m128i shufHi, __m128i ones)
+{
+    __m128i sum1 = _mm_maddubs_epi16(_mm_or_si128(_mm_shuffle_epi8(a1, shufLo), _mm_shuffle_epi8(b1, shufHi)), ones);
+    __m128i sum2 = _mm_maddubs_epi16(_mm_or_si128(_mm_shuffle_epi8(a2, shufLo), _mm_shuffle_epi8(b2, shufHi)), ones);
+    __m128i avg  = _mm_srli_epi16(_mm_add_epi16(sum1, sum2), 2);
+    return _mm_packus_epi16(avg, avg);
+}
+
+static void Convert444toNV12_SSSE3(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
+{
+    LPBYTE lumPlane = output[0];
+    LPBYTE uvPlane  = output[1];
+    int vecWidth    = width & ~7;
+
+    __m128i shufYLo  = SHUF_Y_LO,  shufYHi  = SHUF_Y_HI;
+    __m128i shufUVLo = SHUF_UV_LO, shufUVHi = SHUF_UV_HI;
+    __m128i ones     = _mm_set1_epi8(1);
+
+    for(int y=startY; y<endY; y+=2)
+    {
+        LPBYTE line1 = input+(y*inPitch);
+        LPBYTE line2 = line1+inPitch;
+        LPBYTE lum1  = lumPlane+(y*outPitch);
+        LPBYTE lum2  = lum1+outPitch;
+        LPBYTE uv    = uvPlane+((y>>1)*outPitch);
+
+        for(int x=0; x<vecWidth; x+=8)
+        {
+            __m128i a1 = _mm_loadu_si128((__m128i*)(line1+(x*4)));
+            __m128i b1 = _mm_loadu_si128((__m128i*)(line1+(x*4)+16));
+            __m128i a2 = _mm_loadu_si128((__m128i*)(line2+(x*4)));
+            __m128i b2 = _mm_loadu_si128((__m128i*)(line2+(x*4)+16));
+
+            _mm_storel_epi64((__m128i*)(lum1+x), _mm_or_si128(_mm_shuffle_epi8(a1, shufYLo), _mm_shuffle_epi8(b1, shufYHi)));
+            _mm_storel_epi64((__m128i*)(lum2+x), _mm_or_si128(_mm_shuffle_epi8(a2, shufYLo), _mm_shuffle_epi8(b2, shufYHi)));
+
+            _mm_storel_epi64((__m128i*)(uv+x), AverageUV_SSSE3(a1, b1, a2, b2, shufUVLo, shufUVHi, ones));
+        }
+    }
+
+    if(vecWidth < width)
+        Convert444toNV12_Scalar(input, inPitch, outPitch, vecWidth, width, startY, endY, output);
+}
+
+static void Convert444toI420_SSSE3(LPBYTE input, int width, int pitch, int height, int startY, int endY, LPBYTE *output)
+{
+    LPBYTE lumPlane = output[0];
+    LPBYTE uPlane   = output[1];
+    LPBYTE vPlane   = output[2];
+    int  chrPitch   = width>>1;
+    int vecWidth    = width & ~7;
+
+    __m128i shufYLo  = SHUF_Y_LO,  shufYHi  = SHUF_Y_HI;
+    __m128i shufUVLo = SHUF_UV_LO, shufUVHi = SHUF_UV_HI;
+    __m128i shufSplit = SHUF_SPLIT;
+    __m128i ones     = _mm_set1_epi8(1);
+
+    for(int y=startY; y<endY; y+=2)
+    {
+        LPBYTE line1 = input+(y*pitch);
+        LPBYTE line2 = line1+pitch;
+        LPBYTE lum1  = lumPlane+(y*width);
+        LPBYTE lum2  = lum1+width;
+        LPBYTE u     = uPlane+((y>>1)*chrPitch);
+        LPBYTE v     = vPlane+((y>>1)*chrPitch);
+
+        for(int x=0; x<vecWidth; x+=8)
+        {
+            __m128i a1 = _mm_loadu_si128((__m128i*)(line1+(x*4)));
+            __m128i b1 = _mm_loadu_si128((__m128i*)(line1+(x*4)+16));
+            __m128i a2 = _mm_loadu_si128((__m128i*)(line2+(x*4)));
+            __m128i b2 = _mm_loadu_si128((__m128i*)(line2+(x*4)+16));
+
+            _mm_storel_epi64((__m128i*)(lum1+x), _mm_or_si128(_mm_shuffle_epi8(a1, shufYLo), _mm_shuffle_epi8(b1, shufYHi)));
+            _mm_storel_epi64((__m128i*)(lum2+x), _mm_or_si128(_mm_shuffle_epi8(a2, shufYLo), _mm_shuffle_epi8(b2, shufYHi)));
+
+            __m128i chroma = _mm_shuffle_epi8(AverageUV_SSSE3(a1, b1, a2, b2, shufUVLo, shufUVHi, ones), shufSplit);
+            *(LPUINT)(u+(x>>1)) = _mm_cvtsi128_si32(chroma);
+            *(LPUINT)(v+(x>>1)) = _mm_cvtsi128_si32(_mm_srli_si128(chroma, 8));
+        }
+    }
+
+    if(vecWidth < width)
+        Convert444toI420_Scalar(input, width, pitch, vecWidth, width, startY, endY, output);
+}
+
+//--------------------------------------------------------------------------
+// AVX2, 16 pixels at a time.  same idea as SSSE3, but pshufb works within each
+// 128bit lane, so the results are put back in order with a dword permute.
+
+static void Convert444Block_AVX2(LPBYTE line1, LPBYTE line2, __m256i &lumOut, __m128i &uvOut)
+{
+    const __m256i shufYA  = _mm256_setr_epi8(1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i shufYB  = _mm256_setr_epi8(-1, -1, -1, -1, 1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, 1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i shufUVA = _mm256_setr_epi8(0, 4, 2, 6, 8, 12, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             0, 4, 2, 6, 8, 12, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i shufUVB = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 2, 6, 8, 12, 10, 14,
+                                             -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 2, 6, 8, 12, 10, 14);
+    const __m256i order   = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const __m256i ones    = _mm256_set1_epi8(1);
+
+    __m256i a1 = _mm256_loadu_si256((__m256i*)line1);
+    __m256i b1 = _mm256_loadu_si256((__m256i*)(line1+32));
+    __m256i a2 = _mm256_loadu_si256((__m256i*)line2);
+    __m256i b2 = _mm256_loadu_si256((__m256i*)(line2+32));
+
+    //line 1 Y ends up in dwords 0/1 of each lane, line 2 Y in dwords 2/3
+    __m256i lum1 = _mm256_or_si256(_mm256_shuffle_epi8(a1, shufYA), _mm256_shuffle_epi8(b1, shufYB));
+    __m256i lum2 = _mm256_or_si256(_mm256_shuffle_epi8(a2, shufYA), _mm256_shuffle_epi8(b2, shufYB));
+    lumOut = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(lum1, lum2), order);
+
+    __m256i sum1 = _mm256_maddubs_epi16(_mm256_or_si256(_mm256_shuffle_epi8(a1, shufUVA), _mm256_shuffle_epi8(b1, shufUVB)), ones);
+    __m256i sum2 = _mm256_maddubs_epi16(_mm256_or_si256(_mm256_shuffle_epi8(a2, shufUVA), _mm256_shuffle_epi8(b2, shufUVB)), ones);
+    __m256i avg  = _mm256_srli_epi16(_mm256_add_epi16(sum1, sum2), 2);
+    avg = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(avg, avg), order);
+
+    uvOut = _mm256_castsi256_si128(avg);
+}
+
+static void Convert444toNV12_AVX2(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
+{
+    LPBYTE lumPlane = output[0];
+    LPBYTE uvPlane  = output[1];
+    int vecWidth    = width & ~15;
+
+    for(int y=startY; y<endY; y+=2)
+    {
+        LPBYTE line1 = input+(y*inPitch);
+        LPBYTE line2 = line1+inPitch;
+        LPBYTE lum1  = lumPlane+(y*outPitch);
+        LPBYTE lum2  = lum1+outPitch;
+        LPBYTE uv    = uvPlane+((y>>1)*outPitch);
+
+        for(int x=0; x<vecWidth; x+=16)
+        {
+            __m256i lum;
+            __m128i chroma;
+            Convert444Block_AVX2(line1+(x*4), line2+(x*4), lum, chroma);
+
+            _mm_storeu_si128((__m128i*)(lum1+x), _mm256_castsi256_si128(lum));
+            _mm_storeu_si128((__m128i*)(lum2+x), _mm256_extracti128_si256(lum, 1));
+            _mm_storeu_si128((__m128i*)(uv+x), chroma);
+        }
+    }
+
+    _mm256_zeroupper();
+
+    if(vecWidth < width)
+        Convert444toNV12_Scalar(input, inPitch, outPitch, vecWidth, width, startY, endY, output);
+}
+
+static void Convert444toI420_AVX2(LPBYTE input, int width, int pitch, int height, int startY, int endY, LPBYTE *output)
+{
+    LPBYTE lumPlane = output[0];
+    LPBYTE uPlane   = output[1];
+    LPBYTE vPlane   = output[2];
+    int  chrPitch   = width>>1;
+    int vecWidth    = width & ~15;
+
+    __m128i shufSplit = SHUF_SPLIT;
+
+    for(int y=startY; y<endY; y+=2)
+    {
+        LPBYTE line1 = input+(y*pitch);
+        LPBYTE line2 = line1+pitch;
+        LPBYTE lum1  = lumPlane+(y*width);
+        LPBYTE lum2  = lum1+width;
+        LPBYTE u     = uPlane+((y>>1)*chrPitch);
+        LPBYTE v     = vPlane+((y>>1)*chrPitch);
+
+        for(int x=0; x<vecWidth; x+=16)
+        {
+            __m256i lum;
+            __m128i chroma;
+            Convert444Block_AVX2(line1+(x*4), line2+(x*4), lum, chroma);
+
+            _mm_storeu_si128((__m128i*)(lum1+x), _mm256_castsi256_si128(lum));
+            _mm_storeu_si128((__m128i*)(lum2+x), _mm256_extracti128_si256(lum, 1));
+
+            chroma = _mm_shuffle_epi8(chroma, shufSplit);
+            _mm_storel_epi64((__m128i*)(u+(x>>1)), chroma);
+            _mm_storel_epi64((__m128i*)(v+(x>>1)), _mm_srli_si128(chroma, 8));
+        }
+    }
+
+    _mm256_zeroupper();
+
+    if(vecWidth < width)
+        Convert444toI420_Scalar(input, width, pitch, vecWidth, width, startY, endY, output);
+}
+
+//--------------------------------------------------------------------------
+// runtime dispatch
+
+typedef void (*CONVERT444TOI420PROC)(LPBYTE input, int width, int pitch, int height, int startY, int endY, LPBYTE *output);
+typedef void (*CONVERT444TONV12PROC)(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output);
+
+static CONVERT444TOI420PROC convert444toI420 = Convert444toI420_SSE2;
+static CONVERT444TONV12PROC convert444toNV12 = Convert444toNV12_SSE2;
+
+static bool CPUSupportsAVX2(const int *cpuInfo)
+{
+    //AVX, and the OS has to save the ymm registers
+    if(!(cpuInfo[2] & (1<<27)) || !(cpuInfo[2] & (1<<28)))
+        return false;
+    if((_xgetbv(0) & 6) != 6)
+        return false;
+
+    int extInfo[4];
+    __cpuid(extInfo, 0);
+    if(extInfo[0] < 7)
+        return false;
+
+    __cpuidex(extInfo, 7, 0);
+    return (extInfo[1] & (1<<5)) != 0;
+}
+
+//cpuInfo is cpuid leaf 1.  "General/ColorConversion" can force a lower variant for testing
+void InitConvert444(const int *cpuInfo)
+{
+    CTSTR lpName;
+    String strForce = GlobalConfig->GetString(TEXT("General"), TEXT("ColorConversion"));
+
+    bool bSSSE3 = (cpuInfo[2] & (1<<9)) != 0 && !strForce.CompareI(TEXT("SSE2"));
+    bool bAVX2  = bSSSE3 && CPUSupportsAVX2(cpuInfo) && !strForce.CompareI(TEXT("SSSE3"));
+
+    if(bAVX2)
+    {
+        convert444toI420 = Convert444toI420_AVX2;
+        convert444toNV12 = Convert444toNV12_AVX2;
+        lpName = TEXT("AVX2");
+    }
+    else if(bSSSE3)
+    {
+        convert444toI420 = Convert444toI420_SSSE3;
+        convert444toNV12 = Convert444toNV12_SSSE3;
+        lpName = TEXT("SSSE3");
+    }
+    else
+    {
+        convert444toI420 = Convert444toI420_SSE2;
+        convert444toNV12 = Convert444toNV12_SSE2;
+        lpName = TEXT("SSE2");
+    }
+
+    Log(TEXT("Using %s 4:4:4 to 4:2:0 conversion"), lpName);
+}
+
+void Convert444toI420(LPBYTE input, int width, int pitch, int height, int startY, int endY, LPBYTE *output)
+{
+    profileSegment("Convert444toI420");
+    convert444toI420(input, width, pitch, height, startY, endY, output);
+}
+
+void Convert444toNV12(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
+{
+    profileSegment("Convert444toNV12");
+    convert444toNV12(input, width, inPitch, outPitch, height, startY, endY, output);
+}
+
+//--------------------------------------------------------------------------
+// fused downscale + 4:4:4 to NV12
+//
+//used when the GPU only applies the color matrix and the frame is read back at the base
+//resolution.  each source line is filtered horizontally once into a small ring of
+//intermediate lines, and output lines are filtered vertically out of that ring straight into
+//the NV12 planes, so no scaled 4:4:4 frame is ever written out and read back in between.
+//chroma is the truncated average of each 2x2 block of scaled pixels, same as above.
+
+#define SCALE_WEIGHT_BITS   14
+#define SCALE_INTER_BITS    6   //fraction bits kept in the intermediate lines
+#define SCALE_MAX_TAPS      32  //3x lanczos needs 18
+
+struct ScaleTaps
+{
+    int numTaps;
+    int *offsets;       //first source pixel for each output pixel
+    short *weights;     //numTaps per output pixel, each set sums to 1<<SCALE_WEIGHT_BITS
+};
+
+struct ScaleScratch
+{
+    ScaleScratch *next;
+    short *lines;       //vert.numTaps horizontally scaled lines, used as a ring
+    int *lineRows;      //source line held in each ring slot
+    LPBYTE out[2];      //the two finished 4:4:4 lines of the current output line pair
+};
+
+struct Scale444Data
+{
+    int srcCX, srcCY;
+    int dstCX, dstCY;
+    ScaleTaps horz, vert;
+
+    HANDLE hScratchMutex;
+    ScaleScratch *freeScratch;
+};
+
+static double ScaleKernel(int filterType, double x)
+{
+    x = fabs(x);
+
+    switch(filterType)
+    {
+        case 1: //bicubic, the same B=0 C=0.75 curve as DownscaleBicubicYUV
+            if(x < 1.0)
+                return ((12.0-6.0*0.75)*x*x*x + (-18.0+6.0*0.75)*x*x + 6.0)/6.0;
+            if(x < 2.0)
+                return ((-6.0*0.75)*x*x*x + (30.0*0.75)*x*x + (-48.0*0.75)*x + 24.0*0.75)/6.0;
+            return 0.0;
+
+        case 2: //3 lobe lanczos
+            if(x < 1e-8)
+                return 1.0;
+            if(x < 3.0)
+            {
+                double px = x*3.14159265358979323846;
+                return 3.0*sin(px)*sin(px/3.0)/(px*px);
             }
+            return 0.0;
+
+        default: //bilinear
+            return (x < 1.0) ? 1.0-x : 0.0;
+    }
+}
+
+static void BuildScaleTaps(ScaleTaps &taps, int srcSize, int scaleSize, int dstSize, int filterType)
+{
+    double radius = (filterType == 2) ? 3.0 : ((filterType == 1) ? 2.0 : 1.0);
+    double ratio  = double(srcSize)/double(scaleSize);
+
+    //widen the kernel by the scale ratio so every source pixel contributes
+    double filterScale = MAX(ratio, 1.0);
+    double support = radius*filterScale;
+
+    int numTaps = MIN(MIN(int(ceil(support))*2, srcSize), SCALE_MAX_TAPS);
+
+    taps.numTaps = numTaps;
+    taps.offsets = (int*)Allocate(sizeof(int)*dstSize);
+    taps.weights = (short*)Allocate(sizeof(short)*dstSize*numTaps);
+
+    double *weights = (double*)Allocate(sizeof(double)*numTaps);
+    int *fixedWeights = (int*)Allocate(sizeof(int)*numTaps);
+
+    for(int i=0; i<dstSize; i++)
+    {
+        double center = (double(i)+0.5)*ratio - 0.5;
+        int start = int(floor(center-support))+1;
+
+        double total = 0.0;
+        for(int j=0; j<numTaps; j++)
+        {
+            weights[j] = ScaleKernel(filterType, (double(start+j)-center)/filterScale);
+            total += weights[j];
+        }
+
+        //samples past the edges are clamped, so fold their weight into a window that fits
+        int windowStart = MIN(MAX(start, 0), srcSize-numTaps);
+        zero(fixedWeights, sizeof(int)*numTaps);
+
+        int sum = 0, largest = 0;
+        for(int j=0; j<numTaps; j++)
+        {
+            int pos = MIN(MAX(start+j, 0), srcSize-1)-windowStart;
+            int weight = int(floor(weights[j]/total*double(1<<SCALE_WEIGHT_BITS) + 0.5));
+
+            fixedWeights[pos] += weight;
+            sum += weight;
         }
+
+        for(int j=1; j<numTaps; j++)
+        {
+            if(fixedWeights[j] > fixedWeights[largest])
+                largest = j;
+        }
+
+        //rounding error goes to the biggest tap so flat areas stay exactly flat
+        fixedWeights[largest] += (1<<SCALE_WEIGHT_BITS)-sum;
+
+        taps.offsets[i] = windowStart;
+        for(int j=0; j<numTaps; j++)
+            taps.weights[i*numTaps+j] = short(fixedWeights[j]);
     }
+
+    Free(fixedWeights);
+    Free(weights);
+}
+
+Scale444Data* CreateScale444(int srcCX, int srcCY, int scaleCX, int scaleCY, int dstCX, int dstCY, int filterType)
+{
+    Scale444Data *data = (Scale444Data*)Allocate(sizeof(Scale444Data));
+    zero(data, sizeof(Scale444Data));
+
+    data->srcCX = srcCX;
+    data->srcCY = srcCY;
+    data->dstCX = dstCX;
+    data->dstCY = dstCY;
+
+    BuildScaleTaps(data->horz, srcCX, scaleCX, dstCX, filterType);
+    BuildScaleTaps(data->vert, srcCY, scaleCY, dstCY, filterType);
+
+    data->hScratchMutex = OSCreateMutex();
+
+    Log(TEXT("Using CPU downscale: %dx%d -> %dx%d, %d/%d taps"), srcCX, srcCY, dstCX, dstCY, data->horz.numTaps, data->vert.numTaps);
+    return data;
+}
+
+void DestroyScale444(Scale444Data *data)
+{
+    if(!data)
+        return;
+
+    while(data->freeScratch)
+    {
+        ScaleScratch *next = data->freeScratch->next;
+        Free(data->freeScratch);
+        data->freeScratch = next;
+    }
+
+    OSCloseMutex(data->hScratchMutex);
+
+    Free(data->horz.offsets);
+    Free(data->horz.weights);
+    Free(data->vert.offsets);
+    Free(data->vert.weights);
+    Free(data);
+}
+
+//one scratch block per tile in flight, kept around so steady state doesn't allocate
+static ScaleScratch* AcquireScaleScratch(Scale444Data *data)
+{
+    OSEnterMutex(data->hScratchMutex);
+    ScaleScratch *scratch = data->freeScratch;
+    if(scratch)
+        data->freeScratch = scratch->next;
+    OSLeaveMutex(data->hScratchMutex);
+
+    if(!scratch)
+    {
+        size_t lineSize  = sizeof(short)*data->dstCX*3;
+        size_t linesSize = lineSize*data->vert.numTaps;
+        size_t rowsSize  = sizeof(int)*data->vert.numTaps;
+        size_t outSize   = data->dstCX*3;
+
+        LPBYTE block = (LPBYTE)Allocate(sizeof(ScaleScratch) + linesSize + rowsSize + outSize*2);
+
+        scratch = (ScaleScratch*)block;
+        scratch->lines    = (short*)(block+sizeof(ScaleScratch));
+        scratch->lineRows = (int*)(block+sizeof(ScaleScratch)+linesSize);
+        scratch->out[0]   = block+sizeof(ScaleScratch)+linesSize+rowsSize;
+        scratch->out[1]   = scratch->out[0]+outSize;
+    }
+
+    return scratch;
+}
+
+static void ReleaseScaleScratch(Scale444Data *data, ScaleScratch *scratch)
+{
+    OSEnterMutex(data->hScratchMutex);
+    scratch->next = data->freeScratch;
+    data->freeScratch = scratch;
+    OSLeaveMutex(data->hScratchMutex);
+}
+
+//SSE2 with pairs of taps per pmaddwd, an odd last tap is paired with a zero weight
+
+static void ScaleLineHorz(const Scale444Data *data, LPBYTE input, short *out)
+{
+    const int shift = SCALE_WEIGHT_BITS-SCALE_INTER_BITS;
+
+    int numTaps = data->horz.numTaps;
+    const short *weights = data->horz.weights;
+
+    __m128i zero  = _mm_setzero_si128();
+    __m128i round = _mm_set1_epi32(1<<(shift-1));
+
+    for(int x=0; x<data->dstCX; x++, weights += numTaps, out += 3)
+    {
+        LPBYTE pixel = input+(data->horz.offsets[x]*4);
+        __m128i sum = round;
+        int i = 0;
+
+        for(; i+1<numTaps; i+=2, pixel += 8)
+        {
+            //u0 y0 v0 a0 u1 y1 v1 a1 -> u0 u1 y0 y1 v0 v1 a0 a1
+            __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*)pixel), zero);
+            pixels = _mm_unpacklo_epi16(pixels, _mm_srli_si128(pixels, 8));
+
+            __m128i weight = _mm_set1_epi32(int(WORD(weights[i]) | (DWORD(WORD(weights[i+1]))<<16)));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, weight));
+        }
+
+        if(i < numTaps)
+        {
+            __m128i pixels = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(int*)pixel), zero);
+            pixels = _mm_unpacklo_epi16(pixels, zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, _mm_set1_epi32(WORD(weights[i]))));
+        }
+
+        sum = _mm_packs_epi32(_mm_srai_epi32(sum, shift), zero);
+
+        out[0] = short(_mm_extract_epi16(sum, 0));
+        out[1] = short(_mm_extract_epi16(sum, 1));
+        out[2] = short(_mm_extract_epi16(sum, 2));
+    }
+}
+
+static void ScaleLineVert(const Scale444Data *data, ScaleScratch *scratch, LPBYTE input, int inPitch, int y, LPBYTE out)
+{
+    const int shift = SCALE_WEIGHT_BITS+SCALE_INTER_BITS;
+
+    int numTaps   = data->vert.numTaps;
+    int lineWidth = data->dstCX*3;
+    int firstRow  = data->vert.offsets[y];
+    const short *weights = data->vert.weights+(y*numTaps);
+
+    short *linePtrs[SCALE_MAX_TAPS];
+    __m128i weightPairs[SCALE_MAX_TAPS/2];
+
+    //the window only ever moves down, so each source line gets filtered once per tile
+    for(int i=0; i<numTaps; i++)
+    {
+        int row  = firstRow+i;
+        int slot = row % numTaps;
+        short *line = scratch->lines+(slot*lineWidth);
+
+        if(scratch->lineRows[slot] != row)
+        {
+            ScaleLineHorz(data, input+(row*inPitch), line);
+            scratch->lineRows[slot] = row;
+        }
+
+        linePtrs[i] = line;
+    }
+
+    for(int i=0; i<numTaps; i+=2)
+    {
+        WORD second = (i+1 < numTaps) ? WORD(weights[i+1]) : 0;
+        weightPairs[i>>1] = _mm_set1_epi32(int(WORD(weights[i]) | (DWORD(second)<<16)));
+    }
+
+    __m128i zero  = _mm_setzero_si128();
+    __m128i round = _mm_set1_epi32(1<<(shift-1));
+
+    int x = 0;
+    for(; x+8<=lineWidth; x+=8)
+    {
+        __m128i sumLo = round, sumHi = round;
+
+        for(int i=0; i<numTaps; i+=2)
+        {
+            __m128i line1 = _mm_loadu_si128((__m128i*)(linePtrs[i]+x));
+            __m128i line2 = (i+1 < numTaps) ? _mm_loadu_si128((__m128i*)(linePtrs[i+1]+x)) : zero;
+
+            sumLo = _mm_add_epi32(sumLo, _mm_madd_epi16(_mm_unpacklo_epi16(line1, line2), weightPairs[i>>1]));
+            sumHi = _mm_add_epi32(sumHi, _mm_madd_epi16(_mm_unpackhi_epi16(line1, line2), weightPairs[i>>1]));
+        }
+
+        __m128i vals = _mm_packs_epi32(_mm_srai_epi32(sumLo, shift), _mm_srai_epi32(sumHi, shift));
+        _mm_storel_epi64((__m128i*)(out+x), _mm_packus_epi16(vals, vals));
+    }
+
+    for(; x<lineWidth; x++)
+    {
+        int val = 1<<(shift-1);
+        for(int i=0; i<numTaps; i++)
+            val += linePtrs[i][x]*weights[i];
+
+        val >>= shift;
+        out[x] = BYTE(MIN(MAX(val, 0), 255));
+    }
+}
+
+void Scale444toNV12(Scale444Data *data, LPBYTE input, int inPitch, int outPitch, int startY, int endY, LPBYTE *output)
+{
+    profileSegment("Scale444toNV12");
+
+    ScaleScratch *scratch = AcquireScaleScratch(data);
+    for(int i=0; i<data->vert.numTaps; i++)
+        scratch->lineRows[i] = -1;
+
+    LPBYTE lumPlane = output[0];
+    LPBYTE uvPlane  = output[1];
+
+    for(int y=startY; y<endY; y+=2)
+    {
+        ScaleLineVert(data, scratch, input, inPitch, y,   scratch->out[0]);
+        ScaleLineVert(data, scratch, input, inPitch, y+1, scratch->out[1]);
+
+        LPBYTE line1 = scratch->out[0];
+        LPBYTE line2 = scratch->out[1];
+        LPBYTE lum1  = lumPlane+(y*outPitch);
+        LPBYTE lum2  = lum1+outPitch;
+        LPBYTE uv    = uvPlane+((y>>1)*outPitch);
+
+        for(int x=0; x<data->dstCX; x+=2)
+        {
+            LPBYTE p1 = line1+(x*3);
+            LPBYTE p2 = line2+(x*3);
+
+            lum1[x]   = p1[1];
+            lum1[x+1] = p1[4];
+            lum2[x]   = p2[1];
+            lum2[x+1] = p2[4];
+
+            uv[x]   = BYTE((p1[0]+p1[3]+p2[0]+p2[3])>>2);
+            uv[x+1] = BYTE((p1[2]+p1[5]+p2[2]+p2[5])>>2);
+        }
+    }
+
+    ReleaseScaleScratch(data, scratch);
 }
@@ -37,6 +37,9 @@ class MMDeviceAudioSource : public AudioSource
     bool bIsMic;
     bool bFirstFrameReceived;
 
+    HANDLE hReadyEvent;
+    bool bEventDriven;
+
     bool deviceLost;
     QWORD reinitTimer;
 
@@ -81,7 +84,10 @@ protected:
     virtual CTSTR GetDeviceName() const {return strDeviceName.Array();}
 
 public:
-    bool Initialize(bool bMic, CTSTR lpID);
+    bool Initialize(bool bMic, CTSTR lpID, HANDLE hReadyEvent);
+
+    //true while the device is up and wakes the audio thread itself when it has data
+    inline bool SignalsReady() const {return mmClient && bEventDriven;}
 
     ~MMDeviceAudioSource()
     {
@@ -102,10 +108,10 @@ public:
     virtual void StopCapture();
 };
 
-AudioSource* CreateAudioSource(bool bMic, CTSTR lpID)
+AudioSource* CreateAudioSource(bool bMic, CTSTR lpID, HANDLE hReadyEvent)
 {
     MMDeviceAudioSource *source = new MMDeviceAudioSource;
-    if(source->Initialize(bMic, lpID))
+    if(source->Initialize(bMic, lpID, hReadyEvent))
         return source;
     else
     {
@@ -235,7 +241,38 @@ bool MMDeviceAudioSource::Reinitialize()
 
     DWORD flags = useInputDevice ? 0 : AUDCLNT_STREAMFLAGS_LOOPBACK;
 
-    err = mmClient->Initialize(AUDCLNT_SHAREMODE_SHARED, flags, ConvertMSTo100NanoSec(5000), 0, pwfx, NULL);
+    //capture endpoints can signal the audio thread each period so it doesn't have to poll them.
+    //loopback streams don't signal before windows 10, those are driven by the blank playback
+    //stream instead (see BlankAudioPlayback.cpp)
+    bEventDriven = false;
+    if(useInputDevice && hReadyEvent)
+    {
+        err = mmClient->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_EVENTCALLBACK, ConvertMSTo100NanoSec(5000), 0, pwfx, NULL);
+        if(SUCCEEDED(err))
+        {
+            err = mmClient->SetEventHandle(hReadyEvent);
+            if(SUCCEEDED(err))
+                bEventDriven = true;
+        }
+
+        if(!bEventDriven)
+        {
+            if (!deviceLost) Log(TEXT("MMDeviceAudioSource::Initialize(%d): Event driven capture unavailable (%08lX), polling the device"), (BOOL)bIsMic, err);
+
+            //an audio client can only be initialized once, get a fresh one to poll with
+            SafeRelease(mmClient);
+            err = mmDevice->Activate(IID_IAudioClient, CLSCTX_ALL, NULL, (void**)&mmClient);
+            if(FAILED(err))
+            {
+                if (!deviceLost) AppWarning(TEXT("MMDeviceAudioSource::Initialize(%d): Could not create IAudioClient = %08lX"), (BOOL)bIsMic, err);
+                CoTaskMemFree(pwfx);
+                return false;
+            }
+        }
+    }
+
+    if(!bEventDriven)
+        err = mmClient->Initialize(AUDCLNT_SHAREMODE_SHARED, flags, ConvertMSTo100NanoSec(5000), 0, pwfx, NULL);
     //err = AUDCLNT_E_UNSUPPORTED_FORMAT;
 
     if(FAILED(err))
@@ -275,13 +312,14 @@ bool MMDeviceAudioSource::Reinitialize()
     return true;
 }
 
-bool MMDeviceAudioSource::Initialize(bool bMic, CTSTR lpID)
+bool MMDeviceAudioSource::Initialize(bool bMic, CTSTR lpID, HANDLE hReadyEvent)
 {
     const IID IID_IMMDeviceEnumerator    = __uuidof(IMMDeviceEnumerator);
     const CLSID CLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
 
     bIsMic = bMic;
     deviceId = lpID;
+    this->hReadyEvent = hReadyEvent;
 
     HRESULT err = CoCreateInstance(CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL, IID_IMMDeviceEnumerator, (void**)&mmEnumerator);
     if(FAILED(err))
@@ -484,3 +522,8 @@ void ResetWASAPIAudioDevice(AudioSource *source)
 {
     static_cast<MMDeviceAudioSource*>(source)->Reset();
 }
+
+bool WASAPIAudioDeviceSignalsReady(AudioSource *source)
+{
+    return static_cast<MMDeviceAudioSource*>(source)->SignalsReady();
+}
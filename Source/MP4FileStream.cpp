@@ -53,8 +53,19 @@ struct MP4AudioFrameInfo
     UINT    timestamp;
 };
 
+struct MP4FragmentSample
+{
+    UINT64  decodeTime;     //in the track's time scale
+    UINT    size;
+    INT     compositionOffset;
+    bool    bKeyframe;
+};
+
 #define USE_64BIT_MP4 1
 
+//fragments are cut on keyframes, this forces one out if keyframes stop coming for some reason
+#define MP4_MAX_FRAGMENT_SIZE (64*1024*1024)
+
 inline UINT64 ConvertToAudioTime(DWORD timestamp, UINT64 minVal)
 {
     UINT val = UINT64(timestamp)*App->GetSampleRateHz()/1000;
@@ -66,9 +77,11 @@ inline UINT64 ConvertToAudioTime(DWORD timestamp, UINT64 minVal)
 
 class MP4FileStream : public VideoFileStream
 {
-    XFileOutputSerializer fileOut;
+    AsyncFileWriter fileOut;
     String strFile;
 
+    VideoStreamInfo videoInfo;
+
     List<MP4VideoFrameInfo> videoFrames;
     List<MP4AudioFrameInfo> audioFrames;
 
@@ -101,6 +114,17 @@ class MP4FileStream : public VideoFileStream
 
     bool bSentSEI;
 
+    //fragmented mode.  instead of one big mdat and a moov at the end, an empty moov goes at the
+    //start and every few seconds the samples since the last keyframe are written out as a
+    //moof+mdat pair, so memory use stays flat and the file is playable up to the last fragment
+    bool            bFragmented;
+    bool            bFragmentAudioStarted;
+    DWORD           fragmentDuration;
+    UINT            fragmentSequence;
+    List<BYTE>      videoFragmentData, audioFragmentData;
+    BufferOutputSerializer videoFragmentOut, audioFragmentOut;
+    List<MP4FragmentSample> videoFragmentSamples, audioFragmentSamples;
+
     void PushBox(BufferOutputSerializer &output, DWORD boxName)
     {
         boxOffsets.Insert(0, (UINT)output.GetPos());
@@ -143,13 +167,20 @@ class MP4FileStream : public VideoFileStream
     }
 
 public:
-    bool Init(CTSTR lpFile)
+    MP4FileStream() : bFragmented(false), bFragmentAudioStarted(false), fragmentSequence(0),
+                      videoFragmentOut(videoFragmentData), audioFragmentOut(audioFragmentData) {}
+
+    bool Init(CTSTR lpFile, const VideoStreamInfo &videoInfo)
     {
         strFile = lpFile;
+        this->videoInfo = videoInfo;
 
         initialTimeStamp = -1;
 
-        if(!fileOut.Open(lpFile, XFILE_CREATEALWAYS, 1024*1024))
+        bFragmented = AppConfig->GetInt(TEXT("Publish"), TEXT("FragmentedMP4")) != 0;
+        fragmentDuration = (DWORD)MAX(AppConfig->GetInt(TEXT("Publish"), TEXT("MP4FragmentDuration"), 2000), 500);
+
+        if(!fileOut.Open(lpFile))
             return false;
 
         fileOut.OutputDword(DWORD_BE(0x20));
@@ -164,12 +195,16 @@ public:
         fileOut.OutputDword(DWORD_BE(0x8));
         fileOut.OutputDword(DWORD_BE('free'));
 
-        mdatStart = fileOut.GetPos();
-        fileOut.OutputDword(DWORD_BE(0x1));
-        fileOut.OutputDword(DWORD_BE('mdat'));
+        //fragmented files get their moov once the headers are known, and an mdat per fragment
+        if(!bFragmented)
+        {
+            mdatStart = fileOut.GetPos();
+            fileOut.OutputDword(DWORD_BE(0x1));
+            fileOut.OutputDword(DWORD_BE('mdat'));
 #ifdef USE_64BIT_MP4
-        fileOut.OutputQword(0);
+            fileOut.OutputQword(0);
 #endif
+        }
 
         bMP3 = scmp(App->GetAudioEncoder()->GetCodec(), TEXT("MP3")) == 0;
 
@@ -282,20 +317,10 @@ public:
             audioDecodeTimes.Last().count++;
     }
 
-    ~MP4FileStream()
+    //builds the moov into endBuffer and returns its size.  in fragmented mode the sample tables
+    //are all empty and the samples are described by the moofs instead
+    UINT BuildMoov()
     {
-        if(!bStreamOpened)
-            return;
-
-        App->EnableSceneSwitching(false);
-
-        //---------------------------------------------------
-
-        //HWND hwndProgressDialog = CreateDialog(hinstMain, MAKEINTRESOURCE(IDD_BUILDINGMP4), hwndMain, (DLGPROC)MP4ProgressDialogProc);
-        //SendMessage(GetDlgItem(hwndProgressDialog, IDC_PROGRESS1), PBM_SETRANGE32, 0, 100);
-
-        mdatStop = fileOut.GetPos();
-
         BufferOutputSerializer output(endBuffer);
 
         //set a reasonable initial buffer size
@@ -304,10 +329,11 @@ public:
         UINT64 audioFrameSize = App->GetAudioEncoder()->GetFrameSize();
 
         DWORD macTime = fastHtonl(DWORD(GetMacTime()));
-        UINT videoDuration = fastHtonl(lastVideoTimestamp + App->GetFrameTime());
-        UINT audioDuration = fastHtonl(lastVideoTimestamp + DWORD(double(audioFrameSize)*1000.0/double(App->GetSampleRateHz())));
+        UINT videoDuration = bFragmented ? 0 : fastHtonl(lastVideoTimestamp + 1000/videoInfo.fps);
+        UINT audioDuration = bFragmented ? 0 : fastHtonl(lastVideoTimestamp + DWORD(double(audioFrameSize)*1000.0/double(App->GetSampleRateHz())));
         UINT width, height;
-        App->GetOutputSize(width, height);
+        width = videoInfo.width;
+        height = videoInfo.height;
 
         LPCSTR lpVideoTrack = "Video Media Handler";
         LPCSTR lpAudioTrack = "Sound Media Handler";
@@ -317,7 +343,7 @@ public:
         //-------------------------------------------
         // get video headers
         DataPacket videoHeaders;
-        App->GetVideoHeaders(videoHeaders);
+        videoInfo.encoder->GetHeaders(videoHeaders);
         List<BYTE> SPS, PPS;
 
         LPBYTE lpHeaderData = videoHeaders.lpPacket+11;
@@ -338,16 +364,7 @@ public:
 
         //-------------------------------------------
 
-        EndChunkInfo(videoChunks, videoSampleToChunk, curVideoChunkOffset, numVideoSamples);
-        EndChunkInfo(audioChunks, audioSampleToChunk, curAudioChunkOffset, numAudioSamples);
-
-        if (numVideoSamples > 1)
-            GetVideoDecodeTime(videoFrames.Last(), true);
-
-        if (numAudioSamples > 1)
-            GetAudioDecodeTime(audioFrames.Last(), true);
-
-        UINT audioUnitDuration = fastHtonl(UINT(lastAudioTimeVal));
+        UINT audioUnitDuration = bFragmented ? 0 : fastHtonl(UINT(lastAudioTimeVal));
 
         //SendMessage(GetDlgItem(hwndProgressDialog, IDC_PROGRESS1), PBM_SETPOS, 25, 0);
 
@@ -754,6 +771,30 @@ public:
           //SendMessage(GetDlgItem(hwndProgressDialog, IDC_PROGRESS1), PBM_SETPOS, 80, 0);
           //ProcessEvents();
 
+          //------------------------------------------------------
+          // movie extends, marks the file as fragmented
+          if(bFragmented)
+          {
+            PushBox(output, DWORD_BE('mvex'));
+              PushBox(output, DWORD_BE('trex'));
+                output.OutputDword(0); //version and flags (none)
+                output.OutputDword(DWORD_BE(1)); //track ID
+                output.OutputDword(DWORD_BE(1)); //default sample description index
+                output.OutputDword(0); //default sample duration
+                output.OutputDword(0); //default sample size
+                output.OutputDword(DWORD_BE(0x02000000)); //default sample flags (sync sample)
+              PopBox(output); //trex
+              PushBox(output, DWORD_BE('trex'));
+                output.OutputDword(0); //version and flags (none)
+                output.OutputDword(DWORD_BE(2)); //track ID
+                output.OutputDword(DWORD_BE(1)); //default sample description index
+                output.OutputDword(0); //default sample duration
+                output.OutputDword(0); //default sample size
+                output.OutputDword(DWORD_BE(0x01010000)); //default sample flags (non-sync sample)
+              PopBox(output); //trex
+            PopBox(output); //mvex
+          }
+
           //------------------------------------------------------
           // info thingy
           PushBox(output, DWORD_BE('udta'));
@@ -783,11 +824,172 @@ public:
 
         PopBox(output); //moov
 
-        fileOut.Serialize(endBuffer.Array(), (DWORD)output.GetPos());
+        return (UINT)output.GetPos();
+    }
+
+    //writes a traf for one track and returns where its trun's data offset is, which can only be
+    //filled in once the size of the whole moof is known
+    UINT WriteTrackFragment(BufferOutputSerializer &output, DWORD trackID, List<MP4FragmentSample> &samples, UINT64 nextDecodeTime, bool bVideo)
+    {
+        UINT dataOffsetPos;
+
+        PushBox(output, DWORD_BE('traf'));
+          PushBox(output, DWORD_BE('tfhd'));
+            output.OutputDword(DWORD_BE(0x00020000)); //version (0) and flags (default base is moof)
+            output.OutputDword(fastHtonl(trackID)); //track ID
+          PopBox(output); //tfhd
+          PushBox(output, DWORD_BE('tfdt'));
+            output.OutputDword(DWORD_BE(0x01000000)); //version (1) and flags (none)
+            output.OutputQword(fastHtonll(samples[0].decodeTime)); //decode time of the first sample
+          PopBox(output); //tfdt
+          PushBox(output, DWORD_BE('trun'));
+            output.OutputDword(bVideo ? DWORD_BE(0x00000F01) : DWORD_BE(0x00000301)); //version (0) and flags (data offset, durations, sizes, video also has flags and composition offsets)
+            output.OutputDword(fastHtonl(samples.Num())); //sample count
+            dataOffsetPos = (UINT)output.GetPos();
+            output.OutputDword(0); //data offset (filled in later)
+            for(UINT i=0; i<samples.Num(); i++)
+            {
+                MP4FragmentSample &sample = samples[i];
+                UINT64 nextTime = (i+1 < samples.Num()) ? samples[i+1].decodeTime : nextDecodeTime;
+
+                output.OutputDword(fastHtonl(DWORD(nextTime-sample.decodeTime))); //duration
+                output.OutputDword(fastHtonl(sample.size)); //size
+                if(bVideo)
+                {
+                    output.OutputDword(sample.bKeyframe ? DWORD_BE(0x02000000) : DWORD_BE(0x01010000)); //flags
+                    output.OutputDword(fastHtonl((DWORD)sample.compositionOffset)); //composition offset
+                }
+            }
+          PopBox(output); //trun
+        PopBox(output); //traf
+
+        return dataOffsetPos;
+    }
+
+    //writes out everything buffered since the last fragment as a moof+mdat pair.  nextVideoTime
+    //is the decode time of the frame that starts the next fragment, for the last frame's duration
+    void WriteFragment(UINT64 nextVideoTime)
+    {
+        if(!videoFragmentSamples.Num() && !audioFragmentSamples.Num())
+            return;
+
+        UINT videoDataSize = (UINT)videoFragmentOut.GetPos();
+        UINT audioDataSize = (UINT)audioFragmentOut.GetPos();
+        UINT videoDataOffsetPos = 0, audioDataOffsetPos = 0;
+
+        BufferOutputSerializer output(endBuffer);
+        output.Seek(0);
+
+        PushBox(output, DWORD_BE('moof'));
+          PushBox(output, DWORD_BE('mfhd'));
+            output.OutputDword(0); //version and flags (none)
+            output.OutputDword(fastHtonl(++fragmentSequence)); //sequence number
+          PopBox(output); //mfhd
+
+          if(videoFragmentSamples.Num())
+              videoDataOffsetPos = WriteTrackFragment(output, 2, videoFragmentSamples, nextVideoTime, true);
+          if(audioFragmentSamples.Num())
+              audioDataOffsetPos = WriteTrackFragment(output, 1, audioFragmentSamples, audioFragmentSamples.Last().decodeTime+audioFrameSize, false);
+        PopBox(output); //moof
+
+        //video data followed by audio data, offsets are from the start of the moof
+        UINT moofSize = (UINT)output.GetPos();
+        if(videoDataOffsetPos)
+            *(DWORD*)(endBuffer.Array()+videoDataOffsetPos) = fastHtonl(moofSize+8);
+        if(audioDataOffsetPos)
+            *(DWORD*)(endBuffer.Array()+audioDataOffsetPos) = fastHtonl(moofSize+8+videoDataSize);
+
+        fileOut.Serialize(endBuffer.Array(), moofSize);
+        fileOut.OutputDword(fastHtonl(8+videoDataSize+audioDataSize));
+        fileOut.OutputDword(DWORD_BE('mdat'));
+        if(videoDataSize)
+            fileOut.Serialize(videoFragmentData.Array(), videoDataSize);
+        if(audioDataSize)
+            fileOut.Serialize(audioFragmentData.Array(), audioDataSize);
+
+        //make sure a crash can't lose more than the fragment being built
+        fileOut.Flush();
+
+        //the data buffers keep their size and are just rewritten
+        videoFragmentOut.Seek(0);
+        audioFragmentOut.Seek(0);
+        videoFragmentSamples.Clear();
+        audioFragmentSamples.Clear();
+    }
+
+    UINT64 GetFragmentAudioTime(DWORD timestamp)
+    {
+        if(!bFragmentAudioStarted)
+        {
+            bFragmentAudioStarted = true;
+            lastAudioTimeVal = 0;
+        }
+        else
+        {
+            //same as the regular path, follow the timestamps but never overlap the previous frame
+            UINT64 minVal = lastAudioTimeVal+audioFrameSize;
+            lastAudioTimeVal = (INT(timestamp) > 0) ? ConvertToAudioTime(timestamp, minVal) : minVal;
+        }
+
+        return lastAudioTimeVal;
+    }
+
+    ~MP4FileStream()
+    {
+        if(!bStreamOpened)
+            return;
+
+        if(bFragmented)
+        {
+            //nothing to build, just the last partial fragment to write
+            if(videoFragmentSamples.Num())
+                WriteFragment(videoFragmentSamples.Last().decodeTime+1000/videoInfo.fps);
+            else
+                WriteFragment(0);
+
+            fileOut.Close();
+            return;
+        }
+
+        //the moov would only go after the hole, the file can't be finished
+        if(fileOut.WriteFailed())
+        {
+            fileOut.Close();
+            return;
+        }
+
+        //scene switching is held off while the main thread is stuck building the index.  segments
+        //and replays are finished on their own threads, where turning it back on afterwards would
+        //undo whoever else turned it off (the delayed publisher)
+        bool bHoldSceneSwitching = App->IsMainThread() && App->IsSceneSwitchingEnabled();
+        if(bHoldSceneSwitching)
+            App->EnableSceneSwitching(false);
+
+        //---------------------------------------------------
+
+        //HWND hwndProgressDialog = CreateDialog(hinstMain, MAKEINTRESOURCE(IDD_BUILDINGMP4), hwndMain, (DLGPROC)MP4ProgressDialogProc);
+        //SendMessage(GetDlgItem(hwndProgressDialog, IDC_PROGRESS1), PBM_SETRANGE32, 0, 100);
+
+        mdatStop = fileOut.GetPos();
+
+        EndChunkInfo(videoChunks, videoSampleToChunk, curVideoChunkOffset, numVideoSamples);
+        EndChunkInfo(audioChunks, audioSampleToChunk, curAudioChunkOffset, numAudioSamples);
+
+        //the last frame of each track repeats the duration before it.  numVideoSamples and
+        //numAudioSamples only count the last chunk, so they can't tell whether there was one
+        if (videoDecodeTimes.Num())
+            GetVideoDecodeTime(videoFrames.Last(), true);
+
+        if (audioDecodeTimes.Num())
+            GetAudioDecodeTime(audioFrames.Last(), true);
+
+        UINT moovSize = BuildMoov();
+
+        fileOut.Serialize(endBuffer.Array(), moovSize);
         fileOut.Close();
 
         XFile file;
-        if(file.Open(strFile, XFILE_WRITE, XFILE_OPENEXISTING))
+        if(!fileOut.WriteFailed() && file.Open(strFile, XFILE_WRITE, XFILE_OPENEXISTING))
         {
 #ifdef USE_64BIT_MP4
             file.SetPos((INT64)mdatStart+8, XFILE_BEGIN);
@@ -802,21 +1004,48 @@ public:
             file.Close();
         }
 
-        App->EnableSceneSwitching(true);
+        if(bHoldSceneSwitching)
+            App->EnableSceneSwitching(true);
 
         //DestroyWindow(hwndProgressDialog);
     }
 
-    virtual void AddPacket(BYTE *data, UINT size, DWORD timestamp, PacketType type)
+    virtual void AddPacket(PacketBuffer *packet, DWORD timestamp, PacketType type)
     {
+        LPBYTE data = packet->Data();
+        UINT size = packet->Size();
+
         UINT64 offset = fileOut.GetPos();
 
         if(initialTimeStamp == -1 && data[0] != 0x17)
             return;
         else if(initialTimeStamp == -1 && data[0] == 0x17) {
             initialTimeStamp = timestamp;
+
+            if(bFragmented)
+            {
+                UINT moovSize = BuildMoov();
+                fileOut.Serialize(endBuffer.Array(), moovSize);
+            }
+        }
+
+        //a new fragment starts on the first keyframe after enough has built up
+        if(bFragmented && type != PacketType_Audio && videoFragmentSamples.Num())
+        {
+            DWORD frameTime = timestamp-initialTimeStamp;
+            if(frameTime != lastVideoTimestamp)
+            {
+                DWORD pendingTime = frameTime-DWORD(videoFragmentSamples[0].decodeTime);
+                UINT64 pendingSize = videoFragmentOut.GetPos()+audioFragmentOut.GetPos();
+
+                if((data[0] == 0x17 && pendingTime >= fragmentDuration) || pendingSize >= MP4_MAX_FRAGMENT_SIZE)
+                    WriteFragment(frameTime);
+            }
         }
 
+        Serializer &out = !bFragmented ? (Serializer&)fileOut :
+                          (type == PacketType_Audio) ? (Serializer&)audioFragmentOut : (Serializer&)videoFragmentOut;
+
         if(type == PacketType_Audio)
         {
             UINT copySize;
@@ -824,12 +1053,24 @@ public:
             if(bMP3)
             {
                 copySize = size-1;
-                fileOut.Serialize(data+1, copySize);
+                out.Serialize(data+1, copySize);
             }
             else
             {
                 copySize = size-2;
-                fileOut.Serialize(data+2, copySize);
+                out.Serialize(data+2, copySize);
+            }
+
+            if(bFragmented)
+            {
+                MP4FragmentSample sample;
+                sample.decodeTime           = GetFragmentAudioTime(timestamp-initialTimeStamp);
+                sample.size                 = copySize;
+                sample.compositionOffset    = 0;
+                sample.bKeyframe            = true;
+
+                audioFragmentSamples << sample;
+                return;
             }
 
             MP4AudioFrameInfo audioFrame;
@@ -854,14 +1095,14 @@ public:
                 LPBYTE lpData = data+11;
 
                 UINT spsSize = fastHtons(*(WORD*)lpData);
-                fileOut.OutputWord(0);
-                fileOut.Serialize(lpData, spsSize+2);
+                out.OutputWord(0);
+                out.Serialize(lpData, spsSize+2);
 
                 lpData += spsSize+3;
 
                 UINT ppsSize = fastHtons(*(WORD*)lpData);
-                fileOut.OutputWord(0);
-                fileOut.Serialize(lpData, ppsSize+2);
+                out.OutputWord(0);
+                out.Serialize(lpData, ppsSize+2);
 
                 totalCopied = spsSize+ppsSize+8;
             }
@@ -869,11 +1110,11 @@ public:
             {
                 if (!bSentSEI) {
                     DataPacket sei;
-                    App->GetVideoEncoder()->GetSEI(sei);
+                    videoInfo.encoder->GetSEI(sei);
 
                     if (sei.size > 0)
                     {
-                        fileOut.Serialize(sei.lpPacket, sei.size);
+                        out.Serialize(sei.lpPacket, sei.size);
                         totalCopied += sei.size;
 
                         bSentSEI = true;
@@ -881,10 +1122,30 @@ public:
                 }
 
                 totalCopied += size-5;
-                fileOut.Serialize(data+5, size-5);
+                out.Serialize(data+5, size-5);
             }
 
-            if(!videoFrames.Num() || (timestamp-initialTimeStamp) != lastVideoTimestamp)
+            if(bFragmented)
+            {
+                if(!videoFragmentSamples.Num() || (timestamp-initialTimeStamp) != lastVideoTimestamp)
+                {
+                    INT timeOffset = 0;
+                    mcpy(((BYTE*)&timeOffset)+1, data+2, 3);
+                    if(data[2] >= 0x80)
+                        timeOffset |= 0xFF;
+
+                    MP4FragmentSample sample;
+                    sample.decodeTime           = timestamp-initialTimeStamp;
+                    sample.size                 = totalCopied;
+                    sample.compositionOffset    = (INT)fastHtonl(DWORD(timeOffset));
+                    sample.bKeyframe            = data[0] == 0x17;
+
+                    videoFragmentSamples << sample;
+                }
+                else
+                    videoFragmentSamples.Last().size += totalCopied;
+            }
+            else if(!videoFrames.Num() || (timestamp-initialTimeStamp) != lastVideoTimestamp)
             {
                 INT timeOffset = 0;
                 mcpy(((BYTE*)&timeOffset)+1, data+2, 3);
@@ -918,12 +1179,20 @@ public:
 };
 
 
-VideoFileStream* CreateMP4FileStream(CTSTR lpFile)
+VideoFileStream* CreateMP4FileStream(CTSTR lpFile, const VideoStreamInfo &videoInfo)
 {
     MP4FileStream *fileStream = new MP4FileStream;
-    if(fileStream->Init(lpFile))
+    if(fileStream->Init(lpFile, videoInfo))
         return fileStream;
 
     delete fileStream;
     return NULL;
 }
+
+VideoFileStream* CreateMP4FileStream(CTSTR lpFile)
+{
+    VideoStreamInfo videoInfo;
+    App->GetVideoStreamInfo(videoInfo);
+
+    return CreateMP4FileStream(lpFile, videoInfo);
+}
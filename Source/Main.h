@@ -117,6 +117,7 @@ void WINAPI ProcessEvents();
 #include "../resource.h"
 #include "VolumeControl.h"
 #include "VolumeMeter.h"
+#include "PacketBuffer.h"
 #include "OBS.h"
 #include "WindowStuff.h"
 #include "CodeTokenizer.h"
@@ -0,0 +1,200 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "Main.h"
+#include "RTMPPublisher.h"
+
+
+//sends the same encoded packets to several servers.  each destination is a full RTMPPublisher
+//with its own connection, send queue, threads and frame dropping, so the only thing they share
+//is the (read-only) packet data.  SendPacket never blocks on any of them.
+//
+//the first destination is the normal stream setting and behaves like it always has, the others
+//come from Publish/ExtraURL and Publish/ExtraPlayPath and just drop out if they fail
+class MultiPublisher : public NetworkStream
+{
+    struct DestinationStats
+    {
+        QWORD bytesSent;
+        DWORD numTimesWaited, numDroppedFrames;
+        bool bValid;
+    };
+
+    List<RTMPPublisher*> publishers;
+
+    bool bLimitToSlowest;
+    List<DestinationStats> lastStats;
+    NetworkSendStats totalStats;
+
+public:
+    MultiPublisher()
+    {
+        StringList extraURLs, extraPlayPaths;
+        AppConfig->GetStringList(TEXT("Publish"), TEXT("ExtraURL"), extraURLs);
+        AppConfig->GetStringList(TEXT("Publish"), TEXT("ExtraPlayPath"), extraPlayPaths);
+
+        RTMPPublisher *primary = new RTMPPublisher;
+        primary->SetSharedPackets(true);
+        publishers << primary;
+
+        for(UINT i=0; i<extraURLs.Num(); i++)
+        {
+            RTMPPublisher *publisher = new RTMPPublisher;
+            publisher->SetDestination(0, extraURLs[i], (i < extraPlayPaths.Num()) ? extraPlayPaths[i].Array() : TEXT(""), true);
+            publisher->SetSharedPackets(true);
+            publishers << publisher;
+
+            Log(TEXT("MultiPublisher: also streaming to %s"), extraURLs[i].Array());
+        }
+
+        bLimitToSlowest = AppConfig->GetInt(TEXT("Publish"), TEXT("ExtraURLLimitBitrate")) != 0;
+        lastStats.SetSize(publishers.Num());
+        zero(lastStats.Array(), sizeof(DestinationStats)*lastStats.Num());
+        zero(&totalStats, sizeof(totalStats));
+    }
+
+    ~MultiPublisher()
+    {
+        for(UINT i=0; i<publishers.Num(); i++)
+            delete publishers[i];
+        publishers.Clear();
+    }
+
+    void SendPacket(PacketBuffer *packet, DWORD timestamp, PacketType type)
+    {
+        //each publisher takes its own reference if it keeps the packet
+        for(UINT i=0; i<publishers.Num(); i++)
+            publishers[i]->SendPacket(packet, timestamp, type);
+    }
+
+    void BeginPublishing()
+    {
+        for(UINT i=0; i<publishers.Num(); i++)
+            publishers[i]->BeginPublishing();
+    }
+
+    //the encoder is shared, so whatever drives its bitrate is felt by every destination.  by
+    //default that's the primary alone, so a slow extra destination drops frames on its own
+    //instead of lowering everyone's quality.  with Publish/ExtraURLLimitBitrate the slowest
+    //destination still up drives it instead
+
+    double GetPacketStrain() const
+    {
+        if(!bLimitToSlowest)
+            return publishers[0]->GetPacketStrain();
+
+        double strain = 0.0;
+        for(UINT i=0; i<publishers.Num(); i++)
+        {
+            if(publishers[i]->IsActive())
+                strain = max(strain, publishers[i]->GetPacketStrain());
+        }
+
+        return strain;
+    }
+
+    QWORD GetCurrentSentBytes()
+    {
+        QWORD bytesSent = 0;
+        for(UINT i=0; i<publishers.Num(); i++)
+            bytesSent += publishers[i]->GetCurrentSentBytes();
+
+        return bytesSent;
+    }
+
+    DWORD NumDroppedFrames() const
+    {
+        if(!bLimitToSlowest)
+            return publishers[0]->NumDroppedFrames();
+
+        //destinations that dropped out keep their count, so this never goes backwards
+        DWORD numDropped = 0;
+        for(UINT i=0; i<publishers.Num(); i++)
+            numDropped = max(numDropped, publishers[i]->NumDroppedFrames());
+
+        return numDropped;
+    }
+
+    DWORD NumTotalVideoFrames() const
+    {
+        return publishers[0]->NumTotalVideoFrames();
+    }
+
+    void GetSendStats(NetworkSendStats &stats)
+    {
+        if(!bLimitToSlowest)
+        {
+            publishers[0]->GetSendStats(stats);
+            return;
+        }
+
+        //the counters are built up from each destination's own changes since the last call, so a
+        //destination dropping out just stops adding to them instead of making them jump
+        QWORD minBytesSent = 0;
+        bool bFirst = true;
+        double maxOccupancy = -1.0;
+
+        totalStats.queuedBytes = totalStats.bufferedBytes = totalStats.bufferSize = 0;
+
+        for(UINT i=0; i<publishers.Num(); i++)
+        {
+            RTMPPublisher *publisher = publishers[i];
+            if(!publisher->IsActive())
+                continue;
+
+            NetworkSendStats destStats;
+            publisher->GetSendStats(destStats);
+
+            DestinationStats &last = lastStats[i];
+            if(last.bValid)
+            {
+                //the smallest amount sent gives the slowest send rate, and any wait or drop anywhere counts
+                QWORD bytesSent = destStats.bytesSent-last.bytesSent;
+                minBytesSent = bFirst ? bytesSent : min(minBytesSent, bytesSent);
+                totalStats.numTimesWaited   += destStats.numTimesWaited-last.numTimesWaited;
+                totalStats.numDroppedFrames += destStats.numDroppedFrames-last.numDroppedFrames;
+                bFirst = false;
+            }
+
+            last.bytesSent        = destStats.bytesSent;
+            last.numTimesWaited   = destStats.numTimesWaited;
+            last.numDroppedFrames = destStats.numDroppedFrames;
+            last.bValid           = true;
+
+            totalStats.queuedBytes = max(totalStats.queuedBytes, destStats.queuedBytes);
+
+            double occupancy = destStats.bufferSize ? double(destStats.bufferedBytes)/double(destStats.bufferSize) : 0.0;
+            if(occupancy > maxOccupancy)
+            {
+                totalStats.bufferedBytes = destStats.bufferedBytes;
+                totalStats.bufferSize = destStats.bufferSize;
+                maxOccupancy = occupancy;
+            }
+        }
+
+        totalStats.bytesSent += minBytesSent;
+        stats = totalStats;
+    }
+};
+
+
+NetworkStream* CreateMultiPublisher()
+{
+    return new MultiPublisher;
+}
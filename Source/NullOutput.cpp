@@ -23,7 +23,7 @@
 class NullVideoEncoder : public VideoEncoder
 {
 public:
-    virtual bool Encode(LPVOID picIn, List<DataPacket> &packets, List<PacketType> &packetTypes, DWORD timestamp) {return false;}
+    virtual bool Encode(LPVOID picIn, VideoSegment &packets, DWORD timestamp) {return false;}
     virtual void GetHeaders(DataPacket &packet) {}
     virtual int  GetBitRate() const {return 0;}
     virtual String GetInfoString() const {return String();}
@@ -45,7 +45,7 @@ public:
 
 class NullNetwork : public NetworkStream
 {
-    virtual void SendPacket(BYTE *data, UINT size, DWORD timestamp, PacketType type) {bytesSent += size;framesRendered++;}
+    virtual void SendPacket(PacketBuffer *packet, DWORD timestamp, PacketType type) {bytesSent += packet->Size();framesRendered++;}
 
     double GetPacketStrain() const {return 0;}
     QWORD GetCurrentSentBytes() {return bytesSent;}
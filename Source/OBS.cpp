@@ -48,6 +48,8 @@ void STDCALL SceneHotkey(DWORD hotkey, UPARAM param, bool bDown);
 
 APIInterface* CreateOBSApiInterface();
 
+void InitConvert444(const int *cpuInfo);
+
 
 #define QuickClearHotkey(hotkeyID) \
     if(hotkeyID) \
@@ -128,10 +130,16 @@ BOOL IsWebrootLoaded()
 OBS::OBS()
 {
     App = this;
+    mainThreadID = GetCurrentThreadId();
 
     hSceneMutex = OSCreateMutex();
     hAuxAudioMutex = OSCreateMutex();
     hVideoEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    hAudioEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    hAudioQueryStart = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+    hAudioQueryDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    PacketBuffer::InitPool();
 
     monitors.Clear();
     EnumDisplayMonitors(NULL, NULL, (MONITORENUMPROC)MonitorInfoEnumProc, (LPARAM)&monitors);
@@ -147,6 +155,13 @@ OBS::OBS()
     InitVolumeControl(hinstMain);
     InitVolumeMeter(hinstMain);
 
+    __cpuid(cpuInfo, 1);
+    InitConvert444(cpuInfo);
+
+    //"General/AudioKernels" can be SSE2 or AVX to force a lower variant for testing
+    String strAudioKernels = GlobalConfig->GetString(TEXT("General"), TEXT("AudioKernels"));
+    InitAudioKernels(cpuInfo, strAudioKernels.IsEmpty() ? NULL : strAudioKernels.Array());
+
     //-----------------------------------------------------
     // load locale
 
@@ -766,6 +781,15 @@ OBS::~OBS()
     if (hVideoEvent)
         CloseHandle(hVideoEvent);
 
+    if (hAudioEvent)
+        CloseHandle(hAudioEvent);
+
+    if (hAudioQueryStart)
+        CloseHandle(hAudioQueryStart);
+
+    if (hAudioQueryDone)
+        CloseHandle(hAudioQueryDone);
+
     if(hSceneMutex)
         OSCloseMutex(hSceneMutex);
 
@@ -783,6 +807,8 @@ OBS::~OBS()
     if(hHotkeyMutex)
         OSCloseMutex(hHotkeyMutex);
 
+    PacketBuffer::FreePool();
+
     App = NULL;
 }
 
@@ -1288,6 +1314,7 @@ void OBS::ReloadIniSettings()
     QuickClearHotkey(muteDesktopHotkeyID);
     QuickClearHotkey(stopStreamHotkeyID);
     QuickClearHotkey(startStreamHotkeyID);
+    QuickClearHotkey(saveReplayHotkeyID);
 
     bUsingPushToTalk = AppConfig->GetInt(TEXT("Audio"), TEXT("UsePushToTalk")) != 0;
     DWORD hotkey = AppConfig->GetInt(TEXT("Audio"), TEXT("PushToTalkHotkey"));
@@ -1315,6 +1342,10 @@ void OBS::ReloadIniSettings()
     if(hotkey)
         startStreamHotkeyID = API->CreateHotkey(hotkey, OBS::StartStreamHotkey, NULL);
 
+    hotkey = AppConfig->GetInt(TEXT("Publish"), TEXT("SaveReplayHotkey"));
+    if(hotkey)
+        saveReplayHotkeyID = API->CreateHotkey(hotkey, OBS::SaveReplayHotkey, NULL);
+
     //-------------------------------------------
     // Notification Area icon
     bool showIcon = AppConfig->GetInt(TEXT("General"), TEXT("ShowNotificationAreaIcon"), 0) != 0;
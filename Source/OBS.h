@@ -102,24 +102,112 @@ enum PacketType
     PacketType_Audio
 };
 
+//----------------------------
+
+struct VideoPacketData
+{
+    PacketBuffer *data;
+    PacketType type;
+
+    inline void Clear() {if(data) {data->Release(); data = NULL;}}
+};
+
+struct VideoSegment
+{
+    List<VideoPacketData> packets; //only the first numPackets are in use, the rest is kept around for reuse
+    UINT numPackets;
+    DWORD timestamp;
+    QWORD bufferedTimeNS;
+
+    inline VideoSegment() : numPackets(0), timestamp(0), bufferedTimeNS(0) {}
+    inline ~VideoSegment() {Clear();}
+
+    inline void AddPacket(PacketBuffer *data, PacketType type)
+    {
+        if(numPackets == packets.Num())
+            packets.SetSize(numPackets+1);
+
+        VideoPacketData &packet = packets[numPackets++];
+        packet.data = data;
+        packet.type = type;
+    }
+
+    //releases the packets but keeps the storage
+    inline void Reset()
+    {
+        for(UINT i=0; i<numPackets; i++)
+            packets[i].Clear();
+        numPackets = 0;
+    }
+
+    //hands the references over to another segment, both keep their storage
+    inline void MoveTo(VideoSegment &segment)
+    {
+        for(UINT i=0; i<numPackets; i++)
+        {
+            segment.AddPacket(packets[i].data, packets[i].type);
+            packets[i].data = NULL;
+        }
+        numPackets = 0;
+    }
+
+    inline void Clear()
+    {
+        Reset();
+        packets.Clear();
+    }
+};
+
+struct NetworkSendStats
+{
+    DWORD queuedBytes;          //encoded data waiting in the output's packet queue
+    DWORD bufferedBytes;        //data handed to the socket side but not yet sent
+    DWORD bufferSize;           //size of the socket side buffer, 0 if there isn't one
+    QWORD bytesSent;
+    DWORD numTimesWaited;       //times the sender blocked on a full buffer
+    DWORD numDroppedFrames;
+};
+
 class NetworkStream
 {
 public:
     virtual ~NetworkStream() {}
-    virtual void SendPacket(BYTE *data, UINT size, DWORD timestamp, PacketType type)=0;
+    //packet is only guaranteed to be valid during the call, AddRef it to keep it around
+    virtual void SendPacket(PacketBuffer *packet, DWORD timestamp, PacketType type)=0;
     virtual void BeginPublishing() {}
 
     virtual double GetPacketStrain() const=0;
     virtual QWORD GetCurrentSentBytes()=0;
     virtual DWORD NumDroppedFrames() const=0;
     virtual DWORD NumTotalVideoFrames() const=0;
+
+    virtual void GetSendStats(NetworkSendStats &stats)
+    {
+        zero(&stats, sizeof(stats));
+        stats.bytesSent = GetCurrentSentBytes();
+        stats.numDroppedFrames = NumDroppedFrames();
+    }
+};
+
+//-------------------------------------------------------------------
+
+//steers the encoder bitrate from the output's send stats, so congestion is handled by
+//lowering the bitrate rather than having the publisher drop frames
+class BitrateController
+{
+public:
+    virtual ~BitrateController() {}
+
+    //called once per frame, returns the bitrate (kbps) the encoder should be using
+    virtual DWORD Update(const NetworkSendStats &stats, QWORD timeMS)=0;
+    virtual DWORD GetBitRate() const=0;
 };
 
 //-------------------------------------------------------------------
 
 struct TimedPacket
 {
-    List<BYTE> data;
+    PacketBuffer *data;
     DWORD timestamp;
     PacketType type;
 };
@@ -130,7 +218,89 @@ class VideoFileStream
 {
 public:
     virtual ~VideoFileStream() {}
-    virtual void AddPacket(BYTE *data, UINT size, DWORD timestamp, PacketType type)=0;
+    virtual void AddPacket(PacketBuffer *packet, DWORD timestamp, PacketType type)=0;
+};
+
+struct VideoStreamInfo;
+typedef VideoFileStream* (*FILESTREAMCREATEPROC)(CTSTR lpFile, const VideoStreamInfo &videoInfo);
+
+//keeps the last few seconds of encoded output in memory
+class ReplayBuffer : public VideoFileStream
+{
+public:
+    //writes out what's currently buffered, on its own thread
+    virtual void SaveReplay()=0;
+};
+
+//-------------------------------------------------------------------
+
+struct FileWriteStats
+{
+    QWORD bytesWritten;
+    DWORD numTimesWaited;       //times the encode thread had to wait for a free buffer
+    DWORD totalWaitTime;        //ms spent waiting for a free buffer
+    DWORD maxQueuedBuffers;
+    DWORD maxWriteTime;         //longest single write (ms)
+};
+
+//output serializer for recordings.  data is gathered into a small set of large buffers which
+//a writer thread puts on disk, so a disk stall only holds up the encode thread once every
+//buffer is waiting to be written
+class AsyncFileWriter : public Serializer
+{
+    HANDLE hFile;
+    HANDLE hWriteThread;
+    HANDLE hFreeBuffers, hQueuedBuffers;
+
+    List<LPBYTE> buffers;
+    List<DWORD>  bufferLengths;
+    DWORD bufferSize;
+    UINT curBuffer, writeBuffer;
+    DWORD bufferPos;
+
+    bool bUnbuffered;
+    UINT64 preallocateSize, allocatedSize;
+
+    String strFile;
+
+    UINT64 totalQueued;
+    UINT64 fileOffset;
+
+    //set by the writer thread.  nothing more goes to disk after a failed write, and the file is
+    //cut off where it failed
+    volatile bool bWriteFailed;
+    DWORD writeError;
+    UINT64 failedOffset;
+    bool bReportedFailure;
+
+    volatile LONG numQueued;
+    FileWriteStats stats;
+
+    static DWORD STDCALL WriteThread(LPVOID lpWriter);
+    void WriteLoop();
+
+    void QueueBuffer(DWORD length);
+    void ReportWriteFailure();
+
+public:
+    AsyncFileWriter();
+    ~AsyncFileWriter() {Close();}
+
+    bool Open(CTSTR lpFile);
+    void Close();
+
+    //hands the data so far to the writer thread
+    void Flush();
+
+    BOOL IsLoading() {return FALSE;}
+    void Serialize(LPCVOID lpData, DWORD length);
+    UINT64 Seek(INT64 offset, DWORD seekType=SERIALIZE_SEEK_START);
+    UINT64 GetPos() const {return totalQueued+bufferPos;}
+
+    //true once a write has failed, the file is only good up to that point
+    inline bool WriteFailed() const {return bWriteFailed;}
+
+    inline const FileWriteStats& GetStats() const {return stats;}
 };
 
 //-------------------------------------------------------------------
@@ -159,9 +329,12 @@ public:
 class VideoEncoder
 {
     friend class OBS;
+    friend class VideoRenditionEncoder;
 
 protected:
-    virtual bool Encode(LPVOID picIn, List<DataPacket> &packets, List<PacketType> &packetTypes, DWORD timestamp)=0;
+    //packets are added to the (empty) segment, which then owns a reference to each.  the
+    //caller keeps the segment around so its storage is reused from frame to frame
+    virtual bool Encode(LPVOID picIn, VideoSegment &packets, DWORD timestamp)=0;
 
     virtual void RequestBuffers(LPVOID buffers) {}
 
@@ -185,6 +358,41 @@ public:
     virtual bool HasBufferedFrames() { return false; }
 };
 
+//the video an output is being fed.  outputs normally take the main encoder, but a rendition
+//hands its own to the outputs it creates so they get the right headers and metadata
+struct VideoStreamInfo
+{
+    VideoEncoder *encoder;
+    UINT width, height;
+    UINT fps;
+};
+
+//an extra encode of the composited frame at another size and bitrate, with its own outputs
+class VideoRendition
+{
+public:
+    virtual ~VideoRendition() {}
+
+    virtual void GetSize(UINT &width, UINT &height) const=0;
+    virtual UINT GetFrameDivisor() const=0;
+
+    //capture thread (encode thread for the recording encoder).  gets a free NV12 picture to put
+    //the next frame in, fails if the rendition's encoder is behind, in which case the frame is
+    //just skipped for it
+    virtual bool BeginFrame(LPBYTE *planes)=0;
+    //the picture from BeginFrame is filled in and can be encoded
+    virtual void EndFrame(DWORD timestamp)=0;
+
+    //encode thread.  audio as it goes out to the main outputs
+    virtual void AddAudio(PacketBuffer *audio, DWORD timestamp)=0;
+
+    virtual void GetStreamInfo(VideoStreamInfo &info) const=0;
+
+    //swaps the file being recorded to.  the old one is returned for the caller to finish once
+    //it has every frame up to the swap, the new one starts at the next keyframe
+    virtual VideoFileStream* SetFileStream(VideoFileStream *fileStream)=0;
+};
+
 //-------------------------------------------------------------------
 
 struct MonitorInfo
@@ -257,10 +465,19 @@ struct FontInfo
 
 struct FrameAudio
 {
-    List<BYTE> audioData;
+    PacketBuffer *audioData;
     QWORD timestamp;
 };
 
+//one source's share of an audio tick, run on the audio query threads
+struct AudioQuery
+{
+    AudioSource *source;
+    float volume;
+    bool bDrain;
+    bool bGotAudio;
+};
+
 
 //===============================================================================================
 
@@ -376,6 +593,8 @@ enum
     OBS_SETSOURCERENDER,
     OBS_UPDATESTATUSBAR,
     OBS_NOTIFICATIONAREA,
+    OBS_FILEWRITEFAILED,
+    OBS_SAVEREPLAY,
 };
 
 //----------------------------
@@ -486,31 +705,120 @@ struct StatusBarDrawData
 
 //----------------------------
 
-struct VideoPacketData
+//queue of video segments for the scene buffering delay.  slots and their packet storage are
+//reused, so once warmed up, buffering a frame doesn't touch the heap or shift the queue.  it's
+//reserved for the buffering time at the output fps up front, and only grows if frames come in
+//faster than that (after which it keeps the bigger size)
+class VideoSegmentRing
 {
-    List<BYTE> data;
-    PacketType type;
+    List<VideoSegment> slots;
+    UINT start, count;
 
-    inline void Clear() {data.Clear();}
-};
+public:
+    inline VideoSegmentRing() : start(0), count(0) {}
+    inline ~VideoSegmentRing() {Free();}
 
-struct VideoSegment
-{
-    List<VideoPacketData> packets;
-    DWORD timestamp;
+    inline UINT Num() const {return count;}
+    inline UINT Capacity() const {return slots.Num();}
+
+    inline VideoSegment& operator[](UINT index)
+    {
+        assert(index < count);
+        UINT pos = start+index;
+        if(pos >= slots.Num())
+            pos -= slots.Num();
+        return slots[pos];
+    }
+
+    inline VideoSegment& First() {return (*this)[0];}
+    inline VideoSegment& Last()  {return (*this)[count-1];}
+
+    void Reserve(UINT capacity)
+    {
+        if(capacity <= slots.Num())
+            return;
+
+        //lists are moved as-is, so the segments are laid out again in order starting at 0
+        List<VideoSegment> newSlots;
+        newSlots.SetSize(capacity);
+
+        for(UINT i=0; i<slots.Num(); i++)
+        {
+            UINT pos = start+i;
+            if(pos >= slots.Num())
+                pos -= slots.Num();
+            mcpy(newSlots+i, slots+pos, sizeof(VideoSegment));
+        }
+
+        slots.Clear();
+        slots.TransferFrom(newSlots);
+        start = 0;
+    }
+
+    inline VideoSegment& Push()
+    {
+        if(count == slots.Num())
+            Reserve(max(slots.Num()*2, 8));
+
+        ++count;
+        VideoSegment &segment = Last();
+        segment.Reset();
+        return segment;
+    }
+
+    inline void PopFront()
+    {
+        assert(count);
+        First().Reset();
+        if(++start == slots.Num())
+            start = 0;
+        --count;
+    }
 
-    inline VideoSegment() : timestamp(0) {}
-    inline ~VideoSegment() {Clear();}
     inline void Clear()
     {
-        for(UINT i=0; i<packets.Num(); i++)
-            packets[i].Clear();
-        packets.Clear();
+        while(count)
+            PopFront();
+        start = 0;
+    }
+
+    inline void Free()
+    {
+        Clear();
+        for(UINT i=0; i<slots.Num(); i++)
+            slots[i].Clear();
+        slots.Clear();
     }
 };
 
 //----------------------------
 
+//values under 32us get a bucket each, above that every power of two is split into 16
+#define LATENCY_LINEAR_BUCKETS  32
+#define LATENCY_SUB_BUCKETS     16
+#define LATENCY_NUM_BUCKETS     (LATENCY_LINEAR_BUCKETS + (32-5)*LATENCY_SUB_BUCKETS)
+
+//HDR-style latency histogram in microseconds.  recording is a few interlocked ops and never
+//blocks, so any thread can record while another reads out the stats
+class LatencyHistogram
+{
+    volatile LONG counts[LATENCY_NUM_BUCKETS];
+    volatile LONGLONG numValues, totalTime;
+    volatile LONG minTime, maxTime;
+
+    static UINT BucketIndex(DWORD value);
+    static DWORD BucketTop(UINT index);
+
+public:
+    inline LatencyHistogram() {Reset();}
+
+    void Reset();
+    void Record(QWORD timeNS);
+    void GetStats(FrameStageStats &stats) const;
+};
+
+//----------------------------
+
 enum PreviewDrawType {
     Preview_Standard,
     Preview_Fullscreen,
@@ -518,6 +826,7 @@ enum PreviewDrawType {
 };
 
 void ResetWASAPIAudioDevice(AudioSource *source);
+bool WASAPIAudioDeviceSignalsReady(AudioSource *source);
 
 struct FrameProcessInfo;
 
@@ -658,6 +967,7 @@ private:
     UINT    reconnectTimeout;
 
     bool    bDisableSceneSwitching;
+    DWORD   mainThreadID;
     bool    bChangingSources;
     bool    bAlwaysOnTop;
     bool    bPleaseEnableProjector;   //I'm just too lazy
@@ -696,6 +1006,7 @@ private:
     UINT    outputCX, outputCY;
     float   downscale;
     int     downscaleType;
+    bool    bCPUDownscale;
     UINT    frameTime, fps;
     bool    bUsing444;
     ColorDescription colorDesc;
@@ -719,7 +1030,10 @@ private:
     HANDLE  hVideoThread;
     HANDLE  hSceneMutex;
 
-    List<VideoSegment> bufferedVideo;
+    VideoSegmentRing bufferedVideo;
+    VideoSegment encodedVideo;      //encoder output for the current frame, only used by the encode thread
+
+    LatencyHistogram frameTiming[FrameStage_Count];
 
     CircularList<UINT> bufferedTimes;
 
@@ -732,9 +1046,13 @@ private:
     QWORD latestVideoTimeNS;
 
     bool bUseCFR;
+    bool bLowLatency;
 
     bool bWriteToFile;
     VideoFileStream *fileStream;
+    ReplayBuffer *replayBuffer;
+    List<VideoRendition*> renditions;
+    VideoRendition *recordingEncoder;
 
     bool bRequestKeyframe;
     int  keyframeWait;
@@ -745,7 +1063,7 @@ private:
 
     static DWORD STDCALL EncodeThread(LPVOID lpUnused);
     static DWORD STDCALL MainCaptureThread(LPVOID lpUnused);
-    bool BufferVideoData(const List<DataPacket> &inputPackets, const List<PacketType> &inputTypes, DWORD timestamp, VideoSegment &segmentOut);
+    bool BufferVideoData(VideoSegment &encoded, DWORD timestamp);
     void SendFrame(VideoSegment &curSegment, QWORD firstFrameTime);
     bool ProcessFrame(FrameProcessInfo &frameInfo);
     void EncodeLoop();  
@@ -759,6 +1077,7 @@ private:
     CircularList<QWORD> bufferedAudioTimes;
 
     HANDLE  hSoundThread, hSoundDataMutex;//, hRequestAudioEvent;
+    HANDLE  hAudioEvent;
     QWORD   latestAudioTime;
 
     float   desktopVol, micVol, curMicVol, curDesktopVol;
@@ -771,6 +1090,14 @@ private:
 
     HANDLE hAuxAudioMutex;
 
+    //mic/aux queries are spread over threads of their own rather than the task pool, so they
+    //get COM and MMCSS like the audio thread and never wait behind video tiles
+    List<AudioQuery> audioQueries;
+    List<HANDLE> audioQueryThreads;
+    HANDLE hAudioQueryStart, hAudioQueryDone;
+    volatile LONG nextAudioQuery, numAudioQueriesLeft;
+    bool bAudioQueryExit;
+
     //---------------------------------------------------
     // hotkey stuff
 
@@ -786,15 +1113,22 @@ private:
     UINT muteDesktopHotkeyID;
     UINT startStreamHotkeyID;
     UINT stopStreamHotkeyID;
+    UINT saveReplayHotkeyID;
 
     bool bStartStreamHotkeyDown, bStopStreamHotkeyDown;
 
     static DWORD STDCALL MainAudioThread(LPVOID lpUnused);
+    static DWORD STDCALL AudioQueryThread(LPVOID lpUnused);
+    bool RunAudioQueries();
+    void StopAudioQueryThreads();
+    bool QueryMicAndAuxAudio(bool bDrain);
     bool QueryAudioBuffers(bool bQueriedDesktopDebugParam);
     bool QueryNewAudio();
     void EncodeAudioSegment(float *buffer, UINT numFrames, QWORD timestamp);
     void MainAudioLoop();
 
+    inline void NotifyAudioReady() {if(hAudioEvent) SetEvent(hAudioEvent);}
+
     //---------------------------------------------------
     // notification area icon
     UINT wmExplorerRestarted;
@@ -895,6 +1229,7 @@ private:
 
     static void STDCALL StartStreamHotkey(DWORD hotkey, UPARAM param, bool bDown);
     static void STDCALL StopStreamHotkey(DWORD hotkey, UPARAM param, bool bDown);
+    static void STDCALL SaveReplayHotkey(DWORD hotkey, UPARAM param, bool bDown);
 
     static void STDCALL PushToTalkHotkey(DWORD hotkey, UPARAM param, bool bDown);
     static void STDCALL MuteMicHotkey(DWORD hotkey, UPARAM param, bool bDown);
@@ -994,10 +1329,14 @@ public:
 
     inline UINT GetSampleRateHz() const {return sampleRateHz;}
 
+    inline void RecordFrameStage(FrameStage stage, QWORD timeNS) {frameTiming[stage].Record(timeNS);}
+    void DumpFrameTiming() const;
+    void ResetFrameTiming();
+
     inline QWORD GetAudioTime() const {return latestAudioTime;}
     inline QWORD GetVideoTime() const {return latestVideoTime;}
 
-    char* EncMetaData(char *enc, char *pend, bool bFLVFile=false);
+    char* EncMetaData(char *enc, char *pend, bool bFLVFile=false, const VideoStreamInfo *videoInfo=NULL);
 
     inline void PostStopMessage() {if(hwndMain) PostMessage(hwndMain, OBS_REQUESTSTOP, 0, 0);}
 
@@ -1022,14 +1361,19 @@ public:
 
     inline AudioEncoder* GetAudioEncoder() const {return audioEncoder;}
     inline VideoEncoder* GetVideoEncoder() const {return videoEncoder;}
+    inline void GetVideoStreamInfo(VideoStreamInfo &info) const {info.encoder = videoEncoder; info.width = outputCX; info.height = outputCY; info.fps = fps;}
 
     inline void EnterSceneMutex() {OSEnterMutex(hSceneMutex);}
     inline void LeaveSceneMutex() {OSLeaveMutex(hSceneMutex);}
 
     inline void EnableSceneSwitching(bool bEnable) {bDisableSceneSwitching = !bEnable;}
+    inline bool IsSceneSwitchingEnabled() const    {return !bDisableSceneSwitching;}
+
+    inline bool IsMainThread() const {return GetCurrentThreadId() == mainThreadID;}
 
     inline bool IsRunning()    const {return bRunning;}
     inline UINT GetFPS()       const {return fps;}
+    inline bool IsLowLatency() const {return bLowLatency;}
     inline UINT GetFrameTime() const {return frameTime;}
 
     inline UINT NumMonitors()  const {return monitors.Num();}
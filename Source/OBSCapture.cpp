@@ -21,31 +21,64 @@
 #include <time.h>
 #include <Avrt.h>
 
-VideoEncoder* CreateX264Encoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitRate, int bufferSize, bool bUseCFR);
+VideoEncoder* CreateX264Encoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitRate, int bufferSize, bool bUseCFR, bool bUseCBR, bool bLowLatency, bool bIntraRefresh);
+VideoEncoder* CreateX264HostEncoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitRate, int bufferSize, bool bUseCFR, bool bUseCBR, bool bLowLatency, bool bIntraRefresh);
 VideoEncoder* CreateQSVEncoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitRate, int bufferSize, bool bUseCFR, String &errors);
 VideoEncoder* CreateNVENCEncoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitRate, int bufferSize, bool bUseCFR, String &errors);
 AudioEncoder* CreateMP3Encoder(UINT bitRate);
 AudioEncoder* CreateAACEncoder(UINT bitRate);
 
-AudioSource* CreateAudioSource(bool bMic, CTSTR lpID);
+AudioSource* CreateAudioSource(bool bMic, CTSTR lpID, HANDLE hReadyEvent);
 
 //NetworkStream* CreateRTMPServer();
-NetworkStream* CreateRTMPPublisher();
-NetworkStream* CreateDelayedPublisher(DWORD delayTime);
+NetworkStream* CreateRTMPPublisher(bool bSharedPackets);
+NetworkStream* CreateDelayedPublisher(DWORD delayTime, bool bSharedPackets);
+NetworkStream* CreateMultiPublisher();
 NetworkStream* CreateBandwidthAnalyzer();
 
-void StartBlankSoundPlayback(CTSTR lpDevice);
+void StartBlankSoundPlayback(CTSTR lpDevice, HANDLE hReadyEvent);
 void StopBlankSoundPlayback();
+bool BlankSoundPlaybackSignalsReady();
 
 VideoEncoder* CreateNullVideoEncoder();
 AudioEncoder* CreateNullAudioEncoder();
 NetworkStream* CreateNullNetwork();
 
-VideoFileStream* CreateMP4FileStream(CTSTR lpFile);
-VideoFileStream* CreateFLVFileStream(CTSTR lpFile);
+VideoFileStream* CreateMP4FileStream(CTSTR lpFile, const VideoStreamInfo &videoInfo);
+VideoFileStream* CreateFLVFileStream(CTSTR lpFile, const VideoStreamInfo &videoInfo);
+VideoFileStream* CreateSegmentedFileStream(CTSTR lpFile, FILESTREAMCREATEPROC createStream, const VideoStreamInfo &videoInfo, DWORD segmentTime, UINT64 segmentSize);
+ReplayBuffer* CreateReplayBuffer(DWORD bufferLength, UINT64 maxMemory);
+VideoRendition* CreateVideoRendition(CTSTR lpSection, int quality, CTSTR preset, ColorDescription &colorDesc);
+VideoRendition* CreateRecordingEncoder(int quality, CTSTR preset, ColorDescription &colorDesc);
 //VideoFileStream* CreateAVIFileStream(CTSTR lpFile);
 
 
+//renditions with a URL send the main stream's audio packets from their own publisher, so the
+//main publisher has to treat its packets as shared too
+static bool RenditionsStream()
+{
+    for(UINT i=1; ; i++)
+    {
+        String strSection = FormattedString(TEXT("Rendition%u"), i);
+        if(!AppConfig->HasKey(strSection, TEXT("Width")))
+            return false;
+        if(AppConfig->GetString(strSection, TEXT("URL")).IsValid())
+            return true;
+    }
+}
+
+//the publisher for Publish/Mode 0: delayed, several destinations from Publish/ExtraURL, or the
+//one server.  used for every stream start, including a restart while recording
+static NetworkStream* CreateStreamPublisher(DWORD delayTime)
+{
+    if(delayTime > 0)
+        return CreateDelayedPublisher(delayTime, RenditionsStream());
+    else if(AppConfig->HasKey(TEXT("Publish"), TEXT("ExtraURL")))
+        return CreateMultiPublisher();
+    else
+        return CreateRTMPPublisher(RenditionsStream());
+}
+
 BOOL bLoggedSystemStats = FALSE;
 void LogSystemStats();
 
@@ -139,12 +172,40 @@ void OBS::StartRecording()
     if(!bTestStream && bWriteToFile && strOutputFile.IsValid())
     {
         String strFileExtension = GetPathExtension(strOutputFile);
+        FILESTREAMCREATEPROC createStream = NULL;
         if(strFileExtension.CompareI(TEXT("flv")))
-            fileStream = CreateFLVFileStream(strOutputFile);
+            createStream = CreateFLVFileStream;
         else if(strFileExtension.CompareI(TEXT("mp4")))
-            fileStream = CreateMP4FileStream(strOutputFile);
+            createStream = CreateMP4FileStream;
 
-        if(!fileStream)
+        DWORD segmentTime = (DWORD)AppConfig->GetInt(TEXT("Publish"), TEXT("RecordingSegmentTime"))*60*1000; //minutes
+        UINT64 segmentSize = UINT64(AppConfig->GetInt(TEXT("Publish"), TEXT("RecordingSegmentSize")))*1024*1024; //MB
+
+        VideoStreamInfo videoInfo;
+        if(recordingEncoder)
+            recordingEncoder->GetStreamInfo(videoInfo);
+        else
+            GetVideoStreamInfo(videoInfo);
+
+        VideoFileStream *newStream = NULL;
+        if(createStream)
+        {
+            if(segmentTime || segmentSize)
+                newStream = CreateSegmentedFileStream(strOutputFile, createStream, videoInfo, segmentTime, segmentSize);
+            else
+                newStream = createStream(strOutputFile, videoInfo);
+        }
+
+        //with a separate recording encoder the file gets its packets and not the stream's
+        if(newStream)
+        {
+            if(recordingEncoder)
+                recordingEncoder->SetFileStream(newStream);
+            else
+                fileStream = newStream;
+        }
+
+        if(!newStream)
         {
             Log(TEXT("Warning - OBSCapture::Start: Unable to create the file stream. Check the file path in Broadcast Settings."));
             MessageBox(hwndMain, Str("Capture.Start.FileStream.Warning"), Str("Capture.Start.FileStream.WarningCaption"), MB_OK | MB_ICONWARNING);        
@@ -164,9 +225,14 @@ void OBS::StopRecording()
 
     VideoFileStream *tempStream = NULL;
 
-    tempStream = fileStream;
-    // Prevent the encoder thread from trying to write to fileStream while it's closing
-    fileStream = NULL;
+    if(recordingEncoder)
+        tempStream = recordingEncoder->SetFileStream(NULL);
+    else
+    {
+        tempStream = fileStream;
+        // Prevent the encoder thread from trying to write to fileStream while it's closing
+        fileStream = NULL;
+    }
 
     delete tempStream;
     tempStream = NULL;
@@ -188,7 +254,7 @@ void OBS::Start()
         bFirstConnect = !bReconnecting;
 
         network = NULL;
-        network = CreateRTMPPublisher();
+        network = CreateStreamPublisher(delayTime);
 
         Log(TEXT("=====Stream Start (while recording): %s============================="), CurrentDateTimeString().Array());
 
@@ -276,7 +342,7 @@ retryHookTest:
     {
         switch(networkMode)
         {
-        case 0: network = (delayTime > 0) ? CreateDelayedPublisher(delayTime) : CreateRTMPPublisher(); break;
+        case 0: network = CreateStreamPublisher(delayTime); break;
         case 1: network = CreateNullNetwork(); break;
         }
     }
@@ -327,6 +393,9 @@ retryHookTest:
     outputCX = scaleCX & 0xFFFFFFFC;
     outputCY = scaleCY & 0xFFFFFFFE;
 
+    //read back at base size and scale during the 4:2:0 conversion rather than in the YUV shader
+    bCPUDownscale = !CloseFloat(downscale, 1.0) && AppConfig->GetInt(TEXT("Video"), TEXT("CPUDownscale"), 0) != 0;
+
     bUseMultithreadedOptimizations = AppConfig->GetInt(TEXT("General"), TEXT("UseMultithreadedOptimizations"), TRUE) != 0;
     Log(TEXT("  Multithreaded optimizations: %s"), (CTSTR)(bUseMultithreadedOptimizations ? TEXT("On") : TEXT("Off")));
 
@@ -336,6 +405,8 @@ retryHookTest:
 
     Log(TEXT("  Base resolution: %ux%u"), baseCX, baseCY);
     Log(TEXT("  Output resolution: %ux%u"), outputCX, outputCY);
+    if(bCPUDownscale)
+        Log(TEXT("  Downscaling on the CPU"));
     Log(TEXT("------------------------------------------"));
 
     //------------------------------------------------------------------
@@ -386,7 +457,7 @@ retryHookTestV2:
     //------------------------------------------------------------------
 
     CTSTR lpShader;
-    if(CloseFloat(downscale, 1.0))
+    if(CloseFloat(downscale, 1.0) || bCPUDownscale)
         lpShader = TEXT("shaders/DrawYUVTexture.pShader");
     else if(downscale < 2.01)
     {
@@ -408,18 +479,21 @@ retryHookTestV2:
 
     //-------------------------------------------------------------
 
+    UINT yuvCX = bCPUDownscale ? baseCX : outputCX;
+    UINT yuvCY = bCPUDownscale ? baseCY : outputCY;
+
     for(UINT i=0; i<NUM_RENDER_BUFFERS; i++)
     {
         mainRenderTextures[i] = CreateRenderTarget(baseCX, baseCY, GS_BGRA, FALSE);
-        yuvRenderTextures[i]  = CreateRenderTarget(outputCX, outputCY, GS_BGRA, FALSE);
+        yuvRenderTextures[i]  = CreateRenderTarget(yuvCX, yuvCY, GS_BGRA, FALSE);
     }
 
     //-------------------------------------------------------------
 
     D3D10_TEXTURE2D_DESC td;
     zero(&td, sizeof(td));
-    td.Width            = outputCX;
-    td.Height           = outputCY;
+    td.Width            = yuvCX;
+    td.Height           = yuvCY;
     td.Format           = DXGI_FORMAT_B8G8R8A8_UNORM;
     td.MipLevels        = 1;
     td.ArraySize        = 1;
@@ -473,7 +547,7 @@ retryHookTestV2:
     Log(TEXT("Playback device %s"), strPlaybackDevice.Array());
     playbackDevices.FreeData();
 
-    desktopAudio = CreateAudioSource(false, strPlaybackDevice);
+    desktopAudio = CreateAudioSource(false, strPlaybackDevice, hAudioEvent);
 
     if(!desktopAudio) {
         CrashError(TEXT("Cannot initialize desktop audio sound, more info in the log file."));
@@ -504,7 +578,7 @@ retryHookTestV2:
             if(bUseDefault)
                 strDevice = strDefaultMic;
 
-            micAudio = CreateAudioSource(true, strDevice);
+            micAudio = CreateAudioSource(true, strDevice, hAudioEvent);
 
             if(!micAudio)
                 MessageBox(hwndMain, Str("MicrophoneFailure"), NULL, 0);
@@ -593,10 +667,26 @@ retryHookTestV2:
     String preset  = AppConfig->GetString(TEXT("Video Encoding"), TEXT("Preset"),     TEXT("veryfast"));
     bUsing444      = false;//AppConfig->GetInt   (TEXT("Video Encoding"), TEXT("Use444"),     0) != 0;
     bUseCFR        = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("UseCFR"), 1) != 0;
+    bool bUseCBR   = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("UseCBR"), 1) != 0;
+    bLowLatency    = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("LowLatency")) != 0;
 
     //-------------------------------------------------------------
 
     bufferingTime = GlobalConfig->GetInt(TEXT("General"), TEXT("SceneBufferingTime"), 700);
+
+    //frames are held for the whole buffering time before going out, so low latency mode keeps it
+    //short.  sources whose audio arrives later than this will be out of sync
+    if(bLowLatency)
+    {
+        int maxBufferingTime = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("LowLatencyBufferingTime"), 200);
+        if(bufferingTime > maxBufferingTime)
+        {
+            Log(TEXT("Warning - low latency mode lowers the scene buffering time from %d to %d ms, sources whose audio comes later than that will be out of sync"),
+                bufferingTime, maxBufferingTime);
+            bufferingTime = maxBufferingTime;
+        }
+    }
+
     Log(TEXT("Scene buffering time set to %u"), bufferingTime);
 
     //-------------------------------------------------------------
@@ -611,7 +701,7 @@ retryHookTestV2:
     //-------------------------------------------------------------
 
     if (!useInputDevices)
-        StartBlankSoundPlayback(strPlaybackDevice);
+        StartBlankSoundPlayback(strPlaybackDevice, hAudioEvent);
 
     //-------------------------------------------------------------
 
@@ -629,7 +719,29 @@ retryHookTestV2:
     else if(AppConfig->GetInt(TEXT("Video Encoding"), TEXT("UseNVENC")) != 0)
         videoEncoder = CreateNVENCEncoder(fps, outputCX, outputCY, quality, preset, bUsing444, colorDesc, maxBitRate, bufferSize, bUseCFR, videoEncoderErrors);
     else
-        videoEncoder = CreateX264Encoder(fps, outputCX, outputCY, quality, preset, bUsing444, colorDesc, maxBitRate, bufferSize, bUseCFR);
+    {
+        //intra refresh never makes another IDR after the first frame, and recordings, segments and
+        //replay saves can only start on one.  so it's only used when nothing but the network takes
+        //this encoder's packets, everything else gets real IDRs (StartRecording asks for one)
+        bool bRecordingEncoder = !bTestStream && !bUsing444 && AppConfig->GetInt(TEXT("Recording Encoding"), TEXT("Enabled")) != 0;
+        bool bFileOutput = !bTestStream && !bRecordingEncoder &&
+            (AppConfig->GetInt(TEXT("Publish"), TEXT("Mode"), 2) == 1 || AppConfig->GetInt(TEXT("Publish"), TEXT("SaveToFile")) != 0);
+        bool bReplayOutput = !bTestStream && AppConfig->GetInt(TEXT("Publish"), TEXT("ReplayBufferLength")) != 0;
+
+        bool bIntraRefresh = bLowLatency && AppConfig->GetInt(TEXT("Video Encoding"), TEXT("LowLatencyIntraRefresh"), 1) != 0;
+        if(bIntraRefresh && (bFileOutput || bReplayOutput))
+        {
+            Log(TEXT("Low latency mode: not using intra refresh, recordings and the replay buffer need keyframes"));
+            bIntraRefresh = false;
+        }
+
+        //x264 in X264Helper.exe, falls back to running it here if the helper can't be started
+        if(AppConfig->GetInt(TEXT("Video Encoding"), TEXT("UseX264Host")) != 0)
+            videoEncoder = CreateX264HostEncoder(fps, outputCX, outputCY, quality, preset, bUsing444, colorDesc, maxBitRate, bufferSize, bUseCFR, bUseCBR, bLowLatency, bIntraRefresh);
+
+        if(!videoEncoder)
+            videoEncoder = CreateX264Encoder(fps, outputCX, outputCY, quality, preset, bUsing444, colorDesc, maxBitRate, bufferSize, bUseCFR, bUseCBR, bLowLatency, bIntraRefresh);
+    }
 
     if (!videoEncoder)
     {
@@ -654,14 +766,41 @@ retryHookTestV2:
 
     //-------------------------------------------------------------
 
+    if(!bTestStream && !bUsing444 && AppConfig->GetInt(TEXT("Recording Encoding"), TEXT("Enabled")))
+        recordingEncoder = CreateRecordingEncoder(quality, preset, colorDesc);
+
     StartRecording();
 
+    DWORD replayLength = (DWORD)AppConfig->GetInt(TEXT("Publish"), TEXT("ReplayBufferLength")); //seconds
+    if(!bTestStream && replayLength)
+    {
+        UINT64 replayMemory = UINT64(AppConfig->GetInt(TEXT("Publish"), TEXT("ReplayBufferMemory"), 512))*1024*1024; //MB
+        replayBuffer = CreateReplayBuffer(replayLength*1000, replayMemory);
+    }
+
+    //extra encodes of the same frame, from [Rendition1], [Rendition2]... in the profile
+    if(!bTestStream && !bUsing444)
+    {
+        for(UINT i=1; ; i++)
+        {
+            String strSection = FormattedString(TEXT("Rendition%u"), i);
+            if(!AppConfig->HasKey(strSection, TEXT("Width")))
+                break;
+
+            VideoRendition *rendition = CreateVideoRendition(strSection, quality, preset, colorDesc);
+            if(rendition)
+                renditions << rendition;
+        }
+    }
+
     //-------------------------------------------------------------
 
     curFramePic = NULL;
     bShutdownVideoThread = false;
     bShutdownEncodeThread = false;
     //ResetEvent(hVideoThread);
+    ResetFrameTiming();
+
     hEncodeThread = OSCreateThread((XTHREAD)OBS::EncodeThread, NULL);
     hVideoThread = OSCreateThread((XTHREAD)OBS::MainCaptureThread, NULL);
 
@@ -764,6 +903,7 @@ void OBS::Stop(bool overrideKeepRecording)
     if(hSoundThread)
     {
         //ReleaseSemaphore(hRequestAudioEvent, 1, NULL);
+        NotifyAudioReady();
         OSTerminateThread(hSoundThread, 20000);
     }
 
@@ -782,6 +922,17 @@ void OBS::Stop(bool overrideKeepRecording)
 
     //-------------------------------------------------------------
 
+    delete replayBuffer;
+    replayBuffer = NULL;
+
+    for(UINT i=0; i<renditions.Num(); i++)
+        delete renditions[i];
+    renditions.Clear();
+
+    //flushes the rest of its frames into the recording and finishes the file itself
+    delete recordingEncoder;
+    recordingEncoder = NULL;
+
     delete network;
     network = NULL;
     bStreaming = false;
@@ -803,7 +954,7 @@ void OBS::Stop(bool overrideKeepRecording)
     //-------------------------------------------------------------
 
     for(UINT i=0; i<pendingAudioFrames.Num(); i++)
-        pendingAudioFrames[i].audioData.Clear();
+        pendingAudioFrames[i].audioData->Release();
     pendingAudioFrames.Clear();
 
     //-------------------------------------------------------------
@@ -892,6 +1043,7 @@ void OBS::Stop(bool overrideKeepRecording)
 
     DumpProfileData();
     FreeProfileData();
+    DumpFrameTiming();
     Log(TEXT("=====Stream End: %s================================================="), CurrentDateTimeString().Array());
 
     //update notification icon to reflect current status
@@ -950,60 +1102,151 @@ DWORD STDCALL OBS::MainAudioThread(LPVOID lpUnused)
 
 #define INVALID_LL 0xFFFFFFFFFFFFFFFFLL
 
-inline void CalculateVolumeLevels(float *buffer, int totalFloats, float mulVal, float &RMS, float &MAX)
+inline float toDB(float RMS)
 {
-    float sum = 0.0f;
-    int totalFloatsStore = totalFloats;
+    float db = 20.0f * log10(RMS);
+    if(!_finite(db))
+        return VOL_MIN;
+    return db;
+}
+
+//per-source audio work (device reads, conversion, resampling and filters) doesn't depend on
+//any other source, so the mic and aux sources are spread over a few threads of the audio
+//thread's own and the mix waits for all of them.  the audio thread takes queries too, and each
+//source is a query of its own so one slow filter chain only holds up itself
 
-    float Max = 0.0f;
+#define MAX_AUDIO_QUERY_THREADS 3
+#define AUDIO_QUERIES_PARKED    0x40000000
 
-    if((UPARAM(buffer) & 0xF) == 0)
+static void QueryAudioSource(AudioQuery &query)
+{
+    if(query.bDrain)
     {
-        UINT alignedFloats = totalFloats & 0xFFFFFFFC;
-        __m128 sseMulVal = _mm_set_ps1(mulVal);
+        //drain until dry, then line the burst up against the newest timestamp
+        query.bGotAudio = false;
+        while(query.source->QueryAudio2(query.volume, true) != NoAudioAvailable)
+            query.bGotAudio = true;
 
-        for(UINT i=0; i<alignedFloats; i += 4)
-        {
-            __m128 sseScaledVals = _mm_mul_ps(_mm_load_ps(buffer+i), sseMulVal);
-
-            /*compute squares and add them to the sum*/
-            __m128 sseSquares = _mm_mul_ps(sseScaledVals, sseScaledVals);
-            sum += sseSquares.m128_f32[0] + sseSquares.m128_f32[1] + sseSquares.m128_f32[2] + sseSquares.m128_f32[3];
-
-            /* 
-                sse maximum of squared floats 
-                concept from: http://stackoverflow.com/questions/9795529/how-to-find-the-horizontal-maximum-in-a-256-bit-avx-vector
-            */
-            __m128 sseSquaresP = _mm_shuffle_ps(sseSquares, sseSquares, _MM_SHUFFLE(1, 0, 3, 2));
-            __m128 halfmax = _mm_max_ps(sseSquares, sseSquaresP);
-            __m128 halfmaxP = _mm_shuffle_ps(halfmax, halfmax, _MM_SHUFFLE(0,1,2,3));
-            __m128 maxs = _mm_max_ps(halfmax, halfmaxP);
-
-            Max = max(Max, maxs.m128_f32[0]);
-        }
+        QWORD timestamp;
+        if(query.source->GetLatestTimestamp(timestamp))
+            query.source->SortAudio(timestamp);
+    }
+    else
+        query.bGotAudio = query.source->QueryAudio2(query.volume, true) != NoAudioAvailable;
+}
+
+//takes queries until there are none left, returns true if it finished the last one
+bool OBS::RunAudioQueries()
+{
+    bool bFinishedLast = false;
+
+    while(true)
+    {
+        UINT id = UINT(InterlockedIncrement(&nextAudioQuery)-1);
+        if(id >= audioQueries.Num())
+            break;
 
-        buffer      += alignedFloats;
-        totalFloats -= alignedFloats;
+        QueryAudioSource(audioQueries[id]);
+
+        if(InterlockedDecrement(&numAudioQueriesLeft) == 0)
+            bFinishedLast = true;
     }
 
-    for(int i=0; i<totalFloats; i++)
+    return bFinishedLast;
+}
+
+DWORD STDCALL OBS::AudioQueryThread(LPVOID lpUnused)
+{
+    //same apartment and scheduling class as the audio thread, device reads need both
+    CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+
+    DWORD taskID = 0;
+    HANDLE hTask = AvSetMmThreadCharacteristics(TEXT("Pro Audio"), &taskID);
+
+    while(WaitForSingleObject(App->hAudioQueryStart, INFINITE) == WAIT_OBJECT_0 && !App->bAudioQueryExit)
     {
-        float val = buffer[i] * mulVal;
-        float pow2Val = val * val;
-        sum += pow2Val;
-        Max = max(Max, pow2Val);
+        //a late wake-up finds nothing left and goes back to waiting
+        if(App->RunAudioQueries())
+            SetEvent(App->hAudioQueryDone);
     }
 
-    RMS = sqrt(sum / totalFloatsStore);
-    MAX = sqrt(Max);
+    if(hTask)
+        AvRevertMmThreadCharacteristics(hTask);
+
+    CoUninitialize();
+    return 0;
 }
 
-inline float toDB(float RMS)
+void OBS::StopAudioQueryThreads()
 {
-    float db = 20.0f * log10(RMS);
-    if(!_finite(db))
-        return VOL_MIN;
-    return db;
+    bAudioQueryExit = true;
+    if(audioQueryThreads.Num())
+        ReleaseSemaphore(hAudioQueryStart, audioQueryThreads.Num(), NULL);
+
+    for(UINT i=0; i<audioQueryThreads.Num(); i++)
+    {
+        OSWaitForThread(audioQueryThreads[i], NULL);
+        OSCloseThread(audioQueryThreads[i]);
+    }
+    audioQueryThreads.Clear();
+
+    bAudioQueryExit = false;
+}
+
+//call with hAuxAudioMutex held
+bool OBS::QueryMicAndAuxAudio(bool bDrain)
+{
+    UINT numQueries = auxAudioSources.Num() + (micAudio ? 1 : 0);
+    if(!numQueries)
+        return false;
+
+    //only reallocates when the number of sources changes
+    audioQueries.SetSize(numQueries);
+
+    for(UINT i=0; i<auxAudioSources.Num(); i++)
+    {
+        AudioQuery &query = audioQueries[i];
+        query.source = auxAudioSources[i];
+        query.volume = auxAudioSources[i]->GetVolume();
+        query.bDrain = bDrain;
+    }
+
+    if(micAudio)
+    {
+        AudioQuery &query = audioQueries.Last();
+        query.source = micAudio;
+        query.volume = curMicVol;
+        query.bDrain = bDrain;
+    }
+
+    if(numQueries > 1)
+    {
+        //threads are only started once there are sources for them
+        UINT numHelpers = MIN(numQueries-1, MAX_AUDIO_QUERY_THREADS);
+        while(audioQueryThreads.Num() < numHelpers)
+            audioQueryThreads << OSCreateThread((XTHREAD)OBS::AudioQueryThread, NULL);
+
+        numAudioQueriesLeft = numQueries;
+        InterlockedExchange(&nextAudioQuery, 0);
+        ReleaseSemaphore(hAudioQueryStart, numHelpers, NULL);
+
+        //the wait is only ever on queries already running, the same work the audio thread
+        //used to do by itself with the mutex held
+        if(!RunAudioQueries())
+            WaitForSingleObject(hAudioQueryDone, INFINITE);
+
+        //park the counter out of range so a thread that wakes late can't pick up a query
+        //while the list is being refilled next tick
+        InterlockedExchange(&nextAudioQuery, AUDIO_QUERIES_PARKED);
+    }
+    else
+        QueryAudioSource(audioQueries[0]);
+
+    bool bGotSomeAudio = false;
+    for(UINT i=0; i<numQueries; i++)
+        bGotSomeAudio |= audioQueries[i].bGotAudio;
+
+    return bGotSomeAudio;
 }
 
 bool OBS::QueryAudioBuffers(bool bQueriedDesktopDebugParam)
@@ -1024,20 +1267,9 @@ bool OBS::QueryAudioBuffers(bool bQueriedDesktopDebugParam)
     bufferedAudioTimes << latestAudioTime;
 
     OSEnterMutex(hAuxAudioMutex);
-    for(UINT i=0; i<auxAudioSources.Num(); i++)
-    {
-        if (auxAudioSources[i]->QueryAudio2(auxAudioSources[i]->GetVolume(), true) != NoAudioAvailable)
-            bGotSomeAudio = true;
-    }
-
+    bGotSomeAudio = QueryMicAndAuxAudio(false);
     OSLeaveMutex(hAuxAudioMutex);
 
-    if(micAudio != NULL)
-    {
-        if (micAudio->QueryAudio2(curMicVol, true) != NoAudioAvailable)
-            bGotSomeAudio = true;
-    }
-
     return bGotSomeAudio;
 }
 
@@ -1065,38 +1297,10 @@ bool OBS::QueryNewAudio()
     /* wait until buffers are completely filled before accounting for burst */
     if (!bAudioBufferFilled)
     {
-        QWORD timestamp;
-        int burst = 0;
-
         // No more desktop data, drain auxilary/mic buffers until they're dry to prevent burst data
         OSEnterMutex(hAuxAudioMutex);
-        for(UINT i=0; i<auxAudioSources.Num(); i++)
-        {
-            while (auxAudioSources[i]->QueryAudio2(auxAudioSources[i]->GetVolume(), true) != NoAudioAvailable)
-                burst++;
-
-            if (auxAudioSources[i]->GetLatestTimestamp(timestamp))
-                auxAudioSources[i]->SortAudio(timestamp);
-
-            /*if (burst > 10)
-                Log(L"Burst happened for %s", auxAudioSources[i]->GetDeviceName2());*/
-        }
-
+        QueryMicAndAuxAudio(true);
         OSLeaveMutex(hAuxAudioMutex);
-
-        burst = 0;
-
-        if (micAudio)
-        {
-            while (micAudio->QueryAudio2(curMicVol, true) != NoAudioAvailable)
-                burst++;
-
-            /*if (burst > 10)
-                Log(L"Burst happened for %s", micAudio->GetDeviceName2());*/
-
-            if (micAudio->GetLatestTimestamp(timestamp))
-                micAudio->SortAudio(timestamp);
-        }
     }
 
     return bAudioBufferFilled;
@@ -1110,13 +1314,21 @@ void OBS::EncodeAudioSegment(float *buffer, UINT numFrames, QWORD timestamp)
         OSEnterMutex(hSoundDataMutex);
 
         FrameAudio *frameAudio = pendingAudioFrames.CreateNew();
-        frameAudio->audioData.CopyArray(packet.lpPacket, packet.size);
+        frameAudio->audioData = PacketBuffer::Create(packet.lpPacket, packet.size);
         frameAudio->timestamp = timestamp;
 
         OSLeaveMutex(hSoundDataMutex);
     }
 }
 
+//true when neither WASAPI source needs polling: both wake the audio thread when they have data
+static bool AudioDevicesSignalReady(AudioSource *desktopAudio, AudioSource *micAudio)
+{
+    bool bDesktopSignals = WASAPIAudioDeviceSignalsReady(desktopAudio) || BlankSoundPlaybackSignalsReady();
+    bool bMicSignals     = !micAudio || WASAPIAudioDeviceSignalsReady(micAudio);
+    return bDesktopSignals && bMicSignals;
+}
+
 void OBS::MainAudioLoop()
 {
     const unsigned int audioSamplesPerSec = App->GetSampleRateHz();
@@ -1144,9 +1356,34 @@ void OBS::MainAudioLoop()
 
     //---------------------------------------------
     // the audio loop of doom
+    //
+    // waits on hAudioEvent up to a tick deadline.  DShow audio wakes it through OBSNotifyAudioReady,
+    // event driven WASAPI capture sets it directly, and loopback desktop audio is woken by the blank
+    // playback stream's period event.  when every WASAPI source signals like that the tick only has
+    // to be a 10ms backstop.  if one of them fell back to polling (no event support, device lost and
+    // reacquired without it) the tick drops to the 5ms the old sleep used so it isn't read any later
+    // than it used to be
+
+    QWORD audioTickNS = AudioDevicesSignalReady(desktopAudio, micAudio) ? 10000000 : 5000000;
+    QWORD nextAudioTickNS = GetQPCTimeNS()+audioTickNS;
 
     while (true) {
-        OSSleep(5); //screw it, just run it every 5ms
+        audioTickNS = AudioDevicesSignalReady(desktopAudio, micAudio) ? 10000000 : 5000000;
+
+        QWORD curTimeNS = GetQPCTimeNS();
+        if (curTimeNS < nextAudioTickNS) {
+            DWORD waitMS = DWORD((nextAudioTickNS-curTimeNS+999999)/1000000);
+            WaitForSingleObject(hAudioEvent, waitMS);
+            curTimeNS = GetQPCTimeNS();
+        }
+
+        if (curTimeNS >= nextAudioTickNS) {
+            nextAudioTickNS += audioTickNS;
+
+            //fell a whole tick behind (stall or breakpoint), resync rather than firing back to back
+            if (nextAudioTickNS <= curTimeNS)
+                nextAudioTickNS = curTimeNS+audioTickNS;
+        }
 
         if (!bRunning)
             break;
@@ -1308,8 +1545,13 @@ void OBS::MainAudioLoop()
 
     PostMessage(hwndMain, WM_COMMAND, MAKEWPARAM(ID_MICVOLUMEMETER, VOLN_METERED), 0);
 
+    OSEnterMutex(hSoundDataMutex);
     for (UINT i=0; i<pendingAudioFrames.Num(); i++)
-        pendingAudioFrames[i].audioData.Clear();
+        pendingAudioFrames[i].audioData->Release();
+    pendingAudioFrames.Clear();
+    OSLeaveMutex(hSoundDataMutex);
+
+    StopAudioQueryThreads();
 
     AvRevertMmThreadCharacteristics(hTask);
 }
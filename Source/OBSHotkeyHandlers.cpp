@@ -48,6 +48,14 @@ void STDCALL OBS::StopStreamHotkey(DWORD hotkey, UPARAM param, bool bDown)
     }
 }
 
+void STDCALL OBS::SaveReplayHotkey(DWORD hotkey, UPARAM param, bool bDown)
+{
+    if(!bDown) return;
+
+    //replayBuffer belongs to the main thread, Stop deletes it there
+    PostMessage(hwndMain, OBS_SAVEREPLAY, 0, 0);
+}
+
 void STDCALL OBS::PushToTalkHotkey(DWORD hotkey, UPARAM param, bool bDown)
 {
     if(bDown)
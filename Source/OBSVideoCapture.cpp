@@ -32,6 +32,13 @@ extern "C"
 void Convert444toI420(LPBYTE input, int width, int pitch, int height, int startY, int endY, LPBYTE *output);
 void Convert444toNV12(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output);
 
+struct Scale444Data;
+Scale444Data* CreateScale444(int srcCX, int srcCY, int scaleCX, int scaleCY, int dstCX, int dstCY, int filterType);
+void DestroyScale444(Scale444Data *data);
+void Scale444toNV12(Scale444Data *data, LPBYTE input, int inPitch, int outPitch, int startY, int endY, LPBYTE *output);
+
+BitrateController* CreateAIMDBitrateController(DWORD maxBitRate);
+
 
 DWORD STDCALL OBS::EncodeThread(LPVOID lpUnused)
 {
@@ -46,57 +53,89 @@ DWORD STDCALL OBS::MainCaptureThread(LPVOID lpUnused)
 }
 
 
+//rows per conversion task, has to stay even.  scaled tiles are taller since the lines at
+//the edges of each tile get filtered horizontally by both neighbouring tiles
+#define CONVERT444_TILE_ROWS 16
+#define SCALE444_TILE_ROWS   48
+
 struct Convert444Data
 {
     LPBYTE input;
     LPBYTE output[3];
     bool bNV12;
-    bool bKillThread;
-    HANDLE hSignalConvert, hSignalComplete;
-    int width, height, inPitch, outPitch, startY, endY;
-    DWORD numThreads;
+    int width, height, inPitch, outPitch;
+    DWORD numTiles;
+    Scale444Data *scaler;
+
+    volatile LONG tilesLeft;
+    QWORD dispatchTimeNS;
 };
 
-DWORD STDCALL Convert444Thread(Convert444Data *data)
+void STDCALL Convert444Tile(Convert444Data *data, UINT startY, UINT endY)
 {
-    do
-    {
-        WaitForSingleObject(data->hSignalConvert, INFINITE);
-        if(data->bKillThread) break;
-        profileParallelSegment("Convert444Thread", "Convert444Threads", data->numThreads);
-        if(data->bNV12)
-            Convert444toNV12(data->input, data->width, data->inPitch, data->outPitch, data->height, data->startY, data->endY, data->output);
-        else
-            Convert444toNV12(data->input, data->width, data->inPitch, data->width, data->height, data->startY, data->endY, data->output);
-
-        SetEvent(data->hSignalComplete);
-    }while(!data->bKillThread);
+    profileParallelSegment("Convert444Tile", "Convert444Tiles", data->numTiles);
+    if(data->scaler)
+        Scale444toNV12(data->scaler, data->input, data->inPitch, data->bNV12 ? data->outPitch : data->width, startY, endY, data->output);
+    else if(data->bNV12)
+        Convert444toNV12(data->input, data->width, data->inPitch, data->outPitch, data->height, startY, endY, data->output);
+    else
+        Convert444toNV12(data->input, data->width, data->inPitch, data->width, data->height, startY, endY, data->output);
 
-    return 0;
+    if(!InterlockedDecrement(&data->tilesLeft) && data->dispatchTimeNS)
+        App->RecordFrameStage(FrameStage_Convert, GetQPCTimeNS()-data->dispatchTimeNS);
 }
 
-bool OBS::BufferVideoData(const List<DataPacket> &inputPackets, const List<PacketType> &inputTypes, DWORD timestamp, VideoSegment &segmentOut)
+struct RenditionFrame
 {
-    VideoSegment &segmentIn = *bufferedVideo.CreateNew();
-    segmentIn.timestamp = timestamp;
+    Convert444Data convert;
+    DWORD timestamp;
+    bool bPending;
+};
 
-    segmentIn.packets.SetSize(inputPackets.Num());
-    for(UINT i=0; i<inputPackets.Num(); i++)
+//scales the mapped frame into every rendition that's due one, using the same tasks as the main
+//conversion.  renditions that are still busy with earlier frames just don't get this one
+static void DispatchRenditionFrames(List<VideoRendition*> &renditions, List<RenditionFrame> &frames, UINT frameCount, LPBYTE input, UINT inPitch, DWORD timestamp, TaskGroup &tasks)
+{
+    for(UINT i=0; i<renditions.Num(); i++)
     {
-        segmentIn.packets[i].data.CopyArray(inputPackets[i].lpPacket, inputPackets[i].size);
-        segmentIn.packets[i].type =  inputTypes[i];
+        RenditionFrame &frame = frames[i];
+        if((frameCount % renditions[i]->GetFrameDivisor()) != 0 || !renditions[i]->BeginFrame(frame.convert.output))
+            continue;
+
+        frame.convert.input     = input;
+        frame.convert.inPitch   = inPitch;
+        frame.convert.tilesLeft = frame.convert.numTiles;
+        frame.timestamp = timestamp;
+        frame.bPending  = true;
+
+        tasks.Run((TASKPROC)Convert444Tile, &frame.convert, 0, frame.convert.height, SCALE444_TILE_ROWS);
     }
+}
 
-    if((bufferedVideo.Last().timestamp-bufferedVideo[0].timestamp) >= UINT(App->bufferingTime))
+//call once the tasks are done
+static void FinishRenditionFrames(List<VideoRendition*> &renditions, List<RenditionFrame> &frames)
+{
+    for(UINT i=0; i<renditions.Num(); i++)
     {
-        segmentOut.packets.TransferFrom(bufferedVideo[0].packets);
-        segmentOut.timestamp = bufferedVideo[0].timestamp;
-        bufferedVideo.Remove(0);
-
-        return true;
+        if(frames[i].bPending)
+        {
+            renditions[i]->EndFrame(frames[i].timestamp);
+            frames[i].bPending = false;
+        }
     }
+}
 
-    return false;
+bool OBS::BufferVideoData(VideoSegment &encoded, DWORD timestamp)
+{
+    VideoSegment &segmentIn = bufferedVideo.Push();
+    segmentIn.timestamp = timestamp;
+    segmentIn.bufferedTimeNS = GetQPCTimeNS();
+
+    //takes over the encoder's references, no copying
+    encoded.MoveTo(segmentIn);
+
+    //the oldest segment is ready to go out once it's fallen far enough behind
+    return (bufferedVideo.Last().timestamp-bufferedVideo.First().timestamp) >= UINT(App->bufferingTime);
 }
 
 #define NUM_OUT_BUFFERS 3
@@ -108,6 +147,49 @@ struct EncoderPicture
     EncoderPicture() : picOut(nullptr), mfxOut(nullptr) {}
 };
 
+//the recording encoder gets its own copy of the converted picture so the main encoder never has
+//to wait for it.  if it's still busy with earlier frames this one is skipped for the recording
+static void CopyRecordingFrame(VideoRendition *recordingEncoder, EncoderPicture *pic, DWORD timestamp)
+{
+    LPBYTE planes[3];
+    if(!recordingEncoder->BeginFrame(planes))
+        return;
+
+    UINT width, height;
+    recordingEncoder->GetSize(width, height);
+
+    LPBYTE input[2];
+    UINT inPitch;
+    if(pic->picOut)
+    {
+        input[0] = pic->picOut->img.plane[0];
+        input[1] = pic->picOut->img.plane[1];
+        inPitch  = pic->picOut->img.i_stride[0];
+    }
+    else
+    {
+        mfxFrameData &data = pic->mfxOut->Data;
+        input[0] = data.Y;
+        input[1] = data.UV;
+        inPitch  = data.Pitch;
+    }
+
+    if(inPitch == width)
+    {
+        mcpy(planes[0], input[0], width*height);
+        mcpy(planes[1], input[1], width*height/2);
+    }
+    else
+    {
+        for(UINT y=0; y<height; y++)
+            mcpy(planes[0]+(y*width), input[0]+(y*inPitch), width);
+        for(UINT y=0; y<height/2; y++)
+            mcpy(planes[1]+(y*width), input[1]+(y*inPitch), width);
+    }
+
+    recordingEncoder->EndFrame(timestamp);
+}
+
 bool operator==(const EncoderPicture& lhs, const EncoderPicture& rhs)
 {
     if(lhs.picOut && rhs.picOut)
@@ -129,7 +211,7 @@ void OBS::SendFrame(VideoSegment &curSegment, QWORD firstFrameTime)
 {
     if(!bSentHeaders)
     {
-        if(network && curSegment.packets[0].data[0] == 0x17) {
+        if(network && curSegment.packets[0].data->Data()[0] == 0x17) {
             network->BeginPublishing();
             bSentHeaders = true;
         }
@@ -151,17 +233,22 @@ void OBS::SendFrame(VideoSegment &curSegment, QWORD firstFrameTime)
 
                 if(audioTimestamp == 0 || audioTimestamp > lastAudioTimestamp)
                 {
-                    List<BYTE> &audioData = pendingAudioFrames[0].audioData;
-                    if(audioData.Num())
+                    PacketBuffer *audioData = pendingAudioFrames[0].audioData;
+                    if(audioData->Size())
                     {
                         //Log(TEXT("a:%u, %llu"), audioTimestamp, frameInfo.firstFrameTime+audioTimestamp);
 
-                        if(network)
-                            network->SendPacket(audioData.Array(), audioData.Num(), audioTimestamp, PacketType_Audio);
+                        //file goes first, over RTMPT/RTMPE librtmp still writes its chunk headers into the packet
                         if(fileStream)
-                            fileStream->AddPacket(audioData.Array(), audioData.Num(), audioTimestamp, PacketType_Audio);
-
-                        audioData.Clear();
+                            fileStream->AddPacket(audioData, audioTimestamp, PacketType_Audio);
+                        if(replayBuffer)
+                            replayBuffer->AddPacket(audioData, audioTimestamp, PacketType_Audio);
+                        for(UINT i=0; i<renditions.Num(); i++)
+                            renditions[i]->AddAudio(audioData, audioTimestamp);
+                        if(recordingEncoder && bRecording)
+                            recordingEncoder->AddAudio(audioData, audioTimestamp);
+                        if(network)
+                            network->SendPacket(audioData, audioTimestamp, PacketType_Audio);
 
                         lastAudioTimestamp = audioTimestamp;
                     }
@@ -170,14 +257,16 @@ void OBS::SendFrame(VideoSegment &curSegment, QWORD firstFrameTime)
             else
                 nop();
 
-            pendingAudioFrames[0].audioData.Clear();
+            pendingAudioFrames[0].audioData->Release();
             pendingAudioFrames.Remove(0);
         }
     }
 
     OSLeaveMutex(hSoundDataMutex);
 
-    for(UINT i=0; i<curSegment.packets.Num(); i++)
+    RecordFrameStage(FrameStage_Queued, GetQPCTimeNS()-curSegment.bufferedTimeNS);
+
+    for(UINT i=0; i<curSegment.numPackets; i++)
     {
         VideoPacketData &packet = curSegment.packets[i];
 
@@ -186,24 +275,26 @@ void OBS::SendFrame(VideoSegment &curSegment, QWORD firstFrameTime)
 
         //Log(TEXT("v:%u, %llu"), curSegment.timestamp, frameInfo.firstFrameTime+curSegment.timestamp);
 
-        if(network)
-            network->SendPacket(packet.data.Array(), packet.data.Num(), curSegment.timestamp, packet.type);
         if(fileStream)
-            fileStream->AddPacket(packet.data.Array(), packet.data.Num(), curSegment.timestamp, packet.type);
+            fileStream->AddPacket(packet.data, curSegment.timestamp, packet.type);
+        if(replayBuffer)
+            replayBuffer->AddPacket(packet.data, curSegment.timestamp, packet.type);
+        if(network)
+            network->SendPacket(packet.data, curSegment.timestamp, packet.type);
     }
+
+    //from the tick the frame was rendered on to its packets being handed to the outputs.  the
+    //time the source took to get the picture to us and anything after the socket isn't in it
+    RecordFrameStage(FrameStage_TickToOutput, GetQPCTimeNS()-(firstFrameTime+curSegment.timestamp)*1000000);
 }
 
 bool OBS::ProcessFrame(FrameProcessInfo &frameInfo)
 {
-    List<DataPacket> videoPackets;
-    List<PacketType> videoPacketTypes;
-
     //------------------------------------
     // encode
 
     bufferedTimes << frameInfo.frameTimestamp;
 
-    VideoSegment curSegment;
     bool bProcessedFrame, bSendFrame = false;
     VOID *picIn;
 
@@ -214,14 +305,19 @@ bool OBS::ProcessFrame(FrameProcessInfo &frameInfo)
     else
         picIn = frameInfo.pic->picOut ? (LPVOID)frameInfo.pic->picOut : (LPVOID)frameInfo.pic->mfxOut;
 
-    videoEncoder->Encode(picIn, videoPackets, videoPacketTypes, bufferedTimes[0]);
+    if(recordingEncoder && bRecording && picIn)
+        CopyRecordingFrame(recordingEncoder, frameInfo.pic, frameInfo.frameTimestamp);
 
-    bProcessedFrame = (videoPackets.Num() != 0);
+    QWORD encodeStartTime = GetQPCTimeNS();
+    videoEncoder->Encode(picIn, encodedVideo, bufferedTimes[0]);
+    RecordFrameStage(FrameStage_Encode, GetQPCTimeNS()-encodeStartTime);
+
+    bProcessedFrame = (encodedVideo.numPackets != 0);
 
     //buffer video data before sending out
     if(bProcessedFrame)
     {
-        bSendFrame = BufferVideoData(videoPackets, videoPacketTypes, bufferedTimes[0], curSegment);
+        bSendFrame = BufferVideoData(encodedVideo, bufferedTimes[0]);
         bufferedTimes.Remove(0);
     }
     else
@@ -236,7 +332,10 @@ bool OBS::ProcessFrame(FrameProcessInfo &frameInfo)
 
     //send headers before the first frame if not yet sent
     if(bSendFrame)
-        SendFrame(curSegment, frameInfo.firstFrameTime);
+    {
+        SendFrame(bufferedVideo.First(), frameInfo.firstFrameTime);
+        bufferedVideo.PopFront();
+    }
 
     //profileOut;
 
@@ -299,6 +398,9 @@ void OBS::EncodeLoop()
 
     bufferedTimes.Clear();
 
+    //enough slots for the whole scene buffering delay plus the segment being sent out
+    bufferedVideo.Reserve((bufferingTime*fps+999)/1000 + 2);
+
     bool bUsingQSV = videoEncoder->isQSV();//GlobalConfig->GetInt(TEXT("Video Encoding"), TEXT("UseQSV")) != 0;
 
     QWORD sleepTargetTime = streamTimeStart+frameTimeNS;
@@ -323,6 +425,8 @@ void OBS::EncodeLoop()
         else
             no_sleep_counter = 0;
 
+        RecordFrameStage(FrameStage_TickJitter, GetQPCTimeNS()-sleepTargetTime);
+
         latestVideoTime = sleepTargetTime/1000000;
         latestVideoTimeNS = sleepTargetTime;
 
@@ -402,7 +506,7 @@ void OBS::EncodeLoop()
             } while (curTime - startTime < bufferedVideo[i].timestamp - baseTimestamp);
 
             SendFrame(bufferedVideo[i], firstFrameTimestamp);
-            bufferedVideo[i].Clear();
+            bufferedVideo[i].Reset();
 
             numTotalFrames++;
         }
@@ -410,6 +514,9 @@ void OBS::EncodeLoop()
         bufferedVideo.Clear();
     }
 
+    bufferedVideo.Free();
+    encodedVideo.Clear();
+
     Log(TEXT("Total frames encoded: %d, total frames duplicated: %d (%0.2f%%)"), numTotalFrames, numTotalDuplicatedFrames, (double(numTotalDuplicatedFrames)/double(numTotalFrames))*100.0);
     if (numFramesSkipped)
         Log(TEXT("Number of frames skipped due to encoder lag: %d (%0.2f%%)"), numFramesSkipped, (double(numFramesSkipped)/double(numTotalFrames))*100.0);
@@ -535,6 +642,10 @@ void OBS::MainCaptureLoop()
     Vect2 outputSize  = Vect2(float(outputCX), float(outputCY));
     Vect2 scaleSize   = Vect2(float(scaleCX), float(scaleCY));
 
+    //with CPU downscaling the YUV pass only converts, at base size
+    Vect2 yuvOutputSize = bCPUDownscale ? baseSize : outputSize;
+    Vect2 yuvScaleSize  = bCPUDownscale ? baseSize : scaleSize;
+
     HANDLE hMatrix   = yuvScalePixelShader->GetParameterByName(TEXT("yuvMat"));
     HANDLE hScaleVal = yuvScalePixelShader->GetParameterByName(TEXT("baseDimensionI"));
 
@@ -584,9 +695,12 @@ void OBS::MainCaptureLoop()
     bool bDynamicBitrateSupported = App->GetVideoEncoder()->DynamicBitrateSupported();
     int defaultBitRate = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("MaxBitrate"), 1000);
     int currentBitRate = defaultBitRate;
-    QWORD lastAdjustmentTime = 0;
     UINT adjustmentStreamId = 0;
 
+    BitrateController *bitrateController = NULL;
+    if(bCongestionControl && bDynamicBitrateSupported && network && !bTestStream)
+        bitrateController = CreateAIMDBitrateController(defaultBitRate);
+
     //std::unique_ptr<ProfilerNode> encodeThreadProfiler;
 
     //----------------------------------------
@@ -625,51 +739,68 @@ void OBS::MainCaptureLoop()
     DWORD numSecondsWaited = 0;
 
     //----------------------------------------
-    // 444->420 thread data
+    // 444->420 task data
 
-    int numThreads = MAX(OSGetTotalCores()-2, 1);
-    HANDLE *h420Threads = (HANDLE*)Allocate(sizeof(HANDLE)*numThreads);
-    Convert444Data *convertInfo = (Convert444Data*)Allocate(sizeof(Convert444Data)*numThreads);
+    Convert444Data convertInfo;
+    zero(&convertInfo, sizeof(convertInfo));
 
-    zero(h420Threads, sizeof(HANDLE)*numThreads);
-    zero(convertInfo, sizeof(Convert444Data)*numThreads);
+    convertInfo.width  = outputCX;
+    convertInfo.height = outputCY;
+    convertInfo.bNV12  = bUsingQSV;
 
-    for(int i=0; i<numThreads; i++)
+    UINT convertTileRows = CONVERT444_TILE_ROWS;
+    if(bCPUDownscale)
     {
-        convertInfo[i].width  = outputCX;
-        convertInfo[i].height = outputCY;
-        convertInfo[i].hSignalConvert  = CreateEvent(NULL, FALSE, FALSE, NULL);
-        convertInfo[i].hSignalComplete = CreateEvent(NULL, FALSE, FALSE, NULL);
-        convertInfo[i].bNV12 = bUsingQSV;
-        convertInfo[i].numThreads = numThreads;
-
-        if(i == 0)
-            convertInfo[i].startY = 0;
-        else
-            convertInfo[i].startY = convertInfo[i-1].endY;
+        //the GPU scaler uses the 9 tap bilinear above 2x whatever the filter setting is
+        convertInfo.scaler = CreateScale444(baseCX, baseCY, scaleCX, scaleCY, outputCX, outputCY, (downscale < 2.01) ? downscaleType : 0);
+        convertTileRows = SCALE444_TILE_ROWS;
+    }
 
-        if(i == (numThreads-1))
-            convertInfo[i].endY = outputCY;
-        else
-            convertInfo[i].endY = ((outputCY/numThreads)*(i+1)) & 0xFFFFFFFE;
+    convertInfo.numTiles = (outputCY+convertTileRows-1)/convertTileRows;
+
+    //----------------------------------------
+    // renditions, scaled on the CPU from the same readback
+
+    List<RenditionFrame> renditionFrames;
+    renditionFrames.SetSize(bUsing444 ? 0 : renditions.Num());
+
+    UINT yuvCX = bCPUDownscale ? baseCX : outputCX;
+    UINT yuvCY = bCPUDownscale ? baseCY : outputCY;
+
+    for(UINT i=0; i<renditionFrames.Num(); i++)
+    {
+        Convert444Data &renditionInfo = renditionFrames[i].convert;
+
+        UINT renditionCX, renditionCY;
+        renditions[i]->GetSize(renditionCX, renditionCY);
+
+        //keep the main output's cropping, only the size changes
+        UINT renditionScaleCX = bCPUDownscale ? renditionCX*scaleCX/outputCX : renditionCX;
+        UINT renditionScaleCY = bCPUDownscale ? renditionCY*scaleCY/outputCY : renditionCY;
+        double renditionDownscale = double(yuvCX)/double(renditionScaleCX);
+
+        renditionInfo.width    = renditionCX;
+        renditionInfo.height   = renditionCY;
+        renditionInfo.scaler   = CreateScale444(yuvCX, yuvCY, renditionScaleCX, renditionScaleCY, renditionCX, renditionCY, (renditionDownscale < 2.01) ? downscaleType : 0);
+        renditionInfo.numTiles = (renditionCY+SCALE444_TILE_ROWS-1)/SCALE444_TILE_ROWS;
     }
 
+    UINT renditionFrameCount = 0;
+
+    TaskGroup convertTasks;
+
     bool bEncode;
     bool bFirstFrame = true;
     bool bFirstImage = true;
     bool bFirstEncode = true;
     bool bUseThreaded420 = bUseMultithreadedOptimizations && (OSGetTotalCores() > 1) && !bUsing444;
 
-    List<HANDLE> completeEvents;
-
-    if(bUseThreaded420)
-    {
-        for(int i=0; i<numThreads; i++)
-        {
-            h420Threads[i] = OSCreateThread((XTHREAD)Convert444Thread, convertInfo+i);
-            completeEvents << convertInfo[i].hSignalComplete;
-        }
-    }
+    //the threaded conversion is finished during the next frame, which costs a frame of latency.
+    //low latency mode still splits it across cores but waits for it, so the frame is encoded on
+    //this tick and the encode thread overlaps with the next frame's capture and conversion instead
+    bool bWaitFor420 = bUseThreaded420 && bLowLatency;
+    if(bWaitFor420)
+        bUseThreaded420 = false;
 
     //----------------------------------------
 
@@ -951,8 +1082,8 @@ void OBS::MainCaptureLoop()
         else if(downscale < 3.01)
             yuvScalePixelShader->SetVector2(hScaleVal, 1.0f/(outputSize*3.0f));
 
-        Ortho(0.0f, outputSize.x, outputSize.y, 0.0f, -100.0f, 100.0f);
-        SetViewport(0.0f, 0.0f, outputSize.x, outputSize.y);
+        Ortho(0.0f, yuvOutputSize.x, yuvOutputSize.y, 0.0f, -100.0f, 100.0f);
+        SetViewport(0.0f, 0.0f, yuvOutputSize.x, yuvOutputSize.y);
 
         //why am I using scaleSize instead of outputSize for the texture?
         //because outputSize can be trimmed by up to three pixels due to 128-bit alignment.
@@ -960,11 +1091,11 @@ void OBS::MainCaptureLoop()
         if(bTransitioning)
         {
             BlendFunction(GS_BLEND_ONE, GS_BLEND_ZERO);
-            DrawSpriteEx(transitionTexture, 0xFFFFFFFF, 0.0f, 0.0f, scaleSize.x, scaleSize.y, 0.0f, 0.0f, 1.0f, 1.0f);
+            DrawSpriteEx(transitionTexture, 0xFFFFFFFF, 0.0f, 0.0f, yuvScaleSize.x, yuvScaleSize.y, 0.0f, 0.0f, 1.0f, 1.0f);
             BlendFunction(GS_BLEND_FACTOR, GS_BLEND_INVFACTOR, transitionAlpha);
         }
 
-        DrawSpriteEx(mainRenderTextures[curRenderTarget], 0xFFFFFFFF, 0.0f, 0.0f, outputSize.x, outputSize.y, 0.0f, 0.0f, 1.0f, 1.0f);
+        DrawSpriteEx(mainRenderTextures[curRenderTarget], 0xFFFFFFFF, 0.0f, 0.0f, yuvOutputSize.x, yuvOutputSize.y, 0.0f, 0.0f, 1.0f, 1.0f);
 
         //------------------------------------
 
@@ -1022,13 +1153,17 @@ void OBS::MainCaptureLoop()
         {
             UINT prevCopyTexture = (curCopyTexture == 0) ? NUM_RENDER_BUFFERS-1 : curCopyTexture-1;
 
+            RecordFrameStage(FrameStage_Capture, GetQPCTimeNS()-renderStartTime);
+
             ID3D10Texture2D *copyTexture = copyTextures[curCopyTexture];
             profileIn("CopyResource");
 
             if(!bFirstEncode && bUseThreaded420)
             {
-                WaitForMultipleObjects(completeEvents.Num(), completeEvents.Array(), TRUE, INFINITE);
+                convertTasks.Wait();
                 copyTexture->Unmap(0);
+
+                FinishRenditionFrames(renditions, renditionFrames);
             }
 
             D3D10Texture *d3dYUV = static_cast<D3D10Texture*>(yuvRenderTextures[curYUVTexture]);
@@ -1043,8 +1178,12 @@ void OBS::MainCaptureLoop()
             {
                 HRESULT result;
                 D3D10_MAPPED_TEXTURE2D map;
+                QWORD mapStartTime = GetQPCTimeNS();
                 if(SUCCEEDED(result = prevTexture->Map(0, D3D10_MAP_READ, 0, &map)))
                 {
+                    QWORD mapEndTime = GetQPCTimeNS();
+                    RecordFrameStage(FrameStage_Readback, mapEndTime-mapStartTime);
+
                     int prevOutBuffer = (curOutBuffer == 0) ? NUM_OUT_BUFFERS-1 : curOutBuffer-1;
                     int nextOutBuffer = (curOutBuffer == NUM_OUT_BUFFERS-1) ? 0 : curOutBuffer+1;
 
@@ -1058,42 +1197,86 @@ void OBS::MainCaptureLoop()
 
                         if(bUseThreaded420)
                         {
-                            for(int i=0; i<numThreads; i++)
+                            convertInfo.input   = (LPBYTE)map.pData;
+                            convertInfo.inPitch = map.RowPitch;
+                            if(bUsingQSV)
                             {
-                                convertInfo[i].input     = (LPBYTE)map.pData;
-                                convertInfo[i].inPitch   = map.RowPitch;
-                                if(bUsingQSV)
-                                {
-                                    mfxFrameData& data = nextPicOut.mfxOut->Data;
-                                    videoEncoder->RequestBuffers(&data);
-                                    convertInfo[i].outPitch  = data.Pitch;
-                                    convertInfo[i].output[0] = data.Y;
-                                    convertInfo[i].output[1] = data.UV;
-                                }
-                                else
-                                {
-                                    convertInfo[i].output[0] = nextPicOut.picOut->img.plane[0];
-                                    convertInfo[i].output[1] = nextPicOut.picOut->img.plane[1];
-                                    convertInfo[i].output[2] = nextPicOut.picOut->img.plane[2];
-								}
-                                SetEvent(convertInfo[i].hSignalConvert);
+                                mfxFrameData& data = nextPicOut.mfxOut->Data;
+                                videoEncoder->RequestBuffers(&data);
+                                convertInfo.outPitch  = data.Pitch;
+                                convertInfo.output[0] = data.Y;
+                                convertInfo.output[1] = data.UV;
                             }
+                            else
+                            {
+                                convertInfo.output[0] = nextPicOut.picOut->img.plane[0];
+                                convertInfo.output[1] = nextPicOut.picOut->img.plane[1];
+                                convertInfo.output[2] = nextPicOut.picOut->img.plane[2];
+                            }
+
+                            //finished at the next CopyResource, the mapped texture stays valid until then
+                            convertInfo.tilesLeft = convertInfo.numTiles;
+                            convertInfo.dispatchTimeNS = mapEndTime;
+                            convertTasks.Run((TASKPROC)Convert444Tile, &convertInfo, 0, outputCY, convertTileRows);
+
+                            DispatchRenditionFrames(renditions, renditionFrames, renditionFrameCount++, (LPBYTE)map.pData, map.RowPitch, DWORD(curStreamTime/1000000-firstFrameTimestamp), convertTasks);
 
                             if(bFirstEncode)
                                 bFirstEncode = bEncode = false;
                         }
                         else
                         {
-                            if(bUsingQSV)
+                            if(bWaitFor420)
+                            {
+                                convertInfo.input   = (LPBYTE)map.pData;
+                                convertInfo.inPitch = map.RowPitch;
+                                if(bUsingQSV)
+                                {
+                                    mfxFrameData& data = picOut.mfxOut->Data;
+                                    videoEncoder->RequestBuffers(&data);
+                                    convertInfo.outPitch  = data.Pitch;
+                                    convertInfo.output[0] = data.Y;
+                                    convertInfo.output[1] = data.UV;
+                                }
+                                else
+                                {
+                                    convertInfo.output[0] = picOut.picOut->img.plane[0];
+                                    convertInfo.output[1] = picOut.picOut->img.plane[1];
+                                    convertInfo.output[2] = picOut.picOut->img.plane[2];
+                                }
+
+                                //waited on below along with the renditions
+                                convertInfo.tilesLeft = convertInfo.numTiles;
+                                convertInfo.dispatchTimeNS = mapEndTime;
+                                convertTasks.Run((TASKPROC)Convert444Tile, &convertInfo, 0, outputCY, convertTileRows);
+                            }
+                            else if(bUsingQSV)
                             {
                                 mfxFrameData& data = picOut.mfxOut->Data;
                                 videoEncoder->RequestBuffers(&data);
                                 LPBYTE output[] = {data.Y, data.UV};
-                                Convert444toNV12((LPBYTE)map.pData, outputCX, map.RowPitch, data.Pitch, outputCY, 0, outputCY, output);
+                                if(convertInfo.scaler)
+                                    Scale444toNV12(convertInfo.scaler, (LPBYTE)map.pData, map.RowPitch, data.Pitch, 0, outputCY, output);
+                                else
+                                    Convert444toNV12((LPBYTE)map.pData, outputCX, map.RowPitch, data.Pitch, outputCY, 0, outputCY, output);
                             }
+                            else if(convertInfo.scaler)
+                                Scale444toNV12(convertInfo.scaler, (LPBYTE)map.pData, map.RowPitch, outputCX, 0, outputCY, picOut.picOut->img.plane);
                             else
                                 Convert444toNV12((LPBYTE)map.pData, outputCX, map.RowPitch, outputCX, outputCY, 0, outputCY, picOut.picOut->img.plane);
+
+                            if(renditionFrames.Num() || bWaitFor420)
+                            {
+                                DispatchRenditionFrames(renditions, renditionFrames, renditionFrameCount++, (LPBYTE)map.pData, map.RowPitch, DWORD(curStreamTime/1000000-firstFrameTimestamp), convertTasks);
+                                convertTasks.Wait();
+                                FinishRenditionFrames(renditions, renditionFrames);
+                            }
+
                             prevTexture->Unmap(0);
+
+                            //the tasks record it themselves
+                            if(!bWaitFor420)
+                                RecordFrameStage(FrameStage_Convert, GetQPCTimeNS()-mapEndTime);
                         }
 
                         profileOut;
@@ -1156,51 +1339,31 @@ void OBS::MainCaptureLoop()
             else
                 curYUVTexture++;
 
-            if (bCongestionControl && bDynamicBitrateSupported && !bTestStream && totalStreamTime > 15000)
+            if (bitrateController && totalStreamTime > 15000)
             {
-                if (curStrain > 25)
-                {
-                    if (renderStartTimeMS - lastAdjustmentTime > 1500)
-                    {
-                        if (currentBitRate > 100)
-                        {
-                            currentBitRate = (int)(currentBitRate * (1.0 - (curStrain / 400)));
-                            App->GetVideoEncoder()->SetBitRate(currentBitRate, -1);
-                            if (!adjustmentStreamId)
-                                adjustmentStreamId = App->AddStreamInfo (FormattedString(TEXT("Congestion detected, dropping bitrate to %d kbps"), currentBitRate).Array(), StreamInfoPriority_Low);
-                            else
-                                App->SetStreamInfo(adjustmentStreamId, FormattedString(TEXT("Congestion detected, dropping bitrate to %d kbps"), currentBitRate).Array());
-
-                            bUpdateBPS = true;
-                        }
+                NetworkSendStats sendStats;
+                network->GetSendStats(sendStats);
 
-                        lastAdjustmentTime = renderStartTimeMS;
-                    }
-                }
-                else if (currentBitRate < defaultBitRate && curStrain < 5 && lastStrain < 5)
+                int newBitRate = (int)bitrateController->Update(sendStats, renderStartTimeMS);
+                if (newBitRate != currentBitRate)
                 {
-                    if (renderStartTimeMS - lastAdjustmentTime > 5000)
-                    {
-                        if (currentBitRate < defaultBitRate)
-                        {
-                            currentBitRate += (int)(defaultBitRate * 0.05);
-                            if (currentBitRate > defaultBitRate)
-                                currentBitRate = defaultBitRate;
-                        }
+                    App->GetVideoEncoder()->SetBitRate(newBitRate, -1);
 
-                        App->GetVideoEncoder()->SetBitRate(currentBitRate, -1);
-                        /*if (!adjustmentStreamId)
-                            App->AddStreamInfo (FormattedString(TEXT("Congestion clearing, raising bitrate to %d kbps"), currentBitRate).Array(), StreamInfoPriority_Low);
+                    if (newBitRate < currentBitRate)
+                    {
+                        if (!adjustmentStreamId)
+                            adjustmentStreamId = App->AddStreamInfo (FormattedString(TEXT("Congestion detected, dropping bitrate to %d kbps"), newBitRate).Array(), StreamInfoPriority_Low);
                         else
-                            App->SetStreamInfo(adjustmentStreamId, FormattedString(TEXT("Congestion clearing, raising bitrate to %d kbps"), currentBitRate).Array());*/
-
+                            App->SetStreamInfo(adjustmentStreamId, FormattedString(TEXT("Congestion detected, dropping bitrate to %d kbps"), newBitRate).Array());
+                    }
+                    else if (adjustmentStreamId)
+                    {
                         App->RemoveStreamInfo(adjustmentStreamId);
                         adjustmentStreamId = 0;
-
-                        bUpdateBPS = true;
-
-                        lastAdjustmentTime = renderStartTimeMS;
                     }
+
+                    currentBitRate = newBitRate;
+                    bUpdateBPS = true;
                 }
             }
         }
@@ -1253,35 +1416,15 @@ void OBS::MainCaptureLoop()
     {
         if(bUseThreaded420)
         {
-            for(int i=0; i<numThreads; i++)
-            {
-                if(h420Threads[i])
-                {
-                    convertInfo[i].bKillThread = true;
-                    SetEvent(convertInfo[i].hSignalConvert);
-
-                    OSTerminateThread(h420Threads[i], 10000);
-                    h420Threads[i] = NULL;
-                }
-
-                if(convertInfo[i].hSignalConvert)
-                {
-                    CloseHandle(convertInfo[i].hSignalConvert);
-                    convertInfo[i].hSignalConvert = NULL;
-                }
-
-                if(convertInfo[i].hSignalComplete)
-                {
-                    CloseHandle(convertInfo[i].hSignalComplete);
-                    convertInfo[i].hSignalComplete = NULL;
-                }
-            }
+            convertTasks.Wait();
 
             if(!bFirstEncode)
             {
                 ID3D10Texture2D *copyTexture = copyTextures[curCopyTexture];
                 copyTexture->Unmap(0);
             }
+
+            FinishRenditionFrames(renditions, renditionFrames);
         }
 
         if(bUsingQSV)
@@ -1295,8 +1438,11 @@ void OBS::MainCaptureLoop()
             }
     }
 
-    Free(h420Threads);
-    Free(convertInfo);
+    DestroyScale444(convertInfo.scaler);
+    for(UINT i=0; i<renditionFrames.Num(); i++)
+        DestroyScale444(renditionFrames[i].convert.scaler);
+
+    delete bitrateController;
 
     Log(TEXT("Total frames rendered: %d, number of late frames: %d (%0.2f%%) (it's okay for some frames to be late)"), numTotalFrames, numLongFrames, (double(numLongFrames)/double(numTotalFrames))*100.0);
 }
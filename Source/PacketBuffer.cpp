@@ -0,0 +1,148 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "Main.h"
+
+
+//enough for the frames waiting on their way out at any one time, the delay and replay buffers
+//hold on to more than this but they let go of them at the same rate new ones are made
+#define PACKET_POOL_SIZE        64
+
+//odd huge keyframes aren't worth holding on to
+#define PACKET_POOL_MAX_STORAGE (2*1024*1024)
+
+static HANDLE hPoolMutex = NULL;
+static PacketBuffer *freePackets = NULL;
+static UINT numFreePackets = 0;
+
+void PacketBuffer::InitPool()
+{
+    hPoolMutex = OSCreateMutex();
+}
+
+void PacketBuffer::FreePool()
+{
+    OSEnterMutex(hPoolMutex);
+
+    while(freePackets)
+    {
+        PacketBuffer *packet = freePackets;
+        freePackets = packet->nextFree;
+        delete packet;
+    }
+    numFreePackets = 0;
+
+    OSLeaveMutex(hPoolMutex);
+
+    OSCloseMutex(hPoolMutex);
+    hPoolMutex = NULL;
+}
+
+PacketBuffer* PacketBuffer::Create()
+{
+    PacketBuffer *packet = NULL;
+
+    if(hPoolMutex)
+    {
+        OSEnterMutex(hPoolMutex);
+        if(freePackets)
+        {
+            packet = freePackets;
+            freePackets = packet->nextFree;
+            numFreePackets--;
+        }
+        OSLeaveMutex(hPoolMutex);
+    }
+
+    if(packet)
+    {
+        packet->refs = 1;
+        packet->size = PACKET_HEADROOM;
+        packet->nextFree = NULL;
+    }
+    else
+        packet = new PacketBuffer;
+
+    return packet;
+}
+
+PacketBuffer* PacketBuffer::Create(LPCVOID data, UINT size)
+{
+    PacketBuffer *packet = Create();
+    packet->Write(0, data, size);
+    return packet;
+}
+
+void PacketBuffer::Recycle()
+{
+    if(hPoolMutex && capacity <= PACKET_POOL_MAX_STORAGE)
+    {
+        OSEnterMutex(hPoolMutex);
+        bool bPooled = (numFreePackets < PACKET_POOL_SIZE);
+        if(bPooled)
+        {
+            nextFree = freePackets;
+            freePackets = this;
+            numFreePackets++;
+        }
+        OSLeaveMutex(hPoolMutex);
+
+        if(bPooled)
+            return;
+    }
+
+    delete this;
+}
+
+void PacketBuffer::Reserve(UINT newSize)
+{
+    if(newSize <= capacity)
+        return;
+
+    //grow in big steps so a packet that's filled nal by nal only reallocates a couple of times
+    UINT newCapacity = MAX(newSize, capacity+capacity/2);
+    newCapacity = MAX(newCapacity, 4096);
+
+    buffer = (LPBYTE)ReAllocate(buffer, newCapacity);
+    capacity = newCapacity;
+}
+
+void PacketBuffer::Write(UINT offset, LPCVOID data, UINT length)
+{
+    assert(offset <= Size());
+
+    UINT end = PACKET_HEADROOM+offset+length;
+    Reserve(end);
+
+    mcpy(buffer+PACKET_HEADROOM+offset, data, length);
+    if(end > size)
+        size = end;
+}
+
+void PacketBuffer::Insert(UINT offset, LPCVOID data, UINT length)
+{
+    assert(offset <= Size());
+
+    Reserve(size+length);
+
+    LPBYTE insertPos = buffer+PACKET_HEADROOM+offset;
+    memmove(insertPos+length, insertPos, size-PACKET_HEADROOM-offset);
+    mcpy(insertPos, data, length);
+    size += length;
+}
@@ -0,0 +1,100 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#pragma once
+
+//bytes reserved in front of every encoded packet so the rtmp publisher can write its packet
+//header directly in front of the payload.  must be at least RTMP_MAX_HEADER_SIZE
+#define PACKET_HEADROOM 18
+
+//refcounted encoded packet.  the encoder fills it once and every output (network, file,
+//delay buffer) just holds a reference to it instead of making its own copy.  the payload
+//must be treated as read-only once it has been handed out of the encoder.
+//
+//released packets go back to a small pool with their storage, so once the pool has seen a
+//frame of each size, encoding a frame doesn't touch the heap
+class PacketBuffer
+{
+    volatile LONG refs;
+    LPBYTE buffer;
+    UINT size, capacity;        //size includes the headroom
+    PacketBuffer *nextFree;
+
+    inline PacketBuffer() : refs(1), buffer(NULL), size(PACKET_HEADROOM), capacity(0), nextFree(NULL) {}
+    inline ~PacketBuffer() {Free(buffer);}
+
+    void Reserve(UINT newSize);
+    void Recycle();
+
+public:
+    static PacketBuffer* Create();
+    static PacketBuffer* Create(LPCVOID data, UINT size);
+
+    //the pool lives as long as the app, packets released outside of it are just deleted
+    static void InitPool();
+    static void FreePool();
+
+    inline void AddRef()  {InterlockedIncrement(&refs);}
+    inline void Release() {if(!InterlockedDecrement(&refs)) Recycle();}
+
+    //only for the encoder while it fills the packet, offsets are into the payload
+    void Write(UINT offset, LPCVOID data, UINT length);
+    void Insert(UINT offset, LPCVOID data, UINT length);
+
+    inline LPBYTE Data() const {return buffer+PACKET_HEADROOM;}
+    inline UINT   Size() const {return size-PACKET_HEADROOM;}
+};
+
+//BufferOutputSerializer for packet payloads
+class PacketSerializer : public Serializer
+{
+    PacketBuffer *packet;
+    UINT position;
+
+public:
+    inline PacketSerializer(PacketBuffer *packet) : packet(packet), position(packet->Size()) {}
+
+    BOOL IsLoading() {return FALSE;}
+
+    void Serialize(LPCVOID lpData, DWORD length)
+    {
+        assert(lpData);
+        assert(length);
+
+        if(!lpData || !length)
+            return;
+
+        packet->Write(position, lpData, length);
+        position += length;
+    }
+
+    UINT64 Seek(INT64 offset, DWORD seekType=SERIALIZE_SEEK_START)
+    {
+        INT64 newPos = offset;
+        if(seekType == SERIALIZE_SEEK_CURRENT)
+            newPos += position;
+        else if(seekType == SERIALIZE_SEEK_END)
+            newPos += packet->Size();
+
+        position = UINT(MIN(MAX(newPos, 0), INT64(packet->Size())));
+        return position;
+    }
+
+    UINT64 GetPos() const {return position;}
+};
@@ -23,8 +23,84 @@
 
 #define MAX_BUFFERED_PACKETS 10
 
+#if PACKET_HEADROOM < RTMP_MAX_HEADER_SIZE
+#error PACKET_HEADROOM is too small to hold an RTMP packet header
+#endif
+
 String RTMPPublisher::strRTMPErrors;
 
+//-----------------------------------------------
+
+NetworkPacketQueue::NetworkPacketQueue()
+{
+    slots = (NetworkPacket*)Allocate(sizeof(NetworkPacket)*SEND_QUEUE_SIZE);
+    zero(slots, sizeof(NetworkPacket)*SEND_QUEUE_SIZE);
+    mask = SEND_QUEUE_SIZE-1;
+}
+
+NetworkPacketQueue::~NetworkPacketQueue()
+{
+    Clear();
+    Free(slots);
+}
+
+bool NetworkPacketQueue::Push(PacketBuffer *data, DWORD timestamp, PacketType type)
+{
+    UINT pos = UINT(writePos);
+    if(pos-UINT(readPos) > mask)
+        return false;
+
+    //the consumer has already taken the data out of this slot, so it's ours to fill
+    NetworkPacket &slot = slots[pos & mask];
+    slot.timestamp = timestamp;
+    slot.type = type;
+    slot.queueTimeNS = GetQPCTimeNS();
+    slot.data = data;
+
+    InterlockedExchange(&writePos, LONG(pos+1));
+    return true;
+}
+
+bool NetworkPacketQueue::Pop(NetworkPacket &packet)
+{
+    while(readPos != writePos)
+    {
+        UINT pos = UINT(readPos);
+        NetworkPacket &slot = slots[pos & mask];
+
+        packet.timestamp = slot.timestamp;
+        packet.type = slot.type;
+        packet.queueTimeNS = slot.queueTimeNS;
+        packet.data = (PacketBuffer*)InterlockedExchangePointer((PVOID volatile*)&slot.data, NULL);
+
+        InterlockedExchange(&readPos, LONG(pos+1));
+
+        if(packet.data)
+            return true;
+    }
+
+    return false;
+}
+
+PacketBuffer* NetworkPacketQueue::Take(UINT pos)
+{
+    return (PacketBuffer*)InterlockedExchangePointer((PVOID volatile*)&slots[pos & mask].data, NULL);
+}
+
+void NetworkPacketQueue::Clear()
+{
+    for(UINT pos=Begin(); pos!=End(); pos++)
+    {
+        PacketBuffer *data = Take(pos);
+        if(data)
+            data->Release();
+    }
+
+    readPos = writePos;
+}
+
+//-----------------------------------------------
+
 //QWORD totalCalls = 0, totalTime = 0;
 
 void rtmp_log_output(int level, const char *format, va_list vl)
@@ -72,7 +148,7 @@ String RTMPPublisher::GetRTMPErrors()
     return strRTMPErrors;
 }
 
-RTMPPublisher::RTMPPublisher()
+RTMPPublisher::RTMPPublisher() : dropIndex(SEND_QUEUE_SIZE)
 {
     //bufferedPackets.SetBaseSize(MAX_BUFFERED_PACKETS);
 
@@ -82,10 +158,6 @@ RTMPPublisher::RTMPPublisher()
     if(!hSendSempahore)
         CrashError(TEXT("RTMPPublisher: Could not create semaphore"));
 
-    hDataMutex = OSCreateMutex();
-    if(!hDataMutex)
-        CrashError(TEXT("RTMPPublisher: Could not create mutex"));
-
     hRTMPMutex = OSCreateMutex();
 
     //------------------------------------------
@@ -121,9 +193,39 @@ RTMPPublisher::RTMPPublisher()
     
     bFastInitialKeyframe = AppConfig->GetInt(TEXT("Publish"), TEXT("FastInitialKeyframe"), 0) == 1;
 
+    destServiceID   = AppConfig->GetInt   (TEXT("Publish"), TEXT("Service"));
+    strDestURL      = AppConfig->GetString(TEXT("Publish"), TEXT("URL"));
+    strDestPlayPath = AppConfig->GetString(TEXT("Publish"), TEXT("PlayPath"));
+
+    bSecondary = false;
+    bSharedPackets = bCopyPackets = false;
+
+    App->GetVideoStreamInfo(videoInfo);
+
     strRTMPErrors.Clear();
 }
 
+void RTMPPublisher::SetDestination(int serviceID, CTSTR lpURL, CTSTR lpPlayPath, bool bSecondary)
+{
+    destServiceID   = serviceID;
+    strDestURL      = lpURL;
+    strDestPlayPath = lpPlayPath;
+
+    this->bSecondary = bSecondary;
+}
+
+void RTMPPublisher::RequestStop()
+{
+    if(bSecondary)
+    {
+        if(!bStopping)
+            Log(TEXT("RTMPPublisher: lost the connection to %s, dropping this destination"), strDestURL.Array());
+        bStopping = true;
+    }
+    else
+        App->PostStopMessage();
+}
+
 bool RTMPPublisher::Init(UINT tcpBufferSize)
 {
     //------------------------------------------
@@ -131,6 +233,7 @@ bool RTMPPublisher::Init(UINT tcpBufferSize)
     //Log(TEXT("Using Send Buffer Size: %u"), sendBufferSize);
 
     rtmp->m_customSendFunc = (CUSTOMSEND)RTMPPublisher::BufferedSend;
+    rtmp->m_customSendVecFunc = (CUSTOMSENDVEC)RTMPPublisher::BufferedSendVec;
     rtmp->m_customSendParam = this;
     rtmp->m_bCustomSend = TRUE;
 
@@ -153,6 +256,15 @@ bool RTMPPublisher::Init(UINT tcpBufferSize)
 
     //------------------------------------------
 
+    //over RTMPT (and RTMPE) librtmp writes its chunk headers into the payload
+    bCopyPackets = bSharedPackets && (rtmp->Link.protocol & RTMP_FEATURE_HTTP) != 0;
+#ifdef CRYPTO
+    if(bSharedPackets && rtmp->Link.rc4keyOut)
+        bCopyPackets = true;
+#endif
+
+    //------------------------------------------
+
     hSendThread = OSCreateThread((XTHREAD)RTMPPublisher::SendThread, this);
     if(!hSendThread)
         CrashError(TEXT("RTMPPublisher: Could not create send thread"));
@@ -167,7 +279,7 @@ bool RTMPPublisher::Init(UINT tcpBufferSize)
 
     hDataBufferMutex = OSCreateMutex();
 
-    dataBufferSize = (App->GetVideoEncoder()->GetBitRate() + App->GetAudioEncoder()->GetBitRate()) / 8 * 1024;
+    dataBufferSize = (videoInfo.encoder->GetBitRate() + App->GetAudioEncoder()->GetBitRate()) / 8 * 1024;
     if (dataBufferSize < 131072)
         dataBufferSize = 131072;
 
@@ -293,13 +405,10 @@ RTMPPublisher::~RTMPPublisher()
         RTMP_Close(rtmp);
     }
 
-    if(hDataMutex)
-        OSCloseMutex(hDataMutex);
-
     while (bufferedPackets.Num())
     {
         //this should not happen any more...
-        bufferedPackets[0].data.Clear();
+        bufferedPackets[0].data->Release();
         bufferedPackets.Remove(0);
     }
 
@@ -338,8 +447,6 @@ RTMPPublisher::~RTMPPublisher()
 
     //--------------------------
 
-    for(UINT i=0; i<queuedPackets.Num(); i++)
-        queuedPackets[i].data.Clear();
     queuedPackets.Clear();
 
     double dBFrameDropPercentage = double(numBFramesDumped)/max(1, NumTotalVideoFrames())*100.0;
@@ -366,17 +473,6 @@ RTMPPublisher::~RTMPPublisher()
     //--------------------------
 }
 
-UINT RTMPPublisher::FindClosestQueueIndex(DWORD timestamp)
-{
-    UINT index;
-    for (index=0; index<queuedPackets.Num(); index++) {
-        if (queuedPackets[index].timestamp > timestamp)
-            break;
-    }
-
-    return index;
-}
-
 UINT RTMPPublisher::FindClosestBufferIndex(DWORD timestamp)
 {
     UINT index;
@@ -434,9 +530,7 @@ void RTMPPublisher::FlushBufferedPackets()
             OSSleep (1);
         } while (curTime - startTime < packet.timestamp - baseTimestamp);
 
-        SendPacketForReal(packet.data.Array(), packet.data.Num(), packet.timestamp, packet.type);
-
-        packet.data.Clear();
+        SendPacketForReal(packet.data, packet.timestamp, packet.type);
     }
 
     bufferedPackets.Clear();
@@ -450,12 +544,16 @@ void RTMPPublisher::ProcessPackets()
         bStreamStarted = true;
     }
 
+    //forget about anything the send thread has already taken
+    for (UINT first = queuedPackets.Begin(); dropIndexPos != first; dropIndexPos++)
+        dropIndex.Remove(dropIndexPos);
+
     //never drop frames if we're in the shutdown sequence, just wait it out
     if (!bStopping)
     {
-        if (queuedPackets.Num() && minFramedropTimestsamp < queuedPackets[0].timestamp)
+        if (queuedPackets.Num() && minFramedropTimestsamp < queuedPackets.First().timestamp)
         {
-            DWORD queueDuration = (queuedPackets.Last().timestamp - queuedPackets[0].timestamp);
+            DWORD queueDuration = (queuedPackets.Last().timestamp - queuedPackets.First().timestamp);
 
             DWORD curTime = OSGetTime();
 
@@ -486,8 +584,12 @@ void RTMPPublisher::ProcessPackets()
         ReleaseSemaphore(hSendSempahore, 1, NULL);
 }
 
-void RTMPPublisher::SendPacket(BYTE *data, UINT size, DWORD timestamp, PacketType type)
+void RTMPPublisher::SendPacket(PacketBuffer *data, DWORD timestamp, PacketType type)
 {
+    //a secondary destination that went down just stops taking packets
+    if(bSecondary && bStopping)
+        return;
+
     if(!bConnected && !bConnecting && !bStopping)
     {
         hConnectionThread = OSCreateThread((XTHREAD)CreateConnectionThread, this);
@@ -502,6 +604,8 @@ void RTMPPublisher::SendPacket(BYTE *data, UINT size, DWORD timestamp, PacketTyp
             if (type != PacketType_VideoHighest)
                 return;
         
+            for (UINT i=0; i<bufferedPackets.Num(); i++)
+                bufferedPackets[i].data->Release();
             bufferedPackets.Clear();
         }
 
@@ -518,10 +622,14 @@ void RTMPPublisher::SendPacket(BYTE *data, UINT size, DWORD timestamp, PacketTyp
                 bufferedPackets.Remove(0);
                 packet.timestamp = 0;
 
-                SendPacketForReal(packet.data.Array(), packet.data.Num(), packet.timestamp, packet.type);
+                SendPacketForReal(packet.data, packet.timestamp, packet.type);
             }
             else
+            {
+                for (UINT i=0; i<bufferedPackets.Num(); i++)
+                    bufferedPackets[i].data->Release();
                 bufferedPackets.Clear();
+            }
         }
     }
     else
@@ -550,44 +658,35 @@ void RTMPPublisher::SendPacket(BYTE *data, UINT size, DWORD timestamp, PacketTyp
         mcpy(&packet, &bufferedPackets[0], sizeof(TimedPacket));
         bufferedPackets.Remove(0);
 
-        SendPacketForReal(packet.data.Array(), packet.data.Num(), packet.timestamp, packet.type);
+        SendPacketForReal(packet.data, packet.timestamp, packet.type);
     }
 
     timestamp -= firstTimestamp;
 
-    TimedPacket *packet;
-    
     if (type == PacketType_Audio)
-    {
-        UINT newID;
         timestamp -= audioTimeOffset;
 
-        newID = FindClosestBufferIndex(timestamp);
-        packet = bufferedPackets.InsertNew(newID);
-    }
-    else
-    {
-        packet = bufferedPackets.CreateNew();
-    }
+    //this is the only place packets get put back in timestamp order, the send queue only appends
+    TimedPacket *packet = bufferedPackets.InsertNew(FindClosestBufferIndex(timestamp));
 
-    packet->data.CopyArray(data, size);
+    data->AddRef();
+    packet->data = data;
     packet->timestamp = timestamp;
     packet->type = type;
 
     /*for (UINT i=0; i<bufferedPackets.Num(); i++)
     {
-        if (bufferedPackets[i].data.Array() == 0)
+        if (bufferedPackets[i].data == 0)
             nop();
     }*/
 }
 
-void RTMPPublisher::SendPacketForReal(BYTE *data, UINT size, DWORD timestamp, PacketType type)
+//takes over the caller's reference to data
+void RTMPPublisher::SendPacketForReal(PacketBuffer *data, DWORD timestamp, PacketType type)
 {
     //OSDebugOut (TEXT("%u: SendPacketForReal (%d bytes - %08x @ %u, type %d)\n"), OSGetTime(), size, quickHash(data,size), timestamp, type);
     //Log(TEXT("packet| timestamp: %u, type: %u, bytes: %u"), timestamp, (UINT)type, size);
 
-    OSEnterMutex(hDataMutex);
-
     if(bConnected)
     {
         ProcessPackets();
@@ -627,30 +726,47 @@ void RTMPPublisher::SendPacketForReal(BYTE *data, UINT size, DWORD timestamp, Pa
 
             if(bAddPacket)
             {
-                List<BYTE> paddedData;
-                paddedData.SetSize(size+RTMP_MAX_HEADER_SIZE);
-                mcpy(paddedData.Array()+RTMP_MAX_HEADER_SIZE, data, size);
-
                 if(!bSentFirstKeyframe)
                 {
+                    //the packet is shared with the other outputs, so the SEI goes into a private copy
+                    PacketBuffer *keyframe = PacketBuffer::Create(data->Data(), data->Size());
+                    data->Release();
+                    data = keyframe;
+
                     DataPacket sei;
-                    App->GetVideoEncoder()->GetSEI(sei);
-                    paddedData.InsertArray(RTMP_MAX_HEADER_SIZE+5, sei.lpPacket, sei.size);
+                    videoInfo.encoder->GetSEI(sei);
+                    data->Insert(5, sei.lpPacket, sei.size);
 
                     bSentFirstKeyframe = true;
                 }
 
-                currentBufferSize += paddedData.Num();
+                UINT pos = queuedPackets.End();
+                UINT droppedFrameVal = queuedPackets.Num() ? dropIndex.GetDistance(pos-1)+1 : 10000;
+                LONG size = LONG(data->Size());
 
-                UINT droppedFrameVal = queuedPackets.Num() ? queuedPackets.Last().distanceFromDroppedFrame+1 : 10000;
+                InterlockedExchangeAdd(&currentBufferSize, size);
 
-                UINT id = FindClosestQueueIndex(timestamp);
+                if(queuedPackets.Push(data, timestamp, type))
+                    dropIndex.Add(pos, type, droppedFrameVal);
+                else
+                {
+                    InterlockedExchangeAdd(&currentBufferSize, -size);
+
+                    //the send thread hasn't moved in ages, nothing to do but dump it and wait for a keyframe
+                    RUNONCE Log(TEXT("RTMPPublisher::SendPacketForReal: send queue is full, dumping packets"));
+
+                    if(type != PacketType_Audio)
+                    {
+                        if(type < PacketType_VideoHigh)
+                            numBFramesDumped++;
+                        else
+                            numPFramesDumped++;
 
-                NetworkPacket *queuedPacket = queuedPackets.InsertNew(id);
-                queuedPacket->distanceFromDroppedFrame = droppedFrameVal;
-                queuedPacket->data.TransferFrom(paddedData);
-                queuedPacket->timestamp = timestamp;
-                queuedPacket->type = type;
+                        packetWaitType = PacketType_VideoHighest;
+                    }
+
+                    data->Release();
+                }
             }
             else
             {
@@ -658,11 +774,15 @@ void RTMPPublisher::SendPacketForReal(BYTE *data, UINT size, DWORD timestamp, Pa
                     numBFramesDumped++;
                 else
                     numPFramesDumped++;
+
+                data->Release();
             }
         }
+        else
+            data->Release();
     }
-
-    OSLeaveMutex(hDataMutex);
+    else
+        data->Release();
 }
 
 void RTMPPublisher::BeginPublishingInternal()
@@ -682,12 +802,12 @@ void RTMPPublisher::BeginPublishingInternal()
     char *enc = packet.m_body;
     enc = AMF_EncodeString(enc, pend, &av_setDataFrame);
     enc = AMF_EncodeString(enc, pend, &av_onMetaData);
-    enc = App->EncMetaData(enc, pend);
+    enc = App->EncMetaData(enc, pend, false, &videoInfo);
 
     packet.m_nBodySize = enc - packet.m_body;
     if(!RTMP_SendPacket(rtmp, &packet, FALSE))
     {
-        App->PostStopMessage();
+        RequestStop();
         return;
     }
 
@@ -710,7 +830,7 @@ void RTMPPublisher::BeginPublishingInternal()
     packet.m_nBodySize = mediaHeaders.size;
     if(!RTMP_SendPacket(rtmp, &packet, FALSE))
     {
-        App->PostStopMessage();
+        RequestStop();
         return;
     }
 
@@ -720,7 +840,7 @@ void RTMPPublisher::BeginPublishingInternal()
     packet.m_headerType = RTMP_PACKET_SIZE_LARGE;
     packet.m_packetType = RTMP_PACKET_TYPE_VIDEO;
 
-    App->GetVideoHeaders(mediaHeaders);
+    videoInfo.encoder->GetHeaders(mediaHeaders);
 
     packetPadding.SetSize(RTMP_MAX_HEADER_SIZE);
     packetPadding.AppendArray(mediaHeaders.lpPacket, mediaHeaders.size);
@@ -729,7 +849,7 @@ void RTMPPublisher::BeginPublishingInternal()
     packet.m_nBodySize = mediaHeaders.size;
     if(!RTMP_SendPacket(rtmp, &packet, FALSE))
     {
-        App->PostStopMessage();
+        RequestStop();
         return;
     }
 }
@@ -795,9 +915,9 @@ DWORD WINAPI RTMPPublisher::CreateConnectionThread(RTMPPublisher *publisher)
     String failReason;
     String strBindIP;
 
-    int    serviceID    = AppConfig->GetInt   (TEXT("Publish"), TEXT("Service"));
-    String strURL       = AppConfig->GetString(TEXT("Publish"), TEXT("URL"));
-    String strPlayPath  = AppConfig->GetString(TEXT("Publish"), TEXT("PlayPath"));
+    int    serviceID    = publisher->destServiceID;
+    String strURL       = publisher->strDestURL;
+    String strPlayPath  = publisher->strDestPlayPath;
 
     strURL.KillSpaces();
     strPlayPath.KillSpaces();
@@ -1005,11 +1125,14 @@ end:
         }
         OSLeaveMutex(publisher->hRTMPMutex);
 
-        if(failReason.IsValid())
-            App->SetStreamReport(failReason);
+        if(!publisher->bSecondary)
+        {
+            if(failReason.IsValid())
+                App->SetStreamReport(failReason);
 
-        if(!publisher->bStopping)
-            PostMessage(hwndMain, OBS_REQUESTSTOP, bCanRetry ? 0 : 1, 0);
+            if(!publisher->bStopping)
+                PostMessage(hwndMain, OBS_REQUESTSTOP, bCanRetry ? 0 : 1, 0);
+        }
 
         Log(TEXT("Connection to %s failed: %s"), strURL.Array(), failReason.Array());
 
@@ -1036,6 +1159,17 @@ double RTMPPublisher::GetPacketStrain() const
     return dNetworkStrain*33.0;*/
 }
 
+void RTMPPublisher::GetSendStats(NetworkSendStats &stats)
+{
+    //read without locking, the controller only needs a rough picture
+    stats.queuedBytes = (DWORD)max(currentBufferSize, 0);
+    stats.bufferedBytes = curDataBufferLen;
+    stats.bufferSize = dataBufferSize;
+    stats.bytesSent = bytesSent;
+    stats.numTimesWaited = totalTimesWaited;
+    stats.numDroppedFrames = NumDroppedFrames();
+}
+
 QWORD RTMPPublisher::GetCurrentSentBytes()
 {
     return bytesSent;
@@ -1084,7 +1218,7 @@ void RTMPPublisher::FatalSocketShutdown()
     //anything buffered is invalid now
     curDataBufferLen = 0;
 
-    App->PostStopMessage();
+    RequestStop();
 }
 
 void RTMPPublisher::SocketLoop()
@@ -1158,7 +1292,7 @@ void RTMPPublisher::SocketLoop()
         if (status == WAIT_ABANDONED || status == WAIT_FAILED)
         {
             Log(TEXT("RTMPPublisher::SocketLoop: Aborting due to WaitForMultipleObjects failure"));
-            App->PostStopMessage();
+            RequestStop();
             return;
         }
 
@@ -1168,7 +1302,7 @@ void RTMPPublisher::SocketLoop()
             if (WSAEnumNetworkEvents (rtmp->m_sb.sb_socket, NULL, &networkEvents))
             {
                 Log(TEXT("RTMPPublisher::SocketLoop: Aborting due to WSAEnumNetworkEvents failure, %d"), WSAGetLastError());
-                App->PostStopMessage();
+                RequestStop();
                 return;
             }
 
@@ -1353,23 +1487,15 @@ void RTMPPublisher::SendLoop()
     {
         while(true)
         {
-            OSEnterMutex(hDataMutex);
-            if(queuedPackets.Num() == 0)
-            {
-                OSLeaveMutex(hDataMutex);
+            NetworkPacket queuedPacket;
+            if(!queuedPackets.Pop(queuedPacket))
                 break;
-            }
-
-            List<BYTE> packetData;
-            PacketType type       = queuedPackets[0].type;
-            DWORD      timestamp  = queuedPackets[0].timestamp;
-            packetData.TransferFrom(queuedPackets[0].data);
 
-            currentBufferSize -= packetData.Num();
+            PacketBuffer *packetData = queuedPacket.data;
+            PacketType type       = queuedPacket.type;
+            DWORD      timestamp  = queuedPacket.timestamp;
 
-            queuedPackets.Remove(0);
-
-            OSLeaveMutex(hDataMutex);
+            InterlockedExchangeAdd(&currentBufferSize, -LONG(packetData->Size()));
 
             //--------------------------------------------
 
@@ -1381,17 +1507,32 @@ void RTMPPublisher::SendLoop()
             packet.m_nInfoField2 = rtmp->m_stream_id;
             packet.m_hasAbsTimestamp = TRUE;
 
-            packet.m_nBodySize = packetData.Num()-RTMP_MAX_HEADER_SIZE;
-            packet.m_body = (char*)packetData.Array()+RTMP_MAX_HEADER_SIZE;
+            if(bCopyPackets)
+            {
+                PacketBuffer *copy = PacketBuffer::Create(packetData->Data(), packetData->Size());
+                packetData->Release();
+                packetData = copy;
+            }
+
+            //the header is written into the packet's headroom
+            packet.m_nBodySize = packetData->Size();
+            packet.m_body = (char*)packetData->Data();
 
             //QWORD sendTimeStart = OSGetTimeMicroseconds();
-            if(!RTMP_SendPacket(rtmp, &packet, FALSE))
+            BOOL bSent = RTMP_SendPacket(rtmp, &packet, FALSE);
+            packetData->Release();
+
+            //only the main destination, extra destinations and renditions would mix their queues in
+            if(bSent && !bSecondary && type != PacketType_Audio)
+                App->RecordFrameStage(FrameStage_Sent, GetQPCTimeNS()-queuedPacket.queueTimeNS);
+
+            if(!bSent)
             {
                 //should never reach here with the new shutdown sequence.
                 RUNONCE Log(TEXT("RTMP_SendPacket failure, should not happen!"));
                 if(!RTMP_IsConnected(rtmp))
                 {
-                    App->PostStopMessage();
+                    RequestStop();
                     break;
                 }
             }
@@ -1435,39 +1576,35 @@ DWORD RTMPPublisher::SocketThread(RTMPPublisher *publisher)
     return 0;
 }
 
-void RTMPPublisher::DropFrame(UINT id)
+void RTMPPublisher::DropFrame(UINT pos)
 {
-    NetworkPacket &dropPacket = queuedPackets[id];
-    currentBufferSize -= dropPacket.data.Num();
-    PacketType type = dropPacket.type;
-    dropPacket.data.Clear();
+    PacketType type = queuedPackets[pos].type;
 
-    if(dropPacket.type < PacketType_VideoHigh)
-        numBFramesDumped++;
-    else
-        numPFramesDumped++;
+    //the send thread can't move past pos without taking it, so this is safe to walk back to
+    UINT first = queuedPackets.Begin();
 
-    for(UINT i=id+1; i<queuedPackets.Num(); i++)
-    {
-        UINT distance = (i-id);
-        if(queuedPackets[i].distanceFromDroppedFrame <= distance)
-            break;
+    dropIndex.Remove(pos);
 
-        queuedPackets[i].distanceFromDroppedFrame = distance;
-    }
+    PacketBuffer *data = queuedPackets.Take(pos);
+    if(!data) //sent out from under us
+        return;
 
-    for(int i=int(id)-1; i>=0; i--)
-    {
-        UINT distance = (id-UINT(i));
-        if(queuedPackets[i].distanceFromDroppedFrame <= distance)
-            break;
+    InterlockedExchangeAdd(&currentBufferSize, -LONG(data->Size()));
+    data->Release();
 
-        queuedPackets[i].distanceFromDroppedFrame = distance;
-    }
+    if(type < PacketType_VideoHigh)
+        numBFramesDumped++;
+    else
+        numPFramesDumped++;
+
+    dropIndex.MarkDropped(pos, first, queuedPackets.End());
 
     bool bSetPriority = true;
-    for(UINT i=id+1; i<queuedPackets.Num(); i++)
+    for(UINT i=pos+1; i!=queuedPackets.End(); i++)
     {
+        if(!queuedPackets.IsQueued(i))
+            continue;
+
         NetworkPacket &packet = queuedPackets[i];
         if(packet.type < PacketType_Audio)
         {
@@ -1475,14 +1612,19 @@ void RTMPPublisher::DropFrame(UINT id)
             {
                 if(packet.type < PacketType_VideoHighest)
                 {
-                    currentBufferSize -= packet.data.Num();
-                    packet.data.Clear();
-                    queuedPackets.Remove(i--);
+                    dropIndex.Remove(i);
 
-                    if(packet.type < PacketType_VideoHigh)
-                        numBFramesDumped++;
-                    else
-                        numPFramesDumped++;
+                    PacketBuffer *laterData = queuedPackets.Take(i);
+                    if(laterData)
+                    {
+                        InterlockedExchangeAdd(&currentBufferSize, -LONG(laterData->Size()));
+                        laterData->Release();
+
+                        if(packet.type < PacketType_VideoHigh)
+                            numBFramesDumped++;
+                        else
+                            numPFramesDumped++;
+                    }
                 }
                 else
                 {
@@ -1516,70 +1658,21 @@ void RTMPPublisher::DropFrame(UINT id)
 //video packet count exceeding maximum.  find lowest priority frame to dump
 bool RTMPPublisher::DoIFrameDelay(bool bBFramesOnly)
 {
-    int curWaitType = PacketType_VideoDisposable;
-
-    while(!bBFramesOnly && curWaitType < PacketType_VideoHighest ||
-           bBFramesOnly && curWaitType < PacketType_VideoHigh)
-    {
-        UINT bestPacket = INVALID;
-        UINT bestPacketDistance = 0;
-
-        if(curWaitType == PacketType_VideoHigh)
-        {
-            bool bFoundIFrame = false;
-
-            for(int i=int(queuedPackets.Num())-1; i>=0; i--)
-            {
-                NetworkPacket &packet = queuedPackets[i];
-                if(packet.type == PacketType_Audio)
-                    continue;
-
-                if(packet.type == curWaitType)
-                {
-                    if(bFoundIFrame)
-                    {
-                        bestPacket = UINT(i);
-                        break;
-                    }
-                    else if(bestPacket == INVALID)
-                        bestPacket = UINT(i);
-                }
-                else if(packet.type == PacketType_VideoHighest)
-                    bFoundIFrame = true;
-            }
-        }
-        else
-        {
-            for(UINT i=0; i<queuedPackets.Num(); i++)
-            {
-                NetworkPacket &packet = queuedPackets[i];
-                if(packet.type <= curWaitType)
-                {
-                    if(packet.distanceFromDroppedFrame > bestPacketDistance)
-                    {
-                        bestPacket = i;
-                        bestPacketDistance = packet.distanceFromDroppedFrame;
-                    }
-                }
-            }
-        }
-
-        if(bestPacket != INVALID)
-        {
-            DropFrame(bestPacket);
-            queuedPackets.Remove(bestPacket);
-            return true;
-        }
-
-        curWaitType++;
-    }
+    UINT bestPacket;
+    if(!dropIndex.SelectDrop(bBFramesOnly, queuedPackets.Begin(), queuedPackets.End(), bestPacket))
+        return false;
 
-    return false;
+    DropFrame(bestPacket);
+    return true;
 }
 
 void RTMPPublisher::RequestKeyframe(int waitTime)
 {
-    App->RequestKeyframe(waitTime);
+    //renditions don't go through the main encode loop's keyframe timing
+    if(videoInfo.encoder != App->GetVideoEncoder())
+        videoInfo.encoder->RequestKeyframe();
+    else
+        App->RequestKeyframe(waitTime);
 }
 
 int RTMPPublisher::BufferedSend(RTMPSockBuf *sb, const char *buf, int len, RTMPPublisher *network)
@@ -1622,7 +1715,108 @@ retrySend:
     return len;
 }
 
-NetworkStream* CreateRTMPPublisher()
+int RTMPPublisher::BufferedSendVec(RTMPSockBuf *sb, RTMPIOVec *vec, int count, RTMPPublisher *network)
+{
+    int fullLen = 0;
+    for (int i = 0; i < count; i++)
+        fullLen += vec[i].len;
+
+    //NOTE: This function is called from the SendLoop thread, be careful of race conditions.
+
+    if (!RTMP_IsConnected(network->rtmp))
+        return fullLen;
+
+    int curVec = 0, curOffset = 0;
+
+    OSEnterMutex(network->hDataBufferMutex);
+
+    //if nothing is waiting to go out, try gathering the whole packet straight into the socket rather than
+    //copying it into the data buffer first. the socket loop only sends while holding the data buffer mutex,
+    //so ordering is kept. low latency modes pace everything through the socket loop, so leave those alone.
+    if (!network->curDataBufferLen && network->lowLatencyMode == LL_MODE_NONE)
+    {
+        WSABUF wsaBufs[RTMP_IOVEC_PREALLOC];
+
+        while (curVec < count)
+        {
+            DWORD numBufs = min(count - curVec, RTMP_IOVEC_PREALLOC), batchLen = 0, sent = 0;
+
+            for (DWORD i = 0; i < numBufs; i++)
+            {
+                wsaBufs[i].buf = (CHAR*)vec[curVec+i].base;
+                wsaBufs[i].len = vec[curVec+i].len;
+                batchLen += vec[curVec+i].len;
+            }
+
+            //on WSAEWOULDBLOCK or an error the rest falls through to the buffer and the socket loop deals with it
+            if (WSASend(sb->sb_socket, wsaBufs, numBufs, &sent, 0, NULL, NULL) != 0 || !sent)
+                break;
+
+            network->bytesSent += sent;
+
+            bool bPartial = sent < batchLen;
+
+            while (curVec < count && (int)sent >= vec[curVec].len)
+                sent -= vec[curVec++].len;
+            curOffset = sent;
+
+            //socket send buffer is full, no point trying again until FD_WRITE
+            if (bPartial)
+                break;
+        }
+    }
+
+    while (curVec < count)
+    {
+        int len = vec[curVec].len - curOffset;
+        int space = network->dataBufferSize - network->curDataBufferLen - 1;
+
+        if (space <= 0)
+        {
+            ++network->totalTimesWaited;
+            network->totalBytesWaited += len;
+
+            OSLeaveMutex(network->hDataBufferMutex);
+
+            SetEvent(network->hBufferEvent);
+
+            int status = WaitForSingleObject(network->hBufferSpaceAvailableEvent, INFINITE);
+            if (status == WAIT_ABANDONED || status == WAIT_FAILED)
+                return 0;
+
+            if (!RTMP_IsConnected(network->rtmp))
+                return fullLen;
+
+            OSEnterMutex(network->hDataBufferMutex);
+            continue;
+        }
+
+        //packets larger than the buffer go in piece by piece as the socket loop drains it
+        if (len > space)
+            len = space;
+
+        mcpy(network->dataBuffer + network->curDataBufferLen, vec[curVec].base + curOffset, len);
+        network->curDataBufferLen += len;
+
+        curOffset += len;
+        if (curOffset == vec[curVec].len)
+        {
+            curVec++;
+            curOffset = 0;
+        }
+    }
+
+    OSLeaveMutex(network->hDataBufferMutex);
+
+    SetEvent (network->hBufferEvent);
+
+    return fullLen;
+}
+
+//bSharedPackets: another publisher sends the same packets, see SetSharedPackets
+NetworkStream* CreateRTMPPublisher(bool bSharedPackets)
 {
-    return new RTMPPublisher;
+    RTMPPublisher *publisher = new RTMPPublisher;
+    publisher->SetSharedPackets(bSharedPackets);
+    return publisher;
 }
@@ -18,12 +18,57 @@
 
 #include <Iphlpapi.h>
 
+#include "FrameDropIndex.h"
+
 struct NetworkPacket
 {
-    List<BYTE> data;
+    PacketBuffer *data;
     DWORD timestamp;
     PacketType type;
-    UINT distanceFromDroppedFrame;
+    QWORD queueTimeNS;
+};
+
+//number of slots in the send queue, must be a power of two
+#define SEND_QUEUE_SIZE 8192
+
+//bounded single producer/single consumer ring between the encode thread, which pushes and
+//drops packets, and the send thread, which pops them.  neither side ever waits on the other.
+//
+//positions are free-running counters, slots are indexed with (pos & mask).  a dropped packet
+//stays in its slot with its data taken out, and whichever thread takes the data out of a slot
+//first owns it, so the drop logic can safely look at anything from Begin() to End()
+class NetworkPacketQueue
+{
+    NetworkPacket *slots;
+    UINT mask;
+
+    volatile LONG readPos, writePos;
+
+public:
+    NetworkPacketQueue();
+    ~NetworkPacketQueue();
+
+    //producer only.  fails if the queue is full
+    bool Push(PacketBuffer *data, DWORD timestamp, PacketType type);
+
+    //consumer only.  skips over dropped packets, returns false if there is nothing left
+    bool Pop(NetworkPacket &packet);
+
+    //producer only.  takes the packet out of the queue, returns NULL if it was already sent or dropped
+    PacketBuffer* Take(UINT pos);
+
+    //releases everything left, only call when neither thread is running
+    void Clear();
+
+    inline UINT Begin() const   {return UINT(readPos);}
+    inline UINT End() const     {return UINT(writePos);}
+    inline UINT Num() const     {return UINT(writePos)-UINT(readPos);}
+
+    inline bool IsQueued(UINT pos) const {return *(PacketBuffer *volatile*)&slots[pos & mask].data != NULL;}
+
+    inline NetworkPacket& operator[](UINT pos) const {return slots[pos & mask];}
+    inline NetworkPacket& First() const {return slots[UINT(readPos) & mask];}
+    inline NetworkPacket& Last() const  {return slots[(UINT(writePos)-1) & mask];}
 };
 
 //max latency in milliseconds allowed when using the send buffer
@@ -58,6 +103,7 @@ class RTMPPublisher : public NetworkStream
     void BeginPublishingInternal();
 
     static int BufferedSend(RTMPSockBuf *sb, const char *buf, int len, RTMPPublisher *network);
+    static int BufferedSendVec(RTMPSockBuf *sb, RTMPIOVec *vec, int count, RTMPPublisher *network);
 
     static String strRTMPErrors;
 
@@ -81,18 +127,19 @@ protected:
     bool bBufferFull;
 
     bool bFirstKeyframe;
-    UINT FindClosestQueueIndex(DWORD timestamp);
     UINT FindClosestBufferIndex(DWORD timestamp);
     void InitializeBuffer();
-    void SendPacketForReal(BYTE *data, UINT size, DWORD timestamp, PacketType type);
+    void SendPacketForReal(PacketBuffer *data, DWORD timestamp, PacketType type);
 
     //-----------------------------------------------
     // frame drop stuff
 
     DWORD minFramedropTimestsamp;
     DWORD dropThreshold, bframeDropThreshold;
-    List<NetworkPacket> queuedPackets;
-    UINT currentBufferSize;//, outputRateWindowTime;
+    NetworkPacketQueue queuedPackets;
+    FrameDropIndex dropIndex;
+    UINT dropIndexPos;
+    volatile LONG currentBufferSize;//, outputRateWindowTime;
     UINT lastBFrameDropTime;
 
     //-----------------------------------------------
@@ -100,7 +147,6 @@ protected:
     RTMP *rtmp;
 
     HANDLE hSendSempahore;
-    HANDLE hDataMutex;
     HANDLE hSendThread;
     HANDLE hSocketThread;
     HANDLE hWriteEvent;
@@ -143,6 +189,22 @@ protected:
 
     bool bFastInitialKeyframe;
 
+    //-----------------------------------------------
+    // destination
+
+    int destServiceID;
+    String strDestURL, strDestPlayPath;
+
+    //secondary destinations just drop out on errors instead of stopping the stream
+    bool bSecondary;
+
+    //other destinations send the same packets, so anything that writes into them needs a copy
+    bool bSharedPackets, bCopyPackets;
+
+    VideoStreamInfo videoInfo;
+
+    void RequestStop();
+
     void SendLoop();
     void SocketLoop();
     int FlushDataBuffer();
@@ -151,7 +213,7 @@ protected:
     static DWORD SendThread(RTMPPublisher *publisher);
     static DWORD SocketThread(RTMPPublisher *publisher);
 
-    void DropFrame(UINT id);
+    void DropFrame(UINT pos);
     bool DoIFrameDelay(bool bBFramesOnly);
 
     virtual void ProcessPackets();
@@ -164,7 +226,12 @@ public:
     bool Init(UINT tcpBufferSize);
     ~RTMPPublisher();
 
-    void SendPacket(BYTE *data, UINT size, DWORD timestamp, PacketType type);
+    void SetDestination(int serviceID, CTSTR lpURL, CTSTR lpPlayPath, bool bSecondary);
+    inline void SetSharedPackets(bool bShared) {bSharedPackets = bShared;}
+    inline void SetVideoStream(const VideoStreamInfo &info) {videoInfo = info;}
+    inline bool IsActive() const {return !bStopping;}
+
+    void SendPacket(PacketBuffer *packet, DWORD timestamp, PacketType type);
 
     void BeginPublishing();
 
@@ -172,4 +239,6 @@ public:
     QWORD GetCurrentSentBytes();
     DWORD NumDroppedFrames() const;
     DWORD NumTotalVideoFrames() const {return totalVideoFrames;}
+
+    void GetSendStats(NetworkSendStats &stats);
 };
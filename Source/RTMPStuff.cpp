@@ -215,10 +215,17 @@ int SendPlayStop(RTMP *r)
     return RTMP_SendPacket(r, &packet, FALSE);
 }
 
-char* OBS::EncMetaData(char *enc, char *pend, bool bFLVFile)
+char* OBS::EncMetaData(char *enc, char *pend, bool bFLVFile, const VideoStreamInfo *videoInfo)
 {
-    int    maxBitRate    = GetVideoEncoder()->GetBitRate();
-    int    fps           = GetFPS();
+    VideoStreamInfo mainInfo;
+    if(!videoInfo)
+    {
+        GetVideoStreamInfo(mainInfo);
+        videoInfo = &mainInfo;
+    }
+
+    int    maxBitRate    = videoInfo->encoder->GetBitRate();
+    int    fps           = videoInfo->fps;
     int    audioBitRate  = GetAudioEncoder()->GetBitRate();
     CTSTR  lpAudioCodec  = GetAudioEncoder()->GetCodec();
 
@@ -248,8 +255,8 @@ char* OBS::EncMetaData(char *enc, char *pend, bool bFLVFile)
 
     enc = AMF_EncodeNamedNumber(enc, pend, &av_duration,        0.0);
     enc = AMF_EncodeNamedNumber(enc, pend, &av_fileSize,        0.0);
-    enc = AMF_EncodeNamedNumber(enc, pend, &av_width,           double(outputCX));
-    enc = AMF_EncodeNamedNumber(enc, pend, &av_height,          double(outputCY));
+    enc = AMF_EncodeNamedNumber(enc, pend, &av_width,           double(videoInfo->width));
+    enc = AMF_EncodeNamedNumber(enc, pend, &av_height,          double(videoInfo->height));
 
     /*if(bFLVFile)
         enc = AMF_EncodeNamedNumber(enc, pend, &av_videocodecid,    7.0);//&av_avc1);//
@@ -0,0 +1,351 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "Main.h"
+
+
+VideoFileStream* CreateMP4FileStream(CTSTR lpFile);
+VideoFileStream* CreateFLVFileStream(CTSTR lpFile);
+
+#define REPLAY_SLAB_SIZE (1024*1024)
+
+
+//packets are copied back to back into large slabs instead of each getting its own allocation.
+//the ring and every save in progress hold a reference, so a slab being saved from stays valid
+//after the ring has moved past it
+struct ReplaySlab
+{
+    LPBYTE data;
+    UINT size, used;
+    volatile LONG refs;
+};
+
+struct ReplayPacket
+{
+    ReplaySlab *slab;
+    LPBYTE data;
+    UINT size;
+    DWORD timestamp;
+    PacketType type;
+    bool bKeyframe;
+};
+
+class ReplayBufferStream : public ReplayBuffer
+{
+    DWORD bufferLength;
+    UINT64 maxMemory, slabMemory;
+
+    HANDLE hBufferMutex, hSlabMutex;
+    List<ReplayPacket> packets;
+    List<ReplaySlab*> slabs;
+    List<ReplaySlab*> freeSlabs;
+    ReplaySlab *curSlab;
+
+    HANDLE hSaveThread;
+    String strSaveFile;
+    List<ReplayPacket> savePackets;
+    List<ReplaySlab*> saveSlabs;
+
+    ReplaySlab* GetSlab(UINT minSize)
+    {
+        ReplaySlab *slab = NULL;
+
+        if(minSize <= REPLAY_SLAB_SIZE)
+        {
+            OSEnterMutex(hSlabMutex);
+            if(freeSlabs.Num())
+            {
+                slab = freeSlabs.Last();
+                freeSlabs.Remove(freeSlabs.Num()-1);
+            }
+            OSLeaveMutex(hSlabMutex);
+        }
+
+        if(!slab)
+        {
+            slab = (ReplaySlab*)Allocate(sizeof(ReplaySlab));
+            slab->size = MAX(minSize, REPLAY_SLAB_SIZE);
+            slab->data = (LPBYTE)Allocate(slab->size);
+        }
+
+        slab->used = 0;
+        slab->refs = 1;
+        return slab;
+    }
+
+    void ReleaseSlab(ReplaySlab *slab)
+    {
+        if(InterlockedDecrement(&slab->refs))
+            return;
+
+        //oversized slabs for huge packets aren't worth keeping around
+        if(slab->size == REPLAY_SLAB_SIZE)
+        {
+            OSEnterMutex(hSlabMutex);
+            freeSlabs << slab;
+            OSLeaveMutex(hSlabMutex);
+        }
+        else
+        {
+            Free(slab->data);
+            Free(slab);
+        }
+    }
+
+    void DropPackets(UINT count)
+    {
+        if(count >= packets.Num())
+            packets.Clear();
+        else if(count)
+            packets.RemoveRange(0, count);
+
+        //slabs the remaining packets don't use anymore go back to the pool
+        while(slabs.Num() && (!packets.Num() || slabs[0] != packets[0].slab))
+        {
+            slabMemory -= slabs[0]->size;
+            ReleaseSlab(slabs[0]);
+            slabs.Remove(0);
+        }
+
+        if(!slabs.Num())
+            curSlab = NULL;
+    }
+
+    //keeps at least bufferLength worth of packets, starting from a keyframe
+    void TrimToLength(DWORD newestTime)
+    {
+        UINT dropCount = 0;
+        for(UINT i=1; i<packets.Num() && (newestTime-packets[i].timestamp) >= bufferLength; i++)
+        {
+            if(packets[i].bKeyframe)
+                dropCount = i;
+        }
+
+        if(dropCount)
+            DropPackets(dropCount);
+    }
+
+    //throws away the oldest slab and whatever comes after it up to the next keyframe
+    void TrimToMemory()
+    {
+        while(slabMemory > maxMemory && slabs.Num() > 1)
+        {
+            UINT dropCount = 0;
+            while(dropCount < packets.Num() && packets[dropCount].slab == slabs[0])
+                dropCount++;
+            while(dropCount < packets.Num() && !packets[dropCount].bKeyframe)
+                dropCount++;
+
+            DropPackets(dropCount);
+        }
+    }
+
+    static DWORD STDCALL SaveThread(LPVOID lpBuffer)
+    {
+        ((ReplayBufferStream*)lpBuffer)->SaveReplayFile();
+        return 0;
+    }
+
+    void SaveReplayFile()
+    {
+        DWORD startTime = OSGetTime();
+
+        VideoFileStream *stream;
+        if(GetPathExtension(strSaveFile).CompareI(TEXT("flv")))
+            stream = CreateFLVFileStream(strSaveFile);
+        else
+            stream = CreateMP4FileStream(strSaveFile);
+
+        if(stream)
+        {
+            for(UINT i=0; i<savePackets.Num(); i++)
+            {
+                ReplayPacket &packet = savePackets[i];
+
+                PacketBuffer *data = PacketBuffer::Create(packet.data, packet.size);
+                stream->AddPacket(data, packet.timestamp, packet.type);
+                data->Release();
+            }
+
+            delete stream;
+
+            Log(TEXT("ReplayBuffer: saved %u packets to '%s' in %u ms"), savePackets.Num(), strSaveFile.Array(), OSGetTime()-startTime);
+        }
+        else
+            Log(TEXT("ReplayBuffer: could not create '%s'"), strSaveFile.Array());
+
+        for(UINT i=0; i<saveSlabs.Num(); i++)
+            ReleaseSlab(saveSlabs[i]);
+
+        saveSlabs.Clear();
+        savePackets.Clear();
+    }
+
+    String GetReplayFileName()
+    {
+        String strSavePath = AppConfig->GetString(TEXT("Publish"), TEXT("SavePath"));
+        strSavePath.FindReplace(TEXT("\\"), TEXT("/"));
+
+        String strDirectory;
+        OSFindData ofd;
+        HANDLE hFind = OSFindFirstFile(strSavePath, ofd);
+        if(hFind)
+        {
+            if(ofd.bDirectory)
+                strDirectory = strSavePath;
+            OSFindClose(hFind);
+        }
+
+        if(strDirectory.IsEmpty())
+            strDirectory = GetPathDirectory(strSavePath);
+
+        String strExtension = GetPathExtension(strSavePath);
+        if(!strExtension.CompareI(TEXT("flv")))
+            strExtension = TEXT("mp4");
+
+        SYSTEMTIME st;
+        GetLocalTime(&st);
+
+        return FormattedString(TEXT("%s/Replay %u-%02u-%02u-%02u%02u-%02u.%s"), strDirectory.Array(),
+            st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, strExtension.Array());
+    }
+
+public:
+    ReplayBufferStream(DWORD bufferLength, UINT64 maxMemory)
+    {
+        this->bufferLength = bufferLength;
+        this->maxMemory = MAX(maxMemory, REPLAY_SLAB_SIZE*2);
+        slabMemory = 0;
+        curSlab = NULL;
+        hSaveThread = NULL;
+
+        hBufferMutex = OSCreateMutex();
+        hSlabMutex = OSCreateMutex();
+
+        //the file streams ask for the headers when saving, make sure the encoders have them
+        //ready now rather than generating them from the save thread
+        DataPacket headers;
+        App->GetVideoHeaders(headers);
+        App->GetAudioHeaders(headers);
+
+        Log(TEXT("ReplayBuffer: keeping %u seconds, up to %llu MB"), bufferLength/1000, this->maxMemory/(1024*1024));
+    }
+
+    ~ReplayBufferStream()
+    {
+        if(hSaveThread)
+        {
+            OSWaitForThread(hSaveThread, NULL);
+            OSCloseThread(hSaveThread);
+        }
+
+        DropPackets(packets.Num());
+
+        for(UINT i=0; i<freeSlabs.Num(); i++)
+        {
+            Free(freeSlabs[i]->data);
+            Free(freeSlabs[i]);
+        }
+        freeSlabs.Clear();
+
+        OSCloseMutex(hBufferMutex);
+        OSCloseMutex(hSlabMutex);
+    }
+
+    virtual void AddPacket(PacketBuffer *packet, DWORD timestamp, PacketType type)
+    {
+        LPBYTE data = packet->Data();
+        UINT size = packet->Size();
+        if(!size)
+            return;
+
+        bool bKeyframe = (type != PacketType_Audio) && data[0] == 0x17 && data[1] == 1;
+
+        OSEnterMutex(hBufferMutex);
+
+        //a replay has to start on a keyframe, anything before the first one is useless
+        if(packets.Num() || bKeyframe)
+        {
+            if(!curSlab || curSlab->used+size > curSlab->size)
+            {
+                curSlab = GetSlab(size);
+                slabs << curSlab;
+                slabMemory += curSlab->size;
+            }
+
+            ReplayPacket &replayPacket = *packets.CreateNew();
+            replayPacket.slab       = curSlab;
+            replayPacket.data       = curSlab->data+curSlab->used;
+            replayPacket.size       = size;
+            replayPacket.timestamp  = timestamp;
+            replayPacket.type       = type;
+            replayPacket.bKeyframe  = bKeyframe;
+
+            mcpy(replayPacket.data, data, size);
+            curSlab->used += size;
+
+            if(bKeyframe)
+                TrimToLength(timestamp);
+            TrimToMemory();
+        }
+
+        OSLeaveMutex(hBufferMutex);
+    }
+
+    virtual void SaveReplay()
+    {
+        if(hSaveThread)
+        {
+            if(WaitForSingleObject(hSaveThread, 0) == WAIT_TIMEOUT)
+            {
+                Log(TEXT("ReplayBuffer: still saving the last replay"));
+                return;
+            }
+
+            OSCloseThread(hSaveThread);
+            hSaveThread = NULL;
+        }
+
+        //only the packet list is copied, the data stays in the slabs
+        OSEnterMutex(hBufferMutex);
+
+        savePackets.CopyList(packets);
+        saveSlabs.CopyList(slabs);
+        for(UINT i=0; i<saveSlabs.Num(); i++)
+            InterlockedIncrement(&saveSlabs[i]->refs);
+
+        OSLeaveMutex(hBufferMutex);
+
+        if(!savePackets.Num())
+        {
+            Log(TEXT("ReplayBuffer: nothing to save yet"));
+            saveSlabs.Clear();
+            return;
+        }
+
+        strSaveFile = GetReplayFileName();
+        hSaveThread = OSCreateThread((XTHREAD)ReplayBufferStream::SaveThread, this);
+    }
+};
+
+
+ReplayBuffer* CreateReplayBuffer(DWORD bufferLength, UINT64 maxMemory)
+{
+    return new ReplayBufferStream(bufferLength, maxMemory);
+}
@@ -0,0 +1,211 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "Main.h"
+
+
+//splits a recording into a series of files, each starting on a keyframe with its own headers.
+//the file streams themselves rebase their timestamps on their first keyframe and write the
+//encoder headers before it, so each segment plays on its own.
+class SegmentedFileStream : public VideoFileStream
+{
+    FILESTREAMCREATEPROC createStream;
+    VideoStreamInfo videoInfo;
+
+    String strFilePrefix, strFileExtension;
+    UINT curSegment;
+
+    DWORD segmentTime;      //ms, 0 = no time limit
+    UINT64 segmentSize;     //bytes, 0 = no size limit
+
+    VideoFileStream *curStream;
+    DWORD segmentStartTime;
+    UINT64 segmentBytes;
+    bool bSegmentStarted;
+
+    //finishing a file (writing the mp4 index, patching the flv header) can take a long time,
+    //so old segments get deleted on their own thread instead of the encode thread
+    HANDLE hFinishThread, hFinishSemaphore, hFinishMutex;
+    List<VideoFileStream*> finishedStreams;
+    bool bStopFinishThread;
+
+    static DWORD STDCALL FinishThread(LPVOID lpStream)
+    {
+        ((SegmentedFileStream*)lpStream)->FinishLoop();
+        return 0;
+    }
+
+    void FinishLoop()
+    {
+        while(true)
+        {
+            WaitForSingleObject(hFinishSemaphore, INFINITE);
+
+            OSEnterMutex(hFinishMutex);
+            VideoFileStream *stream = NULL;
+            if(finishedStreams.Num())
+            {
+                stream = finishedStreams[0];
+                finishedStreams.Remove(0);
+            }
+            bool bStop = bStopFinishThread && !stream;
+            OSLeaveMutex(hFinishMutex);
+
+            if(bStop)
+                break;
+
+            DWORD startTime = OSGetTime();
+            delete stream;
+
+            Log(TEXT("SegmentedFileStream: finished segment in %u ms"), OSGetTime()-startTime);
+        }
+    }
+
+    String GetSegmentFileName(UINT segment)
+    {
+        return FormattedString(TEXT("%s-%03u.%s"), strFilePrefix.Array(), segment, strFileExtension.Array());
+    }
+
+    bool StartNextSegment()
+    {
+        String strFile = GetSegmentFileName(++curSegment);
+
+        VideoFileStream *newStream = createStream(strFile, videoInfo);
+        if(!newStream)
+        {
+            Log(TEXT("SegmentedFileStream: could not create segment '%s'"), strFile.Array());
+            return false;
+        }
+
+        Log(TEXT("SegmentedFileStream: recording to '%s'"), strFile.Array());
+
+        if(curStream)
+        {
+            OSEnterMutex(hFinishMutex);
+            finishedStreams << curStream;
+            OSLeaveMutex(hFinishMutex);
+
+            ReleaseSemaphore(hFinishSemaphore, 1, NULL);
+        }
+
+        curStream = newStream;
+        segmentBytes = 0;
+        bSegmentStarted = false;
+        return true;
+    }
+
+public:
+    SegmentedFileStream()
+    {
+        createStream = NULL;
+        curSegment = 0;
+        segmentTime = 0;
+        segmentSize = 0;
+        curStream = NULL;
+        segmentStartTime = 0;
+        segmentBytes = 0;
+        bSegmentStarted = false;
+        hFinishThread = hFinishSemaphore = hFinishMutex = NULL;
+        bStopFinishThread = false;
+    }
+
+    bool Init(CTSTR lpFile, FILESTREAMCREATEPROC createStream, const VideoStreamInfo &videoInfo, DWORD segmentTime, UINT64 segmentSize)
+    {
+        this->createStream = createStream;
+        this->videoInfo = videoInfo;
+        this->segmentTime = segmentTime;
+        this->segmentSize = segmentSize;
+
+        strFilePrefix = GetPathWithoutExtension(lpFile);
+        strFileExtension = GetPathExtension(lpFile);
+
+        hFinishMutex = OSCreateMutex();
+        hFinishSemaphore = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+
+        if(!StartNextSegment())
+            return false;
+
+        hFinishThread = OSCreateThread((XTHREAD)SegmentedFileStream::FinishThread, this);
+        return true;
+    }
+
+    ~SegmentedFileStream()
+    {
+        //the last segment is finished here like a normal recording, the thread just drains the rest
+        delete curStream;
+
+        if(hFinishThread)
+        {
+            OSEnterMutex(hFinishMutex);
+            bStopFinishThread = true;
+            OSLeaveMutex(hFinishMutex);
+
+            ReleaseSemaphore(hFinishSemaphore, 1, NULL);
+
+            OSWaitForThread(hFinishThread, NULL);
+            OSCloseThread(hFinishThread);
+        }
+
+        if(hFinishSemaphore)
+            CloseHandle(hFinishSemaphore);
+        if(hFinishMutex)
+            OSCloseMutex(hFinishMutex);
+    }
+
+    virtual void AddPacket(PacketBuffer *packet, DWORD timestamp, PacketType type)
+    {
+        LPBYTE data = packet->Data();
+        bool bKeyframe = (type != PacketType_Audio) && data[0] == 0x17 && data[1] == 1;
+
+        if(bKeyframe)
+        {
+            if(!bSegmentStarted)
+            {
+                segmentStartTime = timestamp;
+                bSegmentStarted = true;
+            }
+            else if((segmentTime && (timestamp-segmentStartTime) >= segmentTime) ||
+                    (segmentSize && segmentBytes >= segmentSize))
+            {
+                //if the next file can't be opened just keep going with the current one
+                if(StartNextSegment())
+                {
+                    segmentStartTime = timestamp;
+                    bSegmentStarted = true;
+                }
+            }
+        }
+
+        curStream->AddPacket(packet, timestamp, type);
+
+        if(bSegmentStarted)
+            segmentBytes += packet->Size();
+    }
+};
+
+
+VideoFileStream* CreateSegmentedFileStream(CTSTR lpFile, FILESTREAMCREATEPROC createStream, const VideoStreamInfo &videoInfo, DWORD segmentTime, UINT64 segmentSize)
+{
+    SegmentedFileStream *fileStream = new SegmentedFileStream;
+    if(fileStream->Init(lpFile, createStream, videoInfo, segmentTime, segmentSize))
+        return fileStream;
+
+    delete fileStream;
+    return NULL;
+}
@@ -0,0 +1,589 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "Main.h"
+#include "RTMPPublisher.h"
+
+extern "C"
+{
+#include "../x264/x264.h"
+}
+
+
+VideoEncoder* CreateX264Encoder(int fps, int width, int height, int quality, CTSTR preset, bool bUse444, ColorDescription &colorDesc, int maxBitRate, int bufferSize, bool bUseCFR, bool bUseCBR, bool bLowLatency, bool bIntraRefresh);
+VideoFileStream* CreateMP4FileStream(CTSTR lpFile, const VideoStreamInfo &videoInfo);
+VideoFileStream* CreateFLVFileStream(CTSTR lpFile, const VideoStreamInfo &videoInfo);
+
+//enough for one picture being converted, one being encoded and one waiting
+#define NUM_RENDITION_PICTURES 3
+#define INVALID_PICTURE        0xFFFFFFFF
+
+//how long swapping the file waits for the frames still in the encoder to reach the old one
+#define FILE_SWAP_TIMEOUT      5000
+
+
+struct RenditionPacket
+{
+    PacketBuffer *data;
+    DWORD timestamp;
+    PacketType type;
+};
+
+//the capture thread converts the composited frame straight into one of this rendition's pictures,
+//then the rendition encodes it on its own thread and sends it out with the main audio.  if the
+//encoder can't keep up, frames are skipped for this rendition only, the main output never waits.
+class VideoRenditionEncoder : public VideoRendition
+{
+    String strName;
+    UINT width, height, frameDivisor;
+
+    VideoEncoder *encoder;
+    VideoStreamInfo videoInfo;
+
+    //the file can be swapped from the main thread when recording starts and stops.  frames up
+    //to the swap are still in x264 or waiting for audio, so the old file keeps getting packets
+    //up to swapTimestamp, and the new one starts at the first keyframe after it
+    HANDLE hOutputMutex;
+    NetworkStream *network;
+    VideoFileStream *fileStream, *closingStream;
+    DWORD swapTimestamp;
+    bool bWaitForKeyframe;
+    HANDLE hClosedEvent;
+    bool bSentHeaders;
+
+    volatile DWORD lastFrameTimestamp;
+    volatile bool bFramesQueued;
+
+    x264_picture_t pictures[NUM_RENDITION_PICTURES];
+    HANDLE hPictureMutex;
+    List<UINT> freePictures, queuedPictures;
+    UINT curPicture;
+    DWORD numFramesSkipped, numFramesEncoded;
+
+    //encode thread only
+    List<DWORD> bufferedTimes;
+    VideoSegment encoded;
+    List<RenditionPacket> pendingVideo, readyAudio;
+
+    HANDLE hAudioMutex;
+    List<RenditionPacket> pendingAudio;
+    DWORD lastAudioTimestamp;
+
+    HANDLE hEncodeThread, hEncodeEvent;
+    bool bStopEncoding;
+
+    static DWORD STDCALL EncodeThread(LPVOID lpRendition)
+    {
+        ((VideoRenditionEncoder*)lpRendition)->EncodeLoop();
+        return 0;
+    }
+
+    void EncodeLoop()
+    {
+        while(true)
+        {
+            WaitForSingleObject(hEncodeEvent, INFINITE);
+
+            //read before taking pictures so nothing queued ahead of the stop gets lost
+            bool bStop = bStopEncoding;
+
+            while(true)
+            {
+                UINT picture = INVALID_PICTURE;
+
+                OSEnterMutex(hPictureMutex);
+                if(queuedPictures.Num())
+                {
+                    picture = queuedPictures[0];
+                    queuedPictures.Remove(0);
+                }
+                OSLeaveMutex(hPictureMutex);
+
+                if(picture == INVALID_PICTURE)
+                    break;
+
+                EncodePicture(&pictures[picture]);
+                numFramesEncoded++;
+
+                OSEnterMutex(hPictureMutex);
+                freePictures << picture;
+                OSLeaveMutex(hPictureMutex);
+            }
+
+            if(bStop)
+            {
+                while(encoder->HasBufferedFrames() && EncodePicture(NULL));
+                SendPackets(true);
+                break;
+            }
+
+            SendPackets(false);
+        }
+    }
+
+    //same timestamp handling as OBS::ProcessFrame, the encoder gives back the oldest buffered time
+    bool EncodePicture(x264_picture_t *picture)
+    {
+        if(picture)
+            bufferedTimes << DWORD(picture->i_pts);
+
+        if(!bufferedTimes.Num())
+            return false;
+
+        if(!encoder->Encode(picture, encoded, bufferedTimes[0]))
+            return false;
+
+        if(!encoded.numPackets)
+            return picture != NULL;
+
+        for(UINT i=0; i<encoded.numPackets; i++)
+        {
+            RenditionPacket &packet = *pendingVideo.CreateNew();
+            packet.data      = encoded.packets[i].data;
+            packet.timestamp = bufferedTimes[0];
+            packet.type      = encoded.packets[i].type;
+
+            packet.data->AddRef();
+        }
+
+        encoded.Reset();
+
+        bufferedTimes.Remove(0);
+        return true;
+    }
+
+    //video only goes out once the audio has caught up with it, so the two stay interleaved the
+    //same way SendFrame does it for the main outputs
+    void SendPackets(bool bFlush)
+    {
+        OSEnterMutex(hAudioMutex);
+        DWORD audioTimestamp = lastAudioTimestamp;
+        readyAudio.AppendList(pendingAudio);
+        pendingAudio.Clear();
+        OSLeaveMutex(hAudioMutex);
+
+        while(pendingVideo.Num())
+        {
+            RenditionPacket &video = pendingVideo[0];
+            if(!bFlush && audioTimestamp < video.timestamp)
+                break;
+
+            while(readyAudio.Num() && readyAudio[0].timestamp <= video.timestamp)
+            {
+                OutputPacket(readyAudio[0]);
+                readyAudio.Remove(0);
+            }
+
+            OutputPacket(video);
+            pendingVideo.Remove(0);
+        }
+
+        if(bFlush)
+        {
+            for(UINT i=0; i<readyAudio.Num(); i++)
+                OutputPacket(readyAudio[i]);
+            readyAudio.Clear();
+        }
+    }
+
+    void OutputPacket(RenditionPacket &packet)
+    {
+        if(packet.data->Size())
+        {
+            if(network && !bSentHeaders && packet.type != PacketType_Audio && packet.data->Data()[0] == 0x17)
+            {
+                network->BeginPublishing();
+                bSentHeaders = true;
+            }
+
+            //file goes first, over RTMPT/RTMPE librtmp still writes its chunk headers into the packet
+            OSEnterMutex(hOutputMutex);
+
+            bool bVideo = packet.type != PacketType_Audio;
+            bool bAfterSwap = packet.timestamp > swapTimestamp;
+
+            if(closingStream)
+            {
+                if(!bAfterSwap)
+                    closingStream->AddPacket(packet.data, packet.timestamp, packet.type);
+                else if(bVideo)
+                {
+                    //the first frame from after the swap, the old file has everything it's getting
+                    closingStream = NULL;
+                    SetEvent(hClosedEvent);
+                }
+            }
+
+            if(fileStream && bWaitForKeyframe && bAfterSwap && bVideo && packet.data->Data()[0] == 0x17)
+                bWaitForKeyframe = false;
+
+            if(fileStream && !bWaitForKeyframe)
+                fileStream->AddPacket(packet.data, packet.timestamp, packet.type);
+
+            OSLeaveMutex(hOutputMutex);
+
+            if(network)
+                network->SendPacket(packet.data, packet.timestamp, packet.type);
+        }
+
+        packet.data->Release();
+    }
+
+    void ReleasePackets(List<RenditionPacket> &packets)
+    {
+        for(UINT i=0; i<packets.Num(); i++)
+            packets[i].data->Release();
+        packets.Clear();
+    }
+
+public:
+    VideoRenditionEncoder(CTSTR lpName, UINT width, UINT height, UINT frameDivisor, VideoEncoder *encoder)
+    {
+        strName = lpName;
+        this->width = width;
+        this->height = height;
+        this->frameDivisor = frameDivisor;
+        this->encoder = encoder;
+
+        videoInfo.encoder = encoder;
+        videoInfo.width   = width;
+        videoInfo.height  = height;
+        videoInfo.fps     = App->GetFPS()/frameDivisor;
+
+        network = NULL;
+        fileStream = closingStream = NULL;
+        swapTimestamp = 0;
+        bWaitForKeyframe = false;
+        hClosedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        bSentHeaders = false;
+
+        lastFrameTimestamp = 0;
+        bFramesQueued = false;
+
+        for(UINT i=0; i<NUM_RENDITION_PICTURES; i++)
+        {
+            x264_picture_init(&pictures[i]);
+            x264_picture_alloc(&pictures[i], X264_CSP_NV12, width, height);
+            freePictures << i;
+        }
+
+        curPicture = INVALID_PICTURE;
+        numFramesSkipped = numFramesEncoded = 0;
+        lastAudioTimestamp = 0;
+
+        hPictureMutex = OSCreateMutex();
+        hAudioMutex = OSCreateMutex();
+        hOutputMutex = OSCreateMutex();
+
+        hEncodeThread = NULL;
+        hEncodeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        bStopEncoding = false;
+
+        //the outputs ask for the headers from the encode thread, have them ready now
+        DataPacket headers;
+        encoder->GetHeaders(headers);
+    }
+
+    ~VideoRenditionEncoder()
+    {
+        if(hEncodeThread)
+        {
+            bStopEncoding = true;
+            SetEvent(hEncodeEvent);
+
+            OSWaitForThread(hEncodeThread, NULL);
+            OSCloseThread(hEncodeThread);
+        }
+
+        //outputs may still want the encoder's headers while they finish
+        delete fileStream;
+        delete network;
+        delete encoder;
+
+        ReleasePackets(pendingVideo);
+        ReleasePackets(readyAudio);
+        ReleasePackets(pendingAudio);
+
+        for(UINT i=0; i<NUM_RENDITION_PICTURES; i++)
+            x264_picture_clean(&pictures[i]);
+
+        CloseHandle(hEncodeEvent);
+        CloseHandle(hClosedEvent);
+        OSCloseMutex(hPictureMutex);
+        OSCloseMutex(hAudioMutex);
+        OSCloseMutex(hOutputMutex);
+
+        Log(TEXT("%s: encoded %u frames, skipped %u because the encoder was behind"), strName.Array(), numFramesEncoded, numFramesSkipped);
+    }
+
+    bool Init(CTSTR lpURL, CTSTR lpPlayPath, CTSTR lpFile)
+    {
+        if(lpURL && *lpURL)
+        {
+            //a secondary destination, so it drops out on its own instead of stopping the main stream
+            //it gets the main stream's audio packets, and librtmp can write into those
+            RTMPPublisher *publisher = new RTMPPublisher;
+            publisher->SetDestination(0, lpURL, lpPlayPath, true);
+            publisher->SetVideoStream(videoInfo);
+            publisher->SetSharedPackets(true);
+            network = publisher;
+
+            Log(TEXT("%s: streaming to %s"), strName.Array(), lpURL);
+        }
+
+        if(lpFile && *lpFile)
+        {
+            String strFile = lpFile;
+            strFile.FindReplace(TEXT("\\"), TEXT("/"));
+
+            String strExtension = GetPathExtension(strFile);
+            if(!strExtension.CompareI(TEXT("flv")))
+                strExtension = TEXT("mp4");
+
+            //never write over an earlier recording
+            if(OSFileExists(strFile))
+            {
+                String strPrefix = GetPathWithoutExtension(strFile);
+                UINT curFile = 1;
+                do
+                {
+                    strFile = FormattedString(TEXT("%s (%02u).%s"), strPrefix.Array(), curFile++, strExtension.Array());
+                } while(OSFileExists(strFile));
+            }
+
+            if(strExtension.CompareI(TEXT("flv")))
+                fileStream = CreateFLVFileStream(strFile, videoInfo);
+            else
+                fileStream = CreateMP4FileStream(strFile, videoInfo);
+
+            if(fileStream)
+                Log(TEXT("%s: recording to '%s'"), strName.Array(), strFile.Array());
+            else
+                Log(TEXT("%s: could not create '%s'"), strName.Array(), strFile.Array());
+        }
+
+        if(lpFile && *lpFile && !fileStream && !network)
+            return false;
+
+        //the main encoder comes first, a rendition is what gets skipped when the CPU runs out
+        hEncodeThread = OSCreateThread((XTHREAD)VideoRenditionEncoder::EncodeThread, this);
+        SetThreadPriority(hEncodeThread, THREAD_PRIORITY_BELOW_NORMAL);
+        return true;
+    }
+
+    virtual void GetStreamInfo(VideoStreamInfo &info) const
+    {
+        info = videoInfo;
+    }
+
+    virtual VideoFileStream* SetFileStream(VideoFileStream *fileStream)
+    {
+        OSEnterMutex(hOutputMutex);
+
+        VideoFileStream *oldStream = this->fileStream;
+        this->fileStream = fileStream;
+
+        //everything up to the last frame handed to the encoder goes to the old file, anything
+        //after it to the new one from its first keyframe on
+        swapTimestamp = lastFrameTimestamp;
+        bWaitForKeyframe = true;
+
+        bool bDrain = oldStream && bFramesQueued;
+        if(bDrain)
+        {
+            closingStream = oldStream;
+            ResetEvent(hClosedEvent);
+        }
+
+        OSLeaveMutex(hOutputMutex);
+
+        //a new file has to start on a keyframe
+        if(fileStream)
+            encoder->RequestKeyframe();
+
+        //frames keep coming while this waits, and they push the old ones out of the encoder
+        if(bDrain && WaitForSingleObject(hClosedEvent, FILE_SWAP_TIMEOUT) == WAIT_TIMEOUT)
+        {
+            OSEnterMutex(hOutputMutex);
+            closingStream = NULL;
+            OSLeaveMutex(hOutputMutex);
+
+            Log(TEXT("%s: the encoder didn't get past the end of the last file in %u ms, the rest of it is lost"), strName.Array(), FILE_SWAP_TIMEOUT);
+        }
+
+        return oldStream;
+    }
+
+    virtual void GetSize(UINT &width, UINT &height) const
+    {
+        width = this->width;
+        height = this->height;
+    }
+
+    virtual UINT GetFrameDivisor() const {return frameDivisor;}
+
+    virtual bool BeginFrame(LPBYTE *planes)
+    {
+        OSEnterMutex(hPictureMutex);
+        if(freePictures.Num())
+        {
+            curPicture = freePictures.Last();
+            freePictures.Remove(freePictures.Num()-1);
+        }
+        OSLeaveMutex(hPictureMutex);
+
+        if(curPicture == INVALID_PICTURE)
+        {
+            numFramesSkipped++;
+            return false;
+        }
+
+        planes[0] = pictures[curPicture].img.plane[0];
+        planes[1] = pictures[curPicture].img.plane[1];
+        planes[2] = pictures[curPicture].img.plane[2];
+        return true;
+    }
+
+    virtual void EndFrame(DWORD timestamp)
+    {
+        if(curPicture == INVALID_PICTURE)
+            return;
+
+        pictures[curPicture].i_pts = timestamp;
+
+        lastFrameTimestamp = timestamp;
+        bFramesQueued = true;
+
+        OSEnterMutex(hPictureMutex);
+        queuedPictures << curPicture;
+        OSLeaveMutex(hPictureMutex);
+
+        curPicture = INVALID_PICTURE;
+        SetEvent(hEncodeEvent);
+    }
+
+    virtual void AddAudio(PacketBuffer *audio, DWORD timestamp)
+    {
+        audio->AddRef();
+
+        OSEnterMutex(hAudioMutex);
+        RenditionPacket &packet = *pendingAudio.CreateNew();
+        packet.data      = audio;
+        packet.timestamp = timestamp;
+        packet.type      = PacketType_Audio;
+        lastAudioTimestamp = timestamp;
+        OSLeaveMutex(hAudioMutex);
+
+        SetEvent(hEncodeEvent);
+    }
+};
+
+
+//reads a [RenditionN] section of the profile.  renditions always use x264 with the main quality
+//and color settings -- the pixels come out of the main YUV conversion, so the matrix has to match
+VideoRendition* CreateVideoRendition(CTSTR lpSection, int quality, CTSTR preset, ColorDescription &colorDesc)
+{
+    UINT width  = (UINT)AppConfig->GetInt(lpSection, TEXT("Width"));
+    UINT height = (UINT)AppConfig->GetInt(lpSection, TEXT("Height"));
+
+    //renditions are only ever scaled down from the main output, and NV12 needs even sizes
+    UINT outputCX, outputCY;
+    App->GetOutputSize(outputCX, outputCY);
+
+    width  = MIN(MAX(width, 64), outputCX)  & 0xFFFFFFFE;
+    height = MIN(MAX(height, 64), outputCY) & 0xFFFFFFFE;
+
+    UINT fps = App->GetFPS();
+    UINT frameDivisor = (UINT)AppConfig->GetInt(lpSection, TEXT("FrameDivisor"), 1);
+    frameDivisor = MIN(MAX(frameDivisor, 1), fps);
+
+    int maxBitRate = AppConfig->GetInt(lpSection, TEXT("MaxBitrate"), 1000);
+    int bufferSize = AppConfig->GetInt(lpSection, TEXT("BufferSize"), maxBitRate);
+    bool bUseCBR   = AppConfig->GetInt(lpSection, TEXT("UseCBR"), AppConfig->GetInt(TEXT("Video Encoding"), TEXT("UseCBR"), 1)) != 0;
+    String strPreset = AppConfig->GetString(lpSection, TEXT("Preset"), preset);
+
+    String strURL      = AppConfig->GetString(lpSection, TEXT("URL"));
+    String strPlayPath = AppConfig->GetString(lpSection, TEXT("PlayPath"));
+    String strFile     = AppConfig->GetString(lpSection, TEXT("File"));
+
+    if(strURL.IsEmpty() && strFile.IsEmpty())
+    {
+        Log(TEXT("%s: no URL or File set, ignoring it"), lpSection);
+        return NULL;
+    }
+
+    //no intra refresh if the rendition records, a file has to start on an IDR
+    bool bIntraRefresh = strFile.IsEmpty() && AppConfig->GetInt(TEXT("Video Encoding"), TEXT("LowLatencyIntraRefresh"), 1) != 0;
+
+    VideoEncoder *encoder = CreateX264Encoder(fps/frameDivisor, width, height, quality, strPreset, false, colorDesc, maxBitRate, bufferSize, false, bUseCBR, App->IsLowLatency(), bIntraRefresh);
+    if(!encoder)
+    {
+        Log(TEXT("%s: could not create the encoder"), lpSection);
+        return NULL;
+    }
+
+    Log(TEXT("%s: %ux%u at %u fps, %d kbps"), lpSection, width, height, fps/frameDivisor, maxBitRate);
+
+    VideoRenditionEncoder *rendition = new VideoRenditionEncoder(lpSection, width, height, frameDivisor, encoder);
+    if(rendition->Init(strURL, strPlayPath, strFile))
+        return rendition;
+
+    delete rendition;
+    return NULL;
+}
+
+//a second x264 encode at the full output size for local recordings, set up from [Recording Encoding].
+//it defaults to quality based CRF with no VBV limits, so recordings aren't held to the stream bitrate.
+//the encode thread copies each converted picture over, there's no extra readback or conversion
+VideoRendition* CreateRecordingEncoder(int quality, CTSTR preset, ColorDescription &colorDesc)
+{
+    CTSTR lpSection = TEXT("Recording Encoding");
+
+    UINT width, height;
+    App->GetOutputSize(width, height);
+
+    quality = AppConfig->GetInt(lpSection, TEXT("Quality"), quality);
+    String strPreset = AppConfig->GetString(lpSection, TEXT("Preset"), preset);
+    bool bUseCBR = AppConfig->GetInt(lpSection, TEXT("UseCBR")) != 0;
+
+    //0 leaves VBV off, which CBR can't do without
+    int maxBitRate = AppConfig->GetInt(lpSection, TEXT("MaxBitrate"));
+    if(bUseCBR && !maxBitRate)
+        maxBitRate = AppConfig->GetInt(TEXT("Video Encoding"), TEXT("MaxBitrate"), 1000);
+    int bufferSize = AppConfig->GetInt(lpSection, TEXT("BufferSize"), maxBitRate);
+
+    VideoEncoder *encoder = CreateX264Encoder(App->GetFPS(), width, height, quality, strPreset, false, colorDesc, maxBitRate, bufferSize, false, bUseCBR, false, false);
+    if(!encoder)
+    {
+        Log(TEXT("Recording encoder: could not create the encoder"));
+        return NULL;
+    }
+
+    if(bUseCBR)
+        Log(TEXT("Recording encoder: preset %s, CBR %d kbps"), strPreset.Array(), maxBitRate);
+    else
+        Log(TEXT("Recording encoder: preset %s, quality %d"), strPreset.Array(), quality);
+
+    VideoRenditionEncoder *rendition = new VideoRenditionEncoder(TEXT("Recording encoder"), width, height, 1, encoder);
+    if(rendition->Init(NULL, NULL, NULL))
+        return rendition;
+
+    delete rendition;
+    return NULL;
+}
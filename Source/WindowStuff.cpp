@@ -2931,6 +2931,19 @@ LRESULT CALLBACK OBS::OBSProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lPa
             App->SetStatusBarData();
             break;
 
+        case OBS_SAVEREPLAY:
+            if(App->replayBuffer)
+                App->replayBuffer->SaveReplay();
+            break;
+
+        case OBS_FILEWRITEFAILED:
+            if(App->streamReport.IsValid())
+            {
+                MessageBox(hwndMain, App->streamReport.Array(), Str("StreamReport"), MB_ICONEXCLAMATION);
+                App->streamReport.Clear();
+            }
+            break;
+
         case OBS_NOTIFICATIONAREA:
             // the point is to only perform the show/hide (minimize) or the menu creation if no modal dialogs are opened
             // if a modal dialog is topmost, then simply focus it
@@ -0,0 +1,273 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../EncoderHost/FrameRing.h"
+
+
+//measures what handing NV12 frames to another process through a frame_ring costs, with the
+//same copies the x264 host does: OBS copies the converted picture into a slot, the host reads
+//it in place and x264 copies it into its own frame.
+//
+//  X264Helper benchmark [frames] [width] [height] [slots]
+//
+//spawns "X264Helper benchmark-echo" as the consumer, which copies each frame out and answers
+//with its timestamps through a second ring.  two passes are run:
+//
+//  streaming   frames are pushed as fast as the ring takes them, gives the throughput.  the
+//              ring is full most of the time, so latency here is mostly queueing
+//  ping-pong   one frame in flight at a time, gives the bare hand-off latency
+
+using namespace encoder_host;
+
+namespace
+{
+    const uint32_t bench_stop = 1;
+    const uint32_t bench_timeout_ms = 5000;
+
+    struct echo_record
+    {
+        uint64_t queued_ns, dequeued_ns, consumed_ns;
+    };
+
+    struct pass_stats
+    {
+        std::vector<uint64_t> handoff, copy_out;
+        uint64_t copy_in_ns;
+        uint64_t elapsed_ns;
+
+        pass_stats() : copy_in_ns(0), elapsed_ns(0) {}
+    };
+
+    std::string name_prefix()
+    {
+        std::ostringstream ss;
+        ss << "X264HelperBenchmark" << current_process_id() << "_";
+        return ss.str();
+    }
+
+    double percentile_us(std::vector<uint64_t> &values, double p)
+    {
+        if(values.empty())
+            return 0.0;
+
+        std::sort(values.begin(), values.end());
+        size_t index = size_t(p*double(values.size()-1) + 0.5);
+        return double(values[index])/1000.0;
+    }
+
+    bool read_echo(frame_ring &echoes, uint32_t timeout_ms, pass_stats &stats)
+    {
+        slot_header *si;
+        uint8_t *data = echoes.begin_read(timeout_ms, si);
+        if(!data)
+            return false;
+
+        echo_record record;
+        memcpy(&record, data, sizeof(record));
+        echoes.end_read();
+
+        stats.handoff.push_back(record.dequeued_ns-record.queued_ns);
+        stats.copy_out.push_back(record.consumed_ns-record.dequeued_ns);
+        return true;
+    }
+
+    bool run_pass(frame_ring &frames, frame_ring &echoes, host_process &consumer, const std::vector<uint8_t> &source, uint32_t num_frames, bool ping_pong, pass_stats &stats)
+    {
+        uint32_t frame_size = uint32_t(source.size());
+        uint32_t num_sent = 0;
+
+        uint64_t start = monotonic_ns();
+
+        while(num_sent < num_frames)
+        {
+            uint8_t *data = frames.begin_write(bench_timeout_ms);
+            if(!data)
+                return false;
+
+            uint64_t copy_start = monotonic_ns();
+            memcpy(data, &source[0], frame_size);
+            stats.copy_in_ns += monotonic_ns()-copy_start;
+
+            frames.end_write(frame_size);
+            num_sent++;
+
+            if(ping_pong)
+            {
+                if(!read_echo(echoes, bench_timeout_ms, stats))
+                    return false;
+            }
+            else
+            {
+                while(read_echo(echoes, 0, stats));
+            }
+
+            if(!consumer.running())
+                return false;
+        }
+
+        while(stats.handoff.size() < num_sent)
+        {
+            if(!read_echo(echoes, bench_timeout_ms, stats))
+                return false;
+        }
+
+        stats.elapsed_ns = monotonic_ns()-start;
+        return true;
+    }
+
+    void print_pass(const char *name, pass_stats &stats, uint32_t frame_size)
+    {
+        size_t num_frames = stats.handoff.size();
+        double seconds = double(stats.elapsed_ns)/1e9;
+
+        printf("%s:\n", name);
+        printf("  throughput:         %.1f frames/s, %.2f GB/s\n", double(num_frames)/seconds, double(num_frames)*frame_size/seconds/1e9);
+        printf("  copy into slot:     avg %.3f ms\n", double(stats.copy_in_ns)/double(num_frames)/1e6);
+        printf("  hand-off latency:   p50 %.1f us, p99 %.1f us, max %.1f us\n",
+            percentile_us(stats.handoff, 0.5), percentile_us(stats.handoff, 0.99), percentile_us(stats.handoff, 1.0));
+        printf("  copy out of slot:   p50 %.3f ms, p99 %.3f ms\n",
+            percentile_us(stats.copy_out, 0.5)/1000.0, percentile_us(stats.copy_out, 0.99)/1000.0);
+    }
+}
+
+
+int run_ring_benchmark(int argc, char **argv)
+{
+    uint32_t num_frames = (argc > 0) ? uint32_t(atoi(argv[0])) : 600;
+    uint32_t width      = (argc > 1) ? uint32_t(atoi(argv[1])) : 1920;
+    uint32_t height     = (argc > 2) ? uint32_t(atoi(argv[2])) : 1080;
+    uint32_t num_slots  = (argc > 3) ? uint32_t(atoi(argv[3])) : 4;
+
+    if(!num_frames || !width || !height || !num_slots)
+    {
+        fprintf(stderr, "usage: X264Helper benchmark [frames] [width] [height] [slots]\n");
+        return 1;
+    }
+
+    uint32_t frame_size = width*height*3/2;
+    std::string prefix = name_prefix();
+
+    frame_ring frames, echoes;
+    if(!frames.create(prefix+"frames", num_slots, frame_size) || !echoes.create(prefix+"echo", num_slots, sizeof(echo_record)))
+    {
+        fprintf(stderr, "could not create the rings\n");
+        return 1;
+    }
+
+    std::ostringstream slots_arg, size_arg;
+    slots_arg << num_slots;
+    size_arg << frame_size;
+
+    std::vector<std::string> args;
+    args.push_back("benchmark-echo");
+    args.push_back(prefix);
+    args.push_back(slots_arg.str());
+    args.push_back(size_arg.str());
+
+    host_process consumer;
+    if(!consumer.spawn(current_executable_path(), args))
+    {
+        fprintf(stderr, "could not start the consumer process\n");
+        return 1;
+    }
+
+    //something that isn't all zeroes, in case anything along the way gets clever
+    std::vector<uint8_t> source(frame_size);
+    for(uint32_t i=0; i<frame_size; i++)
+        source[i] = uint8_t(i*31 + (i>>12));
+
+    printf("%u frames of %ux%u NV12 (%.2f MB each) through %u slots\n\n", num_frames, width, height, double(frame_size)/(1024.0*1024.0), num_slots);
+
+    pass_stats streaming, ping_pong;
+    bool success = run_pass(frames, echoes, consumer, source, num_frames, false, streaming) &&
+                   run_pass(frames, echoes, consumer, source, num_frames, true, ping_pong);
+
+    if(frames.begin_write(bench_timeout_ms))
+        frames.end_write(0, bench_stop);
+
+    if(!consumer.wait(bench_timeout_ms))
+        consumer.kill();
+
+    if(!success)
+    {
+        fprintf(stderr, "the consumer process stopped responding (exit code %d)\n", consumer.exit_code);
+        return 1;
+    }
+
+    print_pass("streaming", streaming, frame_size);
+    print_pass("ping-pong", ping_pong, frame_size);
+    return 0;
+}
+
+int run_ring_benchmark_echo(int argc, char **argv)
+{
+    if(argc < 3)
+        return 1;
+
+    std::string prefix = argv[0];
+    uint32_t num_slots  = uint32_t(atoi(argv[1]));
+    uint32_t frame_size = uint32_t(atoi(argv[2]));
+
+    frame_ring frames, echoes;
+    if(!frames.open(prefix+"frames", num_slots, frame_size) || !echoes.open(prefix+"echo", num_slots, sizeof(echo_record)))
+        return 2;
+
+    std::vector<uint8_t> frame(frame_size);
+
+    while(true)
+    {
+        slot_header *si;
+        uint8_t *data = frames.begin_read(bench_timeout_ms, si);
+        if(!data)
+            return 3;
+
+        echo_record record;
+        record.queued_ns   = si->queued_ns;
+        record.dequeued_ns = monotonic_ns();
+
+        if(si->flags & bench_stop)
+        {
+            frames.end_read();
+            break;
+        }
+
+        memcpy(&frame[0], data, si->length);
+        record.consumed_ns = monotonic_ns();
+
+        frames.end_read();
+
+        uint8_t *out = echoes.begin_write(bench_timeout_ms);
+        if(!out)
+            return 3;
+
+        memcpy(out, &record, sizeof(record));
+        echoes.end_write(sizeof(record));
+    }
+
+    return 0;
+}
@@ -0,0 +1,355 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include "../x264/x264.h"
+}
+
+#include "X264HostParams.h"
+
+
+//runs x264 for OBS in its own process, so an encoder crash only ends the stream and x264's
+//frame and lookahead buffers don't count against OBS's (32 bit) address space.
+//
+//  X264Helper <prefix>                 encode for the OBS process that created <prefix>*
+//  X264Helper benchmark [...]          frame hand-off benchmark, see RingBenchmark.cpp
+
+int run_ring_benchmark(int argc, char **argv);
+int run_ring_benchmark_echo(int argc, char **argv);
+
+using namespace encoder_host;
+
+namespace
+{
+    //how often to look for a dead OBS while waiting on a ring
+    const uint32_t parent_check_ms = 500;
+
+    FILE *log_file = nullptr;
+
+    void host_log(const char *format, ...)
+    {
+        if(!log_file)
+            return;
+
+        va_list args;
+        va_start(args, format);
+        vfprintf(log_file, format, args);
+        va_end(args);
+
+        fputc('\n', log_file);
+        fflush(log_file);
+    }
+
+    void x264_log(void *param, int level, const char *format, va_list args)
+    {
+        if(!log_file)
+            return;
+
+        fputs("x264: ", log_file);
+        vfprintf(log_file, format, args);
+        fflush(log_file);
+    }
+
+    FILE *open_log(const char *path)
+    {
+        if(!*path)
+            return nullptr;
+#ifdef _WIN32
+        return _wfopen(widen(path).c_str(), L"w");
+#else
+        return fopen(path, "w");
+#endif
+    }
+
+    void fill_response(x264_host_init_response &res, x264_t *x264, const x264_param_t &param)
+    {
+        res.keyint_max      = param.i_keyint_max;
+        res.bitrate         = param.rc.i_bitrate;
+        res.vbv_max_bitrate = param.rc.i_vbv_max_bitrate;
+        res.vbv_buffer_size = param.rc.i_vbv_buffer_size;
+        res.nal_hrd         = param.i_nal_hrd;
+        res.full_range      = param.vui.b_fullrange;
+        res.primaries       = param.vui.i_colorprim;
+        res.transfer        = param.vui.i_transfer;
+        res.matrix          = param.vui.i_colmatrix;
+        res.rf_constant     = param.rc.f_rf_constant;
+
+        x264_nal_t *nals;
+        int nal_count;
+        x264_encoder_headers(x264, &nals, &nal_count);
+
+        const uint32_t max_nals = sizeof(res.header_nals)/sizeof(res.header_nals[0]);
+
+        size_t offset = 0;
+        res.header_nal_count = 0;
+        for(int i=0; i<nal_count && res.header_nal_count < max_nals; i++)
+        {
+            if(offset+nals[i].i_payload > sizeof(res.header_data))
+                break;
+
+            x264_host_nal &nal = res.header_nals[res.header_nal_count++];
+            nal.type    = nals[i].i_type;
+            nal.ref_idc = nals[i].i_ref_idc;
+            nal.size    = nals[i].i_payload;
+
+            memcpy(res.header_data+offset, nals[i].p_payload, nals[i].i_payload);
+            offset += nals[i].i_payload;
+        }
+    }
+
+    //waits for a free bitstream slot, giving up if OBS goes away in the meantime
+    uint8_t *begin_bitstream(frame_ring &bitstream, parent_process &parent)
+    {
+        uint8_t *data;
+        while(!(data = bitstream.begin_write(parent_check_ms)))
+        {
+            if(!parent.alive())
+                return nullptr;
+        }
+        return data;
+    }
+
+    void write_bitstream(uint8_t *data, uint32_t slot_size, x264_host_bitstream &record, x264_nal_t *nals, int nal_count, uint32_t &length)
+    {
+        size_t nal_offset = sizeof(x264_host_bitstream);
+        size_t payload_offset = nal_offset + sizeof(x264_host_nal)*nal_count;
+
+        size_t total = payload_offset;
+        for(int i=0; i<nal_count; i++)
+            total += nals[i].i_payload;
+
+        if(total > slot_size)
+        {
+            host_log("encoded frame of %u bytes doesn't fit a %u byte bitstream slot, dropping it", uint32_t(total), slot_size);
+            record.status = X264_HOST_STATUS_TRUNCATED;
+            nal_count = 0;
+            total = nal_offset;
+        }
+
+        record.nal_count = nal_count;
+        memcpy(data, &record, sizeof(record));
+
+        x264_host_nal *out_nals = reinterpret_cast<x264_host_nal*>(data+nal_offset);
+        uint8_t *payload = data+payload_offset;
+        for(int i=0; i<nal_count; i++)
+        {
+            out_nals[i].type    = nals[i].i_type;
+            out_nals[i].ref_idc = nals[i].i_ref_idc;
+            out_nals[i].size    = nals[i].i_payload;
+
+            memcpy(payload, nals[i].p_payload, nals[i].i_payload);
+            payload += nals[i].i_payload;
+        }
+
+        length = uint32_t(total);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    if(argc >= 2 && strcmp(argv[1], "benchmark") == 0)
+        return run_ring_benchmark(argc-2, argv+2);
+    if(argc >= 2 && strcmp(argv[1], "benchmark-echo") == 0)
+        return run_ring_benchmark_echo(argc-2, argv+2);
+
+    if(argc < 2)
+        return X264_HOST_EXIT_BAD_ARGS;
+
+    std::string prefix = argv[1];
+
+    shared_memory control_memory;
+    ipc_semaphore ready;
+    if(!control_memory.open(prefix+X264_HOST_CONTROL, sizeof(x264_host_control)) || !ready.open(prefix+X264_HOST_READY))
+        return X264_HOST_EXIT_NO_CONTROL;
+
+    x264_host_control &control = *control_memory.as<x264_host_control>();
+    x264_host_init &init = control.init;
+    x264_host_init_response &res = control.response;
+
+    res.status = -1;
+
+    if(init.version != X264_HOST_VERSION)
+    {
+        ready.post();
+        return X264_HOST_EXIT_BAD_VERSION;
+    }
+
+    parent_process parent;
+    if(!parent.open(init.obs_process_id))
+        return X264_HOST_EXIT_PARENT_GONE;
+
+    init.log_path[sizeof(init.log_path)-1] = 0;
+    init.preset[sizeof(init.preset)-1] = 0;
+    init.tune[sizeof(init.tune)-1] = 0;
+    init.profile[sizeof(init.profile)-1] = 0;
+
+    log_file = open_log(init.log_path);
+
+    frame_ring frames, bitstream;
+    if(!frames.open(prefix+X264_HOST_FRAMES, X264_HOST_FRAME_SLOTS, init.frame_slot_size) ||
+       !bitstream.open(prefix+X264_HOST_BITSTREAM, X264_HOST_BITSTREAM_SLOTS, init.bitstream_slot_size))
+    {
+        host_log("could not open the frame rings");
+        ready.post();
+        return X264_HOST_EXIT_NO_CONTROL;
+    }
+
+    x264_param_t param;
+    x264_host_setup_params(param, init, X264_CSP_I420, x264_log, host_log);
+
+    x264_t *x264 = x264_encoder_open(&param);
+    if(!x264)
+    {
+        host_log("could not initialize x264");
+        ready.post();
+        return X264_HOST_EXIT_INIT_FAILED;
+    }
+
+    fill_response(res, x264, param);
+    res.status = 0;
+    ready.post();
+
+    host_log("encoding %dx%d at %d fps, preset %s", init.width, init.height, init.fps, init.preset);
+
+    //pictures are read straight out of the frame slots, x264 copies them during encode
+    x264_picture_t pic_in, pic_out;
+    x264_picture_init(&pic_in);
+    x264_picture_init(&pic_out);
+    pic_in.img.i_csp        = X264_CSP_NV12;
+    pic_in.img.i_plane      = 2;
+    pic_in.img.i_stride[0]  = init.width;
+    pic_in.img.i_stride[1]  = init.width;
+
+    const size_t luma_size = size_t(init.width)*init.height;
+
+    int exit_code = 0;
+    uint64_t num_frames = 0;
+
+    while(true)
+    {
+        slot_header *si;
+        uint8_t *data = frames.begin_read(parent_check_ms, si);
+        if(!data)
+        {
+            if(!parent.alive())
+            {
+                host_log("OBS has gone away");
+                exit_code = X264_HOST_EXIT_PARENT_GONE;
+                break;
+            }
+            continue;
+        }
+
+        x264_host_bitstream record;
+        memset(&record, 0, sizeof(record));
+        record.frame_queued_ns   = si->queued_ns;
+        record.frame_dequeued_ns = monotonic_ns();
+
+        uint32_t flags = si->flags;
+        if(flags & X264_HOST_FRAME_STOP)
+        {
+            frames.end_read();
+            break;
+        }
+
+        x264_host_frame &frame = *reinterpret_cast<x264_host_frame*>(data);
+
+        if(flags & X264_HOST_FRAME_RECONFIG)
+        {
+            if(frame.max_bitrate != -1)
+                param.rc.i_vbv_max_bitrate = frame.max_bitrate;
+            if(frame.buffer_size != -1)
+                param.rc.i_vbv_buffer_size = frame.buffer_size;
+            if(init.use_cbr)
+                param.rc.i_bitrate = frame.max_bitrate;
+
+            record.reconfig_result = x264_encoder_reconfig(x264, &param);
+        }
+
+        x264_nal_t *nals = nullptr;
+        int nal_count = 0;
+        int ret;
+
+        if(flags & X264_HOST_FRAME_FLUSH)
+            ret = x264_encoder_encode(x264, &nals, &nal_count, nullptr, &pic_out);
+        else
+        {
+            pic_in.img.plane[0] = data+x264_host_frame_data_offset();
+            pic_in.img.plane[1] = pic_in.img.plane[0]+luma_size;
+            pic_in.i_pts        = frame.pts;
+            pic_in.i_type       = X264_TYPE_AUTO;
+
+            if(flags & X264_HOST_FRAME_KEYFRAME)
+            {
+                if(init.intra_refresh)
+                    x264_encoder_intra_refresh(x264);
+                else
+                    pic_in.i_type = X264_TYPE_IDR;
+            }
+
+            ret = x264_encoder_encode(x264, &nals, &nal_count, &pic_in, &pic_out);
+            num_frames++;
+        }
+
+        frames.end_read();
+
+        if(ret < 0)
+        {
+            host_log("x264 encode failed");
+            record.status = X264_HOST_STATUS_FAILED;
+            nal_count = 0;
+        }
+
+        record.pts            = pic_out.i_pts;
+        record.dts            = pic_out.i_dts;
+        record.keyframe       = pic_out.b_keyframe ? 1 : 0;
+        record.delayed_frames = x264_encoder_delayed_frames(x264);
+
+        uint8_t *out = begin_bitstream(bitstream, parent);
+        if(!out)
+        {
+            host_log("OBS has gone away");
+            exit_code = X264_HOST_EXIT_PARENT_GONE;
+            break;
+        }
+
+        uint32_t length;
+        write_bitstream(out, bitstream.slot_size(), record, nals, nal_count, length);
+        bitstream.end_write(length);
+    }
+
+    x264_encoder_close(x264);
+
+    host_log("encoded %llu frames, exiting with %d", (unsigned long long)num_frames, exit_code);
+
+    if(log_file)
+        fclose(log_file);
+
+    return exit_code;
+}
@@ -0,0 +1,97 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#pragma once
+
+#include <cstdarg>
+#include <cstring>
+
+#include "X264HostProtocol.h"
+
+
+//turns an x264_host_init into x264 settings.  X264Encoder and X264Helper.exe both go through
+//this, so an encode comes out the same whichever process it runs in.  x264.h has to be
+//included first.
+
+#define X264_HOST_BASE_CRF          22.0f
+
+typedef void (*x264_host_log_function)(const char *format, ...);
+typedef void (*x264_host_x264_log_function)(void *param, int level, const char *format, va_list args);
+
+inline void x264_host_setup_params(x264_param_t &param, const x264_host_init &init, int csp, x264_host_x264_log_function x264_log, x264_host_log_function log)
+{
+    memset(&param, 0, sizeof(param));
+
+    if(x264_param_default_preset(&param, init.preset, *init.tune ? init.tune : 0))
+        log("Failed to set x264 defaults: %s/%s", init.preset, init.tune);
+
+    param.b_deterministic = false;
+
+    //-1 means ignore so we don't have to know both settings
+    if(init.max_bitrate != -1)
+        param.rc.i_vbv_max_bitrate = init.max_bitrate;
+    if(init.buffer_size != -1)
+        param.rc.i_vbv_buffer_size = init.buffer_size;
+
+    if(init.use_cbr)
+    {
+        param.rc.i_bitrate      = init.max_bitrate;
+        if(init.pad_cbr) param.rc.b_filler = 1;
+        param.rc.i_rc_method    = X264_RC_ABR;
+        param.rc.f_rf_constant  = 0.0f;
+    }
+    else
+    {
+        param.rc.i_rc_method    = X264_RC_CRF;
+        param.rc.f_rf_constant  = X264_HOST_BASE_CRF+float(10-init.quality);
+    }
+
+    param.b_vfr_input       = !init.use_cfr;
+    param.b_intra_refresh   = init.intra_refresh;
+    param.i_width           = init.width;
+    param.i_height          = init.height;
+    param.vui.b_fullrange   = init.full_range;
+    param.vui.i_colorprim   = init.primaries;
+    param.vui.i_transfer    = init.transfer;
+    param.vui.i_colmatrix   = init.matrix;
+
+    if(init.keyint)
+        param.i_keyint_max  = init.fps*init.keyint;
+
+    param.i_fps_num         = init.fps;
+    param.i_fps_den         = 1;
+
+    param.i_timebase_num    = 1;
+    param.i_timebase_den    = 1000;
+
+    param.pf_log            = x264_log;
+    param.i_log_level       = X264_LOG_WARNING;
+
+    const char *name, *value, *custom_end = init.custom+sizeof(init.custom);
+    for(const char *entry = init.custom; (entry = x264_host_next_custom(entry, custom_end, name, value)) != 0;)
+    {
+        if(x264_param_parse(&param, name, value) != 0)
+            log("The custom x264 command '%s=%s' failed", name, value);
+    }
+
+    param.i_csp = csp;
+
+    if(*init.profile && x264_param_apply_profile(&param, init.profile))
+        log("Failed to set x264 profile: %s", init.profile);
+}
@@ -0,0 +1,187 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "../EncoderHost/FrameRing.h"
+
+
+//what OBS and X264Helper.exe say to each other.  OBS creates everything below with a unique
+//prefix, fills in the init request and starts "X264Helper.exe <prefix>".  the helper answers
+//in the control block and posts <prefix>ready, then encodes one frame slot at a time and
+//writes exactly one bitstream record per frame slot, in order.
+//
+//frame slots are an x264_host_frame followed by the NV12 picture (pitch = width), bitstream
+//records are an x264_host_bitstream followed by nal_count x264_host_nal entries and then the
+//nal payloads back to back, exactly as x264 returned them.
+
+#define X264_HOST_CONTROL           "control"
+#define X264_HOST_READY             "ready"
+#define X264_HOST_FRAMES            "frames"
+#define X264_HOST_BITSTREAM         "bitstream"
+
+#define X264_HOST_VERSION           2
+
+#define X264_HOST_FRAME_SLOTS       4
+#define X264_HOST_BITSTREAM_SLOTS   4
+
+#define X264_HOST_EXIT_BAD_ARGS         1
+#define X264_HOST_EXIT_NO_CONTROL       2
+#define X264_HOST_EXIT_BAD_VERSION      3
+#define X264_HOST_EXIT_INIT_FAILED      4
+#define X264_HOST_EXIT_PARENT_GONE      5
+
+#define X264_HOST_FRAME_KEYFRAME    0x1     //request an IDR (or a new intra refresh wave)
+#define X264_HOST_FRAME_FLUSH       0x2     //no picture, drain a delayed frame
+#define X264_HOST_FRAME_RECONFIG    0x4     //apply max_bitrate/buffer_size first
+#define X264_HOST_FRAME_STOP        0x8     //close the encoder and exit
+
+#define X264_HOST_STATUS_OK         0
+#define X264_HOST_STATUS_FAILED     -1      //x264_encoder_encode failed
+#define X264_HOST_STATUS_TRUNCATED  -2      //the frame didn't fit the slot and was dropped
+
+#pragma pack(push, 8)
+
+struct x264_host_nal
+{
+    int32_t type, ref_idc, size;
+};
+
+struct x264_host_init
+{
+    uint32_t version;
+    uint32_t obs_process_id;
+
+    int32_t fps, width, height;
+    int32_t quality, keyint;
+    int32_t max_bitrate, buffer_size;
+    uint8_t use_cbr, pad_cbr, use_cfr, intra_refresh;
+
+    int32_t full_range, primaries, transfer, matrix;
+
+    char preset[32], tune[32], profile[32];
+    char custom[2048];          //see x264_host_add_custom, preset/tune/profile already taken out
+    char log_path[1024];        //utf-8
+
+    uint32_t frame_slot_size, bitstream_slot_size;
+};
+
+struct x264_host_init_response
+{
+    int32_t status;
+
+    int32_t keyint_max, bitrate, vbv_max_bitrate, vbv_buffer_size, nal_hrd;
+    int32_t full_range, primaries, transfer, matrix;
+    float rf_constant;
+
+    uint32_t header_nal_count;
+    x264_host_nal header_nals[8];
+    uint8_t header_data[4096];
+};
+
+struct x264_host_control
+{
+    x264_host_init init;
+    x264_host_init_response response;
+};
+
+struct x264_host_frame
+{
+    int64_t pts;
+    int32_t max_bitrate, buffer_size;
+};
+
+struct x264_host_bitstream
+{
+    int64_t pts, dts;
+
+    //frame slot hand-off, for the latency stats on the OBS side
+    uint64_t frame_queued_ns, frame_dequeued_ns;
+
+    int32_t status;
+    int32_t reconfig_result;
+    int32_t delayed_frames;
+    uint32_t nal_count;
+    uint8_t keyframe;
+};
+
+#pragma pack(pop)
+
+//custom x264 settings are stored as a name string and a value string after another, each with
+//its own NUL, up to an empty name.  a value can hold spaces or anything else but a NUL that way
+
+//offset of the empty name that ends the list
+inline size_t x264_host_custom_length(const char *custom, size_t size)
+{
+    size_t offset = 0;
+    while(offset < size && custom[offset])
+    {
+        for(int i=0; i<2; i++)
+        {
+            const char *nul = (const char*)memchr(custom+offset, 0, size-offset);
+            if(!nul)
+                return size;
+            offset = size_t(nul-custom)+1;
+        }
+    }
+    return offset;
+}
+
+//false if the setting doesn't fit, the list is left as it was then
+inline bool x264_host_add_custom(char *custom, size_t size, const char *name, const char *value)
+{
+    size_t offset = x264_host_custom_length(custom, size);
+    size_t name_size = strlen(name)+1, value_size = strlen(value)+1;
+
+    if(name_size == 1 || offset+name_size+value_size+1 > size)
+        return false;
+
+    memcpy(custom+offset, name, name_size);
+    memcpy(custom+offset+name_size, value, value_size);
+    custom[offset+name_size+value_size] = 0;
+    return true;
+}
+
+//reads the setting at entry and returns where the next one starts, or null at the end of the
+//list.  never reads past end, so a list that lost its terminator just ends early
+inline const char *x264_host_next_custom(const char *entry, const char *end, const char *&name, const char *&value)
+{
+    if(entry >= end || !*entry)
+        return 0;
+
+    const char *name_end = (const char*)memchr(entry, 0, end-entry);
+    if(!name_end || name_end+1 >= end)
+        return 0;
+
+    const char *value_end = (const char*)memchr(name_end+1, 0, end-(name_end+1));
+    if(!value_end)
+        return 0;
+
+    name  = entry;
+    value = name_end+1;
+    return value_end+1;
+}
+
+inline size_t x264_host_frame_data_offset() { return encoder_host::ring_align_up(sizeof(x264_host_frame)); }
+inline uint32_t x264_host_frame_slot_size(int width, int height) { return uint32_t(x264_host_frame_data_offset() + size_t(width)*height*3/2); }
+
+//room for the worst frame x264 should ever produce: the raw picture plus some change
+inline uint32_t x264_host_bitstream_slot_size(int width, int height) { return uint32_t(size_t(width)*height*3/2 + 256*1024); }
@@ -135,6 +135,7 @@ static void HandleClientBW(RTMP *r, const RTMPPacket *packet);
 
 static int ReadN(RTMP *r, char *buffer, int n);
 static int WriteN(RTMP *r, const char *buffer, int n);
+static int WriteV(RTMP *r, RTMPIOVec *vec, int count);
 
 static void DecodeTEA(AVal *key, AVal *text);
 
@@ -1806,6 +1807,48 @@ WriteN(RTMP *r, const char *buffer, int n)
     return n == 0;
 }
 
+/* hands a whole packet to the custom vectored send function in one call.
+ * entries are consumed in place on a partial write. */
+static int
+WriteV(RTMP *r, RTMPIOVec *vec, int count)
+{
+    while (count > 0)
+    {
+        int nBytes = r->m_customSendVecFunc(&r->m_sb, vec, count, r->m_customSendParam);
+
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d (%d buffers)", __FUNCTION__,
+                     sockerr, count);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+            return FALSE;
+
+        while (count > 0 && nBytes >= vec->len)
+        {
+            nBytes -= vec->len;
+            vec++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            vec->base += nBytes;
+            vec->len -= nBytes;
+        }
+    }
+
+    return TRUE;
+}
+
 #define SAVC(x)	static const AVal av_##x = AVC(#x)
 
 SAVC(app);
@@ -4234,6 +4277,10 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     char *buffer, *tbuf = NULL, *toff = NULL;
     int nChunkSize;
     int tlen;
+    int bVectored;
+    RTMPIOVec vbuf[RTMP_IOVEC_PREALLOC], *vec = NULL;
+    int vcount = 0;
+    char chdr[3];
 
     if (packet->m_nChannel >= r->m_channelsAllocatedOut)
     {
@@ -4278,7 +4325,17 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     cSize = 0;
     t = packet->m_nTimeStamp - last;
 
-    if (packet->m_body)
+    /* with a vectored send function the headers are gathered alongside the
+     * body slices instead of being written into the body, so the payload
+     * is never modified and can be shared with other outputs */
+    bVectored = r->m_bCustomSend && r->m_customSendVecFunc &&
+                !(r->Link.protocol & RTMP_FEATURE_HTTP);
+#ifdef CRYPTO
+    if (r->Link.rc4keyOut)
+        bVectored = FALSE;
+#endif
+
+    if (packet->m_body && !bVectored)
     {
         header = packet->m_body - nSize;
         hend = packet->m_body;
@@ -4363,6 +4420,26 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
             toff = tbuf;
         }
     }
+    else if (bVectored)
+    {
+        int chunks = nSize ? (nSize+nChunkSize-1) / nChunkSize : 1;
+        vec = vbuf;
+        if (chunks*2 > RTMP_IOVEC_PREALLOC)
+        {
+            vec = malloc(sizeof(RTMPIOVec) * chunks * 2);
+            if (!vec)
+                return FALSE;
+        }
+
+        chdr[0] = (0xc0 | c);
+        if (cSize)
+        {
+            int tmp = packet->m_nChannel - 64;
+            chdr[1] = tmp & 0xff;
+            if (cSize == 2)
+                chdr[2] = tmp >> 8;
+        }
+    }
     while (nSize + hSize)
     {
         int wrote;
@@ -4377,6 +4454,16 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
             memcpy(toff, header, nChunkSize + hSize);
             toff += nChunkSize + hSize;
         }
+        else if (vec)
+        {
+            vec[vcount].base = header;
+            vec[vcount++].len = hSize;
+            if (nChunkSize)
+            {
+                vec[vcount].base = buffer;
+                vec[vcount++].len = nChunkSize;
+            }
+        }
         else
         {
             wrote = WriteN(r, header, nChunkSize + hSize);
@@ -4387,7 +4474,12 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         buffer += nChunkSize;
         hSize = 0;
 
-        if (nSize > 0)
+        if (nSize > 0 && vec)
+        {
+            header = chdr;
+            hSize = 1 + cSize;
+        }
+        else if (nSize > 0)
         {
             header = buffer - 1;
             hSize = 1;
@@ -4414,6 +4506,15 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         if (!wrote)
             return FALSE;
     }
+    if (vec)
+    {
+        int wrote = WriteV(r, vec, vcount);
+        if (vec != vbuf)
+            free(vec);
+        vec = NULL;
+        if (!wrote)
+            return FALSE;
+    }
 
     /* we invoked a remote method */
     if (packet->m_packetType == RTMP_PACKET_TYPE_INVOKE)
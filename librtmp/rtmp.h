@@ -249,6 +249,18 @@ extern "C"
 
     typedef int (*CUSTOMSEND)(RTMPSockBuf*, const char *, int, void*);
 
+    /* one slice of an outgoing packet; RTMP_SendPacket passes the headers
+     * and body chunks of a whole packet to CUSTOMSENDVEC in a single call */
+    typedef struct RTMPIOVec
+    {
+        const char *base;
+        int len;
+    } RTMPIOVec;
+
+#define RTMP_IOVEC_PREALLOC 64
+
+    typedef int (*CUSTOMSENDVEC)(RTMPSockBuf*, RTMPIOVec *, int, void*);
+
     typedef struct RTMP
     {
         int m_inChunkSize;
@@ -273,6 +285,7 @@ extern "C"
         uint8_t m_bCustomSend;
         void*   m_customSendParam;
         CUSTOMSEND m_customSendFunc;
+        CUSTOMSENDVEC m_customSendVecFunc;
 
         RTMP_BINDINFO m_bindIP;
 
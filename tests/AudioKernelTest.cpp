@@ -0,0 +1,480 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+//audio kernels: the SSE2/AVX/AVX2 variants have to match the scalar code bit for bit, at sizes
+//that leave samples over for the scalar tail.  the one exception is the RMS sum, which adds in
+//a different order and only has to be close.  the downmixers have no scalar variant of their
+//own, so they're checked against themselves one frame at a time, which only runs their scalar
+//tail.  "bench" times every variant on 10ms segments.
+//
+//built for AVX2 as a whole like ColorConvertTest, so this needs an AVX2 cpu to run
+
+#include "OBSApi.h"
+#include "TestUtil.h"
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include "AudioProcessing.cpp"
+#pragma GCC pop_options
+
+#include <vector>
+
+static const UINT testSizes[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 882, 960, 1029};
+static const UINT numTestSizes = sizeof(testSizes)/sizeof(testSizes[0]);
+
+//mostly in range, with some past full scale so the mixer's clamping is hit
+static void FillSamples(std::vector<float> &buffer, UINT size, UINT seed)
+{
+    TestRandom random(seed);
+    buffer.resize(size+1);
+    for(UINT i=0; i<size; i++)
+        buffer[i] = random.NextFloat()*((i%7 == 0) ? 1.5f : 0.9f);
+
+    //past the end, has to stay untouched
+    buffer[size] = 12345.0f;
+}
+
+static bool SameBits(const float *a, const float *b, UINT size)
+{
+    return size == 0 || memcmp(a, b, size*sizeof(float)) == 0;
+}
+
+//-------------------------------------------
+
+typedef void (*SUMSQUARESPROC)(const float *buffer, UINT totalFloats, float mulVal, float &sum, float &peak);
+
+struct MixVariant       {const char *name; MIXAUDIOPROC proc;};
+struct MultiplyVariant  {const char *name; MULTIPLYAUDIOPROC proc;};
+struct SumVariant       {const char *name; SUMSQUARESPROC proc;};
+struct ConvertVariant   {const char *name; CONVERTAUDIOPROC proc;};
+struct ResampleVariant  {const char *name; RESAMPLEFRAMEPROC proc;};
+
+static const MixVariant mixVariants[] =
+    {{"scalar", MixAudio_Scalar}, {"SSE2", MixAudio_SSE2}, {"AVX", MixAudio_AVX}};
+static const MultiplyVariant multiplyVariants[] =
+    {{"scalar", MultiplyAudioBuffer_Scalar}, {"SSE2", MultiplyAudioBuffer_SSE2}, {"AVX", MultiplyAudioBuffer_AVX}};
+static const SumVariant sumVariants[] =
+    {{"scalar", SumSquares_Scalar}, {"SSE2", SumSquares_SSE2}, {"AVX", SumSquares_AVX}};
+static const ConvertVariant convertVariants[] =
+    {{"scalar", ConvertAudioToFloat_Scalar}, {"SSE2", ConvertAudioToFloat_SSE2}, {"AVX2", ConvertAudioToFloat_AVX2}};
+static const ResampleVariant resampleVariants[] =
+    {{"SSE2", ResampleFrame_SSE2}, {"AVX", ResampleFrame_AVX}};
+
+#define NUM_VARIANTS(list) (sizeof(list)/sizeof(list[0]))
+
+//-------------------------------------------
+
+static bool TestMix()
+{
+    bool bSuccess = true;
+
+    for(UINT v=1; v<NUM_VARIANTS(mixVariants); v++)
+    {
+        for(int bMono=0; bMono<2; bMono++)
+        {
+            UINT numWrong = 0;
+
+            for(UINT i=0; i<numTestSizes; i++)
+            {
+                //mono needs whole frames
+                UINT size = bMono ? testSizes[i] & ~1 : testSizes[i];
+
+                std::vector<float> refDest, refSrc, dest, src;
+                FillSamples(refDest, size, 1);
+                FillSamples(refSrc,  size, 2);
+                dest = refDest;
+                src = refSrc;
+
+                MixAudio_Scalar(&refDest[0], &refSrc[0], size, bMono != 0);
+                mixVariants[v].proc(&dest[0], &src[0], size, bMono != 0);
+
+                //mono mixes the source down in place, that has to match too
+                if(!SameBits(&refDest[0], &dest[0], size+1) || !SameBits(&refSrc[0], &src[0], size+1))
+                {
+                    TestFail("%s differs at %u floats", mixVariants[v].name, size);
+                    numWrong++;
+                }
+            }
+
+            bSuccess &= TestResult(numWrong == 0, "MixAudio %-6s %s", mixVariants[v].name, bMono ? "forced mono" : "stereo");
+        }
+    }
+
+    return bSuccess;
+}
+
+static bool TestMultiply()
+{
+    bool bSuccess = true;
+    static const float gains[] = {0.0f, 0.25f, 0.7071068f, 1.0f, 3.9f};
+
+    for(UINT v=1; v<NUM_VARIANTS(multiplyVariants); v++)
+    {
+        UINT numWrong = 0;
+
+        for(UINT i=0; i<numTestSizes; i++)
+        {
+            for(UINT g=0; g<sizeof(gains)/sizeof(gains[0]); g++)
+            {
+                std::vector<float> ref, test;
+                FillSamples(ref, testSizes[i], 3);
+                test = ref;
+
+                MultiplyAudioBuffer_Scalar(&ref[0], testSizes[i], gains[g]);
+                multiplyVariants[v].proc(&test[0], testSizes[i], gains[g]);
+
+                if(!SameBits(&ref[0], &test[0], testSizes[i]+1))
+                {
+                    TestFail("%s differs at %u floats, gain %g", multiplyVariants[v].name, testSizes[i], gains[g]);
+                    numWrong++;
+                }
+            }
+        }
+
+        bSuccess &= TestResult(numWrong == 0, "MultiplyAudioBuffer %s", multiplyVariants[v].name);
+    }
+
+    return bSuccess;
+}
+
+static bool TestSumSquares()
+{
+    bool bSuccess = true;
+
+    for(UINT v=1; v<NUM_VARIANTS(sumVariants); v++)
+    {
+        UINT numWrong = 0;
+        double worstError = 0.0;
+
+        for(UINT i=0; i<numTestSizes; i++)
+        {
+            std::vector<float> buffer;
+            FillSamples(buffer, testSizes[i], 4);
+
+            float refSum = 0.0f, refPeak = 0.0f, sum = 0.0f, peak = 0.0f;
+            SumSquares_Scalar(&buffer[0], testSizes[i], 0.8f, refSum, refPeak);
+            sumVariants[v].proc(&buffer[0], testSizes[i], 0.8f, sum, peak);
+
+            //the peak is a max so it's exact, the sum only differs by rounding
+            double error = refSum ? fabs(double(sum)-double(refSum))/double(refSum) : fabs(double(sum));
+            worstError = MAX(worstError, error);
+
+            if(peak != refPeak || error > 1e-5)
+            {
+                TestFail("%s differs at %u floats: sum %.9g vs %.9g, peak %.9g vs %.9g", sumVariants[v].name, testSizes[i], sum, refSum, peak, refPeak);
+                numWrong++;
+            }
+        }
+
+        bSuccess &= TestResult(numWrong == 0, "SumSquares %-4s peak exact, sum within %.1e", sumVariants[v].name, worstError);
+    }
+
+    return bSuccess;
+}
+
+static bool TestConvert()
+{
+    bool bSuccess = true;
+    static const UINT bitDepths[] = {8, 16, 24, 32};
+
+    for(UINT v=1; v<NUM_VARIANTS(convertVariants); v++)
+    {
+        for(UINT b=0; b<sizeof(bitDepths)/sizeof(bitDepths[0]); b++)
+        {
+            UINT bits = bitDepths[b];
+            UINT numWrong = 0;
+
+            for(UINT i=0; i<numTestSizes; i++)
+            {
+                UINT size = testSizes[i];
+
+                //exactly the size of the samples so reading past the end would be caught by asan
+                TestRandom random(size*bits);
+                std::vector<BYTE> input(size*bits/8);
+                for(UINT j=0; j<input.size(); j++)
+                    input[j] = BYTE(random.Next());
+
+                //full scale both ways
+                if(input.size() >= bits/4)
+                {
+                    memset(&input[0], 0x7F, bits/8);
+                    memset(&input[bits/8], 0x80, bits/8);
+                    if(bits > 8)
+                    {
+                        input[bits/8-1] = 0x7F;
+                        memset(&input[0], 0xFF, bits/8-1);
+                        memset(&input[bits/8], 0x00, bits/8-1);
+                    }
+                }
+
+                std::vector<float> ref(size+1, 12345.0f), test(size+1, 12345.0f);
+                const void *data = input.empty() ? NULL : &input[0];
+
+                ConvertAudioToFloat_Scalar(&ref[0], data, size, bits);
+                convertVariants[v].proc(&test[0], data, size, bits);
+
+                if(!SameBits(&ref[0], &test[0], size+1))
+                {
+                    TestFail("%s differs at %u %ubit samples", convertVariants[v].name, size, bits);
+                    numWrong++;
+                }
+            }
+
+            bSuccess &= TestResult(numWrong == 0, "ConvertAudioToFloat %-4s %2ubit", convertVariants[v].name, bits);
+        }
+    }
+
+    return bSuccess;
+}
+
+static bool TestDownmix()
+{
+    struct Layout {const char *name; UINT channels; DWORD mask;};
+    static const Layout layouts[] =
+    {
+        {"mono",        1, KSAUDIO_SPEAKER_MONO},
+        {"stereo",      2, KSAUDIO_SPEAKER_STEREO},
+        {"2.1",         3, KSAUDIO_SPEAKER_2POINT1},
+        {"quad",        4, KSAUDIO_SPEAKER_QUAD},
+        {"3.1",         4, KSAUDIO_SPEAKER_3POINT1},
+        {"surround",    4, KSAUDIO_SPEAKER_SURROUND},
+        {"4.1",         5, KSAUDIO_SPEAKER_4POINT1},
+        {"5.1",         6, KSAUDIO_SPEAKER_5POINT1},
+        {"5.1 surround",6, KSAUDIO_SPEAKER_5POINT1_SURROUND},
+        {"7.1",         8, KSAUDIO_SPEAKER_7POINT1},
+        {"7.1 surround",8, KSAUDIO_SPEAKER_7POINT1_SURROUND},
+    };
+
+    bool bSuccess = true;
+
+    for(UINT l=0; l<sizeof(layouts)/sizeof(layouts[0]); l++)
+    {
+        const Layout &layout = layouts[l];
+        UINT numWrong = 0;
+
+        for(UINT i=0; i<numTestSizes; i++)
+        {
+            UINT numFrames = testSizes[i];
+
+            std::vector<float> input;
+            FillSamples(input, numFrames*layout.channels, 5);
+
+            std::vector<float> ref(numFrames*2+1, 12345.0f), test(numFrames*2+1, 12345.0f);
+
+            for(UINT j=0; j<numFrames; j++)
+                DownmixAudioToStereo(&ref[j*2], &input[j*layout.channels], 1, layout.channels, layout.mask);
+            DownmixAudioToStereo(&test[0], &input[0], numFrames, layout.channels, layout.mask);
+
+            if(!SameBits(&ref[0], &test[0], numFrames*2+1))
+            {
+                TestFail("%s differs at %u frames", layout.name, numFrames);
+                numWrong++;
+            }
+        }
+
+        bSuccess &= TestResult(numWrong == 0, "DownmixAudioToStereo %s", layout.name);
+    }
+
+    return bSuccess;
+}
+
+static bool TestResampleFrame()
+{
+    bool bSuccess = true;
+
+    //a 44.1k->48k filter, against a double precision dot product
+    PolyphaseResampler *resampler = CreatePolyphaseResampler(44100, 48000);
+    UINT numTaps = resampler->numTaps;
+
+    for(UINT v=0; v<NUM_VARIANTS(resampleVariants); v++)
+    {
+        double worstError = 0.0;
+
+        for(UINT phase=0; phase<resampler->upFactor; phase += 7)
+        {
+            std::vector<float> input;
+            FillSamples(input, numTaps*2, phase+6);
+
+            const float *coefs = resampler->coefs+(phase*numTaps*2);
+            double ref[2] = {0.0, 0.0}, scale = 0.0;
+            for(UINT j=0; j<numTaps*2; j++)
+            {
+                ref[j&1] += double(input[j])*double(coefs[j]);
+                scale += fabs(double(input[j])*double(coefs[j]));
+            }
+
+            float output[2];
+            resampleVariants[v].proc(&input[0], coefs, numTaps, output);
+
+            for(UINT j=0; j<2; j++)
+                worstError = MAX(worstError, fabs(double(output[j])-ref[j])/scale);
+        }
+
+        //float accumulation over a few dozen taps, relative to the size of the terms
+        bSuccess &= TestResult(worstError < 1e-6, "ResampleFrame %-4s within %.1e of double precision", resampleVariants[v].name, worstError);
+    }
+
+    DestroyPolyphaseResampler(resampler);
+
+    return bSuccess;
+}
+
+static bool TestDispatch()
+{
+    int cpuInfo[4];
+    __cpuid(cpuInfo, 1);
+
+    InitAudioKernels(cpuInfo, TEXT("SSE2"));
+    bool bSuccess = (mixAudio == MixAudio_SSE2 && convertAudioToFloat == ConvertAudioToFloat_SSE2 && resampleFrame == ResampleFrame_SSE2);
+
+    InitAudioKernels(cpuInfo, TEXT("AVX"));
+    bSuccess &= (mixAudio == MixAudio_AVX && convertAudioToFloat == ConvertAudioToFloat_SSE2 && resampleFrame == ResampleFrame_AVX);
+
+    InitAudioKernels(cpuInfo);
+    bSuccess &= (mixAudio == MixAudio_AVX && sumSquares == SumSquares_AVX && convertAudioToFloat == ConvertAudioToFloat_AVX2);
+
+    return TestResult(bSuccess, "InitAudioKernels picks and forces the variants");
+}
+
+//-------------------------------------------
+
+//best of several runs of a 10ms stereo segment at 48khz
+template<typename T> static double TimeSegment(T run)
+{
+    run();
+
+    double best = 1e30;
+    for(int i=0; i<7; i++)
+    {
+        const int numRuns = 2000;
+        QWORD startTime = TestTimeNS();
+        for(int j=0; j<numRuns; j++)
+            run();
+        best = MIN(best, double(TestTimeNS()-startTime)/numRuns);
+    }
+
+    return best;
+}
+
+static void PrintTime(const char *kernel, const char *variant, double ns, double firstNS)
+{
+    const double segmentFloats = 960.0;
+    printf("%-24s %-7s %9.1f %10.0f %8.2fx\n", kernel, variant, ns, segmentFloats/(ns/1e9)/1e6, firstNS/ns);
+}
+
+static void RunBenchmark()
+{
+    const UINT size = 960;
+    std::vector<float> dest, src, buffer;
+    FillSamples(dest, size, 1);
+    FillSamples(src, size, 2);
+    FillSamples(buffer, size, 3);
+
+    //speedup is against the first variant, scalar except for the resampler
+    printf("%-24s %-7s %9s %10s %9s\n", "kernel, 960 floats", "variant", "ns", "Mfloats/s", "speedup");
+
+    double scalarNS = 0.0;
+    for(UINT v=0; v<NUM_VARIANTS(mixVariants); v++)
+    {
+        MIXAUDIOPROC proc = mixVariants[v].proc;
+        double ns = TimeSegment([&]() {proc(&dest[0], &src[0], size, false);});
+        if(!v) scalarNS = ns;
+        PrintTime("MixAudio", mixVariants[v].name, ns, scalarNS);
+    }
+
+    for(UINT v=0; v<NUM_VARIANTS(multiplyVariants); v++)
+    {
+        MULTIPLYAUDIOPROC proc = multiplyVariants[v].proc;
+        double ns = TimeSegment([&]() {proc(&buffer[0], size, 1.0f);});
+        if(!v) scalarNS = ns;
+        PrintTime("MultiplyAudioBuffer", multiplyVariants[v].name, ns, scalarNS);
+    }
+
+    for(UINT v=0; v<NUM_VARIANTS(sumVariants); v++)
+    {
+        SUMSQUARESPROC proc = sumVariants[v].proc;
+        float sum, peak;
+        double ns = TimeSegment([&]() {sum = peak = 0.0f; proc(&buffer[0], size, 1.0f, sum, peak);});
+        if(!v) scalarNS = ns;
+        PrintTime("SumSquares", sumVariants[v].name, ns, scalarNS);
+    }
+
+    static const UINT bitDepths[] = {16, 24, 32};
+    for(UINT b=0; b<sizeof(bitDepths)/sizeof(bitDepths[0]); b++)
+    {
+        std::vector<BYTE> input(size*bitDepths[b]/8);
+        TestRandom random(b);
+        for(UINT j=0; j<input.size(); j++)
+            input[j] = BYTE(random.Next());
+
+        char name[64];
+        snprintf(name, sizeof(name), "ConvertAudioToFloat %u", bitDepths[b]);
+
+        for(UINT v=0; v<NUM_VARIANTS(convertVariants); v++)
+        {
+            CONVERTAUDIOPROC proc = convertVariants[v].proc;
+            UINT bits = bitDepths[b];
+            double ns = TimeSegment([&]() {proc(&dest[0], &input[0], size, bits);});
+            if(!v) scalarNS = ns;
+            PrintTime(name, convertVariants[v].name, ns, scalarNS);
+        }
+    }
+
+    //a 10ms segment of 44.1k going to 48k, the output is the 960 floats
+    std::vector<float> resampleIn, resampleOut(size+4);
+    FillSamples(resampleIn, 441*2, 7);
+    PolyphaseResampler *resampler = CreatePolyphaseResampler(44100, 48000);
+
+    for(UINT v=0; v<NUM_VARIANTS(resampleVariants); v++)
+    {
+        resampleFrame = resampleVariants[v].proc;
+        double ns = TimeSegment([&]() {PolyphaseResample(resampler, &resampleIn[0], 441, &resampleOut[0], size/2+2);});
+        if(!v) scalarNS = ns;
+        PrintTime("PolyphaseResample", resampleVariants[v].name, ns, scalarNS);
+    }
+
+    DestroyPolyphaseResampler(resampler);
+}
+
+int main(int argc, char **argv)
+{
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("avx2"))
+    {
+        printf("skipped, this cpu doesn't have AVX2\n");
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        RunBenchmark();
+        return 0;
+    }
+
+    bool bSuccess = true;
+    bSuccess &= TestMix();
+    bSuccess &= TestMultiply();
+    bSuccess &= TestSumSquares();
+    bSuccess &= TestConvert();
+    bSuccess &= TestDownmix();
+    bSuccess &= TestResampleFrame();
+    bSuccess &= TestDispatch();
+
+    return TestSummary(bSuccess);
+}
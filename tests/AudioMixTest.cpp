@@ -0,0 +1,443 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+//audio mix timing: synthetic desktop and mic sources with jittery delivery and timestamps go
+//through the real AudioSource queueing, and the audio thread's wake-ups and query/mix steps
+//(OBS::MainAudioLoop, QueryNewAudio and QueryAudioBuffers) are replayed on a simulated clock.
+//every segment carries its sequence number as its samples, so each mix shows exactly which
+//capture it came from.  measured per run:
+//
+//  pickup   time from a segment being available to the audio thread reading it
+//  latency  time from capture to the segment being mixed, buffering time included
+//  drift    how far the mix falls behind capture over the run, and how far mic and desktop
+//           move apart
+//
+//  AudioMixTest            runs the traces and checks both ticks the audio thread uses
+//  AudioMixTest bench      prints the numbers for every tick and source mode
+
+#include "OBSApi.h"
+#include "TestUtil.h"
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include "AudioProcessing.cpp"
+#pragma GCC pop_options
+
+#include "AudioSource.cpp"
+
+#include <deque>
+#include <vector>
+
+//must match MainAudioLoop: the tick while a WASAPI source is polled, and while every source
+//signals the audio thread itself
+#define AUDIO_POLL_TICK_MS   5
+#define AUDIO_SIGNAL_TICK_MS 10
+
+//polled sources were read at least this often when the audio thread used OSSleep(5)
+#define MAX_PICKUP_MS 5
+
+static QWORD simTimeUS = 0;
+
+//-------------------------------------------
+
+struct Stats
+{
+    double sum, maxVal;
+    UINT num;
+
+    Stats() : sum(0.0), maxVal(0.0), num(0) {}
+
+    inline void Add(double val) {sum += val; maxVal = MAX(maxVal, val); num++;}
+    inline double Avg() const {return num ? sum/num : 0.0;}
+};
+
+struct SourceTrace
+{
+    double clockSkew;       //device clock vs. the system clock, 1.0002 is 200ppm fast
+    UINT deliveryJitterMS;  //packets show up 0..this late on top of the 10ms they take to fill
+    UINT stampJitterMS;     //reported timestamps are off by up to this either way
+    UINT stallEveryMS;      //every so often the device holds packets back and bursts them out
+    UINT stallMS;
+};
+
+struct SyntheticPacket
+{
+    QWORD arrivalUS;
+    QWORD timestamp;
+    UINT seq;
+};
+
+//a 10ms-segment device like the WASAPI sources after they've split up their packets
+class SyntheticAudioSource : public AudioSource
+{
+    std::deque<SyntheticPacket> packets;
+    List<float> buffer;
+    TestRandom random;
+
+    SourceTrace trace;
+    UINT nextSeq;
+    QWORD nextCaptureUS;
+
+public:
+    Stats pickup;
+
+    SyntheticAudioSource(const SourceTrace &trace, UINT seed) : random(seed), trace(trace), nextSeq(0), nextCaptureUS(1000000)
+    {
+        InitAudioData(true, 2, 44100, 32, 8, KSAUDIO_SPEAKER_STEREO);
+        buffer.SetSize(441*2);
+    }
+
+    //queue up everything captured before the given time
+    void Generate(QWORD untilUS)
+    {
+        while(nextCaptureUS <= untilUS)
+        {
+            SyntheticPacket packet;
+            packet.seq = nextSeq++;
+
+            QWORD captureMS = nextCaptureUS/1000;
+            int stampJitter = trace.stampJitterMS ? int(random.Next()%(trace.stampJitterMS*2+1))-int(trace.stampJitterMS) : 0;
+            packet.timestamp = QWORD(INT64(captureMS)+stampJitter);
+
+            //a segment is complete 10ms after capture starts
+            packet.arrivalUS = nextCaptureUS+10000;
+            if(trace.deliveryJitterMS)
+                packet.arrivalUS += random.Next()%(trace.deliveryJitterMS*1000+1);
+
+            if(trace.stallEveryMS)
+            {
+                QWORD stallPos = (packet.arrivalUS/1000) % trace.stallEveryMS;
+                if(stallPos < trace.stallMS)
+                    packet.arrivalUS += (trace.stallMS-stallPos)*1000;
+            }
+
+            //devices deliver in order
+            if(!packets.empty() && packet.arrivalUS < packets.back().arrivalUS)
+                packet.arrivalUS = packets.back().arrivalUS;
+
+            packets.push_back(packet);
+            nextCaptureUS += QWORD(10000.0/trace.clockSkew);
+        }
+    }
+
+    inline QWORD NextArrivalUS() const {return packets.empty() ? QWORD(-1) : packets.front().arrivalUS;}
+
+    static inline QWORD CaptureMS(UINT seq) {return 1000+QWORD(seq)*10;}
+
+protected:
+    virtual CTSTR GetDeviceName() const {return TEXT("synthetic");}
+
+    virtual bool GetNextBuffer(void **outBuffer, UINT *numFrames, QWORD *timestamp)
+    {
+        if(packets.empty() || packets.front().arrivalUS > simTimeUS)
+            return false;
+
+        SyntheticPacket &packet = packets.front();
+        pickup.Add(double(simTimeUS-packet.arrivalUS)/1000.0);
+
+        //the sequence number is the sample value, offset so silence can't be mistaken for it
+        float val = float(packet.seq+1);
+        for(UINT i=0; i<buffer.Num(); i++)
+            buffer[i] = val;
+
+        *outBuffer = buffer.Array();
+        *numFrames = 441;
+        *timestamp = packet.timestamp;
+
+        packets.pop_front();
+        return true;
+    }
+
+    virtual void ReleaseBuffer() {}
+};
+
+//-------------------------------------------
+// the audio thread, same steps as OBS::QueryNewAudio/QueryAudioBuffers and the mix
+
+struct MixResult
+{
+    Stats pickup, latency;
+    double driftMS;         //change in how far behind capture the mix is, first vs. last seconds
+    int minOffset, maxOffset;
+    UINT numMixed, numMicMissed, numDesktopSkipped;
+};
+
+class SimulatedMixer
+{
+    SyntheticAudioSource &desktop, &mic;
+    List<QWORD> bufferedAudioTimes;
+    QWORD latestAudioTime;
+    QWORD bufferingTime;
+
+    void QueryAudioBuffers()
+    {
+        if(!latestAudioTime)
+            desktop.GetEarliestTimestamp(latestAudioTime);
+        else
+        {
+            QWORD latestDesktopTimestamp;
+            if(desktop.GetLatestTimestamp(latestDesktopTimestamp))
+            {
+                if((latestAudioTime+10) > latestDesktopTimestamp)
+                    return;
+            }
+            latestAudioTime += 10;
+        }
+
+        bufferedAudioTimes << latestAudioTime;
+        mic.QueryAudio2(1.0f, true);
+    }
+
+    void DrainMic()
+    {
+        while(mic.QueryAudio2(1.0f, true) != NoAudioAvailable);
+
+        QWORD timestamp;
+        if(mic.GetLatestTimestamp(timestamp))
+            mic.SortAudio(timestamp);
+    }
+
+    bool QueryNewAudio()
+    {
+        bool bAudioBufferFilled = false;
+
+        while(!bAudioBufferFilled)
+        {
+            bool bGotAudio = false;
+
+            if(desktop.QueryAudio2(1.0f) != NoAudioAvailable)
+            {
+                QueryAudioBuffers();
+                bGotAudio = true;
+            }
+
+            bAudioBufferFilled = desktop.GetBufferedTime() >= bufferingTime;
+
+            if(!bGotAudio && bAudioBufferFilled)
+                QueryAudioBuffers();
+
+            if(bAudioBufferFilled || !bGotAudio)
+                break;
+        }
+
+        if(!bAudioBufferFilled)
+            DrainMic();
+
+        return bAudioBufferFilled;
+    }
+
+public:
+    SimulatedMixer(SyntheticAudioSource &desktop, SyntheticAudioSource &mic, QWORD bufferingTime)
+        : desktop(desktop), mic(mic), latestAudioTime(0), bufferingTime(bufferingTime) {}
+
+    //one wake-up of the audio thread
+    void Run(MixResult &result, std::vector<double> &behind, UINT &lastDesktopSeq, QWORD warmupUS)
+    {
+        while(QueryNewAudio())
+        {
+            QWORD timestamp = bufferedAudioTimes[0];
+            bufferedAudioTimes.Remove(0);
+
+            float *desktopBuffer, *micBuffer;
+            desktop.GetBuffer(&desktopBuffer, timestamp);
+            bool bGotMic = mic.GetBuffer(&micBuffer, timestamp);
+
+            if(desktopBuffer[0] == 0.0f)
+                continue;
+
+            UINT desktopSeq = UINT(desktopBuffer[0])-1;
+            if(lastDesktopSeq != INVALID && desktopSeq != lastDesktopSeq+1)
+                result.numDesktopSkipped += desktopSeq-lastDesktopSeq-1;
+            lastDesktopSeq = desktopSeq;
+
+            if(simTimeUS < warmupUS)
+                continue;
+
+            double behindMS = double(simTimeUS)/1000.0 - double(SyntheticAudioSource::CaptureMS(desktopSeq));
+            result.latency.Add(behindMS);
+            behind.push_back(behindMS);
+
+            if(bGotMic && micBuffer[0] != 0.0f)
+            {
+                int offset = int(UINT(micBuffer[0])-1) - int(desktopSeq);
+                result.minOffset = MIN(result.minOffset, offset);
+                result.maxOffset = MAX(result.maxOffset, offset);
+            }
+            else
+                result.numMicMissed++;
+
+            result.numMixed++;
+        }
+    }
+};
+
+//tickMS is the audio thread's tick, bPush has both sources signal the thread when a segment is
+//ready, like event driven WASAPI capture and OBSNotifyAudioReady do
+static MixResult RunTrace(const SourceTrace &desktopTrace, const SourceTrace &micTrace, UINT tickMS, bool bPush, UINT seconds)
+{
+    const QWORD bufferingTime = 700;
+
+    //sources are always heap allocated, AudioSource relies on new zeroing it
+    SyntheticAudioSource &desktop = *new SyntheticAudioSource(desktopTrace, 1);
+    SyntheticAudioSource &mic = *new SyntheticAudioSource(micTrace, 2);
+    SimulatedMixer mixer(desktop, mic, bufferingTime);
+
+    MixResult result;
+    zero(&result, sizeof(result));
+    result.minOffset = 0x7FFFFFFF;
+    result.maxOffset = -0x7FFFFFFF;
+
+    std::vector<double> behind;
+    UINT lastDesktopSeq = INVALID;
+    QWORD endUS = QWORD(seconds)*1000000;
+    QWORD warmupUS = 1000000+bufferingTime*2000;
+    QWORD nextTickUS = 0;
+
+    simTimeUS = 0;
+    while(simTimeUS < endUS)
+    {
+        //every capture up to a second out, so the next arrival is known
+        desktop.Generate(simTimeUS+1000000);
+        mic.Generate(simTimeUS+1000000);
+
+        QWORD wakeUS = nextTickUS;
+        if(bPush)
+            wakeUS = MIN(wakeUS, MAX(MIN(desktop.NextArrivalUS(), mic.NextArrivalUS()), simTimeUS));
+
+        simTimeUS = wakeUS;
+        if(simTimeUS >= nextTickUS)
+            nextTickUS += tickMS*1000;
+
+        mixer.Run(result, behind, lastDesktopSeq, warmupUS);
+    }
+
+    //averaged over 5 seconds at either end so single jittery segments don't count
+    const size_t window = 500;
+    if(behind.size() >= window*2)
+    {
+        double first = 0.0, last = 0.0;
+        for(size_t i=0; i<window; i++)
+        {
+            first += behind[i];
+            last  += behind[behind.size()-window+i];
+        }
+        result.driftMS = (last-first)/window;
+    }
+
+    result.pickup.sum    = desktop.pickup.sum    + mic.pickup.sum;
+    result.pickup.num    = desktop.pickup.num    + mic.pickup.num;
+    result.pickup.maxVal = MAX(desktop.pickup.maxVal, mic.pickup.maxVal);
+
+    delete &desktop;
+    delete &mic;
+
+    return result;
+}
+
+//-------------------------------------------
+
+struct Scenario
+{
+    const char *name;
+    SourceTrace desktop, mic;
+};
+
+static const Scenario scenarios[] =
+{
+    //                                    skew    jitter stamp  stalls
+    {"steady",                          {1.0,    0, 0, 0, 0},      {1.0,    0, 0, 0, 0}},
+    {"jittery delivery and stamps",     {1.0,    4, 3, 0, 0},      {1.0,    6, 5, 0, 0}},
+    {"bursty mic",                      {1.0,    2, 1, 0, 0},      {1.0,    3, 2, 1700, 40}},
+    {"mic clock 300ppm fast",           {1.0,    2, 1, 0, 0},      {1.0003, 3, 2, 0, 0}},
+};
+
+static const UINT numScenarios = sizeof(scenarios)/sizeof(scenarios[0]);
+
+static void PrintResult(const char *name, UINT tickMS, bool bPush, const MixResult &result)
+{
+    printf("%-30s %2ums %-5s  pickup %5.2f/%5.2fms  latency %6.1f/%6.1fms  drift %+5.2fms  mic offset %d..%d  missed %u  skipped %u\n",
+        name, tickMS, bPush ? "push" : "poll",
+        result.pickup.Avg(), result.pickup.maxVal, result.latency.Avg(), result.latency.maxVal,
+        result.driftMS, result.minOffset, result.maxOffset, result.numMicMissed, result.numDesktopSkipped);
+}
+
+static bool RunTests()
+{
+    bool bSuccess = true;
+
+    for(UINT i=0; i<numScenarios; i++)
+    {
+        const Scenario &scenario = scenarios[i];
+
+        for(int bPush=0; bPush<2; bPush++)
+        {
+            UINT tickMS = bPush ? AUDIO_SIGNAL_TICK_MS : AUDIO_POLL_TICK_MS;
+            MixResult result = RunTrace(scenario.desktop, scenario.mic, tickMS, bPush != 0, 60);
+
+            //devices have to be read at least as soon as they were with the old 5ms sleep, even
+            //on the longer tick, nothing may go missing once the buffer is full, the mix can't
+            //fall behind the capture over time, and mic and desktop stay within a segment of
+            //each other
+            bool bPickup  = result.pickup.maxVal <= MAX_PICKUP_MS;
+            bool bDrift   = fabs(result.driftMS) <= 1.0;
+            bool bInSync  = result.maxOffset-result.minOffset <= 1;
+            bool bNoGaps  = result.numDesktopSkipped == 0 && result.numMicMissed == 0;
+
+            bSuccess &= TestResult(bPickup && bDrift && bInSync && bNoGaps && result.numMixed > 5000,
+                "%-30s %2ums %s  pickup max %.2fms, drift %+.2fms, mic offset %d..%d, %u missed, %u skipped",
+                scenario.name, tickMS, bPush ? "push" : "poll", result.pickup.maxVal, result.driftMS,
+                result.minOffset, result.maxOffset, result.numMicMissed, result.numDesktopSkipped);
+        }
+    }
+
+    return bSuccess;
+}
+
+static void RunBenchmark()
+{
+    static const UINT ticks[] = {1, 5, 10};
+
+    for(UINT i=0; i<numScenarios; i++)
+    {
+        for(UINT j=0; j<sizeof(ticks)/sizeof(ticks[0]); j++)
+        {
+            for(int bPush=0; bPush<2; bPush++)
+                PrintResult(scenarios[i].name, ticks[j], bPush != 0, RunTrace(scenarios[i].desktop, scenarios[i].mic, ticks[j], bPush != 0, 120));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    //the audio kernels are built for AVX2 as a whole, see ColorConvertTest
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("avx2"))
+    {
+        printf("skipped, this cpu doesn't have AVX2\n");
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        RunBenchmark();
+        return 0;
+    }
+
+    return TestSummary(RunTests());
+}
@@ -0,0 +1,271 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "BitrateController.cpp"
+#include "TestUtil.h"
+
+#include <deque>
+
+
+//replays bandwidth traces through the AIMD bitrate controller.  a 30fps encoder at the
+//controller's bitrate feeds a simulated publisher modelled on RTMPPublisher: frames wait in
+//the packet queue, go into a send buffer sized like its dataBuffer as room frees up (the
+//sender counts a wait when it can't), the link drains the buffer at the trace's bandwidth,
+//and the whole queue is dropped once its oldest frame is FrameDropThreshold old.  the
+//controller gets the publisher's NetworkSendStats once per frame, like OBSVideoCapture does.
+//
+//  BitrateControllerTest   runs the traces
+
+#define MAX_BITRATE         3500
+#define FPS                 30
+
+//RTMPPublisher's FrameDropThreshold default
+#define DROP_THRESHOLD_MS   600
+
+struct BandwidthStep
+{
+    QWORD startMS;
+    DWORD kbps;
+};
+
+class SimulatedPublisher
+{
+    struct Frame
+    {
+        DWORD size;
+        QWORD timeMS;
+    };
+
+    std::deque<Frame> queue;
+    bool bWaiting;
+    double linkCarry;
+
+public:
+    NetworkSendStats stats;
+
+    SimulatedPublisher(DWORD bufferSize) : bWaiting(false), linkCarry(0.0)
+    {
+        zero(&stats, sizeof(stats));
+        stats.bufferSize = bufferSize;
+    }
+
+    void Encode(DWORD size, QWORD timeMS)
+    {
+        Frame frame = {size, timeMS};
+        queue.push_back(frame);
+        stats.queuedBytes += size;
+    }
+
+    //one millisecond of the send thread and the link
+    void Step(DWORD linkKbps, QWORD timeMS)
+    {
+        if(!queue.empty() && timeMS-queue.front().timeMS >= DROP_THRESHOLD_MS)
+        {
+            stats.numDroppedFrames += DWORD(queue.size());
+            stats.queuedBytes = 0;
+            queue.clear();
+        }
+
+        while(!queue.empty() && stats.bufferedBytes+queue.front().size <= stats.bufferSize)
+        {
+            stats.bufferedBytes += queue.front().size;
+            stats.queuedBytes -= queue.front().size;
+            queue.pop_front();
+            bWaiting = false;
+        }
+
+        if(!queue.empty() && !bWaiting)
+        {
+            stats.numTimesWaited++;
+            bWaiting = true;
+        }
+
+        //kbps is bits per ms, so /8 is bytes this ms
+        linkCarry += double(linkKbps)/8.0;
+        DWORD sent = MIN(DWORD(linkCarry), stats.bufferedBytes);
+        linkCarry -= double(DWORD(linkCarry));
+
+        stats.bufferedBytes -= sent;
+        stats.bytesSent += sent;
+    }
+};
+
+//-------------------------------------------
+
+struct TraceResult
+{
+    DWORD lowestBitRate, finalBitRate;
+    DWORD numDropped;
+    double tailAvgBitRate;          //over the last 30 seconds
+    QWORD reachedMaxMS;             //last time the bitrate came back to the maximum, 0 if it didn't
+
+    //after every drop in bandwidth: the first decrease and the first dropped frame, 0 if none
+    UINT numBandwidthDrops, numLateBackoffs;
+    DWORD droppedAfterSettling;     //frames dropped later than 10s after a bandwidth change
+};
+
+static TraceResult RunTrace(const BandwidthStep *steps, UINT numSteps, QWORD lengthMS)
+{
+    BitrateController *controller = CreateAIMDBitrateController(MAX_BITRATE);
+    SimulatedPublisher publisher(MAX(MAX_BITRATE/8*1024, 131072));
+
+    TraceResult result;
+    zero(&result, sizeof(result));
+    result.lowestBitRate = MAX_BITRATE;
+
+    double tailSum = 0.0;
+    UINT tailNum = 0;
+
+    UINT curStep = 0;
+    QWORD lastChangeMS = 0;
+    bool bAwaitingBackoff = false;
+    DWORD lastDropped = 0;
+    UINT frameNum = 0;
+
+    //the controller treats a time of 0 as not started
+    for(QWORD timeMS=1; timeMS<=lengthMS; timeMS++)
+    {
+        if(curStep+1 < numSteps && timeMS >= steps[curStep+1].startMS)
+        {
+            curStep++;
+            lastChangeMS = timeMS;
+
+            if(steps[curStep].kbps < steps[curStep-1].kbps && steps[curStep].kbps < controller->GetBitRate())
+            {
+                result.numBandwidthDrops++;
+                bAwaitingBackoff = true;
+            }
+        }
+
+        if(timeMS >= QWORD(frameNum)*1000/FPS + 1)
+        {
+            DWORD bitRate = controller->GetBitRate();
+            publisher.Encode(bitRate*1000/FPS/8, timeMS);
+            frameNum++;
+
+            DWORD newBitRate = controller->Update(publisher.stats, timeMS);
+            if(newBitRate < bitRate)
+                bAwaitingBackoff = false;
+
+            if(newBitRate == MAX_BITRATE && bitRate != MAX_BITRATE)
+                result.reachedMaxMS = timeMS;
+
+            result.lowestBitRate = MIN(result.lowestBitRate, newBitRate);
+
+            if(timeMS+30000 > lengthMS)
+            {
+                tailSum += newBitRate;
+                tailNum++;
+            }
+        }
+
+        publisher.Step(steps[curStep].kbps, timeMS);
+
+        DWORD dropped = publisher.stats.numDroppedFrames-lastDropped;
+        if(dropped)
+        {
+            if(bAwaitingBackoff)
+            {
+                result.numLateBackoffs++;
+                bAwaitingBackoff = false;
+            }
+
+            if(timeMS-lastChangeMS > 10000)
+                result.droppedAfterSettling += dropped;
+
+            lastDropped = publisher.stats.numDroppedFrames;
+        }
+    }
+
+    result.finalBitRate = controller->GetBitRate();
+    result.numDropped = publisher.stats.numDroppedFrames;
+    result.tailAvgBitRate = tailNum ? tailSum/tailNum : 0.0;
+
+    delete controller;
+    return result;
+}
+
+//-------------------------------------------
+
+static const BandwidthStep stepDown[] =
+{
+    {0,      5000},
+    {30000,  1800},
+};
+
+static const BandwidthStep oscillating[] =
+{
+    {0,      4500}, {30000,  1200}, {60000,  4500}, {90000,  1200}, {120000, 4500}, {150000, 1200},
+    {180000, 4500}, {210000, 1200}, {240000, 4500}, {270000, 1200},
+};
+
+static const BandwidthStep recovering[] =
+{
+    {0,      800},
+    {30000,  6000},
+};
+
+static const BandwidthStep belowMinimum[] =
+{
+    {0,      200},
+};
+
+#define NUM_STEPS(steps) (sizeof(steps)/sizeof(steps[0]))
+
+static bool RunTests()
+{
+    bool bSuccess = true;
+
+    const DWORD minBitRate = MAX(MAX_BITRATE/10, 100);
+
+    //drops from 5000 to 1800 kbps: backs off before the queue overflows and settles just
+    //under the link without dropping anything once it has
+    TraceResult result = RunTrace(stepDown, NUM_STEPS(stepDown), 150000);
+    bSuccess &= TestResult(result.numBandwidthDrops == 1 && result.numLateBackoffs == 0 && result.droppedAfterSettling == 0,
+        "step down: backed off before dropping (%u frames dropped, %u after settling)", result.numDropped, result.droppedAfterSettling);
+    bSuccess &= TestResult(result.tailAvgBitRate >= 1800*0.7 && result.tailAvgBitRate <= 1800,
+        "step down: converged to %.0f kbps on a 1800 kbps link", result.tailAvgBitRate);
+
+    //bandwidth swings between 4500 and 1200 kbps every 30 seconds, long enough for the bitrate
+    //to climb back over 1200 before each drop
+    result = RunTrace(oscillating, NUM_STEPS(oscillating), 300000);
+    bSuccess &= TestResult(result.numBandwidthDrops >= 4 && result.numLateBackoffs == 0 && result.droppedAfterSettling == 0,
+        "oscillating: backed off before dropping after %u of %u drops in bandwidth (%u frames dropped)",
+        result.numBandwidthDrops-result.numLateBackoffs, result.numBandwidthDrops, result.numDropped);
+    bSuccess &= TestResult(result.lowestBitRate >= minBitRate,
+        "oscillating: lowest bitrate %u kbps, minimum %u kbps", result.lowestBitRate, minBitRate);
+
+    //800 kbps for 30 seconds, then plenty: climbs back to the configured maximum and stays
+    result = RunTrace(recovering, NUM_STEPS(recovering), 180000);
+    bSuccess &= TestResult(result.reachedMaxMS && result.finalBitRate == MAX_BITRATE && result.droppedAfterSettling == 0,
+        "recovering: back at %u kbps %.1fs after the link came back, lowest was %u kbps",
+        result.finalBitRate, result.reachedMaxMS ? double(result.reachedMaxMS-30000)/1000.0 : 0.0, result.lowestBitRate);
+
+    //a link slower than the controller's floor: it stops at the floor and lets the publisher drop
+    result = RunTrace(belowMinimum, NUM_STEPS(belowMinimum), 60000);
+    bSuccess &= TestResult(result.lowestBitRate == minBitRate && result.finalBitRate == minBitRate,
+        "below the minimum: held at %u kbps on a 200 kbps link, lowest %u kbps", result.finalBitRate, result.lowestBitRate);
+
+    return bSuccess;
+}
+
+int main(int argc, char **argv)
+{
+    return TestSummary(RunTests());
+}
@@ -0,0 +1,523 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "TaskPool.cpp"
+#include "TestUtil.h"
+
+#pragma GCC push_options
+#pragma GCC target("ssse3,avx2")
+#include "ImageProcessing.cpp"
+#pragma GCC pop_options
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+
+//capture to send latency of the video pipeline with LowLatency on and off.  a synthetic source
+//stamps each frame's number into the picture when it's rendered and notes the time.  the
+//capture thread is modelled on MainCaptureLoop: the render targets, the staging copy mapped a
+//frame later, and the 4:2:0 conversion on the task pool, pipelined or waited for.  the encode
+//thread is modelled on EncodeLoop and ProcessFrame: half frame ticks, an encoder that holds
+//back as many frames as x264 does, the scene buffering delay and SendFrame, with the null
+//network noting when each frame's packets are handed to it.  the stamp is read back out of the
+//converted picture, so a frame that goes missing or out of order on the way shows up.  the
+//source hands its picture over instantly, and displays on either end aren't in it.
+//
+//  CaptureLatencyTest          720p60 for 5 seconds each way, checks low latency mode against
+//                              the 500ms target
+//  CaptureLatencyTest bench    1080p60 for 20 seconds each way
+//
+//the conversion comes from the copied ImageProcessing.cpp, built for AVX2 like ColorConvertTest,
+//so this needs an AVX2 cpu.  it uses the SSE2 conversion either way
+
+//must match OBS.h and OBSVideoCapture.cpp
+#define NUM_RENDER_BUFFERS      2
+#define NUM_OUT_BUFFERS         3
+#define CONVERT444_TILE_ROWS    16
+
+//SceneBufferingTime and LowLatencyBufferingTime defaults
+#define SCENE_BUFFERING_TIME    700
+#define LOW_LATENCY_BUFFERING   200
+
+#define LATENCY_TARGET_MS       500
+
+//stands in for the time the encode call takes
+#define ENCODE_COST_MS          5
+
+//the frame number goes in as 32 blocks along the top, each bit a 16x16 block of black or white
+#define STAMP_BLOCK             16
+#define STAMP_BITS              32
+
+//x264's frames.i_delay, the frames it holds on to before the first one comes out: the larger
+//of b-frames and rc lookahead, one for each extra frame thread, and sync lookahead when frame
+//threaded.  veryfast with the default thread count for normal mode.  zerolatency has no
+//b-frames, no lookahead and sliced threads, so nothing is held
+static UINT X264DelayedFrames(bool bZeroLatency)
+{
+    if(bZeroLatency)
+        return 0;
+
+    const UINT bFrames = 3, rcLookahead = 10;
+    UINT threadFrames = MAX(UINT(OSGetTotalCores())*3/2, 1);
+    UINT syncLookahead = (threadFrames > 1) ? bFrames+1 : 0;
+
+    return MAX(bFrames, rcLookahead) + threadFrames-1 + syncLookahead;
+}
+
+//-------------------------------------------
+// capture side
+
+struct Picture
+{
+    std::vector<BYTE> data;
+    LPBYTE plane[3];
+};
+
+struct ConvertInfo
+{
+    LPBYTE input;
+    LPBYTE output[3];
+    int width, height;
+};
+
+static void STDCALL ConvertTile(LPVOID param, UINT startY, UINT endY)
+{
+    ConvertInfo &info = *(ConvertInfo*)param;
+    Convert444toNV12_SSE2(info.input, info.width, info.width*4, info.width, info.height, startY, endY, info.output);
+}
+
+struct Pipeline
+{
+    int width, height;
+    UINT fps, numTicks;
+    bool bLowLatency, bUseThreaded420, bWaitFor420;
+    UINT bufferingTime, encoderDelay;
+
+    HANDLE hVideoEvent;
+    volatile bool bShutdownVideoThread;
+    volatile QWORD latestVideoTimeNS;
+    volatile QWORD firstFrameTimestamp;
+
+    std::vector<BYTE> yuvRenderTextures[NUM_RENDER_BUFFERS], copyTextures[NUM_RENDER_BUFFERS];
+    Picture outPics[NUM_OUT_BUFFERS];
+    Picture *volatile curFramePic;
+
+    //per frame number: when the source rendered it and when its packets went to the network
+    std::vector<QWORD> captureTimes, sendTimes;
+
+    //encode side
+    std::deque<DWORD> bufferedTimes;
+    std::deque<UINT> encoderFrames;
+
+    struct Segment
+    {
+        UINT frameNum;
+        DWORD timestamp;
+    };
+    std::deque<Segment> bufferedVideo;
+
+    UINT numEncoded, numSent, numDuplicated, numOutOfOrder, numBadStamps;
+    UINT lastFrameEncoded, lastFrameSent;
+};
+
+//a gray picture with the frame number along the top, as the yuv scale shader would leave it:
+//luma in the second byte of each pixel
+static void RenderSyntheticSource(Pipeline &pipeline, std::vector<BYTE> &texture, UINT frameNum)
+{
+    pipeline.captureTimes[frameNum] = TestTimeNS();
+
+    for(int y=0; y<STAMP_BLOCK; y++)
+    {
+        LPBYTE row = &texture[y*pipeline.width*4];
+        for(int x=0; x<STAMP_BITS*STAMP_BLOCK; x++)
+            row[x*4+1] = ((frameNum >> (x/STAMP_BLOCK)) & 1) ? 235 : 16;
+    }
+}
+
+static UINT ReadStamp(Pipeline &pipeline, const Picture &pic)
+{
+    UINT frameNum = 0;
+    const BYTE *row = pic.plane[0] + (STAMP_BLOCK/2)*pipeline.width;
+
+    for(int i=0; i<STAMP_BITS; i++)
+    {
+        if(row[i*STAMP_BLOCK + STAMP_BLOCK/2] > 128)
+            frameNum |= 1U << i;
+    }
+
+    return frameNum;
+}
+
+//MainCaptureLoop without the scene, preview and renditions, and with audio taken as started
+static DWORD STDCALL CaptureThread(LPVOID param)
+{
+    Pipeline &pipeline = *(Pipeline*)param;
+
+    QWORD frameLengthNS = 1000000000/pipeline.fps;
+    QWORD lastStreamTime = 0;
+
+    UINT curRenderTarget = 0, curYUVTexture = 0, curCopyTexture = 0;
+    int curOutBuffer = 0;
+    int copyWait = NUM_RENDER_BUFFERS-1;
+    bool bFirstFrame = true, bFirstImage = true, bFirstEncode = true;
+    UINT frameNum = 0;
+
+    TaskGroup convertTasks;
+    ConvertInfo convertInfo;
+    convertInfo.width  = pipeline.width;
+    convertInfo.height = pipeline.height;
+
+    while(WaitForSingleObject(pipeline.hVideoEvent, INFINITE) == WAIT_OBJECT_0)
+    {
+        if(pipeline.bShutdownVideoThread)
+            break;
+
+        QWORD curStreamTime = pipeline.latestVideoTimeNS;
+        if(!lastStreamTime)
+            lastStreamTime = curStreamTime-frameLengthNS;
+
+        if(frameNum < pipeline.captureTimes.size())
+            RenderSyntheticSource(pipeline, pipeline.yuvRenderTextures[curRenderTarget], frameNum++);
+
+        bool bEncode = true;
+
+        if(copyWait)
+        {
+            copyWait--;
+            bEncode = false;
+        }
+        else if(bFirstFrame)
+        {
+            pipeline.firstFrameTimestamp = lastStreamTime/1000000;
+            bFirstFrame = false;
+        }
+
+        lastStreamTime = curStreamTime;
+
+        if(bEncode)
+        {
+            UINT prevCopyTexture = (curCopyTexture == 0) ? NUM_RENDER_BUFFERS-1 : curCopyTexture-1;
+
+            if(!bFirstEncode && pipeline.bUseThreaded420)
+                convertTasks.Wait();
+
+            //CopyResource
+            mcpy(&pipeline.copyTextures[curCopyTexture][0], &pipeline.yuvRenderTextures[curYUVTexture][0], pipeline.copyTextures[curCopyTexture].size());
+
+            if(bFirstImage)
+                bFirstImage = false;
+            else
+            {
+                int nextOutBuffer = (curOutBuffer == NUM_OUT_BUFFERS-1) ? 0 : curOutBuffer+1;
+
+                Picture &picOut = pipeline.outPics[curOutBuffer];
+                Picture &nextPicOut = pipeline.outPics[nextOutBuffer];
+
+                convertInfo.input = &pipeline.copyTextures[prevCopyTexture][0];
+
+                if(pipeline.bUseThreaded420)
+                {
+                    //finished at the next copy
+                    mcpy(convertInfo.output, nextPicOut.plane, sizeof(convertInfo.output));
+                    convertTasks.Run(ConvertTile, &convertInfo, 0, pipeline.height, CONVERT444_TILE_ROWS);
+
+                    if(bFirstEncode)
+                        bFirstEncode = bEncode = false;
+                }
+                else if(pipeline.bWaitFor420)
+                {
+                    mcpy(convertInfo.output, picOut.plane, sizeof(convertInfo.output));
+                    convertTasks.Run(ConvertTile, &convertInfo, 0, pipeline.height, CONVERT444_TILE_ROWS);
+                    convertTasks.Wait();
+                }
+                else
+                {
+                    mcpy(convertInfo.output, picOut.plane, sizeof(convertInfo.output));
+                    ConvertTile(&convertInfo, 0, pipeline.height);
+                }
+
+                if(bEncode)
+                    pipeline.curFramePic = &picOut;
+
+                curOutBuffer = nextOutBuffer;
+            }
+
+            curCopyTexture = (curCopyTexture == NUM_RENDER_BUFFERS-1) ? 0 : curCopyTexture+1;
+            curYUVTexture  = (curYUVTexture  == NUM_RENDER_BUFFERS-1) ? 0 : curYUVTexture+1;
+        }
+
+        curRenderTarget = (curRenderTarget == NUM_RENDER_BUFFERS-1) ? 0 : curRenderTarget+1;
+    }
+
+    if(pipeline.bUseThreaded420)
+        convertTasks.Wait();
+
+    return 0;
+}
+
+//-------------------------------------------
+// encode side
+
+//the null network: notes when the frame's packets are handed over
+static void SendFrame(Pipeline &pipeline, const Pipeline::Segment &segment)
+{
+    if(pipeline.numSent && segment.frameNum <= pipeline.lastFrameSent)
+        pipeline.numOutOfOrder++;
+
+    pipeline.sendTimes[segment.frameNum] = TestTimeNS();
+    pipeline.lastFrameSent = segment.frameNum;
+    pipeline.numSent++;
+}
+
+static void ProcessFrame(Pipeline &pipeline, Picture *pic, DWORD frameTimestamp)
+{
+    pipeline.bufferedTimes.push_back(frameTimestamp);
+
+    //encode: the picture is read when it goes in, like x264 copying it into its own frame
+    UINT frameNum = ReadStamp(pipeline, *pic);
+
+    if(frameNum >= pipeline.captureTimes.size() || !pipeline.captureTimes[frameNum])
+    {
+        pipeline.numBadStamps++;
+        pipeline.bufferedTimes.pop_back();
+        return;
+    }
+
+    if(pipeline.numEncoded && frameNum == pipeline.lastFrameEncoded)
+    {
+        //the capture thread didn't have a new picture ready, x264 would encode it again
+        pipeline.numDuplicated++;
+        pipeline.bufferedTimes.pop_back();
+        return;
+    }
+
+    pipeline.lastFrameEncoded = frameNum;
+    pipeline.numEncoded++;
+
+    QWORD encodeEndTime = TestTimeNS() + QWORD(ENCODE_COST_MS)*1000000;
+    while(TestTimeNS() < encodeEndTime);
+
+    pipeline.encoderFrames.push_back(frameNum);
+    if(pipeline.encoderFrames.size() <= pipeline.encoderDelay)
+        return;
+
+    //BufferVideoData
+    Pipeline::Segment segment = {pipeline.encoderFrames.front(), pipeline.bufferedTimes.front()};
+    pipeline.encoderFrames.pop_front();
+    pipeline.bufferedTimes.pop_front();
+
+    pipeline.bufferedVideo.push_back(segment);
+
+    if(pipeline.bufferedVideo.back().timestamp-pipeline.bufferedVideo.front().timestamp >= pipeline.bufferingTime)
+    {
+        SendFrame(pipeline, pipeline.bufferedVideo.front());
+        pipeline.bufferedVideo.pop_front();
+    }
+}
+
+//OBS's SleepToNS
+static bool SleepToNS(QWORD qwNSTime)
+{
+    QWORD t = TestTimeNS();
+
+    if(t >= qwNSTime)
+        return false;
+
+    unsigned int milliseconds = (unsigned int)((qwNSTime - t)/1000000);
+    if(milliseconds > 1)
+        OSSleep(milliseconds);
+
+    for(;;)
+    {
+        t = TestTimeNS();
+        if(t >= qwNSTime)
+            return true;
+        OSSleep(1);
+    }
+}
+
+//EncodeLoop, with the encoder's frame list sitting in ProcessFrame
+static void EncodeLoop(Pipeline &pipeline)
+{
+    QWORD streamTimeStart = TestTimeNS();
+    QWORD frameTimeNS = 1000000000/pipeline.fps;
+    QWORD sleepTargetTime = streamTimeStart+frameTimeNS;
+    pipeline.latestVideoTimeNS = streamTimeStart;
+
+    std::deque<QWORD> tickTimes;
+
+    for(UINT tick=0; tick<pipeline.numTicks; tick++)
+    {
+        SleepToNS(sleepTargetTime += (frameTimeNS/2));
+
+        QWORD latestVideoTime = sleepTargetTime/1000000;
+        pipeline.latestVideoTimeNS = sleepTargetTime;
+        SetEvent(pipeline.hVideoEvent);
+
+        SleepToNS(sleepTargetTime += (frameTimeNS/2));
+        tickTimes.push_back(latestVideoTime);
+
+        Picture *pic = pipeline.curFramePic;
+        if(pic && pipeline.firstFrameTimestamp)
+        {
+            while(tickTimes.front() < pipeline.firstFrameTimestamp)
+                tickTimes.pop_front();
+
+            DWORD curFrameTimestamp = DWORD(tickTimes.front() - pipeline.firstFrameTimestamp);
+            tickTimes.pop_front();
+
+            ProcessFrame(pipeline, pic, curFrameTimestamp);
+        }
+    }
+}
+
+//-------------------------------------------
+
+struct LatencyResult
+{
+    double p50, p99, maxVal;
+    UINT numSent, numDuplicated, numOutOfOrder, numBadStamps;
+    double minLatency;
+};
+
+static LatencyResult RunPipeline(bool bLowLatency, int width, int height, UINT fps, UINT seconds)
+{
+    Pipeline *pipelinePtr = new Pipeline;
+    Pipeline &pipeline = *pipelinePtr;
+
+    pipeline.width  = width;
+    pipeline.height = height;
+    pipeline.fps    = fps;
+    pipeline.numTicks = fps*seconds;
+    pipeline.bLowLatency = bLowLatency;
+
+    //as OBS::Start and MainCaptureLoop pick them
+    pipeline.bufferingTime = bLowLatency ? MIN(SCENE_BUFFERING_TIME, LOW_LATENCY_BUFFERING) : SCENE_BUFFERING_TIME;
+    pipeline.encoderDelay = X264DelayedFrames(bLowLatency);
+    pipeline.bUseThreaded420 = OSGetTotalCores() > 1;
+    pipeline.bWaitFor420 = pipeline.bUseThreaded420 && bLowLatency;
+    if(pipeline.bWaitFor420)
+        pipeline.bUseThreaded420 = false;
+
+    for(int i=0; i<NUM_RENDER_BUFFERS; i++)
+    {
+        pipeline.yuvRenderTextures[i].assign(width*height*4, 0x80);
+        pipeline.copyTextures[i].resize(width*height*4);
+    }
+
+    for(int i=0; i<NUM_OUT_BUFFERS; i++)
+    {
+        Picture &pic = pipeline.outPics[i];
+        pic.data.resize(width*height*3/2);
+        pic.plane[0] = &pic.data[0];
+        pic.plane[1] = &pic.data[width*height];
+        pic.plane[2] = NULL;
+    }
+
+    pipeline.captureTimes.resize(pipeline.numTicks+1);
+    pipeline.sendTimes.resize(pipeline.numTicks+1);
+
+    pipeline.hVideoEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    HANDLE hVideoThread = OSCreateThread(CaptureThread, &pipeline);
+
+    EncodeLoop(pipeline);
+
+    pipeline.bShutdownVideoThread = true;
+    SetEvent(pipeline.hVideoEvent);
+    OSWaitForThread(hVideoThread, NULL);
+    OSCloseThread(hVideoThread);
+    CloseHandle(pipeline.hVideoEvent);
+
+    std::vector<double> latencies;
+    for(size_t i=0; i<pipeline.sendTimes.size(); i++)
+    {
+        if(pipeline.sendTimes[i])
+            latencies.push_back(double(pipeline.sendTimes[i]-pipeline.captureTimes[i])/1000000.0);
+    }
+
+    LatencyResult result;
+    zero(&result, sizeof(result));
+    result.numSent       = pipeline.numSent;
+    result.numDuplicated = pipeline.numDuplicated;
+    result.numOutOfOrder = pipeline.numOutOfOrder;
+    result.numBadStamps  = pipeline.numBadStamps;
+
+    if(latencies.size())
+    {
+        std::sort(latencies.begin(), latencies.end());
+        result.minLatency = latencies.front();
+        result.p50 = latencies[latencies.size()/2];
+        result.p99 = latencies[MIN(latencies.size()*99/100, latencies.size()-1)];
+        result.maxVal = latencies.back();
+    }
+
+    printf("%dx%d %ufps, low latency %-3s  buffering %ums, x264 holds %u frames, %s conversion\n",
+        width, height, fps, bLowLatency ? "on" : "off", pipeline.bufferingTime, pipeline.encoderDelay,
+        pipeline.bWaitFor420 ? "waited for" : (pipeline.bUseThreaded420 ? "pipelined" : "single threaded"));
+    printf("    capture to send  p50 %6.1fms  p99 %6.1fms  max %6.1fms  target %dms: %s  (%u frames, %u duplicated)\n",
+        result.p50, result.p99, result.maxVal, LATENCY_TARGET_MS, result.p99 < LATENCY_TARGET_MS ? "met" : "missed",
+        result.numSent, result.numDuplicated);
+
+    delete pipelinePtr;
+    return result;
+}
+
+static bool RunTests()
+{
+    bool bSuccess = true;
+
+    LatencyResult normal     = RunPipeline(false, 1280, 720, 60, 5);
+    LatencyResult lowLatency = RunPipeline(true,  1280, 720, 60, 5);
+
+    bSuccess &= TestResult(normal.numSent && lowLatency.numSent && !normal.numOutOfOrder && !lowLatency.numOutOfOrder &&
+        !normal.numBadStamps && !lowLatency.numBadStamps,
+        "every frame handed to the network carries its own stamp, in order (%u and %u frames)", normal.numSent, lowLatency.numSent);
+    bSuccess &= TestResult(normal.minLatency >= SCENE_BUFFERING_TIME && lowLatency.minLatency >= LOW_LATENCY_BUFFERING,
+        "frames are held for the scene buffering time (shortest %.1fms and %.1fms)", normal.minLatency, lowLatency.minLatency);
+    bSuccess &= TestResult(lowLatency.p99 < LATENCY_TARGET_MS,
+        "low latency mode: p99 capture to send %.1fms, target %dms", lowLatency.p99, LATENCY_TARGET_MS);
+    bSuccess &= TestResult(lowLatency.p50 < normal.p50,
+        "low latency mode takes p50 from %.1fms to %.1fms", normal.p50, lowLatency.p50);
+
+    return bSuccess;
+}
+
+int main(int argc, char **argv)
+{
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("avx2"))
+    {
+        printf("skipped, this cpu doesn't have AVX2\n");
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        RunPipeline(false, 1920, 1080, 60, 20);
+        RunPipeline(true,  1920, 1080, 60, 20);
+        DestroyTaskPool();
+        return 0;
+    }
+
+    bool bSuccess = RunTests();
+    DestroyTaskPool();
+
+    return TestSummary(bSuccess);
+}
@@ -0,0 +1,246 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+//4:4:4 to 4:2:0 conversion: every variant has to match the scalar code byte for byte, at
+//the usual resolutions and at widths that leave columns over for the scalar tail, converted
+//whole or in tiles like the encode thread does it.  "bench" times every variant.
+//
+//gcc won't compile the SSSE3/AVX2 intrinsics unless the code is built for those instruction
+//sets, so the copied source is built for AVX2 as a whole and this needs an AVX2 cpu to run.
+//that also lets gcc vectorize the scalar code, so its benchmark numbers are on the kind side
+
+#include "OBSApi.h"
+#include "TestUtil.h"
+
+#pragma GCC push_options
+#pragma GCC target("ssse3,avx2")
+#include "ImageProcessing.cpp"
+#pragma GCC pop_options
+
+//-------------------------------------------
+
+typedef void (*CONVERTPROC)(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output);
+
+static void NV12_Scalar(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
+{
+    Convert444toNV12_Scalar(input, inPitch, outPitch, 0, width, startY, endY, output);
+}
+
+static void I420_Scalar(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
+{
+    Convert444toI420_Scalar(input, width, inPitch, 0, width, startY, endY, output);
+}
+
+//the I420 functions write tightly packed planes and have a single pitch
+static void I420_SSE2(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
+{
+    Convert444toI420_SSE2(input, width, inPitch, height, startY, endY, output);
+}
+
+static void I420_SSSE3(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
+{
+    Convert444toI420_SSSE3(input, width, inPitch, height, startY, endY, output);
+}
+
+static void I420_AVX2(LPBYTE input, int width, int inPitch, int outPitch, int height, int startY, int endY, LPBYTE *output)
+{
+    Convert444toI420_AVX2(input, width, inPitch, height, startY, endY, output);
+}
+
+struct Variant
+{
+    const char *name;
+    CONVERTPROC nv12, i420;
+};
+
+static const Variant variants[] =
+{
+    {"scalar", NV12_Scalar,             I420_Scalar},
+    {"SSE2",   Convert444toNV12_SSE2,   I420_SSE2},
+    {"SSSE3",  Convert444toNV12_SSSE3,  I420_SSSE3},
+    {"AVX2",   Convert444toNV12_AVX2,   I420_AVX2},
+};
+
+static const UINT numVariants = sizeof(variants)/sizeof(variants[0]);
+
+//-------------------------------------------
+
+struct Frame
+{
+    int width, height;
+    int inPitch, outPitch;
+
+    LPBYTE input;
+    LPBYTE planes;
+    size_t planesSize;
+    LPBYTE output[3];
+
+    Frame(int width, int height, bool bI420) : width(width), height(height)
+    {
+        //the readback texture pitch is 16 byte aligned, SSE2 uses aligned loads
+        inPitch = (width*4+15) & ~15;
+        input = (LPBYTE)aligned_alloc(32, size_t(inPitch)*height);
+
+        TestRandom random(UINT(width*height));
+        for(size_t i=0; i<size_t(inPitch)*height; i++)
+            input[i] = BYTE(random.Next());
+
+        //NV12 gets a padded pitch so writes past the width show up
+        outPitch = bI420 ? width : width+32;
+        size_t lumSize = size_t(outPitch)*height;
+        planesSize = lumSize + lumSize/2;
+        planes = (LPBYTE)malloc(planesSize);
+        memset(planes, 0xCD, planesSize);
+
+        output[0] = planes;
+        output[1] = planes+lumSize;
+        output[2] = bI420 ? output[1]+lumSize/4 : NULL;
+    }
+
+    ~Frame()
+    {
+        free(input);
+        free(planes);
+    }
+};
+
+static bool CompareVariant(const Variant &variant, bool bI420, int width, int height, int numTiles)
+{
+    Frame reference(width, height, bI420), test(width, height, bI420);
+
+    CONVERTPROC refProc  = bI420 ? variants[0].i420 : variants[0].nv12;
+    CONVERTPROC testProc = bI420 ? variant.i420 : variant.nv12;
+
+    refProc(reference.input, width, reference.inPitch, reference.outPitch, height, 0, height, reference.output);
+
+    //tiles are split on even lines, the same as the encode thread's conversion tasks
+    int tileHeight = MAX(((height/numTiles)+1) & ~1, 2);
+    for(int startY=0; startY<height; startY+=tileHeight)
+        testProc(test.input, width, test.inPitch, test.outPitch, height, startY, MIN(startY+tileHeight, height), test.output);
+
+    size_t mismatch = INVALID;
+    for(size_t i=0; i<reference.planesSize; i++)
+    {
+        if(reference.planes[i] != test.planes[i])
+        {
+            mismatch = i;
+            break;
+        }
+    }
+
+    bool bSuccess = TestResult(mismatch == INVALID, "%-6s %s %4dx%-4d %d tile%s", variant.name, bI420 ? "I420" : "NV12", width, height, numTiles, numTiles == 1 ? "" : "s");
+    if(mismatch != INVALID)
+        TestFail("first difference at byte %u of the output: %u, scalar has %u", UINT(mismatch), test.planes[mismatch], reference.planes[mismatch]);
+
+    return bSuccess;
+}
+
+//-------------------------------------------
+
+static const int resolutions[][2] = {{1280, 720}, {1920, 1080}, {2560, 1440}};
+
+static bool RunTests()
+{
+    //odd multiples of 4 and 8 leave columns for the scalar tail of the SSSE3/AVX2 code
+    static const int extraSizes[][2] = {{1916, 1078}, {1300, 732}, {644, 362}, {8, 2}, {20, 6}};
+
+    bool bSuccess = true;
+
+    for(UINT i=1; i<numVariants; i++)
+    {
+        for(int bI420=0; bI420<2; bI420++)
+        {
+            for(UINT j=0; j<sizeof(resolutions)/sizeof(resolutions[0]); j++)
+            {
+                bSuccess &= CompareVariant(variants[i], bI420 != 0, resolutions[j][0], resolutions[j][1], 1);
+                bSuccess &= CompareVariant(variants[i], bI420 != 0, resolutions[j][0], resolutions[j][1], 6);
+            }
+
+            for(UINT j=0; j<sizeof(extraSizes)/sizeof(extraSizes[0]); j++)
+                bSuccess &= CompareVariant(variants[i], bI420 != 0, extraSizes[j][0], extraSizes[j][1], 3);
+        }
+    }
+
+    return bSuccess;
+}
+
+static void RunBenchmark()
+{
+    printf("%-10s %-7s %-5s %10s %10s %9s\n", "size", "variant", "fmt", "ms/frame", "MB/s in", "vs scalar");
+
+    for(UINT j=0; j<sizeof(resolutions)/sizeof(resolutions[0]); j++)
+    {
+        int width = resolutions[j][0], height = resolutions[j][1];
+
+        for(int bI420=0; bI420<2; bI420++)
+        {
+            Frame frame(width, height, bI420 != 0);
+            double scalarTime = 0.0;
+
+            for(UINT i=0; i<numVariants; i++)
+            {
+                CONVERTPROC proc = bI420 ? variants[i].i420 : variants[i].nv12;
+
+                //warm up, then take the best of several runs so other load on the machine drops out
+                proc(frame.input, width, frame.inPitch, frame.outPitch, height, 0, height, frame.output);
+
+                double best = 1e30;
+                for(int run=0; run<5; run++)
+                {
+                    const int numFrames = 20;
+                    QWORD startTime = TestTimeNS();
+                    for(int k=0; k<numFrames; k++)
+                        proc(frame.input, width, frame.inPitch, frame.outPitch, height, 0, height, frame.output);
+                    best = MIN(best, double(TestTimeNS()-startTime)/numFrames);
+                }
+
+                if(i == 0)
+                    scalarTime = best;
+
+                char size[32];
+                snprintf(size, sizeof(size), "%dx%d", width, height);
+                printf("%-10s %-7s %-5s %10.3f %10.0f %8.2fx\n", size, variants[i].name, bI420 ? "I420" : "NV12",
+                    best/1e6, double(frame.inPitch)*height/(best/1e9)/(1024.0*1024.0), scalarTime/best);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("avx2"))
+    {
+        printf("skipped, this cpu doesn't have AVX2\n");
+        return 0;
+    }
+
+    //same variant the app would pick on this machine
+    int cpuInfo[4];
+    __cpuid(cpuInfo, 1);
+    InitConvert444(cpuInfo);
+
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        RunBenchmark();
+        return 0;
+    }
+
+    return TestSummary(RunTests());
+}
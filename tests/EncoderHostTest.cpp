@@ -0,0 +1,240 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "OBSApi.h"
+#include "RingBenchmark.cpp"
+#include "../X264Helper/X264HostProtocol.h"
+#include "TestUtil.h"
+
+
+//the encoder host plumbing without x264: frames go through a frame_ring to a second copy of
+//this program and come back through another one, and have to arrive whole, in order and with
+//their lengths and flags.  the custom x264 settings list OBS hands the host is checked too.
+//
+//  EncoderHostTest                     runs the tests
+//  EncoderHostTest bench [...]         the X264Helper frame hand-off benchmark, same arguments
+//  EncoderHostTest benchmark [...]     as "X264Helper benchmark"
+
+const UINT echoSlots        = 3;
+const UINT echoSlotSize     = 64*1024+17;
+const UINT echoTimeoutMS    = 5000;
+const UINT echoStop         = 0x80000000;
+
+inline BYTE PatternByte(UINT frame, UINT offset)
+{
+    return BYTE((frame*131) ^ (offset*7) ^ (offset>>8));
+}
+
+//the far end of the round trip: copies every frame back as it came in
+static int RunRingEcho(int argc, char **argv)
+{
+    if(argc < 1)
+        return 1;
+
+    std::string prefix = argv[0];
+
+    encoder_host::frame_ring frames, echoes;
+    if(!frames.open(prefix+"frames", echoSlots, echoSlotSize) || !echoes.open(prefix+"echo", echoSlots, echoSlotSize))
+        return 2;
+
+    while(true)
+    {
+        encoder_host::slot_header *si;
+        BYTE *data = frames.begin_read(echoTimeoutMS, si);
+        if(!data)
+            return 3;
+
+        if(si->flags & echoStop)
+        {
+            frames.end_read();
+            return 0;
+        }
+
+        BYTE *out = echoes.begin_write(echoTimeoutMS);
+        if(!out)
+            return 3;
+
+        memcpy(out, data, si->length);
+        echoes.end_write(si->length, si->flags);
+        frames.end_read();
+    }
+}
+
+struct EchoCheck
+{
+    UINT numReceived;
+    UINT numBad;
+
+    EchoCheck() : numReceived(0), numBad(0) {}
+};
+
+static bool ReadEcho(encoder_host::frame_ring &echoes, UINT timeoutMS, EchoCheck &check)
+{
+    encoder_host::slot_header *si;
+    BYTE *data = echoes.begin_read(timeoutMS, si);
+    if(!data)
+        return false;
+
+    UINT frame = check.numReceived++;
+    UINT length = frame*4099 % (echoSlotSize+1);
+
+    bool bGood = (si->length == length && si->flags == frame);
+    for(UINT i=0; bGood && i<length; i++)
+        bGood = (data[i] == PatternByte(frame, i));
+
+    if(!bGood && check.numBad++ < 5)
+        TestFail("frame %u came back as frame %u with %u bytes (expected %u)", frame, si->flags, si->length, length);
+
+    echoes.end_read();
+    return true;
+}
+
+static bool TestRingRoundTrip(UINT numFrames)
+{
+    std::ostringstream ss;
+    ss << "EncoderHostTest" << encoder_host::current_process_id() << "_";
+    std::string prefix = ss.str();
+
+    bool bSuccess = true;
+
+    {
+        encoder_host::frame_ring frames, echoes;
+        if(!frames.create(prefix+"frames", echoSlots, echoSlotSize) || !echoes.create(prefix+"echo", echoSlots, echoSlotSize))
+            return TestResult(false, "ring round trip: could not create the rings");
+
+        encoder_host::frame_ring wrongSize;
+        bSuccess &= TestResult(!wrongSize.open(prefix+"frames", echoSlots, echoSlotSize+1), "a ring can't be opened with the wrong slot size");
+
+        std::vector<std::string> args;
+        args.push_back("ring-echo");
+        args.push_back(prefix);
+
+        encoder_host::host_process echo;
+        if(!echo.spawn(encoder_host::current_executable_path(), args))
+            return TestResult(false, "ring round trip: could not start the echo process");
+
+        //lengths run from empty to a completely full slot, and the rings wrap many times
+        //with both of them full most of the time
+        EchoCheck check;
+        bool bStalled = false;
+
+        for(UINT frame=0; frame<numFrames && !bStalled; frame++)
+        {
+            BYTE *data;
+            while(!(data = frames.begin_write(0)))
+            {
+                if(!ReadEcho(echoes, echoTimeoutMS, check))
+                {
+                    bStalled = true;
+                    break;
+                }
+            }
+
+            if(bStalled)
+                break;
+
+            UINT length = frame*4099 % (echoSlotSize+1);
+            for(UINT i=0; i<length; i++)
+                data[i] = PatternByte(frame, i);
+
+            frames.end_write(length, frame);
+        }
+
+        while(!bStalled && check.numReceived < numFrames)
+            bStalled = !ReadEcho(echoes, echoTimeoutMS, check);
+
+        if(!bStalled && frames.begin_write(echoTimeoutMS))
+            frames.end_write(0, echoStop);
+
+        bool bExited = echo.wait(echoTimeoutMS);
+        if(!bExited)
+            echo.kill();
+
+        bSuccess &= TestResult(!bStalled && check.numReceived == numFrames, "%u of %u frames came back through %u slots", check.numReceived, numFrames, echoSlots);
+        bSuccess &= TestResult(check.numBad == 0, "every frame came back in order with its length, flags and bytes (%u bad)", check.numBad);
+        bSuccess &= TestResult(bExited && echo.exit_code == 0, "the echo process stopped on the stop flag (exit code %d)", echo.exit_code);
+    }
+
+    encoder_host::frame_ring leftover;
+    bSuccess &= TestResult(!leftover.open(prefix+"frames", echoSlots, echoSlotSize), "the rings are gone once their creator closes them");
+
+    return bSuccess;
+}
+
+static bool TestCustomSettings()
+{
+    bool bSuccess = true;
+
+    const char *names[]  = {"keyint", "zones", "no-cabac", "ipratio", "fake-interlaced"};
+    const char *values[] = {"250", "0,100,q=20/200,300,b=0.5", "", "1.40 ", "1"};
+    const UINT numSettings = sizeof(names)/sizeof(names[0]);
+
+    char custom[64];
+    memset(custom, 0xAA, sizeof(custom));
+    custom[0] = 0;
+
+    UINT numAdded = 0;
+    while(numAdded < numSettings && x264_host_add_custom(custom, sizeof(custom), names[numAdded], values[numAdded]))
+        numAdded++;
+
+    //the fourth one doesn't fit in 64 bytes
+    bSuccess &= TestResult(numAdded == 3, "%u of %u settings fit in %u bytes", numAdded, numSettings, UINT(sizeof(custom)));
+    bSuccess &= TestResult(!x264_host_add_custom(custom, sizeof(custom), "", "1"), "settings with no name are turned down");
+
+    UINT numRead = 0;
+    bool bMatch = true;
+    const char *name, *value, *end = custom+sizeof(custom);
+    for(const char *entry = custom; (entry = x264_host_next_custom(entry, end, name, value)) != 0; numRead++)
+    {
+        if(numRead >= numAdded || strcmp(name, names[numRead]) != 0 || strcmp(value, values[numRead]) != 0)
+            bMatch = false;
+    }
+
+    bSuccess &= TestResult(bMatch && numRead == numAdded, "settings come back as they went in, '=' and spaces in values included");
+
+    //one that lost its terminator must not be read past the end
+    char broken[16];
+    memset(broken, 'x', sizeof(broken));
+    memcpy(broken, "keyint\0" "250\0" "ref", 14);
+
+    numRead = 0;
+    for(const char *entry = broken; (entry = x264_host_next_custom(entry, broken+sizeof(broken), name, value)) != 0; numRead++);
+
+    bSuccess &= TestResult(numRead == 1, "a list without its end stops at the last whole setting");
+    bSuccess &= TestResult(!x264_host_add_custom(broken, sizeof(broken), "ref", "1"), "nothing is added to a list without its end");
+
+    return bSuccess;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && (strcmp(argv[1], "bench") == 0 || strcmp(argv[1], "benchmark") == 0))
+        return run_ring_benchmark(argc-2, argv+2);
+    if(argc > 1 && strcmp(argv[1], "benchmark-echo") == 0)
+        return run_ring_benchmark_echo(argc-2, argv+2);
+    if(argc > 1 && strcmp(argv[1], "ring-echo") == 0)
+        return RunRingEcho(argc-2, argv+2);
+
+    bool bSuccess = true;
+
+    bSuccess &= TestCustomSettings();
+    bSuccess &= TestRingRoundTrip(2000);
+
+    return TestSummary(bSuccess);
+}
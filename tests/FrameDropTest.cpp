@@ -0,0 +1,484 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "FrameDropIndex.cpp"
+#include "TestUtil.h"
+
+
+//drives FrameDropIndex with a synthetic packet trace and checks every drop it picks against
+//the linear scans RTMPPublisher used before the index.  the trace is a 60fps stream with
+//b-frames and audio going into a send queue that congests now and then, and the publisher
+//side (queueing, the b/p-frame thresholds, DropFrame's cascade and packetWaitType) is
+//modelled the same way RTMPPublisher does it.
+//
+//  FrameDropTest           runs the traces
+//  FrameDropTest bench     times draining a full queue with the index and with the scans
+
+struct TraceSlot
+{
+    PacketType type;
+    UINT distance;          //the reference copy, the index keeps its own
+    bool bQueued;
+};
+
+class TraceQueue
+{
+    TraceSlot *slots;
+    UINT size, mask;
+
+public:
+    UINT begin, end;
+
+    TraceQueue(UINT size, UINT startPos) : size(size), mask(size-1), begin(startPos), end(startPos)
+    {
+        slots = (TraceSlot*)Allocate(sizeof(TraceSlot)*size);
+        zero(slots, sizeof(TraceSlot)*size);
+    }
+
+    ~TraceQueue() {Free(slots);}
+
+    inline TraceSlot& operator[](UINT pos) {return slots[pos & mask];}
+    inline UINT Num() const {return end-begin;}
+    inline bool IsFull() const {return end-begin > mask;}
+};
+
+//--------------------------------------------------------------------------
+// reference, the scans from RTMPPublisher::DoIFrameDelay and DropFrame before the index
+
+static bool ReferenceSelectDrop(TraceQueue &queue, bool bBFramesOnly, UINT &bestPacket)
+{
+    int curWaitType = PacketType_VideoDisposable;
+
+    while(!bBFramesOnly && curWaitType < PacketType_VideoHighest ||
+           bBFramesOnly && curWaitType < PacketType_VideoHigh)
+    {
+        UINT bestPacketDistance = 0;
+        bool bFoundPacket = false;
+
+        if(curWaitType == PacketType_VideoHigh)
+        {
+            bool bFoundIFrame = false;
+
+            for(UINT i=queue.end; i!=queue.begin;)
+            {
+                i--;
+
+                TraceSlot &packet = queue[i];
+                if(!packet.bQueued || packet.type == PacketType_Audio)
+                    continue;
+
+                if(packet.type == curWaitType)
+                {
+                    if(bFoundIFrame)
+                    {
+                        bestPacket = i;
+                        bFoundPacket = true;
+                        break;
+                    }
+                    else if(!bFoundPacket)
+                    {
+                        bestPacket = i;
+                        bFoundPacket = true;
+                    }
+                }
+                else if(packet.type == PacketType_VideoHighest)
+                    bFoundIFrame = true;
+            }
+        }
+        else
+        {
+            for(UINT i=queue.begin; i!=queue.end; i++)
+            {
+                TraceSlot &packet = queue[i];
+                if(!packet.bQueued)
+                    continue;
+
+                if(packet.type <= curWaitType && packet.distance > bestPacketDistance)
+                {
+                    bestPacket = i;
+                    bestPacketDistance = packet.distance;
+                    bFoundPacket = true;
+                }
+            }
+        }
+
+        if(bFoundPacket)
+            return true;
+
+        curWaitType++;
+    }
+
+    return false;
+}
+
+static void ReferenceMarkDropped(TraceQueue &queue, UINT pos)
+{
+    queue[pos].distance = 0;
+
+    for(UINT i=pos+1; i!=queue.end; i++)
+    {
+        UINT distance = (i-pos);
+        if(queue[i].distance <= distance)
+            break;
+
+        queue[i].distance = distance;
+    }
+
+    for(UINT i=pos; i!=queue.begin;)
+    {
+        i--;
+
+        UINT distance = (pos-i);
+        if(queue[i].distance <= distance)
+            break;
+
+        queue[i].distance = distance;
+    }
+}
+
+//--------------------------------------------------------------------------
+// the publisher side, as in RTMPPublisher
+
+struct TraceStats
+{
+    UINT numPackets, numDropChecks, numBFramesDumped, numPFramesDumped, numFullDrops, numSent;
+};
+
+class TracePublisher
+{
+    TraceQueue queue;
+    FrameDropIndex dropIndex;
+    UINT dropIndexPos;
+    int packetWaitType;
+
+    bool bCheckAll;
+
+public:
+    TraceStats stats;
+    bool bFailed;
+
+    TracePublisher(UINT size, UINT startPos, bool bCheckAll)
+        : queue(size, startPos), dropIndex(size), dropIndexPos(startPos), packetWaitType(PacketType_VideoDisposable),
+          bCheckAll(bCheckAll), bFailed(false)
+    {
+        zero(&stats, sizeof(stats));
+    }
+
+    void CheckDistances()
+    {
+        for(UINT i=queue.begin; i!=queue.end; i++)
+        {
+            if(dropIndex.GetDistance(i) != queue[i].distance)
+            {
+                TestFail("distance of packet %u is %u in the index, %u in the reference", i-queue.begin, dropIndex.GetDistance(i), queue[i].distance);
+                bFailed = true;
+                return;
+            }
+        }
+    }
+
+    void DropFrame(UINT pos)
+    {
+        PacketType type = queue[pos].type;
+
+        dropIndex.Remove(pos);
+        queue[pos].bQueued = false;
+
+        if(type < PacketType_VideoHigh)
+            stats.numBFramesDumped++;
+        else
+            stats.numPFramesDumped++;
+
+        dropIndex.MarkDropped(pos, queue.begin, queue.end);
+        ReferenceMarkDropped(queue, pos);
+
+        bool bSetPriority = true;
+        for(UINT i=pos+1; i!=queue.end; i++)
+        {
+            TraceSlot &packet = queue[i];
+            if(!packet.bQueued || packet.type == PacketType_Audio)
+                continue;
+
+            if(type >= PacketType_VideoHigh)
+            {
+                if(packet.type < PacketType_VideoHighest)
+                {
+                    dropIndex.Remove(i);
+                    packet.bQueued = false;
+
+                    if(packet.type < PacketType_VideoHigh)
+                        stats.numBFramesDumped++;
+                    else
+                        stats.numPFramesDumped++;
+                }
+                else
+                {
+                    bSetPriority = false;
+                    break;
+                }
+            }
+            else if(packet.type >= type)
+            {
+                bSetPriority = false;
+                break;
+            }
+        }
+
+        if(bSetPriority)
+        {
+            if(type >= PacketType_VideoHigh)
+                packetWaitType = PacketType_VideoHighest;
+            else if(packetWaitType < type)
+                packetWaitType = type;
+        }
+    }
+
+    bool DoIFrameDelay(bool bBFramesOnly)
+    {
+        UINT pos, refPos;
+        bool bFound    = dropIndex.SelectDrop(bBFramesOnly, queue.begin, queue.end, pos);
+        bool bRefFound = ReferenceSelectDrop(queue, bBFramesOnly, refPos);
+
+        stats.numDropChecks++;
+
+        if(bFound != bRefFound || (bFound && pos != refPos))
+        {
+            TestFail("drop check %u (%s): index picked %d, the reference picked %d", stats.numDropChecks, bBFramesOnly ? "b-frames" : "all",
+                bFound ? int(pos-queue.begin) : -1, bRefFound ? int(refPos-queue.begin) : -1);
+            bFailed = true;
+            return false;
+        }
+
+        if(!bFound)
+            return false;
+
+        DropFrame(pos);
+        if(bCheckAll)
+            CheckDistances();
+
+        return !bFailed;
+    }
+
+    void ProcessPackets(UINT bframeDropThreshold, UINT dropThreshold)
+    {
+        for(UINT first = queue.begin; dropIndexPos != first; dropIndexPos++)
+            dropIndex.Remove(dropIndexPos);
+
+        //thresholds are in queued packets rather than milliseconds, the trace has no clock
+        if(queue.Num() >= dropThreshold)
+        {
+            stats.numFullDrops++;
+            while(DoIFrameDelay(false));
+        }
+        else if(queue.Num() >= bframeDropThreshold)
+            while(DoIFrameDelay(true));
+    }
+
+    void SendPacket(PacketType type)
+    {
+        stats.numPackets++;
+
+        if(type < packetWaitType)
+            return;
+        if(type != PacketType_Audio)
+            packetWaitType = PacketType_VideoDisposable;
+
+        if(queue.IsFull())
+        {
+            TestFail("send queue filled up, the trace is too congested");
+            bFailed = true;
+            return;
+        }
+
+        UINT pos = queue.end;
+        UINT distance = queue.Num() ? queue[pos-1].distance+1 : 10000;
+
+        TraceSlot &slot = queue[pos];
+        slot.type = type;
+        slot.distance = distance;
+        slot.bQueued = true;
+        queue.end++;
+
+        dropIndex.Add(pos, type, distance);
+    }
+
+    //the send thread, takes up to num packets and skips over the dropped ones
+    void Send(UINT num)
+    {
+        while(num && queue.Num())
+        {
+            if(queue[queue.begin].bQueued)
+            {
+                queue[queue.begin].bQueued = false;
+                stats.numSent++;
+                num--;
+            }
+
+            queue.begin++;
+        }
+    }
+};
+
+//60fps with ~47 audio packets a second.  gop of keyint frames, two b-frames between refs, a
+//third of them referenced
+static PacketType NextVideoType(UINT frame, UINT keyint, TestRandom &random)
+{
+    if(frame % keyint == 0)
+        return PacketType_VideoHighest;
+    if(frame % 3 == 0)
+        return PacketType_VideoHigh;
+
+    return (random.Next() % 3 == 0) ? PacketType_VideoLow : PacketType_VideoDisposable;
+}
+
+static bool RunTrace(CTSTR name, UINT queueSize, UINT startPos, UINT numFrames, UINT keyint, bool bCheckAll, UINT seed)
+{
+    TestRandom random(seed);
+    TracePublisher publisher(queueSize, startPos, bCheckAll);
+
+    UINT bframeDropThreshold = queueSize/4;
+    UINT dropThreshold       = queueSize/2;
+
+    //alternates between a link that keeps up and one that stalls for a while
+    bool bCongested = false;
+    UINT phaseFrames = 0;
+    double audioClock = 0.0;
+
+    for(UINT frame=0; frame<numFrames && !publisher.bFailed; frame++)
+    {
+        if(!phaseFrames)
+        {
+            bCongested = !bCongested;
+            phaseFrames = 30 + random.Next()%(bCongested ? queueSize/3 : 300);
+        }
+        phaseFrames--;
+
+        publisher.ProcessPackets(bframeDropThreshold, dropThreshold);
+        publisher.SendPacket(NextVideoType(frame, keyint, random));
+
+        for(audioClock += 1000.0/60.0; audioClock >= 21.333; audioClock -= 21.333)
+        {
+            publisher.ProcessPackets(bframeDropThreshold, dropThreshold);
+            publisher.SendPacket(PacketType_Audio);
+        }
+
+        publisher.Send(bCongested ? random.Next()%2 : 3 + random.Next()%3);
+    }
+
+    if(!publisher.bFailed)
+        publisher.CheckDistances();
+
+    TraceStats &stats = publisher.stats;
+    TestResult(!publisher.bFailed, "%s: %u packets, %u drop checks, %u b-frames and %u p-frames dropped, %u full flushes",
+        name, stats.numPackets, stats.numDropChecks, stats.numBFramesDumped, stats.numPFramesDumped, stats.numFullDrops);
+
+    return !publisher.bFailed;
+}
+
+//--------------------------------------------------------------------------
+// drain benchmark: a full queue flushed with while(DoIFrameDelay(false)), like ProcessPackets
+
+static void FillQueue(TraceQueue &queue, FrameDropIndex *dropIndex, UINT numFrames, TestRandom &random)
+{
+    double audioClock = 0.0;
+
+    for(UINT frame=0; frame<numFrames; frame++)
+    {
+        for(int i=0; i<2; i++)
+        {
+            PacketType type = PacketType_Audio;
+            if(i == 0)
+                type = NextVideoType(frame, 250, random);
+            else if((audioClock += 1000.0/60.0) >= 21.333)
+                audioClock -= 21.333;
+            else
+                continue;
+
+            UINT pos = queue.end++;
+            queue[pos].type = type;
+            queue[pos].distance = (pos != queue.begin) ? queue[pos-1].distance+1 : 10000;
+            queue[pos].bQueued = true;
+
+            if(dropIndex)
+                dropIndex->Add(pos, type, queue[pos].distance);
+        }
+    }
+}
+
+static void RunDrainBenchmark(UINT queueSize)
+{
+    UINT numFrames = queueSize*7/16;
+
+    TestRandom random(1), random2(1);
+    TraceQueue indexQueue(queueSize, 0), refQueue(queueSize, 0);
+    FrameDropIndex dropIndex(queueSize);
+
+    FillQueue(indexQueue, &dropIndex, numFrames, random);
+    FillQueue(refQueue, NULL, numFrames, random2);
+
+    UINT numIndexDrops = 0, numRefDrops = 0, pos;
+
+    QWORD start = TestTimeNS();
+    while(dropIndex.SelectDrop(false, indexQueue.begin, indexQueue.end, pos))
+    {
+        dropIndex.Remove(pos);
+        dropIndex.MarkDropped(pos, indexQueue.begin, indexQueue.end);
+        indexQueue[pos].bQueued = false;
+        numIndexDrops++;
+    }
+    QWORD indexTime = TestTimeNS()-start;
+
+    start = TestTimeNS();
+    while(ReferenceSelectDrop(refQueue, false, pos))
+    {
+        ReferenceMarkDropped(refQueue, pos);
+        refQueue[pos].bQueued = false;
+        numRefDrops++;
+    }
+    QWORD refTime = TestTimeNS()-start;
+
+    printf("%5u packets queued, %5u drops:  index %8.3f ms   linear scans %8.3f ms   (%.1fx)\n",
+        indexQueue.Num(), numIndexDrops, double(indexTime)/1e6, double(refTime)/1e6, double(refTime)/double(indexTime));
+
+    if(numIndexDrops != numRefDrops)
+        printf("    the index dropped %u frames, the scans %u\n", numIndexDrops, numRefDrops);
+}
+
+//--------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        printf("draining a congested send queue:\n");
+        for(UINT size=512; size<=8192; size *= 2)
+            RunDrainBenchmark(size);
+        return 0;
+    }
+
+    bool bSuccess = true;
+
+    //small queues wrap around the ring a lot, the real one is 8192 slots
+    bSuccess &= RunTrace("256 slots",                        256,  0,          20000, 60,  true,  1);
+    bSuccess &= RunTrace("256 slots, keyint 250",            256,  0,          20000, 250, true,  2);
+    bSuccess &= RunTrace("1024 slots, counters wrap",        1024, 0xFFFFF000, 40000, 120, true,  3);
+    bSuccess &= RunTrace("8192 slots",                       8192, 0,          60000, 120, false, 4);
+
+    return TestSummary(bSuccess);
+}
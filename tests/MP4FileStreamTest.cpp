@@ -0,0 +1,972 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+//MP4 recording: synthetic FLV-style packets go into the real MP4FileStream, which writes into
+//memory, and the file that comes out is walked box by box.  fragmented files have to be an
+//empty moov followed by moof+mdat pairs that start on keyframes, have contiguous decode times
+//and point at exactly the bytes that went in, and every fragment has to be flushed as soon as
+//it's written so the file is playable up to it.  regular files have to have the same samples
+//through their sample tables.
+
+#include "Main.h"
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+//-------------------------------------------
+// the parts of OBS.h that MP4FileStream.cpp uses, with just enough behind them
+
+struct DataPacket
+{
+    LPBYTE lpPacket;
+    UINT size;
+};
+
+class VideoFileStream
+{
+public:
+    virtual ~VideoFileStream() {}
+    virtual void AddPacket(PacketBuffer *packet, DWORD timestamp, PacketType type)=0;
+};
+
+static std::vector<BYTE> testVideoHeaders, testAudioHeaders, testSEI;
+
+class AudioEncoder
+{
+public:
+    UINT  GetFrameSize() const  {return 1024;}
+    int   GetBitRate() const    {return 160;}
+    CTSTR GetCodec() const      {return TEXT("AAC");}
+    void  GetHeaders(DataPacket &packet) {packet.lpPacket = &testAudioHeaders[0]; packet.size = UINT(testAudioHeaders.size());}
+};
+
+class VideoEncoder
+{
+public:
+    void GetHeaders(DataPacket &packet) {packet.lpPacket = &testVideoHeaders[0]; packet.size = UINT(testVideoHeaders.size());}
+    void GetSEI(DataPacket &packet)     {packet.lpPacket = &testSEI[0]; packet.size = UINT(testSEI.size());}
+};
+
+struct VideoStreamInfo
+{
+    VideoEncoder *encoder;
+    UINT width, height;
+    UINT fps;
+};
+
+class OBS
+{
+public:
+    AudioEncoder audioEncoder;
+    VideoEncoder videoEncoder;
+    bool bDisableSceneSwitching;
+    UINT sceneSwitchingCalls;
+
+    UINT GetSampleRateHz() const                        {return 44100;}
+    AudioEncoder* GetAudioEncoder()                     {return &audioEncoder;}
+    void GetAudioHeaders(DataPacket &packet)            {audioEncoder.GetHeaders(packet);}
+    std::thread::id mainThreadID;
+
+    void EnableSceneSwitching(bool bEnable)             {bDisableSceneSwitching = !bEnable; sceneSwitchingCalls++;}
+    bool IsSceneSwitchingEnabled() const                {return !bDisableSceneSwitching;}
+    bool IsMainThread() const                           {return std::this_thread::get_id() == mainThreadID;}
+    void GetVideoStreamInfo(VideoStreamInfo &info)      {info.encoder = &videoEncoder; info.width = 1280; info.height = 720; info.fps = 30;}
+};
+
+#define OBS_VERSION_STRING_ANSI "Open Broadcaster Software test"
+
+static OBS testApp;
+static OBS *App = &testApp;
+
+static int testFragmented, testFragmentDuration = 2000;
+
+class TestConfigFile
+{
+public:
+    int GetInt(CTSTR lpSection, CTSTR lpKey, int def=0)
+    {
+        if(scmp(lpKey, TEXT("FragmentedMP4")) == 0)
+            return testFragmented;
+        if(scmp(lpKey, TEXT("MP4FragmentDuration")) == 0)
+            return testFragmentDuration;
+        return def;
+    }
+};
+
+static TestConfigFile testConfig;
+static TestConfigFile *AppConfig = &testConfig;
+
+//files live in memory, and every flush is remembered so the test knows what a crash would keep
+static std::map<std::string, std::vector<BYTE> > testFiles;
+static std::vector<UINT64> testFlushes;
+static bool testWriteFailed;
+
+class AsyncFileWriter : public Serializer
+{
+    std::vector<BYTE> *file;
+
+public:
+    AsyncFileWriter() : file(NULL) {}
+
+    bool Open(CTSTR lpFile) {file = &testFiles[lpFile]; file->clear(); testFlushes.clear(); return true;}
+    void Close()            {if(file) testFlushes.push_back(file->size()); file = NULL;}
+    void Flush()            {testFlushes.push_back(file->size());}
+
+    BOOL IsLoading() {return FALSE;}
+    void Serialize(LPCVOID lpData, DWORD length) {file->insert(file->end(), (const BYTE*)lpData, (const BYTE*)lpData+length);}
+    UINT64 Seek(INT64 offset, DWORD seekType=SERIALIZE_SEEK_START) {return GetPos();}
+    UINT64 GetPos() const {return file->size();}
+
+    bool WriteFailed() const {return testWriteFailed;}
+};
+
+#define XFILE_WRITE         0x2
+#define XFILE_OPENEXISTING  3
+#define XFILE_BEGIN         1
+
+class XFile
+{
+    std::vector<BYTE> *file;
+    UINT64 pos;
+
+public:
+    XFile() : file(NULL), pos(0) {}
+
+    BOOL Open(CTSTR lpFile, DWORD dwAccess, DWORD dwCreationDisposition)
+    {
+        if(!testFiles.count(lpFile))
+            return FALSE;
+        file = &testFiles[lpFile];
+        pos = 0;
+        return TRUE;
+    }
+
+    QWORD SetPos(INT64 iPos, DWORD dwMoveMethod) {return pos = UINT64(iPos);}
+
+    DWORD Write(const void *lpBuffer, DWORD dwBytes)
+    {
+        if(pos+dwBytes > file->size())
+            file->resize(size_t(pos+dwBytes));
+        mcpy(&(*file)[size_t(pos)], lpBuffer, dwBytes);
+        pos += dwBytes;
+        return dwBytes;
+    }
+
+    void Close() {file = NULL;}
+};
+
+//the build progress dialog, never shown here
+#define WM_INITDIALOG   0x0110
+#define WM_COMMAND      0x0111
+#define DWLP_USER       8
+#define IDCANCEL        2
+#define IDYES           6
+#define MB_YESNO        4
+#define LOWORD(val)     WORD(val)
+
+inline void LocalizeWindow(HWND hwnd) {}
+inline CTSTR Str(CTSTR lpLookup) {return lpLookup;}
+inline LONG_PTR SetWindowLongPtr(HWND hwnd, int index, LONG_PTR val) {return 0;}
+inline LONG_PTR GetWindowLongPtr(HWND hwnd, int index) {return 0;}
+inline int MessageBox(HWND hwnd, CTSTR lpText, CTSTR lpCaption, UINT type) {return 0;}
+inline BOOL EndDialog(HWND hwnd, INT_PTR result) {return TRUE;}
+
+#include "PacketBuffer.cpp"
+#include "MP4FileStream.cpp"
+
+//-------------------------------------------
+// input
+
+struct InputSample
+{
+    UINT64 decodeTime;      //ms for video, samples for audio
+    INT compositionOffset;
+    bool bKeyframe;
+    std::vector<BYTE> data; //as it has to come out in the file
+};
+
+struct InputPackets
+{
+    std::vector<PacketBuffer*> packets;
+    std::vector<DWORD> timestamps;
+    std::vector<PacketType> types;
+
+    std::vector<InputSample> video, audio;
+
+    ~InputPackets()
+    {
+        for(size_t i=0; i<packets.size(); i++)
+            packets[i]->Release();
+    }
+
+    void Add(const std::vector<BYTE> &data, DWORD timestamp, PacketType type)
+    {
+        packets.push_back(PacketBuffer::Create(&data[0], UINT(data.size())));
+        timestamps.push_back(timestamp);
+        types.push_back(type);
+    }
+};
+
+static void AppendBE(std::vector<BYTE> &data, UINT val, UINT size)
+{
+    for(UINT i=0; i<size; i++)
+        data.push_back(BYTE(val >> ((size-1-i)*8)));
+}
+
+static void SetupHeaders()
+{
+    static const BYTE sps[] = {0x67, 0x64, 0x00, 0x1F, 0xAC, 0xD9, 0x40, 0x50, 0x05, 0xBB, 0x01, 0x10};
+    static const BYTE pps[] = {0x68, 0xEB, 0xE3, 0xCB, 0x22, 0xC0};
+
+    //FLV AVC sequence header: the SPS length is at offset 11
+    testVideoHeaders.clear();
+    BYTE videoStart[] = {0x17, 0x00, 0x00, 0x00, 0x00, 0x01, sps[1], sps[2], sps[3], 0xFF, 0xE1};
+    testVideoHeaders.insert(testVideoHeaders.end(), videoStart, videoStart+sizeof(videoStart));
+    AppendBE(testVideoHeaders, sizeof(sps), 2);
+    testVideoHeaders.insert(testVideoHeaders.end(), sps, sps+sizeof(sps));
+    testVideoHeaders.push_back(0x01);
+    AppendBE(testVideoHeaders, sizeof(pps), 2);
+    testVideoHeaders.insert(testVideoHeaders.end(), pps, pps+sizeof(pps));
+
+    //AAC LC, 44.1khz stereo
+    BYTE audioHeaders[] = {0xAF, 0x00, 0x12, 0x10};
+    testAudioHeaders.assign(audioHeaders, audioHeaders+sizeof(audioHeaders));
+
+    BYTE sei[] = {0x00, 0x00, 0x00, 0x05, 0x06, 0x05, 0x01, 0x42, 0x80};
+    testSEI.assign(sei, sei+sizeof(sei));
+}
+
+//video at 30fps with a keyframe every keyframeInterval frames, AAC frames in between, all in
+//timestamp order the way the encoders hand them out.  a sequence header goes in with the first
+//keyframe, and some audio before it that has to be dropped
+static void MakePackets(InputPackets &input, UINT seconds, UINT keyframeInterval, UINT frameSize)
+{
+    TestRandom random(seconds*1000 + keyframeInterval);
+    const DWORD startTime = 5000;
+
+    UINT numVideo = seconds*30;
+    UINT numAudio = seconds*44100/1024;
+    UINT v = 0, a = 0;
+
+    for(DWORD t=startTime-100; t<startTime; t+=23)
+    {
+        BYTE early[] = {0xAF, 0x01, 0x21, 0x00};
+        input.Add(std::vector<BYTE>(early, early+sizeof(early)), t, PacketType_Audio);
+    }
+
+    while(v < numVideo || a < numAudio)
+    {
+        DWORD videoTime = startTime + v*1000/30;
+        DWORD audioTime = startTime + DWORD(UINT64(a)*1024*1000/44100);
+
+        if(v < numVideo && (a >= numAudio || videoTime <= audioTime))
+        {
+            bool bKeyframe = (v % keyframeInterval) == 0;
+            INT compositionOffset = (v % 3)*33;
+
+            InputSample sample;
+            sample.decodeTime = videoTime-startTime;
+            sample.compositionOffset = compositionOffset;
+            sample.bKeyframe = bKeyframe;
+
+            if(v == 0)
+            {
+                input.Add(testVideoHeaders, videoTime, PacketType_VideoHighest);
+
+                //the SPS and PPS get length prefixes in place of the FLV framing
+                const BYTE *headers = &testVideoHeaders[11];
+                UINT spsSize = (headers[0]<<8) | headers[1];
+                AppendBE(sample.data, spsSize, 4);
+                sample.data.insert(sample.data.end(), headers+2, headers+2+spsSize);
+                headers += spsSize+3;
+                UINT ppsSize = (headers[0]<<8) | headers[1];
+                AppendBE(sample.data, ppsSize, 4);
+                sample.data.insert(sample.data.end(), headers+2, headers+2+ppsSize);
+
+                sample.data.insert(sample.data.end(), testSEI.begin(), testSEI.end());
+            }
+
+            UINT nalSize = bKeyframe ? frameSize*4 : frameSize/2 + random.Next()%frameSize;
+            std::vector<BYTE> packet;
+            packet.push_back(bKeyframe ? 0x17 : 0x27);
+            packet.push_back(0x01);
+            AppendBE(packet, UINT(compositionOffset), 3);
+            AppendBE(packet, nalSize, 4);
+            for(UINT i=0; i<nalSize; i++)
+                packet.push_back(BYTE(random.Next()));
+
+            sample.data.insert(sample.data.end(), packet.begin()+5, packet.end());
+            input.video.push_back(sample);
+
+            input.Add(packet, videoTime, bKeyframe ? PacketType_VideoHighest : PacketType_VideoLow);
+            v++;
+        }
+        else
+        {
+            UINT frameBytes = 300 + random.Next()%200;
+            std::vector<BYTE> packet;
+            packet.push_back(0xAF);
+            packet.push_back(0x01);
+            for(UINT i=0; i<frameBytes; i++)
+                packet.push_back(BYTE(random.Next()));
+
+            InputSample sample;
+            sample.decodeTime = 0;
+            sample.compositionOffset = 0;
+            sample.bKeyframe = true;
+            sample.data.assign(packet.begin()+2, packet.end());
+            input.audio.push_back(sample);
+
+            input.Add(packet, audioTime, PacketType_Audio);
+            a++;
+        }
+    }
+}
+
+static void Record(InputPackets &input, CTSTR lpFile)
+{
+    VideoFileStream *stream = CreateMP4FileStream(lpFile);
+    for(size_t i=0; i<input.packets.size(); i++)
+        stream->AddPacket(input.packets[i], input.timestamps[i], input.types[i]);
+    delete stream;
+}
+
+//-------------------------------------------
+// box walking
+
+struct Box
+{
+    DWORD type;
+    UINT64 start, size;
+    UINT64 dataStart;       //after the header
+};
+
+static UINT BE32(const BYTE *data) {return (UINT(data[0])<<24) | (UINT(data[1])<<16) | (UINT(data[2])<<8) | UINT(data[3]);}
+static UINT64 BE64(const BYTE *data) {return (UINT64(BE32(data))<<32) | BE32(data+4);}
+
+static std::string BoxName(DWORD type)
+{
+    char name[5] = {char(type>>24), char(type>>16), char(type>>8), char(type), 0};
+    return name;
+}
+
+//children of a range, false if any of them runs past its end
+static bool ReadBoxes(const std::vector<BYTE> &file, UINT64 start, UINT64 end, std::vector<Box> &boxes)
+{
+    boxes.clear();
+
+    UINT64 pos = start;
+    while(pos < end)
+    {
+        if(end-pos < 8)
+            return false;
+
+        Box box;
+        box.start = pos;
+        box.size = BE32(&file[pos]);
+        box.type = BE32(&file[pos+4]);
+        box.dataStart = pos+8;
+
+        if(box.size == 1)
+        {
+            if(end-pos < 16)
+                return false;
+            box.size = BE64(&file[pos+8]);
+            box.dataStart += 8;
+        }
+        else if(box.size == 0)
+            box.size = end-pos;
+
+        if(box.size < box.dataStart-pos || box.size > end-pos)
+            return false;
+
+        boxes.push_back(box);
+        pos += box.size;
+    }
+
+    return true;
+}
+
+static bool FindBox(const std::vector<BYTE> &file, const Box &parent, DWORD type, Box &found, UINT index=0, UINT64 skip=0)
+{
+    std::vector<Box> children;
+    if(!ReadBoxes(file, parent.dataStart+skip, parent.start+parent.size, children))
+        return false;
+
+    for(size_t i=0; i<children.size(); i++)
+    {
+        if(children[i].type == type && index-- == 0)
+        {
+            found = children[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//a path like "mdia/minf/stbl/stsz" below parent
+static bool FindPath(const std::vector<BYTE> &file, Box box, const char *path, Box &found)
+{
+    while(*path)
+    {
+        DWORD type = BE32((const BYTE*)path);
+        if(!FindBox(file, box, type, box))
+            return false;
+
+        path += 4;
+        if(*path == '/')
+            path++;
+    }
+
+    found = box;
+    return true;
+}
+
+//the trak with this track ID
+static bool FindTrack(const std::vector<BYTE> &file, const Box &moov, UINT trackID, Box &trak)
+{
+    for(UINT i=0; FindBox(file, moov, 'trak', trak, i); i++)
+    {
+        Box tkhd;
+        if(FindBox(file, trak, 'tkhd', tkhd) && BE32(&file[tkhd.dataStart+12]) == trackID)
+            return true;
+    }
+
+    return false;
+}
+
+//stco, or co64 once offsets pass 4GB
+static bool FindChunkOffsets(const std::vector<BYTE> &file, const Box &trak, Box &offsets, UINT &entrySize)
+{
+    entrySize = 4;
+    if(FindPath(file, trak, "mdia/minf/stbl/stco", offsets))
+        return true;
+
+    entrySize = 8;
+    return FindPath(file, trak, "mdia/minf/stbl/co64", offsets);
+}
+
+static UINT64 ChunkOffset(const std::vector<BYTE> &file, const Box &offsets, UINT entrySize, UINT chunk)
+{
+    const BYTE *entry = &file[offsets.dataStart+8+chunk*entrySize];
+    return (entrySize == 8) ? BE64(entry) : BE32(entry);
+}
+
+//-------------------------------------------
+// fragmented
+
+struct FragmentInfo
+{
+    UINT64 start, end;          //of the moof+mdat pair
+    UINT sequence;
+    bool bHasVideo;
+    UINT64 videoDecodeTime, audioDecodeTime;
+};
+
+//checks one traf against the input samples from firstSample on, and moves firstSample on past it
+static bool CheckTrackFragment(const std::vector<BYTE> &file, const Box &moof, const Box &traf, const Box &mdat,
+                               const std::vector<InputSample> &input, size_t &firstSample, bool bVideo,
+                               UINT64 &decodeTime, UINT64 &nextDecodeTime, UINT64 &dataEnd)
+{
+    Box tfhd, tfdt, trun;
+    if(!FindBox(file, traf, 'tfhd', tfhd) || !FindBox(file, traf, 'tfdt', tfdt) || !FindBox(file, traf, 'trun', trun))
+    {
+        TestFail("traf is missing tfhd, tfdt or trun");
+        return false;
+    }
+
+    if((BE32(&file[tfhd.dataStart]) & 0x020000) == 0)
+    {
+        TestFail("tfhd doesn't say offsets are from the moof");
+        return false;
+    }
+
+    decodeTime = (file[tfdt.dataStart] == 1) ? BE64(&file[tfdt.dataStart+4]) : BE32(&file[tfdt.dataStart+4]);
+
+    const BYTE *run = &file[trun.dataStart];
+    UINT flags = BE32(run) & 0xFFFFFF;
+    UINT count = BE32(run+4);
+    const BYTE *entry = run+8;
+
+    UINT64 dataPos = moof.start;
+    if(flags & 0x1)
+    {
+        dataPos += INT(BE32(entry));
+        entry += 4;
+    }
+    if(flags & 0x4)
+        entry += 4;
+
+    //the data has to be in this fragment's mdat
+    if(dataPos < mdat.dataStart)
+    {
+        TestFail("trun data offset points before the mdat");
+        return false;
+    }
+
+    UINT64 time = decodeTime;
+    for(UINT i=0; i<count; i++)
+    {
+        UINT duration = (flags & 0x100) ? BE32(entry) : 0; if(flags & 0x100) entry += 4;
+        UINT size     = (flags & 0x200) ? BE32(entry) : 0; if(flags & 0x200) entry += 4;
+        UINT sampleFlags = (flags & 0x400) ? BE32(entry) : 0x02000000; if(flags & 0x400) entry += 4;
+        INT offset    = (flags & 0x800) ? INT(BE32(entry)) : 0; if(flags & 0x800) entry += 4;
+
+        size_t index = firstSample+i;
+        if(index >= input.size())
+        {
+            TestFail("more samples than went in");
+            return false;
+        }
+
+        const InputSample &sample = input[index];
+
+        if(dataPos+size > mdat.start+mdat.size)
+        {
+            TestFail("sample %u runs past the mdat", UINT(index));
+            return false;
+        }
+
+        if(size != sample.data.size() || memcmp(&file[dataPos], &sample.data[0], size) != 0)
+        {
+            TestFail("%s sample %u has different bytes, %u against %u", bVideo ? "video" : "audio", UINT(index), size, UINT(sample.data.size()));
+            return false;
+        }
+
+        bool bSync = (sampleFlags & 0x02000000) != 0 && (sampleFlags & 0x00010000) == 0;
+        if(bVideo && (bSync != sample.bKeyframe || offset != sample.compositionOffset || time != sample.decodeTime))
+        {
+            TestFail("video sample %u: keyframe %d, composition offset %d, time %u, wanted %d, %d, %u", UINT(index),
+                bSync, offset, UINT(time), sample.bKeyframe, sample.compositionOffset, UINT(sample.decodeTime));
+            return false;
+        }
+
+        if(duration == 0)
+        {
+            TestFail("%s sample %u has no duration", bVideo ? "video" : "audio", UINT(index));
+            return false;
+        }
+
+        time += duration;
+        dataPos += size;
+    }
+
+    firstSample += count;
+    nextDecodeTime = time;
+    dataEnd = dataPos;
+    return true;
+}
+
+//bKeyframeStarts is off when fragments were forced out by size and can start anywhere
+static bool CheckFragmentedFile(const std::vector<BYTE> &file, const InputPackets &input, std::vector<FragmentInfo> &fragments, bool bKeyframeStarts)
+{
+    std::vector<Box> boxes;
+    if(!ReadBoxes(file, 0, file.size(), boxes))
+    {
+        TestFail("top level boxes don't add up to the file size");
+        return false;
+    }
+
+    if(boxes.size() < 5 || boxes[0].type != 'ftyp' || boxes[1].type != 'free' || boxes[2].type != 'moov')
+    {
+        TestFail("doesn't start with ftyp, free, moov");
+        return false;
+    }
+
+    //the moov describes the tracks but none of the samples
+    const Box &moov = boxes[2];
+    Box mvex, trex;
+    if(!FindBox(file, moov, 'mvex', mvex) || !FindBox(file, mvex, 'trex', trex, 0) || !FindBox(file, mvex, 'trex', trex, 1))
+    {
+        TestFail("moov has no mvex with two trex");
+        return false;
+    }
+
+    for(UINT trackID=1; trackID<=2; trackID++)
+    {
+        Box trak, stsz, stts, stco;
+        UINT entrySize;
+        if(!FindTrack(file, moov, trackID, trak) || !FindPath(file, trak, "mdia/minf/stbl/stsz", stsz) ||
+           !FindPath(file, trak, "mdia/minf/stbl/stts", stts) || !FindChunkOffsets(file, trak, stco, entrySize))
+        {
+            TestFail("track %u is missing its sample tables", trackID);
+            return false;
+        }
+
+        if(BE32(&file[stsz.dataStart+8]) != 0 || BE32(&file[stts.dataStart+4]) != 0 || BE32(&file[stco.dataStart+4]) != 0)
+        {
+            TestFail("track %u has samples in the moov", trackID);
+            return false;
+        }
+    }
+
+    Box avcC;
+    Box videoTrak;
+    if(!FindTrack(file, moov, 2, videoTrak) || !FindPath(file, videoTrak, "mdia/minf/stbl/stsd", avcC) ||
+       !FindBox(file, avcC, 'avc1', avcC, 0, 8) || !FindBox(file, avcC, 'avcC', avcC, 0, 78) ||
+       memcmp(&file[avcC.dataStart+8], &testVideoHeaders[13], 12) != 0)
+    {
+        TestFail("avcC doesn't have the SPS");
+        return false;
+    }
+
+    //then moof+mdat pairs
+    size_t videoSample = 0, audioSample = 0;
+    UINT64 nextVideoTime = 0, nextAudioTime = 0;
+
+    for(size_t i=3; i<boxes.size(); i += 2)
+    {
+        if(boxes[i].type != 'moof' || i+1 >= boxes.size() || boxes[i+1].type != 'mdat')
+        {
+            TestFail("box %u is %s, not a moof+mdat pair", UINT(i), BoxName(boxes[i].type).c_str());
+            return false;
+        }
+
+        const Box &moof = boxes[i], &mdat = boxes[i+1];
+
+        FragmentInfo fragment;
+        fragment.start = moof.start;
+        fragment.end = mdat.start+mdat.size;
+        fragment.bHasVideo = false;
+
+        Box mfhd;
+        if(!FindBox(file, moof, 'mfhd', mfhd))
+        {
+            TestFail("moof has no mfhd");
+            return false;
+        }
+        fragment.sequence = BE32(&file[mfhd.dataStart+4]);
+
+        //video first, then audio, back to back in the mdat
+        UINT64 dataPos = mdat.dataStart;
+        Box traf;
+        for(UINT t=0; FindBox(file, moof, 'traf', traf, t); t++)
+        {
+            Box tfhd;
+            FindBox(file, traf, 'tfhd', tfhd);
+            bool bVideo = BE32(&file[tfhd.dataStart+4]) == 2;
+
+            UINT64 decodeTime, dataEnd;
+            bool bGood;
+            if(bVideo)
+            {
+                size_t first = videoSample;
+                bGood = CheckTrackFragment(file, moof, traf, mdat, input.video, videoSample, true, decodeTime, nextVideoTime, dataEnd);
+                if(bGood && bKeyframeStarts && !input.video[first].bKeyframe)
+                {
+                    TestFail("fragment %u starts on video sample %u, which isn't a keyframe", UINT(fragments.size()), UINT(first));
+                    bGood = false;
+                }
+                fragment.videoDecodeTime = decodeTime;
+                fragment.bHasVideo = true;
+            }
+            else
+            {
+                size_t first = audioSample;
+                UINT64 expected = nextAudioTime;
+                bGood = CheckTrackFragment(file, moof, traf, mdat, input.audio, audioSample, false, decodeTime, nextAudioTime, dataEnd);
+                if(bGood && first && decodeTime != expected)
+                {
+                    TestFail("audio decode time %u, the last fragment ended at %u", UINT(decodeTime), UINT(expected));
+                    bGood = false;
+                }
+                fragment.audioDecodeTime = decodeTime;
+            }
+
+            if(!bGood)
+                return false;
+
+            dataPos = dataEnd;
+        }
+
+        if(dataPos != mdat.start+mdat.size)
+        {
+            TestFail("fragment %u: the truns cover %u of %u mdat bytes", UINT(fragments.size()), UINT(dataPos-mdat.dataStart), UINT(mdat.size-8));
+            return false;
+        }
+
+        fragments.push_back(fragment);
+    }
+
+    if(videoSample != input.video.size() || audioSample != input.audio.size())
+    {
+        TestFail("%u/%u video and %u/%u audio samples came out", UINT(videoSample), UINT(input.video.size()), UINT(audioSample), UINT(input.audio.size()));
+        return false;
+    }
+
+    return true;
+}
+
+static bool TestFragmented()
+{
+    testFragmented = 1;
+    testFragmentDuration = 2000;
+
+    //10s with a keyframe every second, so fragments start every other keyframe
+    InputPackets input;
+    MakePackets(input, 10, 30, 2000);
+    testApp.sceneSwitchingCalls = 0;
+    Record(input, TEXT("fragmented.mp4"));
+
+    const std::vector<BYTE> &file = testFiles["fragmented.mp4"];
+    std::vector<FragmentInfo> fragments;
+    bool bParsed = CheckFragmentedFile(file, input, fragments, true);
+    bool bSuccess = TestResult(bParsed, "fragmented file parses, samples match what went in (%u fragments)", UINT(fragments.size()));
+    if(!bSuccess)
+        return false;
+
+    bool bTiming = fragments.size() == 5;
+    for(size_t i=0; i<fragments.size(); i++)
+    {
+        bTiming &= fragments[i].sequence == i+1;
+        bTiming &= fragments[i].bHasVideo && fragments[i].videoDecodeTime == i*2000;
+    }
+    bSuccess &= TestResult(bTiming, "a fragment every 2s, on keyframes, numbered in order");
+
+    //every fragment is on its way to disk as soon as it's written, so a crash keeps it
+    bool bFlushed = testFlushes.size() >= fragments.size();
+    for(size_t i=0; i<fragments.size() && bFlushed; i++)
+        bFlushed = std::find(testFlushes.begin(), testFlushes.end(), fragments[i].end) != testFlushes.end();
+    bSuccess &= TestResult(bFlushed, "every fragment is flushed as soon as it's written");
+
+    //cut the file after any fragment and what's left is still whole boxes
+    bool bTruncated = true;
+    for(size_t i=0; i<fragments.size() && bTruncated; i++)
+    {
+        std::vector<Box> boxes;
+        bTruncated = ReadBoxes(file, 0, fragments[i].end, boxes) && boxes.size() == 3 + (i+1)*2;
+    }
+    bSuccess &= TestResult(bTruncated, "cut after any fragment, the file is still whole boxes");
+
+    bSuccess &= TestResult(testApp.sceneSwitchingCalls == 0, "finishing a fragmented file leaves scene switching alone");
+
+    return bSuccess;
+}
+
+//keyframes stop, so fragments have to be forced out by size
+static bool TestForcedFragments()
+{
+    testFragmented = 1;
+    testFragmentDuration = 2000;
+
+    InputPackets input;
+    MakePackets(input, 10, 100000, 250000);
+    Record(input, TEXT("forced.mp4"));
+
+    const std::vector<BYTE> &file = testFiles["forced.mp4"];
+    std::vector<FragmentInfo> fragments;
+    bool bGood = CheckFragmentedFile(file, input, fragments, false);
+
+    UINT64 largest = 0;
+    for(size_t i=0; i<fragments.size(); i++)
+        largest = MAX(largest, fragments[i].end-fragments[i].start);
+
+    bGood &= fragments.size() >= 2 && largest < MP4_MAX_FRAGMENT_SIZE + 2*1024*1024;
+    return TestResult(bGood, "without keyframes, fragments are cut at %uMB (%u fragments, largest %.1fMB)",
+        MP4_MAX_FRAGMENT_SIZE/(1024*1024), UINT(fragments.size()), double(largest)/(1024.0*1024.0));
+}
+
+//-------------------------------------------
+// regular
+
+//sample offsets from stsc, chunk offsets and stsz, checked against the input
+static bool CheckSampleTables(const std::vector<BYTE> &file, const Box &trak, const std::vector<InputSample> &input, const char *name)
+{
+    Box stsz, stsc, stco, stts;
+    UINT entrySize;
+    if(!FindPath(file, trak, "mdia/minf/stbl/stsz", stsz) || !FindPath(file, trak, "mdia/minf/stbl/stsc", stsc) ||
+       !FindChunkOffsets(file, trak, stco, entrySize) || !FindPath(file, trak, "mdia/minf/stbl/stts", stts))
+    {
+        TestFail("%s track is missing its sample tables", name);
+        return false;
+    }
+
+    UINT numSamples = BE32(&file[stsz.dataStart+8]);
+    if(numSamples != input.size())
+    {
+        TestFail("%s track has %u samples, %u went in", name, numSamples, UINT(input.size()));
+        return false;
+    }
+
+    UINT numTimes = BE32(&file[stts.dataStart+4]), timedSamples = 0;
+    for(UINT i=0; i<numTimes; i++)
+        timedSamples += BE32(&file[stts.dataStart+8+i*8]);
+    if(timedSamples != numSamples)
+    {
+        TestFail("%s track has times for %u of %u samples", name, timedSamples, numSamples);
+        return false;
+    }
+
+    UINT numChunks = BE32(&file[stco.dataStart+4]);
+    UINT numRuns = BE32(&file[stsc.dataStart+4]);
+    UINT sample = 0;
+
+    for(UINT chunk=0; chunk<numChunks; chunk++)
+    {
+        //the last run that starts at or before this chunk (chunk numbers are 1 based)
+        UINT samplesPerChunk = 0;
+        for(UINT run=0; run<numRuns; run++)
+        {
+            if(BE32(&file[stsc.dataStart+8+run*12]) <= chunk+1)
+                samplesPerChunk = BE32(&file[stsc.dataStart+8+run*12+4]);
+        }
+
+        UINT64 pos = ChunkOffset(file, stco, entrySize, chunk);
+        for(UINT i=0; i<samplesPerChunk && sample < numSamples; i++, sample++)
+        {
+            UINT size = BE32(&file[stsz.dataStart+12+sample*4]);
+            if(size != input[sample].data.size() || pos+size > file.size() || memcmp(&file[pos], &input[sample].data[0], size) != 0)
+            {
+                TestFail("%s sample %u has different bytes", name, sample);
+                return false;
+            }
+            pos += size;
+        }
+    }
+
+    if(sample != numSamples)
+    {
+        TestFail("%s chunks cover %u of %u samples", name, sample, numSamples);
+        return false;
+    }
+
+    return true;
+}
+
+static bool TestRegular()
+{
+    testFragmented = 0;
+
+    InputPackets input;
+    MakePackets(input, 5, 30, 2000);
+    testApp.sceneSwitchingCalls = 0;
+    Record(input, TEXT("regular.mp4"));
+
+    const std::vector<BYTE> &file = testFiles["regular.mp4"];
+
+    std::vector<Box> boxes;
+    bool bGood = ReadBoxes(file, 0, file.size(), boxes) && boxes.size() == 4 &&
+                 boxes[0].type == 'ftyp' && boxes[1].type == 'free' && boxes[2].type == 'mdat' && boxes[3].type == 'moov';
+
+    Box videoTrak, audioTrak, stss;
+    bGood = bGood && FindTrack(file, boxes[3], 2, videoTrak) && FindTrack(file, boxes[3], 1, audioTrak);
+    bGood = bGood && CheckSampleTables(file, videoTrak, input.video, "video") && CheckSampleTables(file, audioTrak, input.audio, "audio");
+
+    //stss has the 1 based numbers of the keyframes
+    if(bGood && FindPath(file, videoTrak, "mdia/minf/stbl/stss", stss))
+    {
+        UINT numKeyframes = BE32(&file[stss.dataStart+4]);
+        UINT expected = 0;
+        for(size_t i=0; i<input.video.size(); i++)
+        {
+            if(input.video[i].bKeyframe)
+            {
+                bGood &= expected < numKeyframes && BE32(&file[stss.dataStart+8+expected*4]) == i+1;
+                expected++;
+            }
+        }
+        bGood &= expected == numKeyframes;
+    }
+    else
+        bGood = false;
+
+    return TestResult(bGood, "regular file parses, its sample tables point at what went in");
+}
+
+//the index build holds off scene switching, but only on the main thread and only if it was on.
+//segments are finished on their own thread while the delayed publisher may have it off
+static bool TestSceneSwitching()
+{
+    testFragmented = 0;
+
+    InputPackets input;
+    MakePackets(input, 2, 30, 2000);
+
+    testApp.bDisableSceneSwitching = false;
+    testApp.sceneSwitchingCalls = 0;
+    Record(input, TEXT("switching.mp4"));
+    bool bMainThread = testApp.sceneSwitchingCalls == 2 && testApp.IsSceneSwitchingEnabled();
+
+    testApp.bDisableSceneSwitching = true;
+    testApp.sceneSwitchingCalls = 0;
+    Record(input, TEXT("switching.mp4"));
+    bool bAlreadyOff = testApp.sceneSwitchingCalls == 0 && !testApp.IsSceneSwitchingEnabled();
+
+    testApp.bDisableSceneSwitching = true;
+    testApp.sceneSwitchingCalls = 0;
+    std::thread finishThread(Record, std::ref(input), TEXT("switching.mp4"));
+    finishThread.join();
+    bool bOtherThread = testApp.sceneSwitchingCalls == 0 && !testApp.IsSceneSwitchingEnabled();
+
+    testApp.bDisableSceneSwitching = false;
+
+    return TestResult(bMainThread && bAlreadyOff && bOtherThread, "scene switching is only held off on the main thread, and never turned back on if it was off");
+}
+
+//a file whose writer failed can't be finished, the moov and mdat size are left out
+static bool TestWriteFailed()
+{
+    testFragmented = 0;
+    testWriteFailed = true;
+
+    InputPackets input;
+    MakePackets(input, 2, 30, 2000);
+    testApp.sceneSwitchingCalls = 0;
+    Record(input, TEXT("failed.mp4"));
+
+    testWriteFailed = false;
+
+    const std::vector<BYTE> &file = testFiles["failed.mp4"];
+
+    //ftyp and free, then the mdat header as it was first written, with a zero 64 bit size
+    UINT64 mdatStart = BE32(&file[0]) + 8;
+    const BYTE *mdat = &file[size_t(mdatStart)];
+
+    bool bGood = BE32(mdat) == 1 && BE32(mdat+4) == 'mdat' && BE64(mdat+8) == 0;
+    bGood &= std::search(file.begin(), file.end(), (const BYTE*)"moov", (const BYTE*)"moov"+4) == file.end();
+    bGood &= testApp.sceneSwitchingCalls == 0;
+
+    return TestResult(bGood, "after a failed write, the moov isn't built and the mdat size isn't patched");
+}
+
+//-------------------------------------------
+
+int main(int argc, char **argv)
+{
+    PacketBuffer::InitPool();
+    SetupHeaders();
+    testApp.mainThreadID = std::this_thread::get_id();
+
+    bool bSuccess = true;
+    bSuccess &= TestFragmented();
+    bSuccess &= TestForcedFragments();
+    bSuccess &= TestRegular();
+    bSuccess &= TestSceneSwitching();
+    bSuccess &= TestWriteFailed();
+
+    testFiles.clear();
+    PacketBuffer::FreePool();
+
+    return TestSummary(bSuccess);
+}
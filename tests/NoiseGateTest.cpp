@@ -0,0 +1,559 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+//block noise gate against the per-sample gate it replaced, on speech.  the speech is synthetic
+//by default: formant-filtered pulse trains with a wandering pitch, fricatives, plosive onsets
+//and pauses, over a noise floor and some hum, so it crosses both thresholds the way a mic does.
+//a recording can be given instead:
+//
+//  NoiseGateTest [bench] [speech.wav]
+//
+//16bit or float wav, mono or stereo, at any rate.  the gains of both gates have to stay within
+//one block of attack of each other, and look-ahead has to keep more of each onset while still
+//being a plain delay of the input.  "bench" times both gates on 10ms segments.
+
+#include "OBSApi.h"
+#include "TestUtil.h"
+
+//the filter needs its parent's settings, which are private to everyone but the filter
+#define private public
+#include "NoiseGate.h"
+#undef private
+
+#include "NoiseGateFilter.cpp"
+
+#include <vector>
+
+//the real ones are in the settings half, which isn't built here
+NoiseGate::NoiseGate() {}
+NoiseGate::~NoiseGate() {}
+
+#define PI_D 3.14159265358979323846
+
+static void SetDefaults(NoiseGate &gate)
+{
+    gate.isEnabled = true;
+    gate.isDisabledFromConfig = false;
+    gate.openThreshold = dbToRms(-26.0f);
+    gate.closeThreshold = dbToRms(-32.0f);
+    gate.attackTime = 0.025f;
+    gate.holdTime = 0.2f;
+    gate.releaseTime = 0.15f;
+    gate.lookAheadTime = 0.0f;
+}
+
+//-------------------------------------------
+
+//the per-sample gate as it was before it went block-wise, recording its gain for every frame
+struct ReferenceGate
+{
+    NoiseGate *parent;
+    float attenuation, level, heldTime;
+    bool isOpen;
+
+    ReferenceGate(NoiseGate *parent) : parent(parent), attenuation(0.0f), level(0.0f), heldTime(0.0f), isOpen(false) {}
+
+    void ApplyNoiseGate(float *buffer, int totalFloats, float *gains)
+    {
+        const float SAMPLE_RATE_F = float(OBSGetSampleRateHz());
+        const float dtPerSample = 1.0f / SAMPLE_RATE_F;
+
+        const float attackRate = 1.0f / (parent->attackTime * SAMPLE_RATE_F);
+        const float releaseRate = 1.0f / (parent->releaseTime * SAMPLE_RATE_F);
+
+        const float thresholdDiff = parent->openThreshold - parent->closeThreshold;
+        const float minDecayPeriod = (1.0f / 75.0f) * SAMPLE_RATE_F;
+        const float decayRate = thresholdDiff / minDecayPeriod;
+
+        for(int i = 0; i < totalFloats; i += 2)
+        {
+            float curLvl = abs(buffer[i] + buffer[i+1]) * 0.5f;
+
+            if(curLvl > parent->openThreshold && !isOpen)
+                isOpen = true;
+            if(level < parent->closeThreshold && isOpen)
+            {
+                heldTime = 0.0f;
+                isOpen = false;
+            }
+
+            level = max(level, curLvl) - decayRate;
+
+            if(isOpen)
+                attenuation = min(1.0f, attenuation + attackRate);
+            else
+            {
+                heldTime += dtPerSample;
+                if(heldTime > parent->holdTime)
+                    attenuation = max(0.0f, attenuation - releaseRate);
+            }
+
+            buffer[i] *= attenuation;
+            buffer[i+1] *= attenuation;
+            gains[i/2] = attenuation;
+        }
+    }
+};
+
+//-------------------------------------------
+// speech
+
+struct Speech
+{
+    UINT sampleRate;
+    std::vector<float> samples;     //stereo
+    std::vector<UINT> onsets;       //first frame of every word after a long pause, synthetic speech only
+};
+
+//two-pole resonator, unity gain at its centre
+struct Resonator
+{
+    double a1, a2, gain, y1, y2;
+
+    void Set(double frequency, double bandwidth, double sampleRate)
+    {
+        double r = exp(-PI_D*bandwidth/sampleRate);
+        a1 = 2.0*r*cos(2.0*PI_D*frequency/sampleRate);
+        a2 = -r*r;
+        gain = 1.0-r;
+    }
+
+    double Run(double x)
+    {
+        double y = gain*x + a1*y1 + a2*y2;
+        y2 = y1;
+        y1 = y;
+        return y;
+    }
+};
+
+static double RandomRange(TestRandom &random, double low, double high)
+{
+    return low + (high-low)*(double(random.NextFloat())*0.5 + 0.5);
+}
+
+static void SynthesizeSpeech(Speech &speech, UINT sampleRate, double seconds)
+{
+    static const double vowels[][3] =
+        {{730, 1090, 2440}, {270, 2290, 3010}, {300, 870, 2240}, {530, 1840, 2480}, {570, 840, 2410}};
+
+    TestRandom random(1);
+    double rate = double(sampleRate);
+    UINT numFrames = UINT(seconds*rate);
+
+    std::vector<double> mono(numFrames, 0.0);
+
+    Resonator formants[3];
+    zero(formants, sizeof(formants));
+
+    UINT pos = UINT(rate*0.3);
+    bool bAfterPause = true;
+    while(pos < numFrames)
+    {
+        //the gate has closed by the end of a long pause, that's where onsets get clipped
+        if(bAfterPause)
+            speech.onsets.push_back(pos);
+
+        //a word of one to four syllables
+        UINT numSyllables = 1 + random.Next()%4;
+        double loudness = pow(10.0, RandomRange(random, -18.0, -6.0)/20.0);
+        double pitch = RandomRange(random, 90.0, 220.0);
+
+        for(UINT s=0; s<numSyllables && pos < numFrames; s++)
+        {
+            //some syllables start on a fricative
+            if(random.Next()%3 == 0)
+            {
+                UINT length = UINT(rate*RandomRange(random, 0.03, 0.08));
+                double amplitude = loudness*0.3, last = 0.0;
+                for(UINT i=0; i<length && pos < numFrames; i++, pos++)
+                {
+                    double noise = random.NextFloat();
+                    double ramp = min(1.0, double(i)/(rate*0.005));
+                    mono[pos] += (noise-last)*amplitude*ramp;
+                    last = noise;
+                }
+            }
+
+            const double *vowel = vowels[random.Next()%5];
+            for(UINT f=0; f<3; f++)
+                formants[f].Set(vowel[f], 80.0+40.0*f, rate);
+
+            //voiced part with a sharp onset, a pitch glide and a short decay
+            UINT length = UINT(rate*RandomRange(random, 0.1, 0.3));
+            double phase = 0.0, glide = RandomRange(random, -0.3, 0.3);
+            for(UINT i=0; i<length && pos < numFrames; i++, pos++)
+            {
+                double t = double(i)/double(length);
+                double f0 = pitch*(1.0 + glide*t) * (1.0 + 0.01*sin(2.0*PI_D*5.0*double(i)/rate));
+                phase += f0/rate;
+
+                double pulse = 0.0;
+                if(phase >= 1.0)
+                {
+                    phase -= 1.0;
+                    pulse = 1.0;
+                }
+
+                double voiced = 0.0;
+                for(UINT f=0; f<3; f++)
+                    voiced += formants[f].Run(pulse)/double(f+1);
+
+                double envelope = min(1.0, double(i)/(rate*0.004)) * min(1.0, double(length-i)/(rate*0.03));
+                mono[pos] += voiced*loudness*envelope*40.0;
+            }
+
+            pos += UINT(rate*RandomRange(random, 0.0, 0.04));
+        }
+
+        //pause between words, sometimes one long enough for the gate to hold and release
+        bAfterPause = (random.Next()%3 == 0);
+        pos += UINT(rate*(bAfterPause ? RandomRange(random, 0.6, 1.5) : RandomRange(random, 0.08, 0.3)));
+    }
+
+    //room noise and mains hum, well under the close threshold
+    speech.sampleRate = sampleRate;
+    speech.samples.resize(numFrames*2);
+    double noiseLevel = pow(10.0, -50.0/20.0), humLevel = pow(10.0, -58.0/20.0), lowpass = 0.0;
+    for(UINT i=0; i<numFrames; i++)
+    {
+        lowpass += (random.NextFloat() - lowpass)*0.2;
+        double val = mono[i] + lowpass*noiseLevel*2.0 + humLevel*sin(2.0*PI_D*50.0*double(i)/rate);
+        speech.samples[i*2] = speech.samples[i*2+1] = float(max(-1.0, min(1.0, val)));
+    }
+}
+
+static UINT ReadLE(const BYTE *data, UINT size)
+{
+    UINT val = 0;
+    for(UINT i=0; i<size; i++)
+        val |= UINT(data[i]) << (i*8);
+    return val;
+}
+
+static bool LoadWav(Speech &speech, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+        return false;
+
+    std::vector<BYTE> data;
+    BYTE buffer[65536];
+    size_t size;
+    while((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer+size);
+    fclose(file);
+
+    if(data.size() < 12 || memcmp(&data[0], "RIFF", 4) != 0 || memcmp(&data[8], "WAVE", 4) != 0)
+        return false;
+
+    UINT format = 0, channels = 0, bits = 0;
+    for(size_t pos = 12; pos+8 <= data.size();)
+    {
+        UINT chunkSize = ReadLE(&data[pos+4], 4);
+        const BYTE *chunk = &data[pos+8];
+        size_t available = MIN(size_t(chunkSize), data.size()-pos-8);
+
+        if(memcmp(&data[pos], "fmt ", 4) == 0 && available >= 16)
+        {
+            format = ReadLE(chunk, 2);
+            channels = ReadLE(chunk+2, 2);
+            speech.sampleRate = ReadLE(chunk+4, 4);
+            bits = ReadLE(chunk+14, 2);
+        }
+        else if(memcmp(&data[pos], "data", 4) == 0 && channels)
+        {
+            bool bFloat = (format == 3 && bits == 32);
+            if(!bFloat && !(format == 1 && bits == 16) || channels > 2)
+                return false;
+
+            UINT frameSize = channels*bits/8;
+            UINT numFrames = UINT(available/frameSize);
+            speech.samples.resize(numFrames*2);
+
+            for(UINT i=0; i<numFrames; i++)
+            {
+                for(UINT c=0; c<2; c++)
+                {
+                    const BYTE *sample = chunk + i*frameSize + MIN(c, channels-1)*(bits/8);
+                    float val;
+                    if(bFloat)
+                        mcpy(&val, sample, 4);
+                    else
+                        val = float(short(ReadLE(sample, 2)))/32768.0f;
+                    speech.samples[i*2+c] = val;
+                }
+            }
+
+            return numFrames != 0;
+        }
+
+        pos += 8 + chunkSize + (chunkSize&1);
+    }
+
+    return false;
+}
+
+//-------------------------------------------
+
+//both gates over the whole input in 10ms segments, through Process() for the block gate
+struct GateRun
+{
+    std::vector<float> output, gains;
+    std::vector<QWORD> timestamps;
+};
+
+static void RunBlockGate(NoiseGate &gate, const Speech &speech, GateRun &run)
+{
+    NoiseGateFilter filter(&gate);
+    UINT segmentFrames = speech.sampleRate/100;
+    UINT numFrames = UINT(speech.samples.size()/2);
+
+    run.output.clear();
+    run.gains.clear();
+    run.timestamps.clear();
+
+    for(UINT pos=0; pos+segmentFrames <= numFrames; pos += segmentFrames)
+    {
+        AudioSegment *segment = new AudioSegment(const_cast<float*>(&speech.samples[pos*2]), segmentFrames*2, 1000 + pos*1000/speech.sampleRate);
+        segment = filter.Process(segment);
+
+        run.output.insert(run.output.end(), segment->audioData.Array(), segment->audioData.Array()+segmentFrames*2);
+        run.gains.insert(run.gains.end(), filter.gains.Array(), filter.gains.Array()+segmentFrames);
+        run.timestamps.push_back(segment->timestamp);
+        delete segment;
+    }
+}
+
+static void RunReferenceGate(NoiseGate &gate, const Speech &speech, GateRun &run)
+{
+    ReferenceGate reference(&gate);
+    UINT segmentFrames = speech.sampleRate/100;
+    UINT numFrames = UINT(speech.samples.size()/2);
+
+    run.output.assign(speech.samples.begin(), speech.samples.begin() + (numFrames/segmentFrames)*segmentFrames*2);
+    run.gains.resize(run.output.size()/2);
+
+    for(UINT pos=0; pos+segmentFrames <= numFrames; pos += segmentFrames)
+        reference.ApplyNoiseGate(&run.output[pos*2], segmentFrames*2, &run.gains[pos]);
+}
+
+static double PowerDB(const std::vector<float> &samples)
+{
+    double sum = 0.0;
+    for(size_t i=0; i<samples.size(); i++)
+        sum += double(samples[i])*double(samples[i]);
+    return 10.0*log10(MAX(sum, 1e-30));
+}
+
+//-------------------------------------------
+
+static bool TestAgainstReference(const Speech &speech)
+{
+    NoiseGate gate;
+    SetDefaults(gate);
+
+    GateRun blockRun, referenceRun;
+    RunBlockGate(gate, speech, blockRun);
+    RunReferenceGate(gate, speech, referenceRun);
+
+    //the thresholds are tested once per block, so a state change can land up to a block late,
+    //and the ramp that follows it is that many frames behind
+    float attackRate = 1.0f/(gate.attackTime*float(speech.sampleRate));
+    float releaseRate = 1.0f/(gate.releaseTime*float(speech.sampleRate));
+    float tolerance = float(NoiseGateFilter::BLOCK_FRAMES)*MAX(attackRate, releaseRate) + 1e-4f;
+
+    float worstGain = 0.0f;
+    UINT worstFrame = 0, openFrames = 0;
+    for(size_t i=0; i<blockRun.gains.size(); i++)
+    {
+        float diff = fabs(blockRun.gains[i]-referenceRun.gains[i]);
+        if(diff > worstGain)
+        {
+            worstGain = diff;
+            worstFrame = UINT(i);
+        }
+
+        if(referenceRun.gains[i] > 0.5f)
+            openFrames++;
+    }
+
+    std::vector<float> difference(blockRun.output.size());
+    for(size_t i=0; i<difference.size(); i++)
+        difference[i] = blockRun.output[i]-referenceRun.output[i];
+
+    double differenceDB = PowerDB(difference) - PowerDB(referenceRun.output);
+    double openShare = double(openFrames)/double(blockRun.gains.size());
+
+    bool bSuccess = true;
+
+    //make sure the speech really does open and close the gate, or there's nothing to compare
+    bSuccess &= TestResult(openShare > 0.2 && openShare < 0.9, "the speech holds the gate open %.0f%% of the time", openShare*100.0);
+    bSuccess &= TestResult(worstGain <= tolerance, "gains within %.4f of the per-sample gate, tolerance %.4f", worstGain, tolerance);
+    if(worstGain > tolerance)
+        TestFail("at frame %u: %.4f against %.4f", worstFrame, blockRun.gains[worstFrame], referenceRun.gains[worstFrame]);
+    bSuccess &= TestResult(differenceDB < -40.0, "difference from the per-sample gate %.1f dB below its output", -differenceDB);
+
+    return bSuccess;
+}
+
+//look-ahead delays the output by exactly the look-ahead, gained by the undelayed analysis
+static bool TestLookAheadDelay(const Speech &speech)
+{
+    NoiseGate gate;
+    SetDefaults(gate);
+    gate.lookAheadTime = 0.01f;
+
+    GateRun run;
+    RunBlockGate(gate, speech, run);
+
+    UINT delay = UINT(gate.lookAheadTime*float(speech.sampleRate) + 0.5f);
+    bool bExact = true;
+    for(size_t i=0; i<run.gains.size() && bExact; i++)
+    {
+        float input = (i >= delay) ? speech.samples[(i-delay)*2] : 0.0f;
+        bExact = run.output[i*2] == input*run.gains[i];
+    }
+
+    bool bTimestamps = true;
+    UINT segmentFrames = speech.sampleRate/100;
+    for(size_t i=0; i<run.timestamps.size(); i++)
+        bTimestamps &= run.timestamps[i] == 1000 + QWORD(i)*segmentFrames*1000/speech.sampleRate - 10;
+
+    return TestResult(bExact && bTimestamps, "look-ahead of %u frames delays the output and its timestamps", delay);
+}
+
+//how much of the first 20ms of each word makes it through
+static double OnsetShare(const Speech &speech, const GateRun &run, UINT delay)
+{
+    UINT window = speech.sampleRate/50;
+    double input = 0.0, output = 0.0;
+
+    for(size_t w=0; w<speech.onsets.size(); w++)
+    {
+        UINT onset = speech.onsets[w];
+        for(UINT i=onset; i<onset+window && (i+delay)*2 < run.output.size(); i++)
+        {
+            input  += double(speech.samples[i*2])*double(speech.samples[i*2]);
+            output += double(run.output[(i+delay)*2])*double(run.output[(i+delay)*2]);
+        }
+    }
+
+    return output/MAX(input, 1e-30);
+}
+
+static bool TestLookAheadOnsets(const Speech &speech)
+{
+    NoiseGate gate;
+    SetDefaults(gate);
+
+    GateRun run, lookAheadRun;
+    RunBlockGate(gate, speech, run);
+
+    gate.lookAheadTime = gate.attackTime;
+    RunBlockGate(gate, speech, lookAheadRun);
+
+    UINT delay = UINT(gate.lookAheadTime*float(speech.sampleRate) + 0.5f);
+    double share = OnsetShare(speech, run, 0);
+    double lookAheadShare = OnsetShare(speech, lookAheadRun, delay);
+
+    return TestResult(lookAheadShare > share*1.5 && lookAheadShare > 0.5,
+        "%.0fms look-ahead keeps %.0f%% of the energy at word onsets, %.0f%% without", gate.lookAheadTime*1000.0f, lookAheadShare*100.0, share*100.0);
+}
+
+//-------------------------------------------
+
+static void RunBenchmark(const Speech &speech)
+{
+    NoiseGate gate;
+    SetDefaults(gate);
+
+    UINT segmentFrames = speech.sampleRate/100;
+    UINT numSegments = UINT(speech.samples.size()/2)/segmentFrames;
+    std::vector<float> buffer(speech.samples.begin(), speech.samples.begin()+numSegments*segmentFrames*2);
+    std::vector<float> gains(segmentFrames);
+
+    double best[2] = {1e30, 1e30};
+    for(int run=0; run<5; run++)
+    {
+        ReferenceGate reference(&gate);
+        mcpy(&buffer[0], &speech.samples[0], buffer.size()*sizeof(float));
+        QWORD startTime = TestTimeNS();
+        for(UINT s=0; s<numSegments; s++)
+            reference.ApplyNoiseGate(&buffer[s*segmentFrames*2], segmentFrames*2, &gains[0]);
+        best[0] = MIN(best[0], double(TestTimeNS()-startTime)/numSegments);
+
+        NoiseGateFilter filter(&gate);
+        mcpy(&buffer[0], &speech.samples[0], buffer.size()*sizeof(float));
+        startTime = TestTimeNS();
+        for(UINT s=0; s<numSegments; s++)
+            filter.ApplyNoiseGate(&buffer[s*segmentFrames*2], segmentFrames*2);
+        best[1] = MIN(best[1], double(TestTimeNS()-startTime)/numSegments);
+    }
+
+    printf("%-22s %9s %9s\n", "gate, 10ms segments", "ns", "speedup");
+    printf("%-22s %9.0f %8.2fx\n", "per-sample", best[0], 1.0);
+    printf("%-22s %9.0f %8.2fx\n", "block", best[1], best[0]/best[1]);
+}
+
+//-------------------------------------------
+
+int main(int argc, char **argv)
+{
+    bool bBench = false;
+    const char *wavPath = NULL;
+    for(int i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i], "bench") == 0)
+            bBench = true;
+        else
+            wavPath = argv[i];
+    }
+
+    Speech speech;
+    if(wavPath)
+    {
+        if(!LoadWav(speech, wavPath))
+        {
+            printf("couldn't read %s, it has to be a 16bit or float wav\n", wavPath);
+            return 1;
+        }
+        printf("%s: %.1fs at %uHz\n", wavPath, double(speech.samples.size()/2)/double(speech.sampleRate), speech.sampleRate);
+    }
+    else
+        SynthesizeSpeech(speech, 44100, 60.0);
+
+    compatSampleRateHz = speech.sampleRate;
+
+    if(bBench)
+    {
+        RunBenchmark(speech);
+        return 0;
+    }
+
+    bool bSuccess = true;
+    bSuccess &= TestAgainstReference(speech);
+    bSuccess &= TestLookAheadDelay(speech);
+
+    //onsets are only known for the synthetic speech
+    if(!speech.onsets.empty())
+        bSuccess &= TestLookAheadOnsets(speech);
+
+    return TestSummary(bSuccess);
+}
@@ -0,0 +1,248 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+//packet buffer tests: building a payload the way the encoders do, and the pool handing the same
+//packets and storage back out so a warmed up encoder doesn't allocate
+
+#include "PacketBuffer.cpp"
+#include "TestUtil.h"
+
+#include <vector>
+
+static bool PayloadIs(PacketBuffer *packet, const std::vector<BYTE> &expected)
+{
+    return packet->Size() == expected.size() && (expected.empty() || memcmp(packet->Data(), &expected[0], expected.size()) == 0);
+}
+
+static void FillPayload(PacketBuffer *packet, std::vector<BYTE> &expected, UINT size, UINT seed)
+{
+    TestRandom random(seed);
+    PacketSerializer packetOut(packet);
+
+    while(size)
+    {
+        BYTE chunk[1000];
+        UINT chunkSize = MIN(size, 1+random.Next()%sizeof(chunk));
+        for(UINT i=0; i<chunkSize; i++)
+            chunk[i] = BYTE(random.Next());
+
+        //length prefixed like a nal
+        packetOut.OutputDword(chunkSize);
+        packetOut.Serialize(chunk, chunkSize);
+
+        BYTE *prefix = (BYTE*)&chunkSize;
+        expected.insert(expected.end(), prefix, prefix+4);
+        expected.insert(expected.end(), chunk, chunk+chunkSize);
+
+        size -= chunkSize;
+    }
+}
+
+static bool TestPayload()
+{
+    bool bSuccess = true;
+
+    //serialize nals, then put the flv frame header in front like the encoders do
+    PacketBuffer *packet = PacketBuffer::Create();
+    std::vector<BYTE> expected;
+    FillPayload(packet, expected, 50000, 1);
+
+    BYTE frameHeader[5] = {0x17, 1, 0, 0, 0};
+    packet->Insert(0, frameHeader, 5);
+    expected.insert(expected.begin(), frameHeader, frameHeader+5);
+    bSuccess &= TestResult(PayloadIs(packet, expected), "serialized nals with the frame header inserted in front");
+
+    //the rtmp publisher puts the SEI right after the frame header
+    BYTE sei[37];
+    for(UINT i=0; i<sizeof(sei); i++)
+        sei[i] = BYTE(0x80+i);
+    packet->Insert(5, sei, sizeof(sei));
+    expected.insert(expected.begin()+5, sei, sei+sizeof(sei));
+    bSuccess &= TestResult(PayloadIs(packet, expected), "SEI inserted after the frame header");
+
+    //the rtmp header goes into the headroom, which must stay writable
+    memset(packet->Data()-PACKET_HEADROOM, 0xCD, PACKET_HEADROOM);
+    bSuccess &= TestResult(PayloadIs(packet, expected), "headroom is separate from the payload");
+
+    {
+        PacketSerializer packetOut(packet);
+        packetOut.Seek(1);
+        packetOut.OutputByte(0xEE);
+        expected[1] = 0xEE;
+        bool bSeek = (packetOut.GetPos() == 2);
+
+        packetOut.Seek(0, SERIALIZE_SEEK_END);
+        packetOut.OutputByte(0x42);
+        expected.push_back(0x42);
+        bSeek &= (packetOut.GetPos() == expected.size());
+
+        bSuccess &= TestResult(bSeek && PayloadIs(packet, expected), "serializer seeks and overwrites in place");
+    }
+
+    packet->Release();
+
+    std::vector<BYTE> copyData(300);
+    for(UINT i=0; i<copyData.size(); i++)
+        copyData[i] = BYTE(i*7);
+    PacketBuffer *copy = PacketBuffer::Create(&copyData[0], UINT(copyData.size()));
+    bSuccess &= TestResult(PayloadIs(copy, copyData), "Create(data, size) copies the payload");
+    copy->Release();
+
+    return bSuccess;
+}
+
+static bool TestPool()
+{
+    bool bSuccess = true;
+
+    PacketBuffer *packet = PacketBuffer::Create();
+    std::vector<BYTE> expected;
+    FillPayload(packet, expected, 100000, 2);
+    LPBYTE data = packet->Data();
+    packet->Release();
+
+    //next one out of the pool is the same packet with the storage it grew last time
+    packet = PacketBuffer::Create();
+    bool bReused = (packet->Size() == 0);
+
+    expected.clear();
+    FillPayload(packet, expected, 100000, 3);
+    bReused &= (packet->Data() == data) && PayloadIs(packet, expected);
+    bSuccess &= TestResult(bReused, "released packets come back empty with their storage");
+
+    //only the last reference gives it back
+    UINT numFree = numFreePackets;
+    packet->AddRef();
+    packet->Release();
+    bool bHeld = (numFreePackets == numFree) && PayloadIs(packet, expected);
+    packet->Release();
+    bHeld &= (numFreePackets == numFree+1);
+    bSuccess &= TestResult(bHeld, "pool only takes packets back once the last reference is gone");
+
+    //the pool keeps a bounded number of packets
+    std::vector<PacketBuffer*> packets;
+    for(UINT i=0; i<PACKET_POOL_SIZE*2; i++)
+        packets.push_back(PacketBuffer::Create());
+    for(UINT i=0; i<packets.size(); i++)
+        packets[i]->Release();
+    bSuccess &= TestResult(numFreePackets == PACKET_POOL_SIZE, "pool holds at most %d packets (%u)", PACKET_POOL_SIZE, numFreePackets);
+
+    //and doesn't hold on to huge ones
+    numFree = numFreePackets;
+    PacketBuffer *huge = PacketBuffer::Create();
+    std::vector<BYTE> hugeData(PACKET_POOL_MAX_STORAGE+1);
+    huge->Write(0, &hugeData[0], UINT(hugeData.size()));
+    huge->Release();
+    bSuccess &= TestResult(numFreePackets == numFree-1, "oversized packets aren't pooled");
+
+    return bSuccess;
+}
+
+//-------------------------------------------
+
+struct ThreadTest
+{
+    UINT seed;
+    bool bSuccess;
+};
+
+static void* PacketThread(void *param)
+{
+    ThreadTest &test = *(ThreadTest*)param;
+    TestRandom random(test.seed);
+
+    PacketBuffer *held[8] = {};
+
+    for(UINT i=0; i<20000; i++)
+    {
+        UINT slot = random.Next()%8;
+        if(held[slot])
+        {
+            //a packet someone else had must never show up while it's still being used here
+            LPBYTE data = held[slot]->Data();
+            for(UINT j=0; j<held[slot]->Size(); j++)
+            {
+                if(data[j] != BYTE(slot+j))
+                {
+                    test.bSuccess = false;
+                    break;
+                }
+            }
+            held[slot]->Release();
+        }
+
+        PacketBuffer *packet = PacketBuffer::Create();
+        UINT size = random.Next()%5000;
+        for(UINT j=0; j<size; j++)
+        {
+            BYTE val = BYTE(slot+j);
+            packet->Write(j, &val, 1);
+        }
+        held[slot] = packet;
+    }
+
+    for(UINT i=0; i<8; i++)
+    {
+        if(held[i])
+            held[i]->Release();
+    }
+
+    return NULL;
+}
+
+static bool TestThreads()
+{
+    const UINT numThreads = 4;
+    pthread_t threads[numThreads];
+    ThreadTest tests[numThreads];
+
+    for(UINT i=0; i<numThreads; i++)
+    {
+        tests[i].seed = 100+i;
+        tests[i].bSuccess = true;
+        pthread_create(&threads[i], NULL, PacketThread, &tests[i]);
+    }
+
+    bool bSuccess = true;
+    for(UINT i=0; i<numThreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        bSuccess &= tests[i].bSuccess;
+    }
+
+    return TestResult(bSuccess && numFreePackets <= PACKET_POOL_SIZE, "%u threads creating and releasing packets", numThreads);
+}
+
+int main(int argc, char **argv)
+{
+    PacketBuffer::InitPool();
+
+    bool bSuccess = true;
+    bSuccess &= TestPayload();
+    bSuccess &= TestPool();
+    bSuccess &= TestThreads();
+
+    PacketBuffer::FreePool();
+
+    //after shutdown they're just deleted
+    PacketBuffer *packet = PacketBuffer::Create();
+    packet->Release();
+
+    return TestSummary(bSuccess);
+}
@@ -0,0 +1,751 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#include "OBSApi.h"
+#include "TestUtil.h"
+#include "librtmp_posix.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+#include "rtmp.h"
+
+#include <vector>
+
+
+//RTMP sends over loopback: the tags of an FLV file go through librtmp's RTMP_SendPacket to a
+//local sink, either the way OBS sent them before, one chunk at a time through BufferedSend
+//into the data buffer, or gathered whole through BufferedSendVec.  the publisher side is
+//modelled on RTMPPublisher: a data buffer behind a mutex, a socket loop that sends out of it,
+//and the vectored path going straight to the socket while the buffer is empty.  the sink only
+//reads the chunk stream, there's no handshake or connect since only the send path is looked at.
+//
+//  RTMPSendTest                runs both paths through a slow sink and checks what arrives
+//  RTMPSendTest bench [file]   sends the FLV file (a generated one by default) as fast as the
+//                              sink takes it and prints throughput and cpu time per Mbit
+
+//RTMPPublisher's chunk size
+#define OUT_CHUNK_SIZE  4096
+
+//-------------------------------------------
+// flv
+
+struct FLVTag
+{
+    BYTE type;
+    DWORD timestamp;
+    std::vector<BYTE> packet;   //RTMP_MAX_HEADER_SIZE of headroom, then the tag body
+};
+
+static bool ParseFLV(const std::vector<BYTE> &file, std::vector<FLVTag> &tags)
+{
+    if(file.size() < 13 || memcmp(&file[0], "FLV", 3) != 0)
+        return false;
+
+    size_t pos = (file[5]<<24 | file[6]<<16 | file[7]<<8 | file[8]) + 4;
+
+    while(pos+11 <= file.size())
+    {
+        const BYTE *header = &file[pos];
+        UINT size = header[1]<<16 | header[2]<<8 | header[3];
+        DWORD timestamp = header[4]<<16 | header[5]<<8 | header[6] | header[7]<<24;
+
+        if(pos+11+size > file.size())
+            break;
+
+        if(header[0] == RTMP_PACKET_TYPE_AUDIO || header[0] == RTMP_PACKET_TYPE_VIDEO)
+        {
+            FLVTag tag;
+            tag.type = header[0];
+            tag.timestamp = timestamp;
+            tag.packet.resize(RTMP_MAX_HEADER_SIZE+size);
+            mcpy(&tag.packet[RTMP_MAX_HEADER_SIZE], header+11, size);
+            tags.push_back(tag);
+        }
+
+        pos += 11+size+4;
+    }
+
+    return !tags.empty();
+}
+
+static void PutBE(std::vector<BYTE> &out, DWORD val, UINT bytes)
+{
+    while(bytes--)
+        out.push_back(BYTE(val >> (bytes*8)));
+}
+
+//a stand-in recording: 60fps video at about 3500 kbps with a keyframe every 2 seconds, and
+//160 kbps of 48khz AAC, noise for payload
+static void BuildFLV(UINT seconds, std::vector<BYTE> &file)
+{
+    TestRandom random(7);
+
+    const BYTE flvHeader[] = {'F', 'L', 'V', 1, 5, 0, 0, 0, 9, 0, 0, 0, 0};
+    file.assign(flvHeader, flvHeader+sizeof(flvHeader));
+
+    UINT numFrames = seconds*60, audioFrame = 0;
+    for(UINT i=0; i<numFrames; i++)
+    {
+        DWORD videoTime = i*1000/60;
+
+        while(audioFrame*1024*1000/48000 <= videoTime)
+        {
+            UINT size = 2 + 160000/8*1024/48000;
+            PutBE(file, RTMP_PACKET_TYPE_AUDIO, 1);
+            PutBE(file, size, 3);
+            PutBE(file, audioFrame*1024*1000/48000, 3);
+            PutBE(file, 0, 4);
+            file.push_back(0xAF);
+            file.push_back(1);
+            for(UINT j=2; j<size; j++)
+                file.push_back(BYTE(random.Next()));
+            PutBE(file, 11+size, 4);
+            audioFrame++;
+        }
+
+        bool bKeyframe = (i%120) == 0;
+        UINT size = 5 + (bKeyframe ? 80000 : 6600) + random.Next()%1500;
+        PutBE(file, RTMP_PACKET_TYPE_VIDEO, 1);
+        PutBE(file, size, 3);
+        PutBE(file, videoTime, 3);
+        PutBE(file, 0, 4);
+        file.push_back(bKeyframe ? 0x17 : 0x27);
+        file.push_back(1);
+        PutBE(file, 0, 3);
+        for(UINT j=5; j<size; j++)
+            file.push_back(BYTE(random.Next()));
+        PutBE(file, 11+size, 4);
+    }
+}
+
+//-------------------------------------------
+// sink
+
+struct LoopbackSink
+{
+    SOCKET listenSocket, socket;
+    HANDLE hThread;
+
+    UINT stallEvery, stallMS;       //reads this many bytes between stalls, 0 for none
+    std::vector<char> *received;    //NULL to throw it away
+
+    QWORD numBytes;
+};
+
+static QWORD ThreadCPUTimeNS()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return QWORD(ts.tv_sec)*1000000000ULL + QWORD(ts.tv_nsec);
+}
+
+static DWORD STDCALL SinkThread(LPVOID param)
+{
+    LoopbackSink &sink = *(LoopbackSink*)param;
+    sink.socket = accept(sink.listenSocket, NULL, NULL);
+
+    std::vector<char> buffer(256*1024);
+    UINT sinceStall = 0;
+
+    while(sink.socket != -1)
+    {
+        int ret = recv(sink.socket, &buffer[0], int(buffer.size()), 0);
+        if(ret <= 0)
+            break;
+
+        sink.numBytes += ret;
+        if(sink.received)
+            sink.received->insert(sink.received->end(), buffer.begin(), buffer.begin()+ret);
+
+        sinceStall += ret;
+        if(sink.stallEvery && sinceStall >= sink.stallEvery)
+        {
+            OSSleep(sink.stallMS);
+            sinceStall = 0;
+        }
+    }
+
+    return 0;
+}
+
+//returns the connected sending socket
+static SOCKET StartSink(LoopbackSink &sink, int sendBufferSize)
+{
+    sink.numBytes = 0;
+
+    sockaddr_in addr;
+    zero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    sink.listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    socklen_t addrLen = sizeof(addr);
+    if(bind(sink.listenSocket, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(sink.listenSocket, 1) != 0 ||
+       getsockname(sink.listenSocket, (sockaddr*)&addr, &addrLen) != 0)
+        return -1;
+
+    sink.hThread = OSCreateThread(SinkThread, &sink);
+
+    SOCKET sendSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(sendBufferSize)
+        setsockopt(sendSocket, SOL_SOCKET, SO_SNDBUF, &sendBufferSize, sizeof(sendBufferSize));
+
+    int noDelay = 1;
+    setsockopt(sendSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    if(connect(sendSocket, (sockaddr*)&addr, sizeof(addr)) != 0)
+        return -1;
+
+    return sendSocket;
+}
+
+static void StopSink(LoopbackSink &sink)
+{
+    OSWaitForThread(sink.hThread, NULL);
+    OSCloseThread(sink.hThread);
+    close(sink.socket);
+    close(sink.listenSocket);
+}
+
+//-------------------------------------------
+// publisher side, as RTMPPublisher does it
+
+struct Publisher
+{
+    RTMP *rtmp;
+
+    HANDLE hDataBufferMutex, hBufferEvent, hBufferSpaceAvailableEvent;
+    HANDLE hSocketThread;
+    volatile bool bStopping;
+
+    BYTE *dataBuffer;
+    int dataBufferSize, curDataBufferLen;
+
+    QWORD bytesSent, bytesSentDirect;
+    DWORD totalTimesWaited;
+
+    QWORD socketLoopCPUTimeNS;
+};
+
+//RTMPPublisher::SocketLoop, with poll standing in for FD_WRITE
+static DWORD STDCALL SocketLoop(LPVOID param)
+{
+    Publisher &network = *(Publisher*)param;
+
+    while(true)
+    {
+        WaitForSingleObject(network.hBufferEvent, 10);
+
+        OSEnterMutex(network.hDataBufferMutex);
+        if(!network.curDataBufferLen)
+        {
+            OSLeaveMutex(network.hDataBufferMutex);
+            if(network.bStopping)
+                break;
+            continue;
+        }
+
+        int ret = send(network.rtmp->m_sb.sb_socket, (const char*)network.dataBuffer, network.curDataBufferLen, MSG_DONTWAIT);
+        if(ret > 0)
+        {
+            if(network.curDataBufferLen - ret)
+                memmove(network.dataBuffer, network.dataBuffer + ret, network.curDataBufferLen - ret);
+            network.curDataBufferLen -= ret;
+            network.bytesSent += ret;
+
+            OSLeaveMutex(network.hDataBufferMutex);
+            SetEvent(network.hBufferSpaceAvailableEvent);
+            SetEvent(network.hBufferEvent);
+        }
+        else
+        {
+            OSLeaveMutex(network.hDataBufferMutex);
+            if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                printf("socket loop: send failed, errno %d\n", errno);
+                break;
+            }
+
+            pollfd fd = {network.rtmp->m_sb.sb_socket, POLLOUT, 0};
+            poll(&fd, 1, 100);
+            SetEvent(network.hBufferEvent);
+        }
+    }
+
+    network.socketLoopCPUTimeNS = ThreadCPUTimeNS();
+    return 0;
+}
+
+//RTMPPublisher::BufferedSend
+static int BufferedSend(RTMPSockBuf *sb, const char *buf, int len, Publisher *network)
+{
+retrySend:
+    OSEnterMutex(network->hDataBufferMutex);
+
+    if(network->curDataBufferLen + len >= network->dataBufferSize)
+    {
+        ++network->totalTimesWaited;
+        OSLeaveMutex(network->hDataBufferMutex);
+
+        WaitForSingleObject(network->hBufferSpaceAvailableEvent, INFINITE);
+        goto retrySend;
+    }
+
+    mcpy(network->dataBuffer + network->curDataBufferLen, buf, len);
+    network->curDataBufferLen += len;
+
+    OSLeaveMutex(network->hDataBufferMutex);
+
+    SetEvent(network->hBufferEvent);
+
+    return len;
+}
+
+//RTMPPublisher::BufferedSendVec, sendmsg standing in for WSASend on the non-blocking socket
+static int BufferedSendVec(RTMPSockBuf *sb, RTMPIOVec *vec, int count, Publisher *network)
+{
+    int fullLen = 0;
+    for(int i = 0; i < count; i++)
+        fullLen += vec[i].len;
+
+    int curVec = 0, curOffset = 0;
+
+    OSEnterMutex(network->hDataBufferMutex);
+
+    if(!network->curDataBufferLen)
+    {
+        iovec iov[RTMP_IOVEC_PREALLOC];
+
+        while(curVec < count)
+        {
+            int numBufs = MIN(count - curVec, RTMP_IOVEC_PREALLOC), batchLen = 0;
+
+            for(int i = 0; i < numBufs; i++)
+            {
+                iov[i].iov_base = (void*)vec[curVec+i].base;
+                iov[i].iov_len = vec[curVec+i].len;
+                batchLen += vec[curVec+i].len;
+            }
+
+            msghdr msg;
+            zero(&msg, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = numBufs;
+
+            int sent = int(sendmsg(sb->sb_socket, &msg, MSG_DONTWAIT));
+            if(sent <= 0)
+                break;
+
+            network->bytesSent += sent;
+            network->bytesSentDirect += sent;
+
+            bool bPartial = sent < batchLen;
+
+            while(curVec < count && sent >= vec[curVec].len)
+                sent -= vec[curVec++].len;
+            curOffset = sent;
+
+            if(bPartial)
+                break;
+        }
+    }
+
+    while(curVec < count)
+    {
+        int len = vec[curVec].len - curOffset;
+        int space = network->dataBufferSize - network->curDataBufferLen - 1;
+
+        if(space <= 0)
+        {
+            ++network->totalTimesWaited;
+            OSLeaveMutex(network->hDataBufferMutex);
+
+            SetEvent(network->hBufferEvent);
+            WaitForSingleObject(network->hBufferSpaceAvailableEvent, INFINITE);
+
+            OSEnterMutex(network->hDataBufferMutex);
+            continue;
+        }
+
+        if(len > space)
+            len = space;
+
+        mcpy(network->dataBuffer + network->curDataBufferLen, vec[curVec].base + curOffset, len);
+        network->curDataBufferLen += len;
+
+        curOffset += len;
+        if(curOffset == vec[curVec].len)
+        {
+            curVec++;
+            curOffset = 0;
+        }
+    }
+
+    OSLeaveMutex(network->hDataBufferMutex);
+
+    SetEvent(network->hBufferEvent);
+
+    return fullLen;
+}
+
+struct SendResult
+{
+    QWORD numBytes, bytesSentDirect;
+    DWORD totalTimesWaited;
+    double seconds, cpuMS;          //RTMP_SendPacket and the socket loop, not the pacing or the sink
+    bool bSent, bBodiesUntouched;
+};
+
+//sends the tags numLoops times, timestamps carrying on across loops.  bRealTime sends each tag
+//when its timestamp comes up, like a live stream, otherwise as fast as they go
+static SendResult SendTags(std::vector<FLVTag> &tags, UINT numLoops, bool bVectored, bool bRealTime, LoopbackSink &sink, int sendBufferSize)
+{
+    SendResult result;
+    zero(&result, sizeof(result));
+
+    SOCKET sendSocket = StartSink(sink, sendBufferSize);
+    if(sendSocket == -1)
+    {
+        printf("couldn't set up the loopback connection, errno %d\n", errno);
+        return result;
+    }
+
+    RTMP rtmp;
+    RTMP_Init(&rtmp);
+    rtmp.m_sb.sb_socket = sendSocket;
+    rtmp.m_outChunkSize = OUT_CHUNK_SIZE;
+    rtmp.m_stream_id = 1;
+
+    Publisher network;
+    zero(&network, sizeof(network));
+    network.rtmp = &rtmp;
+    network.hDataBufferMutex = OSCreateMutex();
+    network.hBufferEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    network.hBufferSpaceAvailableEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    //RTMPPublisher's size for a 3500+160 kbps stream
+    network.dataBufferSize = (3500+160)/8*1024;
+    network.dataBuffer = (BYTE*)Allocate(network.dataBufferSize);
+
+    rtmp.m_bCustomSend = 1;
+    rtmp.m_customSendParam = &network;
+    rtmp.m_customSendFunc = (CUSTOMSEND)BufferedSend;
+    rtmp.m_customSendVecFunc = bVectored ? (CUSTOMSENDVEC)BufferedSendVec : NULL;
+
+    //the vectored path has to leave the headroom and bodies alone, so they can be shared
+    std::vector<std::vector<BYTE> > originals;
+    if(bVectored)
+    {
+        for(size_t i=0; i<tags.size(); i++)
+            originals.push_back(tags[i].packet);
+    }
+
+    QWORD startTime = TestTimeNS();
+    QWORD sendCPUTimeNS = 0;
+
+    network.hSocketThread = OSCreateThread(SocketLoop, &network);
+
+    result.bSent = true;
+    DWORD loopTime = tags.back().timestamp + 20;
+
+    for(UINT loop=0; loop<numLoops && result.bSent; loop++)
+    {
+        for(size_t i=0; i<tags.size(); i++)
+        {
+            FLVTag &tag = tags[i];
+
+            RTMPPacket packet;
+            zero(&packet, sizeof(packet));
+            packet.m_nChannel = (tag.type == RTMP_PACKET_TYPE_AUDIO) ? 0x5 : 0x4;
+            packet.m_headerType = RTMP_PACKET_SIZE_MEDIUM;
+            packet.m_packetType = tag.type;
+            packet.m_nTimeStamp = tag.timestamp + loop*loopTime;
+            packet.m_nInfoField2 = rtmp.m_stream_id;
+            packet.m_hasAbsTimestamp = TRUE;
+            packet.m_nBodySize = UINT(tag.packet.size()-RTMP_MAX_HEADER_SIZE);
+            packet.m_body = (char*)&tag.packet[RTMP_MAX_HEADER_SIZE];
+
+            if(bRealTime)
+            {
+                QWORD dueTime = startTime + QWORD(packet.m_nTimeStamp)*1000000;
+                while(TestTimeNS() < dueTime)
+                    OSSleep(1);
+            }
+
+            QWORD startCPU = ThreadCPUTimeNS();
+            result.bSent = RTMP_SendPacket(&rtmp, &packet, FALSE) != 0;
+            sendCPUTimeNS += ThreadCPUTimeNS()-startCPU;
+
+            if(!result.bSent)
+                break;
+        }
+    }
+
+    //everything out of the data buffer before the connection goes
+    network.bStopping = true;
+    SetEvent(network.hBufferEvent);
+    OSWaitForThread(network.hSocketThread, NULL);
+    OSCloseThread(network.hSocketThread);
+
+    rtmp.m_stream_id = 0;
+    RTMP_Close(&rtmp);
+
+    StopSink(sink);
+
+    result.seconds = double(TestTimeNS()-startTime)/1000000000.0;
+    result.cpuMS = double(sendCPUTimeNS+network.socketLoopCPUTimeNS)/1000000.0;
+    result.numBytes = network.bytesSent;
+    result.bytesSentDirect = network.bytesSentDirect;
+    result.totalTimesWaited = network.totalTimesWaited;
+
+    result.bBodiesUntouched = true;
+    for(size_t i=0; i<originals.size(); i++)
+        result.bBodiesUntouched &= (originals[i] == tags[i].packet);
+
+    Free(network.dataBuffer);
+    OSCloseMutex(network.hDataBufferMutex);
+    CloseHandle(network.hBufferEvent);
+    CloseHandle(network.hBufferSpaceAvailableEvent);
+
+    return result;
+}
+
+//-------------------------------------------
+// tests
+
+struct ReceivedMessage
+{
+    BYTE type;
+    DWORD timestamp;
+    std::vector<BYTE> body;
+};
+
+//reads the chunk stream back into messages.  only what RTMP_SendPacket writes for these tags
+//is handled: one byte basic headers and no extended timestamps.  it only starts a message with
+//a type 3 header when the timestamp hasn't changed, so that's taken as no delta
+static bool ParseChunkStream(const std::vector<char> &stream, std::vector<ReceivedMessage> &messages)
+{
+    struct ChunkStream
+    {
+        DWORD timestamp, length, streamID;
+        BYTE type;
+        std::vector<BYTE> body;
+    } channels[64] = {};
+
+    const BYTE *data = (const BYTE*)&stream[0];
+    size_t pos = 0, size = stream.size();
+
+    while(pos < size)
+    {
+        BYTE fmt = data[pos] >> 6, csid = data[pos] & 0x3F;
+        if(csid < 2)
+            return false;
+        pos++;
+
+        static const UINT headerSizes[] = {11, 7, 3, 0};
+        if(pos+headerSizes[fmt] > size)
+            return false;
+
+        ChunkStream &channel = channels[csid];
+        const BYTE *header = data+pos;
+
+        if(channel.body.empty() && fmt == 3 && !channel.length)
+            return false;
+
+        if(fmt <= 2)
+        {
+            DWORD time = header[0]<<16 | header[1]<<8 | header[2];
+            channel.timestamp = (fmt == 0) ? time : channel.timestamp+time;
+        }
+        if(fmt <= 1)
+        {
+            channel.length = header[3]<<16 | header[4]<<8 | header[5];
+            channel.type = header[6];
+        }
+        if(fmt == 0)
+            channel.streamID = header[7] | header[8]<<8 | header[9]<<16 | header[10]<<24;
+
+        pos += headerSizes[fmt];
+
+        size_t chunk = MIN(size_t(OUT_CHUNK_SIZE), channel.length-channel.body.size());
+        if(pos+chunk > size)
+            return false;
+
+        channel.body.insert(channel.body.end(), data+pos, data+pos+chunk);
+        pos += chunk;
+
+        if(channel.body.size() == channel.length)
+        {
+            ReceivedMessage message;
+            message.type = channel.type;
+            message.timestamp = channel.timestamp;
+            message.body.swap(channel.body);
+            messages.push_back(message);
+        }
+    }
+
+    return true;
+}
+
+static bool RunTests()
+{
+    bool bSuccess = true;
+
+    std::vector<BYTE> file;
+    BuildFLV(5, file);
+
+    std::vector<FLVTag> tags;
+    ParseFLV(file, tags);
+
+    //a small socket buffer and a sink that keeps stalling, so the vectored path runs into
+    //partial writes and has to fall back to the data buffer mid-packet
+    std::vector<char> received[2];
+    SendResult results[2];
+
+    for(int bVectored=0; bVectored<2; bVectored++)
+    {
+        LoopbackSink sink;
+        zero(&sink, sizeof(sink));
+        sink.stallEvery = 512*1024;
+        sink.stallMS = 20;
+        sink.received = &received[bVectored];
+
+        //copied sends write continuation headers into the bodies, so each run sends its own copy
+        std::vector<FLVTag> sent = tags;
+        results[bVectored] = SendTags(sent, 1, bVectored != 0, false, sink, 32*1024);
+    }
+
+    std::vector<ReceivedMessage> messages;
+    bool bParsed = ParseChunkStream(received[1], messages);
+
+    UINT numWrong = 0;
+    if(messages.size() == tags.size())
+    {
+        for(size_t i=0; i<tags.size(); i++)
+        {
+            const ReceivedMessage &message = messages[i];
+            const FLVTag &tag = tags[i];
+
+            bool bSame = message.type == tag.type && message.timestamp == tag.timestamp &&
+                         message.body.size() == tag.packet.size()-RTMP_MAX_HEADER_SIZE &&
+                         memcmp(&message.body[0], &tag.packet[RTMP_MAX_HEADER_SIZE], message.body.size()) == 0;
+            if(!bSame)
+                numWrong++;
+        }
+    }
+
+    bSuccess &= TestResult(results[0].bSent && results[1].bSent, "both paths sent every packet");
+    bSuccess &= TestResult(bParsed && messages.size() == tags.size() && numWrong == 0,
+        "vectored sends arrive as the %u tags that went in (%u came back, %u wrong)", UINT(tags.size()), UINT(messages.size()), numWrong);
+    bSuccess &= TestResult(received[0] == received[1],
+        "the chunk stream is byte for byte the same as with copied sends (%u bytes)", UINT(received[1].size()));
+    bSuccess &= TestResult(results[1].bytesSentDirect && results[1].bytesSentDirect < results[1].numBytes && results[1].totalTimesWaited,
+        "vectored sends went straight to the socket for %.0f%% and through the buffer for the rest (%u waits)",
+        100.0*double(results[1].bytesSentDirect)/double(MAX(results[1].numBytes, 1)), results[1].totalTimesWaited);
+    bSuccess &= TestResult(results[1].bBodiesUntouched, "vectored sends leave the packet bodies and their headroom alone");
+
+    return bSuccess;
+}
+
+//-------------------------------------------
+// benchmark
+
+static bool LoadFile(const char *path, std::vector<BYTE> &file)
+{
+    FILE *fp = fopen(path, "rb");
+    if(!fp)
+        return false;
+
+    fseek(fp, 0, SEEK_END);
+    file.resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    bool bRead = file.empty() || fread(&file[0], 1, file.size(), fp) == file.size();
+    fclose(fp);
+
+    return bRead;
+}
+
+static int RunBenchmark(const char *path)
+{
+    std::vector<BYTE> file;
+    if(path)
+    {
+        if(!LoadFile(path, file))
+        {
+            printf("couldn't read %s\n", path);
+            return 1;
+        }
+    }
+    else
+        BuildFLV(60, file);
+
+    std::vector<FLVTag> tags;
+    if(!ParseFLV(file, tags))
+    {
+        printf("no audio or video tags in %s\n", path ? path : "the generated file");
+        return 1;
+    }
+
+    //flat out: at least 256MB per run.  real time: the first 10 seconds at the rate they were
+    //recorded at, where each packet usually finds the data buffer empty like on a live stream
+    UINT numLoops = UINT(MAX(QWORD(256*1024*1024)/file.size(), 1));
+
+    std::vector<FLVTag> firstTags;
+    for(size_t i=0; i<tags.size() && tags[i].timestamp < 10000; i++)
+        firstTags.push_back(tags[i]);
+
+    printf("%s, %.1fMB over loopback, %d byte chunks\n",
+        path ? path : "generated 60s 3500+160 kbps stream", double(file.size())/(1024.0*1024.0), OUT_CHUNK_SIZE);
+
+    for(int bRealTime=0; bRealTime<2; bRealTime++)
+    {
+        for(int bVectored=0; bVectored<2; bVectored++)
+        {
+            LoopbackSink sink;
+            zero(&sink, sizeof(sink));
+
+            SendResult result = bRealTime ? SendTags(firstTags, 1, bVectored != 0, true, sink, 0) :
+                                            SendTags(tags, numLoops, bVectored != 0, false, sink, 0);
+            if(!result.bSent)
+            {
+                printf("sending failed\n");
+                return 1;
+            }
+
+            double mbits = double(result.numBytes)*8.0/1000000.0;
+            printf("%-9s %-8s %7.1f MB/s  %6.1f us cpu/Mbit  %5.1f%% direct  %u waits\n",
+                bRealTime ? "real time" : "flat out", bVectored ? "vectored" : "copied",
+                double(result.numBytes)/(1024.0*1024.0)/result.seconds, result.cpuMS*1000.0/mbits,
+                100.0*double(result.bytesSentDirect)/double(MAX(result.numBytes, 1)), result.totalTimesWaited);
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+        return RunBenchmark(argc > 2 ? argv[2] : NULL);
+
+    return TestSummary(RunTests());
+}
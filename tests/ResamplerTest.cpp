@@ -0,0 +1,438 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+//polyphase resampler against libsamplerate's sinc converters, which AudioSource falls back to.
+//quality is measured on sines: a least squares fit at the known frequency takes out the
+//converter's delay and gain, and whatever is left over is noise and distortion.  tones above
+//the output nyquist have to come out as little as possible.  the output also has to be the
+//same however the input is split into blocks, and come to the right length.  "bench" times
+//every converter on 10ms stereo blocks.
+//
+//SRC_SINC_BEST_QUALITY is left out, its coefficient table isn't in the tree and compat/ only
+//stands in mid_qual_coeffs for it.  built for AVX2 as a whole like AudioKernelTest, so this
+//needs an AVX2 cpu to run
+
+#include "OBSApi.h"
+#include "TestUtil.h"
+#include "../libsamplerate/samplerate.h"
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include "AudioProcessing.cpp"
+#pragma GCC pop_options
+
+#include <vector>
+
+struct RatePair {UINT inputRate, outputRate;};
+
+//what devices actually run at against the 44.1k/48k output rates
+static const RatePair ratePairs[] =
+    {{44100, 48000}, {48000, 44100}, {32000, 48000}, {22050, 44100}, {16000, 48000}, {96000, 48000}};
+static const UINT numRatePairs = sizeof(ratePairs)/sizeof(ratePairs[0]);
+
+struct SincConverter {const char *name; int type;};
+
+static const SincConverter sincConverters[] =
+    {{"SINC_FASTEST", SRC_SINC_FASTEST}, {"SINC_MEDIUM", SRC_SINC_MEDIUM_QUALITY}};
+static const UINT numSincConverters = sizeof(sincConverters)/sizeof(sincConverters[0]);
+
+#define TEST_SECONDS    2
+#define PI_D            3.14159265358979323846
+
+//stereo sine, the right channel a quarter period behind so the channels can't get swapped
+static void MakeSine(std::vector<float> &buffer, UINT sampleRate, double frequency, double amplitude, UINT numFrames)
+{
+    buffer.resize(numFrames*2);
+    for(UINT i=0; i<numFrames; i++)
+    {
+        double t = 2.0*PI_D*frequency*double(i)/double(sampleRate);
+        buffer[i*2]   = float(amplitude*sin(t));
+        buffer[i*2+1] = float(amplitude*cos(t));
+    }
+}
+
+//-------------------------------------------
+
+//10ms blocks, or whatever the block sizes list says
+static void RunPolyphase(PolyphaseResampler *resampler, const std::vector<float> &input, const std::vector<UINT> &blockSizes, std::vector<float> &output)
+{
+    UINT numFrames = UINT(input.size()/2);
+    output.clear();
+
+    std::vector<float> block;
+    UINT pos = 0, blockIndex = 0;
+    while(pos < numFrames)
+    {
+        UINT blockFrames = MIN(blockSizes[blockIndex % blockSizes.size()], numFrames-pos);
+        blockIndex++;
+        UINT maxOutput = blockFrames*resampler->upFactor/resampler->downFactor + 2;
+        block.resize(maxOutput*2);
+
+        UINT outputFrames = PolyphaseResample(resampler, &input[pos*2], blockFrames, &block[0], maxOutput);
+        output.insert(output.end(), block.begin(), block.begin()+outputFrames*2);
+        pos += blockFrames;
+    }
+}
+
+static void RunSinc(SRC_STATE *state, double ratio, const std::vector<float> &input, UINT blockFrames, std::vector<float> &output)
+{
+    UINT numFrames = UINT(input.size()/2);
+    output.clear();
+
+    std::vector<float> block(UINT(blockFrames*ratio + 16)*2);
+    UINT pos = 0;
+    while(pos < numFrames)
+    {
+        SRC_DATA data;
+        zero(&data, sizeof(data));
+        data.data_in       = const_cast<float*>(&input[pos*2]);
+        data.input_frames  = MIN(blockFrames, numFrames-pos);
+        data.data_out      = &block[0];
+        data.output_frames = long(block.size()/2);
+        data.src_ratio     = ratio;
+
+        if(src_process(state, &data) != 0)
+            break;
+
+        output.insert(output.end(), block.begin(), block.begin()+data.output_frames_gen*2);
+        pos += UINT(data.input_frames_used);
+    }
+}
+
+//-------------------------------------------
+
+//fits a*sin + b*cos at the tone's frequency to each channel, past the start-up and short of
+//the end.  returns signal to residual in dB, with the fitted amplitude in amplitude
+static double MeasureSNR(const std::vector<float> &output, UINT sampleRate, double frequency, double &amplitude)
+{
+    UINT numFrames = UINT(output.size()/2);
+    UINT start = sampleRate/10, end = numFrames - sampleRate/20;
+
+    double signal = 0.0, noise = 0.0;
+    amplitude = 0.0;
+
+    for(UINT channel=0; channel<2; channel++)
+    {
+        double ss = 0.0, cc = 0.0, sc = 0.0, ys = 0.0, yc = 0.0;
+        for(UINT i=start; i<end; i++)
+        {
+            double t = 2.0*PI_D*frequency*double(i)/double(sampleRate);
+            double s = sin(t), c = cos(t), y = output[i*2+channel];
+            ss += s*s; cc += c*c; sc += s*c;
+            ys += y*s; yc += y*c;
+        }
+
+        double det = ss*cc - sc*sc;
+        double a = (ys*cc - yc*sc)/det;
+        double b = (yc*ss - ys*sc)/det;
+
+        for(UINT i=start; i<end; i++)
+        {
+            double t = 2.0*PI_D*frequency*double(i)/double(sampleRate);
+            double fit = a*sin(t) + b*cos(t);
+            double residual = double(output[i*2+channel]) - fit;
+            signal += fit*fit;
+            noise  += residual*residual;
+        }
+
+        amplitude += sqrt(a*a + b*b)*0.5;
+    }
+
+    return 10.0*log10(signal/MAX(noise, 1e-30));
+}
+
+//everything that comes out, relative to a full scale sine, in dB
+static double MeasureLevel(const std::vector<float> &output, UINT sampleRate, double amplitude)
+{
+    UINT numFrames = UINT(output.size()/2);
+    UINT start = sampleRate/10, end = numFrames - sampleRate/20;
+
+    double sum = 0.0;
+    for(UINT i=start*2; i<end*2; i++)
+        sum += double(output[i])*double(output[i]);
+
+    double rms = sqrt(sum/double((end-start)*2));
+    return 20.0*log10(MAX(rms, 1e-15)/(amplitude/sqrt(2.0)));
+}
+
+//-------------------------------------------
+
+static bool TestQuality()
+{
+    bool bSuccess = true;
+    std::vector<UINT> tenMS(1);
+
+    printf("     %-13s %-7s %12s %13s %13s\n", "rates", "tone", "polyphase", sincConverters[0].name, sincConverters[1].name);
+
+    for(UINT p=0; p<numRatePairs; p++)
+    {
+        const RatePair &rates = ratePairs[p];
+        UINT lowerRate = MIN(rates.inputRate, rates.outputRate);
+        tenMS[0] = rates.inputRate/100;
+
+        //one tone low in the passband, one near the top of it
+        double tones[2] = {1000.0, floor(double(lowerRate)*0.35/100.0)*100.0};
+
+        for(UINT t=0; t<2; t++)
+        {
+            std::vector<float> input, output;
+            MakeSine(input, rates.inputRate, tones[t], 0.5, rates.inputRate*TEST_SECONDS);
+
+            PolyphaseResampler *resampler = CreatePolyphaseResampler(rates.inputRate, rates.outputRate);
+            if(!resampler)
+            {
+                bSuccess &= TestResult(false, "%u -> %u gets a polyphase resampler", rates.inputRate, rates.outputRate);
+                continue;
+            }
+
+            RunPolyphase(resampler, input, tenMS, output);
+            DestroyPolyphaseResampler(resampler);
+
+            double amplitude;
+            double snr = MeasureSNR(output, rates.outputRate, tones[t], amplitude);
+
+            double sincSNR[numSincConverters];
+            for(UINT c=0; c<numSincConverters; c++)
+            {
+                int err;
+                SRC_STATE *state = src_new(sincConverters[c].type, 2, &err);
+                std::vector<float> sincOutput;
+                RunSinc(state, double(rates.outputRate)/double(rates.inputRate), input, tenMS[0], sincOutput);
+                src_delete(state);
+
+                double sincAmplitude;
+                sincSNR[c] = MeasureSNR(sincOutput, rates.outputRate, tones[t], sincAmplitude);
+            }
+
+            //the fast path has to be good enough that nobody hears the switch from libsamplerate
+            char label[32];
+            snprintf(label, sizeof(label), "%u->%u", rates.inputRate, rates.outputRate);
+            bool bGood = snr > 90.0 && fabs(amplitude-0.5) < 0.005;
+            bSuccess &= TestResult(bGood, "%-13s %5.0fHz %9.1f dB %10.1f dB %10.1f dB", label, tones[t], snr, sincSNR[0], sincSNR[1]);
+            if(!bGood)
+                TestFail("amplitude %.4f, wanted 0.5", amplitude);
+        }
+    }
+
+    return bSuccess;
+}
+
+//a tone between the output nyquist and the input nyquist has nowhere to go but away
+static bool TestStopband()
+{
+    bool bSuccess = true;
+    std::vector<UINT> tenMS(1);
+
+    for(UINT p=0; p<numRatePairs; p++)
+    {
+        const RatePair &rates = ratePairs[p];
+        if(rates.inputRate <= rates.outputRate)
+            continue;
+
+        tenMS[0] = rates.inputRate/100;
+        double tone = double(rates.outputRate)*0.5 + double(rates.inputRate-rates.outputRate)*0.25;
+
+        std::vector<float> input, output;
+        MakeSine(input, rates.inputRate, tone, 0.5, rates.inputRate*TEST_SECONDS);
+
+        PolyphaseResampler *resampler = CreatePolyphaseResampler(rates.inputRate, rates.outputRate);
+        RunPolyphase(resampler, input, tenMS, output);
+        DestroyPolyphaseResampler(resampler);
+
+        double level = MeasureLevel(output, rates.outputRate, 0.5);
+
+        double sincLevel[numSincConverters];
+        for(UINT c=0; c<numSincConverters; c++)
+        {
+            int err;
+            SRC_STATE *state = src_new(sincConverters[c].type, 2, &err);
+            std::vector<float> sincOutput;
+            RunSinc(state, double(rates.outputRate)/double(rates.inputRate), input, tenMS[0], sincOutput);
+            src_delete(state);
+
+            sincLevel[c] = MeasureLevel(sincOutput, rates.outputRate, 0.5);
+        }
+
+        char label[32];
+        snprintf(label, sizeof(label), "%u->%u", rates.inputRate, rates.outputRate);
+        bSuccess &= TestResult(level < -70.0, "%-13s %5.0fHz %9.1f dB %10.1f dB %10.1f dB  (alias level)", label, tone, level, sincLevel[0], sincLevel[1]);
+    }
+
+    return bSuccess;
+}
+
+//devices hand over whatever they have, so the output can't depend on where blocks start
+static bool TestBlockSizes()
+{
+    bool bSuccess = true;
+
+    for(UINT p=0; p<numRatePairs; p++)
+    {
+        const RatePair &rates = ratePairs[p];
+
+        std::vector<float> input;
+        TestRandom random(p+1);
+        input.resize(rates.inputRate*2);
+        for(size_t i=0; i<input.size(); i++)
+            input[i] = random.NextFloat()*0.5f;
+
+        std::vector<UINT> wholeBlock(1, UINT(input.size()/2)), oddBlocks;
+        for(UINT i=0; i<64; i++)
+            oddBlocks.push_back(random.Next() % 1500);
+        oddBlocks.push_back(1);
+
+        std::vector<float> whole, split;
+
+        PolyphaseResampler *resampler = CreatePolyphaseResampler(rates.inputRate, rates.outputRate);
+        RunPolyphase(resampler, input, wholeBlock, whole);
+        DestroyPolyphaseResampler(resampler);
+
+        resampler = CreatePolyphaseResampler(rates.inputRate, rates.outputRate);
+        RunPolyphase(resampler, input, oddBlocks, split);
+        DestroyPolyphaseResampler(resampler);
+
+        //starts with numTaps-1 frames of silence, so output k is out as soon as input frame k*in/out is
+        UINT numFrames = UINT(input.size()/2);
+        size_t expected = size_t((QWORD(numFrames)*QWORD(rates.outputRate) + rates.inputRate-1)/QWORD(rates.inputRate));
+
+        bool bSame = whole.size() == split.size() && memcmp(&whole[0], &split[0], whole.size()*sizeof(float)) == 0;
+        bool bLength = whole.size()/2 == expected;
+
+        bSuccess &= TestResult(bSame && bLength, "%u -> %u: same output for any block sizes, %u frames", rates.inputRate, rates.outputRate, UINT(whole.size()/2));
+        if(!bSame)
+            TestFail("split into blocks gives %u frames%s", UINT(split.size()/2), whole.size() == split.size() ? ", different samples" : "");
+        if(!bLength)
+            TestFail("expected %u frames", UINT(expected));
+    }
+
+    return bSuccess;
+}
+
+//ratios that would need huge tables go to libsamplerate
+static bool TestFallback()
+{
+    bool bSuccess = true;
+
+    PolyphaseResampler *resampler = CreatePolyphaseResampler(44100, 44101);
+    bSuccess &= (resampler == NULL);
+    DestroyPolyphaseResampler(resampler);
+
+    bSuccess &= (CreatePolyphaseResampler(0, 48000) == NULL);
+    bSuccess &= (CreatePolyphaseResampler(48000, 0) == NULL);
+
+    return TestResult(bSuccess, "odd ratios and zero rates fall back to libsamplerate");
+}
+
+//-------------------------------------------
+
+//best of several runs over a second of audio in 10ms blocks, in ns per block
+template<typename T> static double TimeBlocks(T run, UINT numBlocks)
+{
+    run();
+
+    double best = 1e30;
+    for(int i=0; i<5; i++)
+    {
+        QWORD startTime = TestTimeNS();
+        run();
+        best = MIN(best, double(TestTimeNS()-startTime)/numBlocks);
+    }
+
+    return best;
+}
+
+static void RunBenchmark()
+{
+    struct PolyVariant {const char *name; RESAMPLEFRAMEPROC proc;};
+    static const PolyVariant polyVariants[] =
+        {{"polyphase SSE2", ResampleFrame_SSE2}, {"polyphase AVX", ResampleFrame_AVX}};
+
+    printf("%-13s %-16s %9s %11s %9s\n", "rates", "converter", "ns/10ms", "Mframes/s", "speedup");
+
+    for(UINT p=0; p<numRatePairs; p++)
+    {
+        const RatePair &rates = ratePairs[p];
+        UINT blockFrames = rates.inputRate/100;
+        UINT numBlocks = 100;
+
+        std::vector<float> input, output;
+        MakeSine(input, rates.inputRate, 1000.0, 0.5, blockFrames*numBlocks);
+        std::vector<UINT> tenMS(1, blockFrames);
+
+        char label[32];
+        snprintf(label, sizeof(label), "%u->%u", rates.inputRate, rates.outputRate);
+
+        //the speedups are against SRC_SINC_FASTEST, which is what AudioSource used before
+        double baseline = 0.0;
+        double outputFrames = double(blockFrames)*double(rates.outputRate)/double(rates.inputRate);
+
+        for(UINT c=0; c<numSincConverters; c++)
+        {
+            int err;
+            SRC_STATE *state = src_new(sincConverters[c].type, 2, &err);
+            double ratio = double(rates.outputRate)/double(rates.inputRate);
+            double ns = TimeBlocks([&] {RunSinc(state, ratio, input, blockFrames, output);}, numBlocks);
+            src_delete(state);
+
+            if(c == 0)
+                baseline = ns;
+
+            printf("%-13s %-16s %9.0f %11.2f %8.2fx\n", label, sincConverters[c].name, ns, outputFrames*1000.0/ns, baseline/ns);
+        }
+
+        for(UINT v=0; v<sizeof(polyVariants)/sizeof(polyVariants[0]); v++)
+        {
+            resampleFrame = polyVariants[v].proc;
+
+            PolyphaseResampler *resampler = CreatePolyphaseResampler(rates.inputRate, rates.outputRate);
+            double ns = TimeBlocks([&] {RunPolyphase(resampler, input, tenMS, output);}, numBlocks);
+            DestroyPolyphaseResampler(resampler);
+
+            printf("%-13s %-16s %9.0f %11.2f %8.2fx\n", label, polyVariants[v].name, ns, outputFrames*1000.0/ns, baseline/ns);
+        }
+    }
+
+    resampleFrame = ResampleFrame_SSE2;
+}
+
+//-------------------------------------------
+
+int main(int argc, char **argv)
+{
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("avx2"))
+    {
+        printf("skipped, this cpu doesn't have AVX2\n");
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        RunBenchmark();
+        return 0;
+    }
+
+    bool bSuccess = true;
+    bSuccess &= TestQuality();
+    bSuccess &= TestStopband();
+    bSuccess &= TestBlockSizes();
+    bSuccess &= TestFallback();
+
+    return TestSummary(bSuccess);
+}
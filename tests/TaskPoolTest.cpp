@@ -0,0 +1,392 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+//task pool tests: every tile runs exactly once, short-lived groups can be destroyed as soon
+//as Wait returns (build with CXXFLAGS="-O1 -g -fsanitize=address" to have that checked for
+//every group), and a waiter only helps with its own group's tiles
+//
+//  TaskPoolTest            runs the tests
+//  TaskPoolTest bench      converts 1080p frames to NV12 on the pool and on the fixed threads
+//                          with one static band each that the encode thread used before it,
+//                          while other threads keep cores busy, and prints per frame latency
+//
+//the conversion comes from the copied ImageProcessing.cpp, built for AVX2 like ColorConvertTest,
+//so the benchmark needs an AVX2 cpu.  it uses the SSE2 conversion either way
+
+#include "TaskPool.cpp"
+#include "TestUtil.h"
+
+#pragma GCC push_options
+#pragma GCC target("ssse3,avx2")
+#include "ImageProcessing.cpp"
+#pragma GCC pop_options
+
+#include <vector>
+#include <algorithm>
+
+static void STDCALL CountTiles(LPVOID param, UINT start, UINT end)
+{
+    volatile LONG *counts = (volatile LONG*)param;
+    for(UINT i=start; i<end; i++)
+        InterlockedIncrement(counts+i);
+}
+
+static bool TestCoverage()
+{
+    const UINT size = 100000;
+    std::vector<LONG> counts(size);
+
+    TaskGroup group;
+    group.Run(CountTiles, &counts[0], 0, size/2, 7);
+    group.Run(CountTiles, &counts[0], size/2, size, 64);
+    group.Wait();
+
+    UINT numWrong = 0;
+    for(UINT i=0; i<size; i++)
+    {
+        if(counts[i] != 1)
+            numWrong++;
+    }
+
+    return TestResult(numWrong == 0 && group.IsComplete(), "every tile runs once (%u wrong)", numWrong);
+}
+
+//-------------------------------------------
+
+struct SubmitterTest
+{
+    UINT seed;
+    UINT numWrong;
+    UINT numLeftRefs;
+};
+
+static DWORD STDCALL SubmitterThread(LPVOID param)
+{
+    SubmitterTest &test = *(SubmitterTest*)param;
+    TestRandom random(test.seed);
+
+    LONG counts[64];
+
+    for(UINT i=0; i<3000; i++)
+    {
+        UINT size = 1+random.Next()%64;
+        memset(counts, 0, sizeof(counts));
+
+        //heap allocated and freed right after Wait, so a worker still touching it is caught
+        TaskGroup *group = new TaskGroup;
+        group->Run(CountTiles, counts, 0, size, 1+random.Next()%4);
+        group->Wait();
+
+        if(!group->IsComplete())
+            test.numLeftRefs++;
+        delete group;
+
+        for(UINT j=0; j<size; j++)
+        {
+            if(counts[j] != 1)
+                test.numWrong++;
+        }
+    }
+
+    return 0;
+}
+
+static bool TestShortLivedGroups()
+{
+    const UINT numThreads = 4;
+    HANDLE threads[numThreads];
+    SubmitterTest tests[numThreads];
+
+    for(UINT i=0; i<numThreads; i++)
+    {
+        tests[i].seed = i+1;
+        tests[i].numWrong = 0;
+        tests[i].numLeftRefs = 0;
+        threads[i] = OSCreateThread(SubmitterThread, tests+i);
+    }
+
+    UINT numWrong = 0, numLeftRefs = 0;
+    for(UINT i=0; i<numThreads; i++)
+    {
+        OSWaitForThread(threads[i], NULL);
+        OSCloseThread(threads[i]);
+        numWrong += tests[i].numWrong;
+        numLeftRefs += tests[i].numLeftRefs;
+    }
+
+    return TestResult(numWrong == 0 && numLeftRefs == 0, "%u threads with short-lived groups (%u wrong, %u returned early)", numThreads, numWrong, numLeftRefs);
+}
+
+//-------------------------------------------
+
+static volatile LONG numBlocked = 0;
+static volatile bool bReleaseBlocked = false;
+static pthread_t waiterThread;
+static volatile bool bOtherRanOnWaiter = false;
+
+static void STDCALL BlockWorker(LPVOID param, UINT start, UINT end)
+{
+    InterlockedIncrement(&numBlocked);
+    while(!bReleaseBlocked)
+        OSSleep(1);
+}
+
+static void STDCALL OtherGroupTile(LPVOID param, UINT start, UINT end)
+{
+    if(pthread_equal(pthread_self(), waiterThread))
+        bOtherRanOnWaiter = true;
+}
+
+static bool TestWaitHelpsOwnGroup()
+{
+    UINT numWorkers = GetTaskPool()->NumWorkers();
+
+    //every worker stuck in a tile, so anything queued after this stays queued
+    TaskGroup blockers;
+    blockers.Run(BlockWorker, NULL, 0, numWorkers, 1);
+    while(UINT(numBlocked) < numWorkers)
+        OSSleep(1);
+
+    //queued first, so a waiter that steals from the front would take this one
+    TaskGroup other;
+    other.Run(OtherGroupTile, NULL, 0, numWorkers*4, 1);
+
+    const UINT size = 1000;
+    std::vector<LONG> counts(size);
+
+    waiterThread = pthread_self();
+
+    TaskGroup mine;
+    mine.Run(CountTiles, &counts[0], 0, size, 10);
+    mine.Wait();
+
+    bool bSuccess = !bOtherRanOnWaiter;
+    for(UINT i=0; i<size; i++)
+        bSuccess &= (counts[i] == 1);
+
+    bool bOtherPending = !other.IsComplete();
+
+    bReleaseBlocked = true;
+    blockers.Wait();
+    other.Wait();
+
+    return TestResult(bSuccess && bOtherPending, "Wait only runs its own group's tiles with every worker busy");
+}
+
+//-------------------------------------------
+// benchmark
+
+//must match OBSVideoCapture.cpp
+#define CONVERT444_TILE_ROWS 16
+
+struct ConvertFrame
+{
+    LPBYTE input;
+    LPBYTE output[3];
+    int width, height, pitch;
+};
+
+static void STDCALL ConvertTile(LPVOID param, UINT startY, UINT endY)
+{
+    ConvertFrame &frame = *(ConvertFrame*)param;
+    Convert444toNV12_SSE2(frame.input, frame.width, frame.pitch, frame.width, frame.height, startY, endY, frame.output);
+}
+
+//the old Convert444Thread: one thread per band, signalled per frame
+struct BandThread
+{
+    ConvertFrame *frame;
+    int startY, endY;
+    HANDLE hSignalConvert, hSignalComplete, hThread;
+    volatile bool bKillThread;
+};
+
+static DWORD STDCALL BandThreadProc(LPVOID param)
+{
+    BandThread &band = *(BandThread*)param;
+
+    while(true)
+    {
+        WaitForSingleObject(band.hSignalConvert, INFINITE);
+        if(band.bKillThread)
+            break;
+
+        ConvertTile(band.frame, band.startY, band.endY);
+        SetEvent(band.hSignalComplete);
+    }
+
+    return 0;
+}
+
+static volatile bool bStopSpinning = false;
+
+static DWORD STDCALL SpinThread(LPVOID param)
+{
+    volatile UINT spin = 0;
+    while(!bStopSpinning)
+        spin++;
+    return 0;
+}
+
+struct LatencyStats
+{
+    double p50, p99, maxVal;
+};
+
+static LatencyStats GetLatencyStats(std::vector<double> &times)
+{
+    std::sort(times.begin(), times.end());
+
+    LatencyStats stats;
+    stats.p50 = times[times.size()/2];
+    stats.p99 = times[MIN(times.size()*99/100, times.size()-1)];
+    stats.maxVal = times.back();
+    return stats;
+}
+
+static void RunBenchmark()
+{
+    const int width = 1920, height = 1080;
+    const UINT numFrames = 200;
+
+    ConvertFrame frame;
+    frame.width  = width;
+    frame.height = height;
+    frame.pitch  = width*4;
+
+    std::vector<BYTE> input(frame.pitch*height), luma(width*height), chroma(width*height/2);
+    TestRandom random(1);
+    for(size_t i=0; i<input.size(); i++)
+        input[i] = BYTE(random.Next());
+
+    frame.input     = &input[0];
+    frame.output[0] = &luma[0];
+    frame.output[1] = &chroma[0];
+    frame.output[2] = NULL;
+
+    //same count and split as the old threads: cores-2, bands of even height
+    int numBands = MAX(OSGetTotalCores()-2, 1);
+    std::vector<BandThread> bands(numBands);
+    for(int i=0; i<numBands; i++)
+    {
+        BandThread &band = bands[i];
+        band.frame = &frame;
+        band.startY = i ? bands[i-1].endY : 0;
+        band.endY = (i == numBands-1) ? height : ((height/numBands)*(i+1)) & 0xFFFFFFFE;
+        band.bKillThread = false;
+        band.hSignalConvert  = CreateEvent(NULL, FALSE, FALSE, NULL);
+        band.hSignalComplete = CreateEvent(NULL, FALSE, FALSE, NULL);
+        band.hThread = OSCreateThread(BandThreadProc, &band);
+    }
+
+    printf("1080p to NV12, %u frames, %d cores, %u pool workers, %d band threads\n",
+        numFrames, OSGetTotalCores(), GetTaskPool()->NumWorkers(), numBands);
+
+    std::vector<UINT> spinCounts;
+    spinCounts.push_back(0);
+    spinCounts.push_back(MAX(OSGetTotalCores()/2, 1));
+    spinCounts.push_back(OSGetTotalCores());
+    spinCounts.erase(std::unique(spinCounts.begin(), spinCounts.end()), spinCounts.end());
+
+    for(size_t i=0; i<spinCounts.size(); i++)
+    {
+        UINT numSpinners = spinCounts[i];
+
+        bStopSpinning = false;
+        std::vector<HANDLE> spinners(numSpinners);
+        for(UINT j=0; j<numSpinners; j++)
+            spinners[j] = OSCreateThread(SpinThread, NULL);
+
+        for(int bPool=0; bPool<2; bPool++)
+        {
+            std::vector<double> times;
+
+            for(UINT j=0; j<numFrames; j++)
+            {
+                //a frame's worth of idle time, so the threads go back to sleep between frames
+                OSSleep(2);
+
+                QWORD startTime = TestTimeNS();
+
+                if(bPool)
+                {
+                    TaskGroup group;
+                    group.Run(ConvertTile, &frame, 0, height, CONVERT444_TILE_ROWS);
+                    group.Wait();
+                }
+                else
+                {
+                    for(int k=0; k<numBands; k++)
+                        SetEvent(bands[k].hSignalConvert);
+                    for(int k=0; k<numBands; k++)
+                        WaitForSingleObject(bands[k].hSignalComplete, INFINITE);
+                }
+
+                times.push_back(double(TestTimeNS()-startTime)/1000000.0);
+            }
+
+            LatencyStats stats = GetLatencyStats(times);
+            printf("%2u busy threads  %-13s p50 %6.2fms  p99 %6.2fms  max %6.2fms\n",
+                numSpinners, bPool ? "task pool" : "static bands", stats.p50, stats.p99, stats.maxVal);
+        }
+
+        bStopSpinning = true;
+        for(UINT j=0; j<numSpinners; j++)
+        {
+            OSWaitForThread(spinners[j], NULL);
+            OSCloseThread(spinners[j]);
+        }
+    }
+
+    for(int i=0; i<numBands; i++)
+    {
+        bands[i].bKillThread = true;
+        SetEvent(bands[i].hSignalConvert);
+        OSWaitForThread(bands[i].hThread, NULL);
+        OSCloseThread(bands[i].hThread);
+        CloseHandle(bands[i].hSignalConvert);
+        CloseHandle(bands[i].hSignalComplete);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        __builtin_cpu_init();
+        if(!__builtin_cpu_supports("avx2"))
+        {
+            printf("skipped, this cpu doesn't have AVX2\n");
+            return 0;
+        }
+
+        RunBenchmark();
+        DestroyTaskPool();
+        return 0;
+    }
+
+    bool bSuccess = true;
+    bSuccess &= TestCoverage();
+    bSuccess &= TestShortLivedGroups();
+    bSuccess &= TestWaitHelpsOwnGroup();
+
+    DestroyTaskPool();
+
+    return TestSummary(bSuccess);
+}
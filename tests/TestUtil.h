@@ -0,0 +1,79 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#pragma once
+
+#include <time.h>
+
+//shared bits for the test programs: results, a clock and a repeatable random generator
+
+inline void TestFail(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    printf("    ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+inline bool TestResult(bool bSuccess, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    printf("%s ", bSuccess ? "ok  " : "FAIL");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+
+    return bSuccess;
+}
+
+inline int TestSummary(bool bSuccess)
+{
+    printf(bSuccess ? "all passed\n" : "FAILED\n");
+    return bSuccess ? 0 : 1;
+}
+
+inline QWORD TestTimeNS()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return QWORD(ts.tv_sec)*1000000000ULL + QWORD(ts.tv_nsec);
+}
+
+//xorshift, so every run and every machine sees the same trace
+class TestRandom
+{
+    QWORD state;
+
+public:
+    TestRandom(QWORD seed) : state(seed*0x9E3779B97F4A7C15ULL + 1) {}
+
+    inline UINT Next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return UINT(state >> 32);
+    }
+
+    //uniform in [-1, 1)
+    inline float NextFloat() {return float(int(Next()))/2147483648.0f;}
+};
@@ -0,0 +1,56 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#pragma once
+
+//stand-in for Source/Main.h, see OBSApi.h in this directory
+
+#include "OBSApi.h"
+
+//must match Source/OBS.h
+enum PacketType
+{
+    PacketType_VideoDisposable,
+    PacketType_VideoLow,
+    PacketType_VideoHigh,
+    PacketType_VideoHighest,
+    PacketType_Audio
+};
+
+#include "PacketBuffer.h"
+
+//must match Source/OBS.h
+struct NetworkSendStats
+{
+    DWORD queuedBytes;
+    DWORD bufferedBytes;
+    DWORD bufferSize;
+    QWORD bytesSent;
+    DWORD numTimesWaited;
+    DWORD numDroppedFrames;
+};
+
+class BitrateController
+{
+public:
+    virtual ~BitrateController() {}
+
+    virtual DWORD Update(const NetworkSendStats &stats, QWORD timeMS)=0;
+    virtual DWORD GetBitRate() const=0;
+};
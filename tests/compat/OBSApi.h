@@ -0,0 +1,476 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#pragma once
+
+//stand-in for OBSApi.h when building the tests on linux.  only has what the sources under
+//test actually use, with the same names and the same behaviour as the real thing.  TCHAR is
+//plain char here, so TEXT("") strings and %s formats work with printf.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <type_traits>
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+typedef int                 BOOL,INT;
+typedef unsigned int        UINT,DWORD,ULONG,*LPUINT,*LPDWORD;
+typedef int                 LONG;
+typedef signed char         INT8;
+typedef signed short        INT16,SHORT;
+typedef unsigned short      WORD,USHORT,*LPWORD;
+typedef unsigned char       BYTE,UCHAR,*LPBYTE;
+typedef long long           INT64,LONGLONG,LONG64;
+typedef unsigned long long  QWORD,UINT64;
+typedef char                TCHAR,CHAR;
+typedef char                *LPSTR;
+typedef const char          *LPCSTR;
+typedef TCHAR               *TSTR;
+typedef const TCHAR         *CTSTR;
+typedef void                *LPVOID,*HANDLE,*PVOID;
+typedef const void          *LPCVOID;
+
+#define TEXT(val)   val
+#define TRUE        1
+#define FALSE       0
+#define INVALID     0xFFFFFFFF
+
+#define MIN(a, b)   (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)   (((a) > (b)) ? (a) : (b))
+
+#define BASE_EXPORT
+#define STDCALL
+
+//-------------------------------------------
+// memory
+
+#define Allocate(size)              malloc(size)
+#define ReAllocate(lpData, size)    realloc(lpData, size)
+
+inline void Free(void *lpData)                                  {free(lpData);}
+
+//the real new zeroes memory too, and code relies on it.  not inline since it's a replacement,
+//every test program is a single source file
+void* operator new(size_t size)     {return calloc(1, size ? size : 1);}
+void* operator new[](size_t size)   {return calloc(1, size ? size : 1);}
+void operator delete(void *lpData) noexcept     {free(lpData);}
+void operator delete[](void *lpData) noexcept   {free(lpData);}
+void operator delete(void *lpData, size_t) noexcept     {free(lpData);}
+void operator delete[](void *lpData, size_t) noexcept   {free(lpData);}
+inline void zero(void *pDest, size_t iLen)                      {memset(pDest, 0, iLen);}
+inline void mcpy(void *pDest, const void *pSrc, size_t iLen)    {memcpy(pDest, pSrc, iLen);}
+
+inline void msetd(void *pDest, DWORD val, size_t iLen)
+{
+    DWORD *destDW = (DWORD*)pDest;
+    for(size_t i=0; i<iLen/4; i++)
+        destDW[i] = val;
+}
+
+inline void mcpyrev(void *pDest, const void *pSrc, size_t iLen) {memmove(pDest, pSrc, iLen);}
+
+inline void mswap(void *pDest, void *pSrc, size_t iLen)
+{
+    LPBYTE dest = (LPBYTE)pDest, src = (LPBYTE)pSrc;
+    for(size_t i=0; i<iLen; i++)
+    {
+        BYTE val = dest[i];
+        dest[i] = src[i];
+        src[i] = val;
+    }
+}
+
+//windows.h has these as macros, so mixed types go through the usual conversions
+template<typename T, typename U> inline typename std::common_type<T, U>::type min(T a, U b)
+{
+    typedef typename std::common_type<T, U>::type R;
+    return (R(a) < R(b)) ? R(a) : R(b);
+}
+
+template<typename T, typename U> inline typename std::common_type<T, U>::type max(T a, U b)
+{
+    typedef typename std::common_type<T, U>::type R;
+    return (R(a) > R(b)) ? R(a) : R(b);
+}
+
+inline int scmp(CTSTR str1, CTSTR str2) {return strcmp(str1, str2);}
+inline int scmpi(CTSTR str1, CTSTR str2) {return strcasecmp(str1, str2);}
+
+inline void nop() {}
+
+#define RUNONCE static bool bRunOnce = false; if(!bRunOnce && (bRunOnce = true))
+
+inline QWORD GetQWDif(QWORD val1, QWORD val2)
+{
+    return (val1 > val2) ? (val1-val2) : (val2-val1);
+}
+
+//big endian conversion, same as the real ones
+#define QWORD_BE(val) (((val>>56)&0xFF) | (((val>>48)&0xFF)<<8) | (((val>>40)&0xFF)<<16) | (((val>>32)&0xFF)<<24) | \
+    (((val>>24)&0xFF)<<32) | (((val>>16)&0xFF)<<40) | (((val>>8)&0xFF)<<48) | ((val&0xFF)<<56))
+#define DWORD_BE(val) (((val>>24)&0xFF) | (((val>>16)&0xFF)<<8) | (((val>>8)&0xFF)<<16) | ((val&0xFF)<<24))
+#define WORD_BE(val)  (((val>>8)&0xFF) | ((val&0xFF)<<8))
+
+inline QWORD fastHtonll(QWORD qw) {return QWORD_BE(qw);}
+inline DWORD fastHtonl (DWORD dw) {return DWORD_BE(dw);}
+inline  WORD fastHtons (WORD  w)  {return  WORD_BE(w);}
+
+//-------------------------------------------
+// strings and config, just enough for reading a setting that's never set
+
+class String
+{
+    const TCHAR *lpString;
+
+public:
+    inline String(const TCHAR *lpString=NULL) : lpString(lpString) {}
+
+    inline bool CompareI(CTSTR lpStr) const {return lpString && lpStr && strcasecmp(lpString, lpStr) == 0;}
+    inline CTSTR Array() const {return lpString;}
+    inline operator CTSTR() const {return lpString;}
+    inline bool IsEmpty() const {return !lpString || !*lpString;}
+};
+
+class ConfigFile
+{
+public:
+    inline String GetString(CTSTR lpSection, CTSTR lpKey, CTSTR def=NULL) {return String(def);}
+    inline int GetInt(CTSTR lpSection, CTSTR lpKey, int def=0) {return def;}
+};
+
+static ConfigFile compatConfig;
+static ConfigFile *GlobalConfig __attribute__((unused)) = &compatConfig;
+
+//-------------------------------------------
+// profiler, off
+
+#define profileSegment(name)
+#define profileIn(name)
+#define profileOut
+
+//-------------------------------------------
+// logging, quiet unless OBS_TEST_VERBOSE is set
+
+inline void Log(CTSTR format, ...)
+{
+    if(!getenv("OBS_TEST_VERBOSE"))
+        return;
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+inline void AppWarning(CTSTR format, ...)
+{
+    if(!getenv("OBS_TEST_VERBOSE"))
+        return;
+
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "warning: ");
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+//always fatal, same as the real one
+inline void CrashError(CTSTR format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "crash error: ");
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    abort();
+}
+
+//-------------------------------------------
+// threading
+
+inline LONG InterlockedIncrement(volatile LONG *val) {return __sync_add_and_fetch(val, 1);}
+inline LONG InterlockedDecrement(volatile LONG *val) {return __sync_sub_and_fetch(val, 1);}
+
+inline HANDLE OSCreateMutex()
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+    pthread_mutex_t *mutex = new pthread_mutex_t;
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return mutex;
+}
+
+inline void OSEnterMutex(HANDLE hMutex) {pthread_mutex_lock((pthread_mutex_t*)hMutex);}
+inline void OSLeaveMutex(HANDLE hMutex) {pthread_mutex_unlock((pthread_mutex_t*)hMutex);}
+
+inline void OSCloseMutex(HANDLE hMutex)
+{
+    pthread_mutex_destroy((pthread_mutex_t*)hMutex);
+    delete (pthread_mutex_t*)hMutex;
+}
+
+inline LONG InterlockedExchangeAdd(volatile LONG *val, LONG add) {return __sync_fetch_and_add(val, add);}
+
+inline PVOID InterlockedCompareExchangePointer(PVOID volatile *dest, PVOID exchange, PVOID comparand)
+{
+    return __sync_val_compare_and_swap(dest, comparand, exchange);
+}
+
+inline BOOL SwitchToThread() {sched_yield(); return TRUE;}
+inline void OSSleep(DWORD ms) {usleep(ms*1000);}
+
+inline int OSGetTotalCores() {return int(sysconf(_SC_NPROCESSORS_ONLN));}
+
+//events and semaphores are the same thing here: a count that waits take from.  a set event
+//is a count of 1, and a manual reset event's waits don't take it
+struct CompatWaitable
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    LONG count, maxCount;
+    bool bManualReset;
+};
+
+inline HANDLE CompatCreateWaitable(LONG count, LONG maxCount, bool bManualReset)
+{
+    CompatWaitable *waitable = new CompatWaitable;
+    pthread_mutex_init(&waitable->mutex, NULL);
+    pthread_cond_init(&waitable->cond, NULL);
+    waitable->count = count;
+    waitable->maxCount = maxCount;
+    waitable->bManualReset = bManualReset;
+    return waitable;
+}
+
+inline HANDLE CreateEvent(LPVOID attributes, BOOL bManualReset, BOOL bInitialState, LPVOID name)
+{
+    return CompatCreateWaitable(bInitialState ? 1 : 0, 1, bManualReset != 0);
+}
+
+inline HANDLE CreateSemaphore(LPVOID attributes, LONG initialCount, LONG maxCount, LPVOID name)
+{
+    return CompatCreateWaitable(initialCount, maxCount, false);
+}
+
+inline BOOL ReleaseSemaphore(HANDLE handle, LONG count, LONG *prevCount)
+{
+    CompatWaitable *waitable = (CompatWaitable*)handle;
+    pthread_mutex_lock(&waitable->mutex);
+    if(prevCount)
+        *prevCount = waitable->count;
+    waitable->count = MIN(waitable->count+count, waitable->maxCount);
+    pthread_cond_broadcast(&waitable->cond);
+    pthread_mutex_unlock(&waitable->mutex);
+    return TRUE;
+}
+
+inline BOOL SetEvent(HANDLE handle) {return ReleaseSemaphore(handle, 1, NULL);}
+
+inline BOOL ResetEvent(HANDLE handle)
+{
+    CompatWaitable *waitable = (CompatWaitable*)handle;
+    pthread_mutex_lock(&waitable->mutex);
+    waitable->count = 0;
+    pthread_mutex_unlock(&waitable->mutex);
+    return TRUE;
+}
+
+#define INFINITE        0xFFFFFFFF
+#define WAIT_OBJECT_0   0
+#define WAIT_TIMEOUT    258
+
+inline DWORD WaitForSingleObject(HANDLE handle, DWORD ms)
+{
+    CompatWaitable *waitable = (CompatWaitable*)handle;
+
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += ms/1000;
+    deadline.tv_nsec += long(ms%1000)*1000000;
+    if(deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    DWORD result = WAIT_OBJECT_0;
+
+    pthread_mutex_lock(&waitable->mutex);
+    while(!waitable->count)
+    {
+        if(ms == INFINITE)
+            pthread_cond_wait(&waitable->cond, &waitable->mutex);
+        else if(pthread_cond_timedwait(&waitable->cond, &waitable->mutex, &deadline) != 0)
+        {
+            result = WAIT_TIMEOUT;
+            break;
+        }
+    }
+    if(result == WAIT_OBJECT_0 && !waitable->bManualReset)
+        waitable->count--;
+    pthread_mutex_unlock(&waitable->mutex);
+
+    return result;
+}
+
+inline BOOL CloseHandle(HANDLE handle)
+{
+    CompatWaitable *waitable = (CompatWaitable*)handle;
+    pthread_cond_destroy(&waitable->cond);
+    pthread_mutex_destroy(&waitable->mutex);
+    delete waitable;
+    return TRUE;
+}
+
+typedef DWORD (STDCALL *XTHREAD)(LPVOID);
+
+struct CompatThread
+{
+    pthread_t thread;
+    XTHREAD proc;
+    LPVOID param;
+    DWORD retVal;
+};
+
+inline void* CompatThreadProc(void *param)
+{
+    CompatThread *thread = (CompatThread*)param;
+    thread->retVal = thread->proc(thread->param);
+    return NULL;
+}
+
+inline HANDLE OSCreateThread(XTHREAD lpThreadFunc, LPVOID param)
+{
+    CompatThread *thread = new CompatThread;
+    thread->proc = lpThreadFunc;
+    thread->param = param;
+    thread->retVal = 0;
+    pthread_create(&thread->thread, NULL, CompatThreadProc, thread);
+    return thread;
+}
+
+inline BOOL OSWaitForThread(HANDLE hThread, LPDWORD ret)
+{
+    CompatThread *thread = (CompatThread*)hThread;
+    pthread_join(thread->thread, NULL);
+    if(ret)
+        *ret = thread->retVal;
+    return TRUE;
+}
+
+inline BOOL OSCloseThread(HANDLE hThread)
+{
+    delete (CompatThread*)hThread;
+    return TRUE;
+}
+
+//-------------------------------------------
+// serializer, output side only.  DWORD and UINT are the same type here, so the real header's
+// operator<< overloads can't be used as-is
+
+#define SERIALIZE_SEEK_START    0
+#define SERIALIZE_SEEK_CURRENT  1
+#define SERIALIZE_SEEK_END      2
+
+class Serializer
+{
+public:
+    virtual ~Serializer() {}
+
+    virtual BOOL IsLoading()=0;
+    virtual void Serialize(LPCVOID lpData, DWORD length)=0;
+    virtual UINT64 Seek(INT64 offset, DWORD seekType=SERIALIZE_SEEK_START)=0;
+    virtual UINT64 GetPos() const=0;
+
+    inline Serializer& OutputByte (BYTE  cVal)  {if(!IsLoading()) Serialize(&cVal, 1); return *this;}
+    inline Serializer& OutputWord (WORD  sVal)  {if(!IsLoading()) Serialize(&sVal, 2); return *this;}
+    inline Serializer& OutputDword(DWORD lVal)  {if(!IsLoading()) Serialize(&lVal, 4); return *this;}
+    inline Serializer& OutputQword(QWORD qVal)  {if(!IsLoading()) Serialize(&qVal, 8); return *this;}
+};
+
+inline Serializer& operator<<(Serializer &s, UINT &val) {s.Serialize(&val, sizeof(val)); return s;}
+
+//-------------------------------------------
+// List and BufferOutputSerializer, pulled out of the real Utility/Template.h by the makefile
+
+#include <typeinfo>
+#include "List.h"
+#include "BufferOutputSerializer.h"
+
+//-------------------------------------------
+// audio, see the real OBSApi.h and APIInterface.h.  the tests set the sample rate and
+// buffering time through the compat variables
+
+BASE_EXPORT void InitAudioKernels(const int *cpuInfo, CTSTR lpForce=NULL);
+BASE_EXPORT void MixAudio(float *bufferDest, float *bufferSrc, UINT totalFloats, bool bForceMono);
+BASE_EXPORT void MultiplyAudioBuffer(float *buffer, UINT totalFloats, float mulVal);
+BASE_EXPORT void CalculateVolumeLevels(const float *buffer, UINT totalFloats, float mulVal, float &RMS, float &peak);
+BASE_EXPORT void ConvertAudioToFloat(float *output, const void *input, UINT totalSamples, UINT bitsPerSample);
+BASE_EXPORT void DownmixAudioToStereo(float *output, const float *input, UINT numFrames, UINT channels, DWORD channelMask);
+
+struct PolyphaseResampler;
+BASE_EXPORT PolyphaseResampler* CreatePolyphaseResampler(UINT inputRate, UINT outputRate);
+BASE_EXPORT void DestroyPolyphaseResampler(PolyphaseResampler *resampler);
+BASE_EXPORT UINT PolyphaseResample(PolyphaseResampler *resampler, const float *input, UINT inputFrames, float *output, UINT maxOutputFrames);
+
+static UINT compatSampleRateHz __attribute__((unused)) = 44100;
+static UINT compatSceneBufferingTime __attribute__((unused)) = 700;
+
+inline UINT OBSGetSampleRateHz() {return compatSampleRateHz;}
+inline UINT OBSGetSceneBufferingTime() {return compatSceneBufferingTime;}
+
+#include "AudioFilter.h"
+#include "AudioSource.h"
+
+//-------------------------------------------
+// plugins.  only the types their headers mention, none of the windows UI is built here
+
+typedef void                *HWND,*HINSTANCE;
+typedef intptr_t            INT_PTR,LONG_PTR,LPARAM,LRESULT;
+typedef uintptr_t           UINT_PTR,DWORD_PTR,WPARAM;
+
+#define CALLBACK
+#define __declspec(val)
+
+#define VOL_MIN -96
+
+inline int _finite(double val) {return isfinite(val);}
+
+class SettingsPane
+{
+public:
+    virtual ~SettingsPane() {}
+};
@@ -0,0 +1,7 @@
+/*
+** stand-in for libsamplerate's high_qual_coeffs.h, which isn't in the tree.  nothing in OBS
+** uses SRC_SINC_BEST_QUALITY, so the tests build src_sinc.c with the medium quality table in
+** its place
+*/
+
+#define slow_high_qual_coeffs slow_mid_qual_coeffs
@@ -0,0 +1,49 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#pragma once
+
+//stand-in for msvc's intrin.h: the gcc intrinsics plus msvc style cpuid and xgetbv
+
+#include <x86intrin.h>
+#include <cpuid.h>
+
+#undef __cpuid
+
+//newer cpuid.h already has __cpuidex
+#if !defined(__clang__) && __GNUC__ < 11
+inline void __cpuidex(int *cpuInfo, int function, int subFunction)
+{
+    unsigned int a, b, c, d;
+    __cpuid_count(function, subFunction, a, b, c, d);
+    cpuInfo[0] = int(a); cpuInfo[1] = int(b); cpuInfo[2] = int(c); cpuInfo[3] = int(d);
+}
+#endif
+
+inline void __cpuid(int *cpuInfo, int function) {__cpuidex(cpuInfo, function, 0);}
+
+//gcc only has _xgetbv with -mxsave
+inline unsigned long long CompatXGetBV(unsigned int index)
+{
+    unsigned int lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+    return (unsigned long long)lo | ((unsigned long long)hi << 32);
+}
+
+#define _xgetbv(index) CompatXGetBV(index)
@@ -0,0 +1,44 @@
+/********************************************************************************
+ Copyright (C) 2012 Hugh Bailey <obs.jim@gmail.com>
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+********************************************************************************/
+
+
+#pragma once
+
+//included ahead of every librtmp file: librtmp's own posix path covers the sockets, this is
+//the handful of winsock bits OBS's copy uses outside of it
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/socket.h>
+
+typedef int SOCKET;
+
+#define WSA_FLAG_OVERLAPPED 0
+#define WSASocket(af, type, protocol, info, group, flags) socket(af, type, protocol)
+
+//socketerror just says "unknown error", the tests log errno themselves
+#define FORMAT_MESSAGE_FROM_SYSTEM 0
+#define FormatMessageA(flags, source, err, lang, buff, size, args) 0